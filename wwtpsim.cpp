@@ -77,6 +77,29 @@ Made by FERI.
 #include <algorithm>
 #include <deque> //..Include deque for storing water quality history
 #include <memory>
+#include <array>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <typeinfo>
+#include <fstream>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <random>
+#include <future>
+#include <limits>
+#include <unordered_map>
+#include <cstring>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 //|........||Definition of constants and enumerations
 const float SIMULATION_TIME_STEP = 0.016f; //|........||Simulation time step in seconds
@@ -104,6 +127,8 @@ enum WaterParameter {
     METALS      //|........||Heavy Metals
 };
 
+const int PARAMETER_COUNT = METALS + 1;
+
 //|........||Helper function to convert parameters to string
 std::string parameterToString(WaterParameter param) {
     switch (param) {
@@ -131,14 +156,116 @@ std::string parameterToString(WaterParameter param) {
     }
 }
 
+//|........||Short names used in plant files, influent series and reports
+const char* parameterKey(WaterParameter param) {
+    static const char* keys[PARAMETER_COUNT] = {
+        "BOD", "COD", "TSS", "NH4", "NO3", "pH", "P", "OIL", "DO", "TEMP",
+        "PATHOGENS", "SALINITY", "TURBIDITY", "EC", "ALKALINITY", "CL2", "HARDNESS", "SO4", "CL", "METALS"
+    };
+    return keys[param];
+}
+
+bool parameterFromKey(const std::string& key, WaterParameter& param) {
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        if (key == parameterKey(WaterParameter(p))) {
+            param = WaterParameter(p);
+            return true;
+        }
+    }
+    return false;
+}
+
 //...................................................................................................
 
-//|........||Class to represent water and its parameters
-class Water {
+//|........||Forward-mode automatic differentiation: a value with its derivatives along up to DUAL_WIDTH seeded
+//|........||directions (more directions take several passes). Unit kernels are templated on the water type, so
+//|........||the same code runs on float to simulate and on Dual to differentiate. The math functions below are
+//|........||found by argument-dependent lookup; kernels call them unqualified after `using std::exp` and so on.
+constexpr int DUAL_WIDTH = 8;
+
+struct Dual {
+    double value = 0.0;
+    std::array<double, DUAL_WIDTH> d{};
+
+    Dual() {}
+    Dual(double v) : value(v) {}
+
+    Dual& operator+=(const Dual& b) {
+        value += b.value;
+        for (int j = 0; j < DUAL_WIDTH; ++j) d[j] += b.d[j];
+        return *this;
+    }
+    Dual& operator-=(const Dual& b) {
+        value -= b.value;
+        for (int j = 0; j < DUAL_WIDTH; ++j) d[j] -= b.d[j];
+        return *this;
+    }
+    Dual& operator*=(const Dual& b) {
+        for (int j = 0; j < DUAL_WIDTH; ++j) d[j] = d[j] * b.value + value * b.d[j];
+        value *= b.value;
+        return *this;
+    }
+    Dual& operator/=(const Dual& b) {
+        double inverse = 1.0 / b.value;
+        value *= inverse;
+        for (int j = 0; j < DUAL_WIDTH; ++j) d[j] = (d[j] - value * b.d[j]) * inverse;
+        return *this;
+    }
+
+    friend Dual operator+(Dual a, const Dual& b) { return a += b; }
+    friend Dual operator-(Dual a, const Dual& b) { return a -= b; }
+    friend Dual operator*(Dual a, const Dual& b) { return a *= b; }
+    friend Dual operator/(Dual a, const Dual& b) { return a /= b; }
+    friend Dual operator-(Dual a) {
+        a.value = -a.value;
+        for (double& x : a.d) x = -x;
+        return a;
+    }
+    friend bool operator<(const Dual& a, const Dual& b) { return a.value < b.value; }
+    friend bool operator>(const Dual& a, const Dual& b) { return a.value > b.value; }
+    friend bool operator<=(const Dual& a, const Dual& b) { return a.value <= b.value; }
+    friend bool operator>=(const Dual& a, const Dual& b) { return a.value >= b.value; }
+    friend bool operator==(const Dual& a, const Dual& b) { return a.value == b.value && a.d == b.d; }
+    friend bool operator!=(const Dual& a, const Dual& b) { return !(a == b); }
+
+    //|........||f(a) with f'(a) = slope
+    static Dual chain(const Dual& a, double f, double slope) {
+        Dual r(f);
+        for (int j = 0; j < DUAL_WIDTH; ++j) r.d[j] = slope * a.d[j];
+        return r;
+    }
+    friend Dual exp(const Dual& a) {
+        double e = std::exp(a.value);
+        return chain(a, e, e);
+    }
+    friend Dual log(const Dual& a) { return chain(a, std::log(a.value), 1.0 / a.value); }
+    friend Dual sqrt(const Dual& a) {
+        double root = std::sqrt(a.value);
+        return chain(a, root, root > 0.0 ? 0.5 / root : 0.0);
+    }
+    friend Dual fabs(const Dual& a) { return a.value < 0.0 ? -a : a; }
+    //|........||a^b = exp(b ln a); the ln a term is skipped where b carries no derivative, so a may be 0 there
+    friend Dual pow(const Dual& a, const Dual& b) {
+        double p = std::pow(a.value, b.value);
+        Dual r(p);
+        double da = a.value != 0.0 ? b.value * p / a.value : 0.0;
+        double db = a.value > 0.0 ? p * std::log(a.value) : 0.0;
+        for (int j = 0; j < DUAL_WIDTH; ++j) r.d[j] = da * a.d[j] + (b.d[j] != 0.0 ? db * b.d[j] : 0.0);
+        return r;
+    }
+};
+
+//|........||Class to represent water and its parameters.
+//|........||Dense array indexed by WaterParameter: copies and comparisons are a flat 80-byte block.
+//|........||Templated on the scalar so that unit kernels also run on Dual (DualWater) for derivatives.
+template <typename T>
+class BasicWater {
 public:
-    std::map<WaterParameter, float> parameters;
+    typedef T Scalar;
+    std::array<T, PARAMETER_COUNT> parameters;
+    T flow = 100.0f; //|........||Stream flow in m³/day, used to weight blends and splits
 
-    Water() {
+    BasicWater() {
         //|........||Default initial values
         parameters[BOD] = 300.0f;
         parameters[COD] = 600.0f;
@@ -162,13 +289,841 @@ public:
         parameters[METALS] = 5.0f;
     }
 
-    void updateParameter(WaterParameter param, float value) {
+    void updateParameter(WaterParameter param, T value) {
         parameters[param] = value;
     }
 
-    float getParameter(WaterParameter param) {
+    T getParameter(WaterParameter param) const {
         return parameters[param];
     }
+
+    bool operator==(const BasicWater& other) const {
+        return flow == other.flow && parameters == other.parameters;
+    }
+
+    bool operator!=(const BasicWater& other) const {
+        return !(*this == other);
+    }
+};
+
+typedef BasicWater<float> Water;
+typedef BasicWater<Dual> DualWater;
+typedef BasicWater<double> PreciseWater;
+
+//|........||A water as constants (no derivatives), and the values of a dual water
+DualWater dualOf(const Water& water) {
+    DualWater dual;
+    dual.flow = water.flow;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) dual.parameters[p] = water.parameters[p];
+    return dual;
+}
+
+Water valueOf(const DualWater& dual) {
+    Water water;
+    water.flow = float(dual.flow.value);
+    for (int p = 0; p < PARAMETER_COUNT; ++p) water.parameters[p] = float(dual.parameters[p].value);
+    return water;
+}
+
+//|........||A float water in double, and a double water rounded back to float
+PreciseWater preciseOf(const Water& water) {
+    PreciseWater precise;
+    precise.flow = water.flow;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) precise.parameters[p] = water.parameters[p];
+    return precise;
+}
+
+Water roundedOf(const PreciseWater& precise) {
+    Water water;
+    water.flow = float(precise.flow);
+    for (int p = 0; p < PARAMETER_COUNT; ++p) water.parameters[p] = float(precise.parameters[p]);
+    return water;
+}
+
+//|........||How a kernel reads a unit's tunable fields: as themselves when simulating, or seeded with a unit
+//|........||derivative along their direction when differentiating
+struct PlainValues {
+    float operator()(const float& field) const {
+        return field;
+    }
+};
+
+struct DualSeeds {
+    std::array<const float*, DUAL_WIDTH> fields{};
+    int width = 0;
+
+    Dual operator()(const float& field) const {
+        Dual x(field);
+        for (int j = 0; j < width; ++j) {
+            if (fields[j] == &field) x.d[j] = 1.0;
+        }
+        return x;
+    }
+
+    bool seeds(const float& field) const {
+        for (int j = 0; j < width; ++j) {
+            if (fields[j] == &field) return true;
+        }
+        return false;
+    }
+};
+
+//|........||...or widened to double for the double-precision sweep
+struct PreciseValues {
+    double operator()(const float& field) const {
+        return field;
+    }
+};
+
+//|........||Arrhenius temperature corrections theta^(T - 20) of the biological kinetics, T in °C. A sweep feeds
+//|........||its units water at a handful of temperatures and they use a handful of coefficients, so the factors
+//|........||live in one small table per thread shared by every unit instead of a pow in every kernel call. A
+//|........||hit returns the factor bit for bit; a miss computes it and takes the slot.
+class ArrheniusCache {
+public:
+    static const int BITS = 6;
+
+    static float factor(float theta, float temperature) {
+        thread_local std::array<Entry, 1 << BITS> entries;
+        uint32_t a, b;
+        std::memcpy(&a, &theta, sizeof a);
+        std::memcpy(&b, &temperature, sizeof b);
+        Entry& entry = entries[(a * 0x9E3779B1u ^ b * 0x85EBCA77u) >> (32 - BITS)];
+        if (entry.theta != theta || entry.temperature != temperature) {
+            entry.theta = theta;
+            entry.temperature = temperature;
+            entry.value = std::pow(theta, temperature - 20.0f);
+        }
+        return entry.value;
+    }
+
+private:
+    struct Entry {
+        float theta = std::numeric_limits<float>::quiet_NaN();   //|........||matches nothing
+        float temperature = 0.0f;
+        float value = 1.0f;
+    };
+};
+
+//|........||The correction in a kernel: cached on float, through pow on Dual so derivatives reach theta and T,
+//|........||and on double
+inline float temperatureFactor(float theta, float temperature) {
+    return ArrheniusCache::factor(theta, temperature);
+}
+
+template <typename Theta, typename T>
+T temperatureFactor(const Theta& theta, const T& temperature) {
+    using std::pow;
+    return pow(T(theta), temperature - T(20.0));
+}
+
+//|........||What a pipe carries: the liquid line, sludge drawn off for treatment, or reject water going back
+enum StreamKind {
+    LIQUID_STREAM,
+    SLUDGE_STREAM,
+    REJECT_STREAM
+};
+
+//|........||Share of each parameter bound to settleable solids; the rest is dissolved and follows the water
+const std::array<float, PARAMETER_COUNT> PARTICULATE_FRACTION = {
+    0.5f, 0.5f, 1.0f, 0.0f, 0.0f,   //|........||BOD, COD, TSS, NH4, NO3
+    0.0f, 0.3f, 0.8f, 0.0f, 0.0f,   //|........||PH, P, OIL, DO, TEMP
+    0.5f, 0.0f, 1.0f, 0.0f, 0.0f,   //|........||PATHOGENS, SALINITY, TURBIDITY, EC, ALKALINITY
+    0.0f, 0.0f, 0.0f, 0.0f, 0.5f    //|........||RESIDUAL_CHLORINE, HARDNESS, SULFATES, CHLORIDES, METALS
+};
+
+//|........||Splits `in` into a solids stream of `solidsFlow` m³/day holding `capture` of every particulate load and
+//|........||a liquid stream with the rest. Dissolved parameters keep their concentration in both; mass is conserved.
+void separateSolids(const Water& in, float capture, float solidsFlow, Water& solids, Water& liquid) {
+    solidsFlow = std::clamp(solidsFlow, 0.0f, in.flow);
+    float liquidFlow = in.flow - solidsFlow;
+    if (solidsFlow <= 0.0f) capture = 0.0f;
+    if (liquidFlow <= 0.0f) capture = 1.0f;
+    solids = in;
+    liquid = in;
+    solids.flow = solidsFlow;
+    liquid.flow = liquidFlow;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        float fraction = PARTICULATE_FRACTION[p];
+        if (fraction == 0.0f) continue;
+        float dissolved = in.parameters[p] * (1.0f - fraction);
+        float load = in.flow * in.parameters[p] * fraction;
+        solids.parameters[p] = dissolved + (solidsFlow > 0.0f ? capture * load / solidsFlow : 0.0f);
+        liquid.parameters[p] = dissolved + (liquidFlow > 0.0f ? (1.0f - capture) * load / liquidFlow : 0.0f);
+    }
+}
+
+//...................................................................................................
+
+//|........||Built-in profiler. Compiled in with -DWWTPSIM_PROFILE; otherwise every PROFILE_* macro is empty.
+//|........||Each thread owns its counters (single writer, relaxed atomics) and the UI thread folds them once per frame.
+#ifdef WWTPSIM_PROFILE
+#include <chrono>
+
+enum ProfileZone {
+    PROFILE_FRAME,
+    PROFILE_PLANT_STEP,
+    PROFILE_COMPONENT_UPDATE,
+    PROFILE_CONNECTION_UPDATE,
+    PROFILE_HISTORIES,
+    PROFILE_GRAPHS,
+    PROFILE_DRAW,
+    PROFILE_PHASE_COUNT
+};
+
+const char* profileZoneName(int zone) {
+    switch (zone) {
+        case PROFILE_FRAME: return "Frame";
+        case PROFILE_PLANT_STEP: return "Plant step (simulate)";
+        case PROFILE_COMPONENT_UPDATE: return "Component update";
+        case PROFILE_CONNECTION_UPDATE: return "Connection update";
+        case PROFILE_HISTORIES: return "updateHistories";
+        case PROFILE_GRAPHS: return "drawGraphs";
+        case PROFILE_DRAW: return "SFML draw";
+        default: return "";
+    }
+}
+
+const int PROFILE_MAX_UNITS = 512; //|........||Units beyond this share slots
+const int PROFILE_ZONE_COUNT = PROFILE_PHASE_COUNT + 2 * PROFILE_MAX_UNITS;
+
+struct ProfileCounters {
+    std::array<std::atomic<unsigned long long>, PROFILE_ZONE_COUNT> nanoseconds;
+    std::array<std::atomic<unsigned long long>, PROFILE_ZONE_COUNT> calls;
+
+    ProfileCounters() {
+        for (auto& value : nanoseconds) value.store(0, std::memory_order_relaxed);
+        for (auto& value : calls) value.store(0, std::memory_order_relaxed);
+    }
+};
+
+class Profiler {
+public:
+    static const int MAX_THREADS = 64;
+    static const int HISTORY = 120; //|........||Frames kept for rolling percentiles
+
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    //|........||Counters of the calling thread, registered on first use without locking. Threads past MAX_THREADS
+    //|........||share `overflow`: it has several writers, but every update is a fetch_add, so its totals stay exact.
+    ProfileCounters& threadCounters() {
+        thread_local ProfileCounters* counters = nullptr;
+        if (!counters) {
+            int index = threadCount.fetch_add(1, std::memory_order_relaxed);
+            if (index < MAX_THREADS) {
+                counters = new ProfileCounters();
+                threads[index].store(counters, std::memory_order_release);
+            } else {
+                counters = &overflow;
+            }
+        }
+        return *counters;
+    }
+
+    //|........||Threads whose time went to the shared overflow counters
+    int overflowThreads() const {
+        return std::max(threadCount.load(std::memory_order_relaxed) - MAX_THREADS, 0);
+    }
+
+    int assignUnitSlot() {
+        return nextUnitSlot.fetch_add(1, std::memory_order_relaxed) % PROFILE_MAX_UNITS;
+    }
+
+    //|........||Folds every thread's totals into this frame's per-zone milliseconds
+    void endFrame() {
+        int count = std::min(threadCount.load(std::memory_order_relaxed), MAX_THREADS);
+        for (int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone) {
+            unsigned long long total = 0;
+            for (int t = 0; t < count; ++t) {
+                ProfileCounters* counters = threads[t].load(std::memory_order_acquire);
+                if (counters) total += counters->nanoseconds[zone].load(std::memory_order_relaxed);
+            }
+            total += overflow.nanoseconds[zone].load(std::memory_order_relaxed);
+            history[zone * HISTORY + head] = float(total - lastTotals[zone]) * 1e-6f;
+            lastTotals[zone] = total;
+        }
+        lastFrame = head;
+        head = (head + 1) % HISTORY;
+        frames = std::min(frames + 1, HISTORY);
+    }
+
+    float frameMs(int zone) const {
+        return frames ? history[zone * HISTORY + lastFrame] : 0.0f;
+    }
+
+    float percentileMs(int zone, float q) {
+        if (!frames) return 0.0f;
+        scratch.assign(history.begin() + zone * HISTORY, history.begin() + zone * HISTORY + frames);
+        size_t k = std::min(size_t(q * (frames - 1) + 0.5f), scratch.size() - 1);
+        std::nth_element(scratch.begin(), scratch.begin() + k, scratch.end());
+        return scratch[k];
+    }
+
+    float meanMs(int zone) const {
+        if (!frames) return 0.0f;
+        float sum = 0.0f;
+        for (int i = 0; i < frames; ++i) sum += history[zone * HISTORY + i];
+        return sum / frames;
+    }
+
+    //|........||Oldest-first copy of a zone's history, for plotting
+    void series(int zone, std::vector<float>& out) const {
+        out.clear();
+        for (int i = 0; i < frames; ++i) {
+            int frame = (head - frames + i + HISTORY) % HISTORY;
+            out.push_back(history[zone * HISTORY + frame]);
+        }
+    }
+
+private:
+    std::array<std::atomic<ProfileCounters*>, MAX_THREADS> threads;
+    ProfileCounters overflow;
+    std::atomic<int> threadCount{0};
+    std::atomic<int> nextUnitSlot{0};
+    std::vector<unsigned long long> lastTotals;
+    std::vector<float> history; //|........||Zone-major ring buffers of per-frame milliseconds
+    std::vector<float> scratch;
+    int head = 0;
+    int lastFrame = 0;
+    int frames = 0;
+
+    Profiler() : lastTotals(PROFILE_ZONE_COUNT, 0), history(PROFILE_ZONE_COUNT * HISTORY, 0.0f) {
+        for (auto& slot : threads) slot.store(nullptr, std::memory_order_relaxed);
+    }
+};
+
+//|........||Adds the lifetime of the scope to `zone` on the current thread
+class ProfileScope {
+public:
+    explicit ProfileScope(int z) : zone(z), start(std::chrono::steady_clock::now()) {}
+
+    ~ProfileScope() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        ProfileCounters& counters = Profiler::instance().threadCounters();
+        counters.nanoseconds[zone].fetch_add(
+            (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+            std::memory_order_relaxed);
+        counters.calls[zone].fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    int zone;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(zone) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(zone)
+#define PROFILE_UNIT_SIMULATE(comp) (PROFILE_PHASE_COUNT + 2 * (comp)->profileSlot)
+#define PROFILE_UNIT_UPDATE(comp) (PROFILE_PHASE_COUNT + 2 * (comp)->profileSlot + 1)
+#define PROFILE_END_FRAME() Profiler::instance().endFrame()
+#else
+#define PROFILE_SCOPE(zone) ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#endif
+
+//|........||Trace export in Chrome JSON (chrome://tracing, ui.perfetto.dev). Compiled in with -DWWTPSIM_TRACE
+//|........||and switched on at run time with Tracer::start. Each thread pushes into its own single-producer ring
+//|........||and a background thread drains the rings into the file.
+#ifdef WWTPSIM_TRACE
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+struct TraceEvent {
+    char name[48];
+    char phase; //|........||'X' complete span, 'C' counter
+    int tid;
+    long long startNs;
+    long long durationNs;
+    double value;
+};
+
+struct TraceBuffer {
+    static const size_t CAPACITY = 65536; //|........||Power of two
+    std::array<TraceEvent, CAPACITY> events;
+    std::atomic<size_t> head{0}; //|........||Advanced by the owning thread
+    std::atomic<size_t> tail{0}; //|........||Advanced by the flusher
+    std::atomic<unsigned long long> dropped{0};
+    int tid = 0;
+
+    void push(const TraceEvent& event) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        events[h & (CAPACITY - 1)] = event;
+        head.store(h + 1, std::memory_order_release);
+    }
+};
+
+class Tracer {
+public:
+    static const int MAX_THREADS = 64;
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool enabled() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    bool start(const std::string& path) {
+        if (enabled()) return true;
+        out.open(path);
+        if (!out) return false;
+        out << "{\"traceEvents\":[\n";
+        firstEvent = true;
+        origin = std::chrono::steady_clock::now();
+        running.store(true);
+        flusher = std::thread([this] {
+            while (running.load()) {
+                drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        });
+        active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    void stop() {
+        if (!enabled()) return;
+        active.store(false, std::memory_order_release);
+        running.store(false);
+        flusher.join();
+        drain();
+        unsigned long long dropped = 0;
+        int count = std::min(threadCount.load(), MAX_THREADS);
+        for (int t = 0; t < count; ++t) {
+            if (TraceBuffer* buffer = buffers[t].load(std::memory_order_acquire)) dropped += buffer->dropped.load();
+        }
+        dropped += untracedEvents.load();
+        out << (firstEvent ? "" : ",\n") << "{\"name\":\"dropped_events\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"count\":" << dropped
+            << ",\"untraced_threads\":" << std::max(threadCount.load() - MAX_THREADS, 0) << "}}\n]}\n";
+        out.close();
+    }
+
+    long long nowNs() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void complete(const char* name, long long startNs, long long endNs) {
+        TraceBuffer* buffer = threadBuffer();
+        if (!buffer) {
+            untracedEvents.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        TraceEvent event;
+        fill(event, name, 'X', buffer->tid);
+        event.startNs = startNs;
+        event.durationNs = endNs - startNs;
+        buffer->push(event);
+    }
+
+    void counter(const char* name, double value) {
+        TraceBuffer* buffer = threadBuffer();
+        if (!buffer) {
+            untracedEvents.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        TraceEvent event;
+        fill(event, name, 'C', buffer->tid);
+        event.startNs = nowNs();
+        event.value = value;
+        buffer->push(event);
+    }
+
+private:
+    std::array<std::atomic<TraceBuffer*>, MAX_THREADS> buffers;
+    std::atomic<int> threadCount{0};
+    std::atomic<unsigned long long> untracedEvents{0}; //|........||Events of threads past MAX_THREADS
+    std::atomic<bool> active{false};
+    std::atomic<bool> running{false};
+    std::thread flusher;
+    std::ofstream out;
+    bool firstEvent = true;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    Tracer() {
+        for (auto& slot : buffers) slot.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~Tracer() {
+        stop();
+    }
+
+    //|........||Ring of the calling thread, or null past MAX_THREADS: those threads are not traced and
+    //|........||allocate nothing; their events only count towards dropped_events
+    TraceBuffer* threadBuffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        thread_local bool registered = false;
+        if (!registered) {
+            registered = true;
+            int index = threadCount.fetch_add(1, std::memory_order_relaxed);
+            if (index < MAX_THREADS) {
+                buffer = new TraceBuffer();
+                buffer->tid = index + 1;
+                buffers[index].store(buffer, std::memory_order_release);
+            }
+        }
+        return buffer;
+    }
+
+    void fill(TraceEvent& event, const char* name, char phase, int tid) {
+        std::strncpy(event.name, name, sizeof(event.name) - 1);
+        event.name[sizeof(event.name) - 1] = '\0';
+        event.phase = phase;
+        event.tid = tid;
+        event.durationNs = 0;
+        event.value = 0.0;
+    }
+
+    //|........||Only the flusher (or stop, after joining it) writes the file
+    void drain() {
+        int count = std::min(threadCount.load(std::memory_order_relaxed), MAX_THREADS);
+        for (int t = 0; t < count; ++t) {
+            TraceBuffer* buffer = buffers[t].load(std::memory_order_acquire);
+            if (!buffer) continue;
+            size_t tail = buffer->tail.load(std::memory_order_relaxed);
+            size_t head = buffer->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail) {
+                write(buffer->events[tail & (TraceBuffer::CAPACITY - 1)]);
+            }
+            buffer->tail.store(tail, std::memory_order_release);
+        }
+        out.flush();
+    }
+
+    void write(const TraceEvent& event) {
+        char line[256];
+        std::string name;
+        for (const char* c = event.name; *c; ++c) {
+            if (*c == '"' || *c == '\\') name += '\\';
+            name += *c;
+        }
+        if (event.phase == 'X') {
+            std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                name.c_str(), event.tid, event.startNs * 1e-3, event.durationNs * 1e-3);
+        } else {
+            std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                name.c_str(), event.tid, event.startNs * 1e-3, event.value);
+        }
+        out << (firstEvent ? "" : ",\n") << line;
+        firstEvent = false;
+    }
+};
+
+//|........||Records the lifetime of the scope as one complete event when tracing is on
+class TraceScope {
+public:
+    explicit TraceScope(const char* n) : name(n), startNs(Tracer::instance().enabled() ? Tracer::instance().nowNs() : -1) {}
+
+    ~TraceScope() {
+        if (startNs >= 0 && Tracer::instance().enabled()) {
+            Tracer::instance().complete(name, startNs, Tracer::instance().nowNs());
+        }
+    }
+
+private:
+    const char* name;
+    long long startNs;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, value) do { if (Tracer::instance().enabled()) Tracer::instance().counter(name, (value)); } while (0)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_COUNTER(name, value) ((void)0)
+#endif
+
+//|........||Electrical power drawn by a unit and the energy it adds up over a dynamic run
+struct EnergyMeter {
+    float power = 0.0f;    //|........||kW, last step
+    float flow = 0.0f;     //|........||m³/day served, last step
+    double energy = 0.0;   //|........||kWh since the last reset
+    double volume = 0.0;   //|........||m³ served since the last reset
+
+    //|........||deltaTime in seconds; 0 (steady state) only updates the instantaneous values
+    void record(float kilowatts, float servedFlow, float deltaTime) {
+        power = kilowatts;
+        flow = servedFlow;
+        if (deltaTime > 0.0f) {
+            energy += kilowatts * deltaTime / 3600.0;
+            volume += servedFlow * deltaTime / 86400.0;
+        }
+    }
+
+    //|........||kWh per m³: accumulated over a dynamic run, instantaneous in steady state
+    double specificEnergy() const {
+        if (volume > 0.0) return energy / volume;
+        return flow > 0.0f ? power * 24.0 / flow : 0.0;
+    }
+
+    void reset() {
+        energy = 0.0;
+        volume = 0.0;
+    }
+};
+
+//|........||Discrete PI(D) controller with its own sample time. Between samples it only adds up the elapsed
+//|........||time and holds its output, so thousands of loops cost a compare each per step. The integral is
+//|........||frozen while the output is saturated (conditional integration anti-windup).
+struct PIDController {
+    bool enabled = true;
+    float setpoint = 2.0f;
+    float gain = 2.0f;             //|........||Output units per unit of error
+    float integralTime = 900.0f;   //|........||s; the integral term adds gain * error per integralTime
+    float derivativeTime = 0.0f;   //|........||s; 0 gives a PI controller
+    float sampleTime = 30.0f;      //|........||s
+    float outputMin = 0.0f;
+    float outputMax = 12.0f;
+
+    float output = 0.0f;
+    float integral = 0.0f;
+    float elapsed = 0.0f;
+    float lastMeasurement = 0.0f;
+
+    float update(float measurement, float deltaTime) {
+        elapsed += deltaTime;
+        if (elapsed < sampleTime) return output;
+        float interval = elapsed;
+        elapsed = 0.0f;
+
+        float error = setpoint - measurement;
+        float nextIntegral = integral + gain * error * interval / std::max(integralTime, 1e-3f);
+        //|........||Derivative on the measurement, so setpoint changes do not kick the output
+        float derivative = -gain * derivativeTime * (measurement - lastMeasurement) / interval;
+        lastMeasurement = measurement;
+        float raw = gain * error + nextIntegral + derivative;
+        output = std::clamp(raw, outputMin, outputMax);
+        bool saturatedHigh = raw > outputMax && error > 0.0f;
+        bool saturatedLow = raw < outputMin && error < 0.0f;
+        if (!saturatedHigh && !saturatedLow) integral = nextIntegral;
+        return output;
+    }
+
+    //|........||Starts from `value` without a bump, e.g. after a steady-state solve
+    void hold(float value, float measurement) {
+        output = value;
+        integral = value;
+        lastMeasurement = measurement;
+    }
+};
+
+//|........||Diffused aeration of a tank: KLa oxygen transfer into a completely mixed DO balance, the air
+//|........||a blower must deliver for it and its power (adiabatic compression). Times in hours unless noted.
+struct Aeration {
+    PIDController control;         //|........||Manipulates KLa (1/h) to hold the DO setpoint (mg/L)
+    float manualKLa = 4.0f;        //|........||1/h, used when the controller is off
+    float diffuserDepth = 4.5f;    //|........||m of water above the diffusers
+    float transferPerMetre = 0.06f; //|........||Field oxygen transfer efficiency per metre of depth
+    float blowerEfficiency = 0.7f;
+    float lineLosses = 10.0f;      //|........||kPa in pipework and diffusers
+
+    float KLa = 0.0f;
+    float dissolvedOxygen = 2.0f;  //|........||mg/L in the tank (dynamic state)
+    EnergyMeter meter;             //|........||Blower
+
+    //|........||Saturation DO (mg/L) of fresh water at 1 atm
+    template <typename T>
+    static T saturation(const T& temperature) {
+        T t = std::clamp(temperature, T(0.0), T(40.0));
+        return T(14.652) - T(0.41022) * t + T(0.007991) * t * t - T(0.000077774) * t * t * t;
+    }
+
+    //|........||Steady DO with the controller taken as ideal (or the manual KLa), and the KLa that holds it.
+    //|........||Written over the scalar type so the aeration tanks can differentiate through it.
+    template <typename T, typename Values>
+    T steadyOxygen(const T& inletDO, const T& demand, const T& temperature, const T& HRT, const Values& value,
+        T& kla) const {
+        T dilution = T(1.0) / std::max(HRT, T(1e-3));
+        T uptake = demand * dilution;
+        T cs = saturation(temperature);
+        if (control.enabled) {
+            T target = std::min(value(control.setpoint), T(0.95) * cs);
+            kla = std::clamp((uptake - dilution * (inletDO - target)) / (cs - target), T(control.outputMin), T(control.outputMax));
+        } else {
+            kla = value(manualKLa);
+        }
+        return std::max((dilution * inletDO + kla * cs - uptake) / (dilution + kla), T(0.0));
+    }
+
+    //|........||Advances the tank DO by `deltaTime` seconds and returns it. `demand` is the oxygen taken up
+    //|........||from the water passing through (mg/L). deltaTime 0 asks for the steady state, where the
+    //|........||controller is taken as ideal and KLa is whatever holds the setpoint.
+    float apply(float inletDO, float demand, float temperature, float HRT, float volume, float inletFlow, float deltaTime) {
+        float cs = saturation(temperature);
+        if (deltaTime <= 0.0f) {
+            dissolvedOxygen = steadyOxygen(inletDO, demand, temperature, HRT, PlainValues(), KLa);
+            control.hold(KLa, dissolvedOxygen);
+        } else {
+            float dilution = 1.0f / std::max(HRT, 1e-3f);
+            float uptake = demand * dilution;
+            KLa = control.enabled ? control.update(dissolvedOxygen, deltaTime) : manualKLa;
+            //|........||Exact solution over the step for constant KLa and load: stable for any step length
+            float rate = dilution + KLa;
+            float equilibrium = (dilution * inletDO + KLa * cs - uptake) / rate;
+            dissolvedOxygen = equilibrium + (dissolvedOxygen - equilibrium) * std::exp(-rate * deltaTime / 3600.0f);
+            dissolvedOxygen = std::max(dissolvedOxygen, 0.0f);
+        }
+
+        //|........||O2 transferred (kg/h) -> air mass flow (kg/s) -> blower shaft power (kW)
+        float transferred = KLa * std::max(cs - dissolvedOxygen, 0.0f) * volume / 1000.0f;
+        float efficiency = std::clamp(transferPerMetre * diffuserDepth, 0.01f, 0.5f);
+        float air = transferred / (3600.0f * 0.232f * efficiency);
+        meter.record(air * compressionWork() / blowerEfficiency, inletFlow, deltaTime);
+        return dissolvedOxygen;
+    }
+
+private:
+    float cachedDepth = -1.0f;
+    float cachedLosses = -1.0f;
+    float cachedWork = 0.0f;
+
+    //|........||kJ per kg of air, R T1 / (29.7 n) [(p2/p1)^n - 1] with n = 0.283 and air at 20 °C.
+    //|........||Depends only on depth and losses, so the pow is redone only when those are edited.
+    float compressionWork() {
+        if (diffuserDepth != cachedDepth || lineLosses != cachedLosses) {
+            cachedDepth = diffuserDepth;
+            cachedLosses = lineLosses;
+            float inletPressure = 101.325f;
+            float outletPressure = inletPressure + 9.81f * diffuserDepth + lineLosses;
+            cachedWork = 8.314f * 293.15f / (29.7f * 0.283f) * (std::pow(outletPressure / inletPressure, 0.283f) - 1.0f);
+        }
+        return cachedWork;
+    }
+};
+
+//|........||Curve through tabulated points (x strictly increasing). The interpolant is a monotone cubic
+//|........||(Fritsch-Carlson), so it never overshoots between points, and it is resampled once onto a uniform
+//|........||grid: a lookup is one index computation and a linear blend. Outside the points the ends are held.
+class CurveTable {
+public:
+    static const int SAMPLES = 256;
+
+    bool build(const std::vector<float>& xs, const std::vector<float>& ys) {
+        size_t n = std::min(xs.size(), ys.size());
+        values.clear();
+        if (n == 0) return false;
+        for (size_t k = 1; k < n; ++k) {
+            if (!(xs[k] > xs[k - 1])) return false;
+        }
+        first = xs[0];
+        if (n == 1) {
+            scale = 0.0f;
+            values.assign(2, ys[0]);
+            return true;
+        }
+
+        std::vector<float> secant(n - 1);
+        for (size_t k = 0; k + 1 < n; ++k) secant[k] = (ys[k + 1] - ys[k]) / (xs[k + 1] - xs[k]);
+        std::vector<float> tangent(n);
+        tangent[0] = secant[0];
+        tangent[n - 1] = secant[n - 2];
+        for (size_t k = 1; k + 1 < n; ++k) {
+            tangent[k] = secant[k - 1] * secant[k] <= 0.0f ? 0.0f : 0.5f * (secant[k - 1] + secant[k]);
+        }
+        for (size_t k = 0; k + 1 < n; ++k) {
+            if (secant[k] == 0.0f) {
+                tangent[k] = tangent[k + 1] = 0.0f;
+                continue;
+            }
+            float a = tangent[k] / secant[k];
+            float b = tangent[k + 1] / secant[k];
+            float length = a * a + b * b;
+            if (length > 9.0f) {
+                float t = 3.0f / std::sqrt(length);
+                tangent[k] = t * a * secant[k];
+                tangent[k + 1] = t * b * secant[k];
+            }
+        }
+
+        float span = xs[n - 1] - xs[0];
+        scale = (SAMPLES - 1) / span;
+        values.resize(SAMPLES);
+        size_t k = 0;
+        for (int i = 0; i < SAMPLES; ++i) {
+            float x = xs[0] + span * i / (SAMPLES - 1);
+            while (k + 2 < n && x > xs[k + 1]) ++k;
+            float h = xs[k + 1] - xs[k];
+            float t = std::clamp((x - xs[k]) / h, 0.0f, 1.0f);
+            float t2 = t * t;
+            float t3 = t2 * t;
+            values[i] = (2 * t3 - 3 * t2 + 1) * ys[k] + (t3 - 2 * t2 + t) * h * tangent[k]
+                      + (-2 * t3 + 3 * t2) * ys[k + 1] + (t3 - t2) * h * tangent[k + 1];
+        }
+        return true;
+    }
+
+    bool empty() const {
+        return values.empty();
+    }
+
+    float operator()(float x) const {
+        float position = (x - first) * scale;
+        if (!(position > 0.0f)) return values.front();
+        if (position >= SAMPLES - 1) return values.back();
+        int i = (int)position;
+        float t = position - i;
+        return values[i] + (values[i + 1] - values[i]) * t;
+    }
+
+private:
+    float first = 0.0f;
+    float scale = 0.0f;
+    std::vector<float> values;
+};
+
+class Connection;
+class SurrogateTable;
+
+//|........||Named handle on a tunable value of a unit. Plant files, sensitivity analysis and calibration
+//|........||reach unit parameters only through these; `min`/`max` bound what is physically meaningful.
+struct ParameterRef {
+    const char* name;
+    float* value;
+    float min;
+    float max;
+};
+
+//|........||Arrhenius coefficients of a biological unit: `theta` for all of its processes, and one per process
+//|........||that replaces it once set. An own coefficient left at 0 follows `theta`; a set one outside
+//|........||[MIN, MAX] is clamped there, so a file or study cannot push a process below 1.
+struct ProcessThetas {
+    static constexpr float MIN = 1.0f;
+    static constexpr float MAX = 1.2f;
+
+    float theta = 1.035f;
+    float bod = 0.0f;
+    float cod = 0.0f;
+    float nh4 = 0.0f;
+
+    //|........||The processes a unit runs; only their coefficients are exposed
+    enum Processes { BOD_PROCESS = 1, COD_PROCESS = 2, NH4_PROCESS = 4, ALL_PROCESSES = 7 };
+
+    void parameters(std::vector<ParameterRef>& refs, int processes = ALL_PROCESSES) {
+        refs.push_back({"theta", &theta, MIN, MAX});
+        if (processes & BOD_PROCESS) refs.push_back({"theta_bod", &bod, MIN, MAX});
+        if (processes & COD_PROCESS) refs.push_back({"theta_cod", &cod, MIN, MAX});
+        if (processes & NH4_PROCESS) refs.push_back({"theta_nh4", &nh4, MIN, MAX});
+    }
+
+    //|........||The coefficient of the process owning `own`, read through `value` so a seeded one carries
+    //|........||its derivative; a clamped one is a constant
+    template <typename Values>
+    auto of(const Values& value, const float& own) const {
+        const float& used = own <= 0.0f ? theta : own < MIN ? MIN : own > MAX ? MAX : own;
+        return value(used);
+    }
 };
 
 //|........||Base class for system components
@@ -202,6 +1157,23 @@ public:
     //|........||Removal efficiencies for different water parameters
     std::map<WaterParameter, float> removalEfficiencies;
 
+    //|........||Graph links and cached evaluation slot, maintained by Plant
+    std::vector<Connection*> inputs;
+    std::vector<Connection*> outputs;
+    int orderIndex = -1;
+    int visitMark = 0;
+
+    //|........||Set when a parameter or the inlet water changed and the unit must be re-simulated.
+    //|........||Atomic because parallel branches meeting at a join may flag it at the same time.
+    std::atomic<bool> dirty{true};
+
+    //|........||Owned; answers steady-state evaluations once built (see Plant::buildSurrogates)
+    SurrogateTable* surrogate = nullptr;
+
+#ifdef WWTPSIM_PROFILE
+    int profileSlot = Profiler::instance().assignUnitSlot();
+#endif
+
     Component(const std::string& n, const std::string& desc, const sf::Vector2f& pos)
         : name(n), description(desc), position(pos) {
         shape.setSize(sf::Vector2f(width, height));
@@ -211,10 +1183,90 @@ public:
         shape.setOutlineColor(sf::Color::Black);
     }
 
+    virtual ~Component();   //|........||Defined after SurrogateTable
+
+    void moveTo(const sf::Vector2f& pos) {
+        position = pos;
+        shape.setPosition(position);
+    }
+
+    //|........||deltaTime is in simulated seconds; the steady-state sweep passes 0 to ask for the equilibrium response
     virtual void simulate(float deltaTime) {
         outletWater = inletWater;
     }
 
+    //|........||Steady-state outputs (one per output, at least one) and their derivatives along the seeded
+    //|........||directions. Units with a templated kernel (see Kinetic) run it on Dual; the rest fall back to
+    //|........||central differences of simulate() along each direction. Defined after Connection.
+    virtual void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds& seeds);
+
+    //|........||Steady-state outputs (one per output, at least one) in double precision, for Plant::solvePrecise.
+    //|........||Units with a templated kernel run it on double; the rest run simulate() on the water rounded to
+    //|........||float. Defined after Connection.
+    virtual void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out);
+
+    //|........||Units whose steady solve warm-starts from their own state keep it here, so every perturbed
+    //|........||solve of the fallback starts from the base point and the unit is left as it was found
+    virtual void saveState() {}
+    virtual void restoreState() {}
+
+    //|........||Units with an iterative solve say why their last simulate() result cannot be trusted; null if it can
+    virtual const char* solverError() const {
+        return nullptr;
+    }
+
+    //|........||Plant brackets the sweeps of one recycle-loop solve with these. In between, a unit with a costly
+    //|........||steady solve may start from its previous answer, since later sweeps only nudge its inlet.
+    virtual void beginLoopSolve() {}
+    virtual void endLoopSolve() {}
+
+    //|........||Tunable values by name; units with their own constants append them after these
+    virtual void parameters(std::vector<ParameterRef>& refs) {
+        refs.push_back({"volume", &volume, 1e-3f, 1e7f});
+        refs.push_back({"flowRate", &flowRate, 0.0f, 1e7f});
+        refs.push_back({"HRT", &HRT, 1e-3f, 1e4f});
+        refs.push_back({"SRT", &SRT, 1e-3f, 1e4f});
+        refs.push_back({"temperature", &temperature, -5.0f, 80.0f});
+    }
+
+    //|........||nullptr if the unit has no parameter of that name
+    float* parameter(const std::string& name) {
+        std::vector<ParameterRef> refs;
+        parameters(refs);
+        for (const ParameterRef& ref : refs) {
+            if (name == ref.name) return ref.value;
+        }
+        return nullptr;
+    }
+
+    //|........||Aerated units expose their blower and DO loop
+    virtual Aeration* aerationSystem() {
+        return nullptr;
+    }
+
+    //|........||Units that draw power (blowers, pumps) expose their meter
+    virtual EnergyMeter* energyMeter() {
+        return nullptr;
+    }
+
+    //|........||Water leaving through the given entry of `outputs`; only splitting units differ per output
+    virtual const Water& outletFor(size_t) const {
+        return outletWater;
+    }
+
+    //|........||What each output carries; units with a side stream (underflow, reject) say so for output 1
+    virtual StreamKind outputKind(size_t) const {
+        return LIQUID_STREAM;
+    }
+
+    //|........||Defined after Connection: pulls inletWater from `inputs`, pushes outlets into `outputs`
+    void gatherInlet();
+    bool pushOutlets();
+
+    //|........||Every value a steady-state simulate() leaves for the engine to read; surrogate tables store and
+    //|........||restore exactly these. Defined after Connection.
+    virtual void responseSlots(std::vector<float*>& slots);
+
     virtual void update(float deltaTime) {
         particleSpawnTime += deltaTime;
         if (particleSpawnTime >= 0.05f) {
@@ -245,12 +1297,19 @@ public:
         }
     }
 
+    //|........||Call after editing any unit parameter so the steady-state sweep picks it up
+    void markDirty() {
+        dirty.store(true, std::memory_order_relaxed);
+    }
+
     void addRemovalEfficiency(WaterParameter param, float efficiency) {
         removalEfficiencies[param] = efficiency;
+        markDirty();
     }
 
     void removeRemovalEfficiency(WaterParameter param) {
         removalEfficiencies.erase(param);
+        markDirty();
     }
 };
 
@@ -259,6 +1318,7 @@ class Inlet : public Component {
 public:
     Inlet(const sf::Vector2f& pos) : Component("Inlet", "Entry point of wastewater into the system.", pos) {
         inletShape.setFillColor(sf::Color::Green);
+        outletWater.flow = flowRate;
     }
 };
 
@@ -268,678 +1328,2140 @@ public:
     Outlet(const sf::Vector2f& pos) : Component("Outlet", "Exit point of treated water from the system.", pos) {
         outletShape.setFillColor(sf::Color::Red);
     }
+
+    void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds&) override {
+        out.assign(1, in);
+    }
+    void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) override {
+        out.assign(1, in);
+    }
 };
 
-//|........||Primary Clarifier: removes settleable solids and oil & grease
-class PrimaryClarifier : public Component {
+//|........||Mixer: joins any number of streams. The engine blends every unit's inputs flow-weighted
+//|........||(see blendStreams), so the mixer itself only passes the blended water on.
+class Mixer : public Component {
 public:
-    PrimaryClarifier(const sf::Vector2f& pos) : Component(
-        "Primary Clarifier",
-        "Removes settleable solids and oil & grease from wastewater.",
+    Mixer(const sf::Vector2f& pos) : Component(
+        "Mixer",
+        "Joins several streams into one, blending concentrations by flow.",
         pos) {
-        shape.setFillColor(sf::Color(210, 105, 30));
+        shape.setFillColor(sf::Color(95, 158, 160));
+        height = 60;
+        shape.setSize(sf::Vector2f(width, height));
     }
 
-    void simulate(float deltaTime) override {
-        float removalEfficiencyTSS = 0.70f;
-        float removalEfficiencyOIL = 0.90f;
+    //|........||Carries on whatever its first input carries (e.g. joined sludges stay sludge)
+    StreamKind outputKind(size_t output) const override;
+
+    void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds&) override {
+        out.assign(std::max<size_t>(outputs.size(), 1), in);
+    }
+    void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) override {
+        out.assign(std::max<size_t>(outputs.size(), 1), in);
+    }
+};
+
+//|........||Splitter: divides one stream between its outputs by flow fraction, concentrations unchanged
+class Splitter : public Component {
+public:
+    std::vector<float> splitFractions; //|........||One per output, normalised when used
+    std::vector<Water> outlets;
+
+    Splitter(const sf::Vector2f& pos) : Component(
+        "Splitter",
+        "Divides a stream between several outputs by flow fraction.",
+        pos) {
+        shape.setFillColor(sf::Color(95, 158, 160));
+        height = 60;
+        shape.setSize(sf::Vector2f(width, height));
+    }
+
+    void simulate(float) override {
         outletWater = inletWater;
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) * (1 - removalEfficiencyTSS));
-        outletWater.updateParameter(OIL, inletWater.getParameter(OIL) * (1 - removalEfficiencyOIL));
-        outletWater.updateParameter(TURBIDITY, inletWater.getParameter(TURBIDITY) * 0.8f);
+        if (splitFractions.size() != outputs.size()) splitFractions.assign(outputs.size(), 1.0f);
+        divide(inletWater, outlets, PlainValues());
+    }
+
+    void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds& seeds) override {
+        steadyOutputs(in, out, seeds);
+    }
+    void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) override {
+        steadyOutputs(in, out, PreciseValues());
+    }
+
+    const Water& outletFor(size_t output) const override {
+        return output < outlets.size() ? outlets[output] : outletWater;
+    }
+
+private:
+    template <typename W, typename Values>
+    void steadyOutputs(const W& in, std::vector<W>& out, const Values& value) {
+        if (splitFractions.size() != outputs.size()) splitFractions.assign(outputs.size(), 1.0f);
+        divide(in, out, value);
+        if (out.empty()) out.assign(1, in);
+    }
+
+    template <typename W, typename Values>
+    void divide(const W& in, std::vector<W>& out, const Values& value) {
+        typedef typename W::Scalar T;
+        size_t count = outputs.size();
+        out.resize(count, in);
+        if (count == 0) return;
+
+        T total = 0.0;
+        for (float& fraction : splitFractions) total += std::max(value(fraction), T(0.0));
+        //|........||The last output takes the remainder so the flows add up to the inlet exactly
+        T assigned = 0.0;
+        for (size_t k = 0; k < count; ++k) {
+            out[k] = in;
+            if (k + 1 < count) {
+                T share = total > T(0.0) ? std::max(value(splitFractions[k]), T(0.0)) / total : T(1.0 / count);
+                out[k].flow = in.flow * share;
+                assigned += out[k].flow;
+            } else {
+                out[k].flow = std::max(in.flow - assigned, T(0.0));
+            }
+        }
+    }
+
+};
+
+//|........||Unit that settles solids. Output 0 carries the clarified water; when a second output is connected,
+//|........||output 1 draws off `underflowFraction` of the flow as sludge holding every load the unit removed.
+//|........||Without that output the removed solids simply leave the model.
+class SettlingUnit : public Component {
+public:
+    float underflowFraction = 0.01f;
+    Water sludge;
+
+    using Component::Component;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"underflowFraction", &underflowFraction, 0.0f, 1.0f});
+    }
+
+    const Water& outletFor(size_t output) const override {
+        return output == 1 ? sludge : outletWater;
+    }
+
+    StreamKind outputKind(size_t output) const override {
+        return output == 1 ? SLUDGE_STREAM : LIQUID_STREAM;
+    }
+
+protected:
+    //|........||Call at the end of the kernel, once `out` holds the clarified concentrations
+    template <typename W, typename Values>
+    void drawOffUnderflow(const W& in, W& out, W& underflowWater, const Values& value) const {
+        typedef typename W::Scalar T;
+        underflowWater = in;
+        if (outputs.size() < 2) {
+            underflowWater.flow = T(0.0);
+            return;
+        }
+        T underflow = in.flow * std::clamp(value(underflowFraction), T(0.0), T(1.0));
+        T effluent = in.flow - underflow;
+        underflowWater.flow = underflow;
+        out.flow = effluent;
+        if (underflow <= T(0.0)) return;
+        for (int p = 0; p < PARAMETER_COUNT; ++p) {
+            if (p == PH || p == TEMP) continue;
+            T removed = in.flow * in.parameters[p] - effluent * out.parameters[p];
+            underflowWater.parameters[p] = std::max(removed, T(0.0)) / underflow;
+        }
+    }
+};
+
+//|........||Units whose steady response is a closed-form kernel, written once as a template over the water
+//|........||type (CRTP: Unit::react). simulate() runs it on Water; differentiate() runs the same code on
+//|........||DualWater. Kernels read tunable fields through `value(field)`, which seeds them when differentiating.
+//|........||Settling units' kernels also fill the underflow: react(in, out, underflow, value).
+template <typename Unit, typename Base = Component>
+class Kinetic : public Base {
+public:
+    using Base::Base;
+
+    void simulate(float) override {
+        run(this->inletWater, this->outletWater, underflowSlot(), PlainValues());
+    }
+
+    //|........||out[1] doubles as scratch underflow for units with a single outlet
+    void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds& seeds) override {
+        out.assign(std::max<size_t>(this->outputs.size(), 2), in);
+        run(in, out[0], out[1], seeds);
+    }
+    void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) override {
+        out.assign(std::max<size_t>(this->outputs.size(), 2), in);
+        run(in, out[0], out[1], PreciseValues());
+    }
+
+protected:
+    template <typename W, typename Values>
+    auto run(const W& in, W& out, W& underflow, const Values& value) {
+        Unit& unit = static_cast<Unit&>(*this);
+        if constexpr (std::is_base_of<SettlingUnit, Base>::value) return unit.react(in, out, underflow, value);
+        else return unit.react(in, out, value);
+    }
+
+    Water& underflowSlot() {
+        if constexpr (std::is_base_of<SettlingUnit, Base>::value) return this->sludge;
+        else return this->outletWater;
+    }
+};
+
+//|........||Primary Clarifier: removes settleable solids and oil & grease
+class PrimaryClarifier : public Kinetic<PrimaryClarifier, SettlingUnit> {
+public:
+    PrimaryClarifier(const sf::Vector2f& pos) : Kinetic(
+        "Primary Clarifier",
+        "Removes settleable solids and oil & grease from wastewater.",
+        pos) {
+        shape.setFillColor(sf::Color(210, 105, 30));
+    }
+
+    float removalEfficiencyTSS = 0.70f;
+    float removalEfficiencyOIL = 0.90f;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        SettlingUnit::parameters(refs);
+        refs.push_back({"removalTSS", &removalEfficiencyTSS, 0.0f, 1.0f});
+        refs.push_back({"removalOIL", &removalEfficiencyOIL, 0.0f, 1.0f});
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, W& underflow, const Values& value) const {
+        typedef typename W::Scalar T;
+        out = in;
+        out.updateParameter(TSS, in.getParameter(TSS) * (1 - value(removalEfficiencyTSS)));
+        out.updateParameter(OIL, in.getParameter(OIL) * (1 - value(removalEfficiencyOIL)));
+        out.updateParameter(TURBIDITY, in.getParameter(TURBIDITY) * T(0.8));
+        drawOffUnderflow(in, out, underflow, value);
     }
 };
 
 //|........||Electrocoagulation Unit: removes metals and suspended solids, changes EC and pH
-class ElectrocoagulationUnit : public Component {
+class ElectrocoagulationUnit : public Kinetic<ElectrocoagulationUnit> {
 public:
-    ElectrocoagulationUnit(const sf::Vector2f& pos) : Component(
+    ElectrocoagulationUnit(const sf::Vector2f& pos) : Kinetic(
         "Electrocoagulation Unit",
         "Removes metals and suspended solids, changes EC and pH of wastewater.",
         pos) {
         shape.setFillColor(sf::Color(255, 215, 0));
     }
 
-    void simulate(float deltaTime) override {
-        float removalEfficiencyMETALS = 0.80f;
-        float removalEfficiencyTSS = 0.60f;
-        float pH_adjustment = 0.5f;
-        float EC_adjustment = 200.0f;
-        outletWater = inletWater;
-        outletWater.updateParameter(METALS, inletWater.getParameter(METALS) * (1 - removalEfficiencyMETALS));
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) * (1 - removalEfficiencyTSS));
-        outletWater.updateParameter(PH, inletWater.getParameter(PH) + pH_adjustment);
-        outletWater.updateParameter(EC, inletWater.getParameter(EC) + EC_adjustment);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T removalEfficiencyMETALS = 0.80;
+        T removalEfficiencyTSS = 0.60;
+        T pH_adjustment = 0.5;
+        T EC_adjustment = 200.0;
+        out = in;
+        out.updateParameter(METALS, in.getParameter(METALS) * (1 - removalEfficiencyMETALS));
+        out.updateParameter(TSS, in.getParameter(TSS) * (1 - removalEfficiencyTSS));
+        out.updateParameter(PH, in.getParameter(PH) + pH_adjustment);
+        out.updateParameter(EC, in.getParameter(EC) + EC_adjustment);
     }
 };
 
 //|........||Filtration: Removes suspended solids and turbidity
-class Filtration : public Component {
+class Filtration : public Kinetic<Filtration> {
 public:
-    Filtration(const sf::Vector2f& pos) : Component(
+    Filtration(const sf::Vector2f& pos) : Kinetic(
         "Filtration",
         "Removes suspended solids and turbidity from wastewater.",
         pos) {
         shape.setFillColor(sf::Color(192, 192, 192));
     }
 
-    void simulate(float deltaTime) override {
-        float removalEfficiencyTSS = 0.80f;
-        float removalEfficiencyTURB = 0.70f;
-        outletWater = inletWater;
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) * (1 - removalEfficiencyTSS));
-        outletWater.updateParameter(TURBIDITY, inletWater.getParameter(TURBIDITY) * (1 - removalEfficiencyTURB));
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T removalEfficiencyTSS = 0.80;
+        T removalEfficiencyTURB = 0.70;
+        out = in;
+        out.updateParameter(TSS, in.getParameter(TSS) * (1 - removalEfficiencyTSS));
+        out.updateParameter(TURBIDITY, in.getParameter(TURBIDITY) * (1 - removalEfficiencyTURB));
     }
 };
 
 //Anaeroic-Aerobic Filter: removes BOD, COD, and NH4 through biological treatment
-class AnaerobicAerobicFilter : public Component {
+class AnaerobicAerobicFilter : public Kinetic<AnaerobicAerobicFilter> {
 public:
-    AnaerobicAerobicFilter(const sf::Vector2f& pos) : Component(
+    AnaerobicAerobicFilter(const sf::Vector2f& pos) : Kinetic(
         "Anaerobic-Aerobic Filter",
         "Biological treatment system to remove BOD, COD, and NH₄⁺ from wastewater.",
         pos) {
         shape.setFillColor(sf::Color(0, 128, 128));
     }
 
-    void simulate(float deltaTime) override {
-        float k_bod = 0.2f;
-        float k_cod = 0.1f;
-        float k_nh4 = 0.05f;
-        float tempFactor = std::pow(1.035f, inletWater.getParameter(TEMP) - 20.0f);
-
-        float BOD_in = inletWater.getParameter(BOD);
-        float COD_in = inletWater.getParameter(COD);
-        float NH4_in = inletWater.getParameter(NH4);
+    ProcessThetas thetas;
 
-        float BOD_removal = BOD_in * (1 - std::exp(-k_bod * HRT * tempFactor));
-        float COD_removal = COD_in * (1 - std::exp(-k_cod * HRT * tempFactor));
-        float NH4_removal = NH4_in * (1 - std::exp(-k_nh4 * HRT * tempFactor));
-
-        outletWater = inletWater;
-        outletWater.updateParameter(BOD, BOD_in - BOD_removal);
-        outletWater.updateParameter(COD, COD_in - COD_removal);
-        outletWater.updateParameter(NH4, NH4_in - NH4_removal);
-        outletWater.updateParameter(NO3, inletWater.getParameter(NO3) + NH4_removal * 0.9f);
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        thetas.parameters(refs);
+    }
 
-        float DO_consumed = (BOD_removal + COD_removal + NH4_removal * 4.57f) * 1.5f;
-        outletWater.updateParameter(DO, inletWater.getParameter(DO) - DO_consumed);
-        if (outletWater.getParameter(DO) < 0) outletWater.updateParameter(DO, 0);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        using std::exp;
+        T k_bod = 0.2;
+        T k_cod = 0.1;
+        T k_nh4 = 0.05;
+        T bodFactor = temperatureFactor(thetas.of(value, thetas.bod), in.getParameter(TEMP));
+        T codFactor = temperatureFactor(thetas.of(value, thetas.cod), in.getParameter(TEMP));
+        T nh4Factor = temperatureFactor(thetas.of(value, thetas.nh4), in.getParameter(TEMP));
+
+        T BOD_in = in.getParameter(BOD);
+        T COD_in = in.getParameter(COD);
+        T NH4_in = in.getParameter(NH4);
+
+        T BOD_removal = BOD_in * (1 - exp(-k_bod * value(HRT) * bodFactor));
+        T COD_removal = COD_in * (1 - exp(-k_cod * value(HRT) * codFactor));
+        T NH4_removal = NH4_in * (1 - exp(-k_nh4 * value(HRT) * nh4Factor));
+
+        out = in;
+        out.updateParameter(BOD, BOD_in - BOD_removal);
+        out.updateParameter(COD, COD_in - COD_removal);
+        out.updateParameter(NH4, NH4_in - NH4_removal);
+        out.updateParameter(NO3, in.getParameter(NO3) + NH4_removal * T(0.9));
+
+        T DO_consumed = (BOD_removal + COD_removal + NH4_removal * T(4.57)) * T(1.5);
+        out.updateParameter(DO, in.getParameter(DO) - DO_consumed);
+        if (out.getParameter(DO) < 0) out.updateParameter(DO, 0);
     }
 };
 
 
 //|........||Ozone Disinfection: removes pathogens and oxidizes contaminants
-class OzoneDisinfection : public Component {
+class OzoneDisinfection : public Kinetic<OzoneDisinfection> {
 public:
-    OzoneDisinfection(const sf::Vector2f& pos) : Component(
+    OzoneDisinfection(const sf::Vector2f& pos) : Kinetic(
         "Ozone Disinfection",
         "Removes pathogens and oxidizes contaminants using ozone.",
         pos) {
         shape.setFillColor(sf::Color(255, 255, 0));
     }
 
-    void simulate(float deltaTime) override {
-        float pathogen_removal = inletWater.getParameter(PATHOGENS) * 0.999f;
-        float oxidationEfficiency = 0.90f;
-        outletWater = inletWater;
-        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) - pathogen_removal);
-        outletWater.updateParameter(COD, inletWater.getParameter(COD) * (1 - oxidationEfficiency));
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) * (1 - oxidationEfficiency));
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T pathogen_removal = in.getParameter(PATHOGENS) * T(0.999);
+        T oxidationEfficiency = 0.90;
+        out = in;
+        out.updateParameter(PATHOGENS, in.getParameter(PATHOGENS) - pathogen_removal);
+        out.updateParameter(COD, in.getParameter(COD) * (1 - oxidationEfficiency));
+        out.updateParameter(TSS, in.getParameter(TSS) * (1 - oxidationEfficiency));
     }
 };
 
 //|........||MBR: Membrane Bioreactor for advanced treatment
-class MBR : public Component {
+class MBR : public Kinetic<MBR> {
 public:
-    MBR(const sf::Vector2f& pos) : Component(
+    MBR(const sf::Vector2f& pos) : Kinetic(
         "MBR",
         "Membrane bioreactor, bacteria and protozoa remove contaminants.",
         pos) {
         shape.setFillColor(sf::Color(128, 128, 128));
     }
 
-    void simulate(float deltaTime) override {
-        float k_bod = 0.1f;
-        float k_cod = 0.05f;
-        float k_nh4 = 0.03f;
-        float tempFactor = std::pow(1.035f, inletWater.getParameter(TEMP) - 20.0f);
-
-        float BOD_in = inletWater.getParameter(BOD);
-        float COD_in = inletWater.getParameter(COD);
-        float NH4_in = inletWater.getParameter(NH4);
-
-        float BOD_removal = BOD_in * (1 - std::exp(-k_bod * HRT * tempFactor));
-        float COD_removal = COD_in * (1 - std::exp(-k_cod * HRT * tempFactor));
-        float NH4_removal = NH4_in * (1 - std::exp(-k_nh4 * HRT * tempFactor));
+    ProcessThetas thetas;
 
-        outletWater = inletWater;
-        outletWater.updateParameter(BOD, BOD_in - BOD_removal);
-        outletWater.updateParameter(COD, COD_in - COD_removal);
-        outletWater.updateParameter(NH4, NH4_in - NH4_removal);
-        outletWater.updateParameter(NO3, inletWater.getParameter(NO3) + NH4_removal * 0.9f);
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        thetas.parameters(refs);
+    }
 
-        float DO_consumed = (BOD_removal + COD_removal + NH4_removal * 4.57f) * 1.5f;
-        outletWater.updateParameter(DO, inletWater.getParameter(DO) - DO_consumed);
-        if (outletWater.getParameter(DO) < 0) outletWater.updateParameter(DO, 0);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        using std::exp;
+        T k_bod = 0.1;
+        T k_cod = 0.05;
+        T k_nh4 = 0.03;
+        T bodFactor = temperatureFactor(thetas.of(value, thetas.bod), in.getParameter(TEMP));
+        T codFactor = temperatureFactor(thetas.of(value, thetas.cod), in.getParameter(TEMP));
+        T nh4Factor = temperatureFactor(thetas.of(value, thetas.nh4), in.getParameter(TEMP));
+
+        T BOD_in = in.getParameter(BOD);
+        T COD_in = in.getParameter(COD);
+        T NH4_in = in.getParameter(NH4);
+
+        T BOD_removal = BOD_in * (1 - exp(-k_bod * value(HRT) * bodFactor));
+        T COD_removal = COD_in * (1 - exp(-k_cod * value(HRT) * codFactor));
+        T NH4_removal = NH4_in * (1 - exp(-k_nh4 * value(HRT) * nh4Factor));
+
+        out = in;
+        out.updateParameter(BOD, BOD_in - BOD_removal);
+        out.updateParameter(COD, COD_in - COD_removal);
+        out.updateParameter(NH4, NH4_in - NH4_removal);
+        out.updateParameter(NO3, in.getParameter(NO3) + NH4_removal * T(0.9));
+
+        T DO_consumed = (BOD_removal + COD_removal + NH4_removal * T(4.57)) * T(1.5);
+        out.updateParameter(DO, in.getParameter(DO) - DO_consumed);
+        if (out.getParameter(DO) < 0) out.updateParameter(DO, 0);
     }
 };
 
 //|........||Realistic Biofilter: removes BOD, COD, and NH4 through biological treatment
-class Biofilter : public Component {
+class Biofilter : public Kinetic<Biofilter> {
 public:
-    Biofilter(const sf::Vector2f& pos) : Component(
+    Biofilter(const sf::Vector2f& pos) : Kinetic(
         "Realistic Biofilter",
         "Biological treatment system to remove BOD, COD, and NH₄⁺ from wastewater.",
         pos) {
         shape.setFillColor(sf::Color(0, 128, 0));
     }
 
-    void simulate(float deltaTime) override {
-        float k_bod = 0.2f;
-        float k_cod = 0.1f;
-        float k_nh4 = 0.05f;
-        float tempFactor = std::pow(1.035f, inletWater.getParameter(TEMP) - 20.0f);
-
-        float BOD_in = inletWater.getParameter(BOD);
-        float COD_in = inletWater.getParameter(COD);
-        float NH4_in = inletWater.getParameter(NH4);
+    ProcessThetas thetas;
 
-        float BOD_removal = BOD_in * (1 - std::exp(-k_bod * HRT * tempFactor));
-        float COD_removal = COD_in * (1 - std::exp(-k_cod * HRT * tempFactor));
-        float NH4_removal = NH4_in * (1 - std::exp(-k_nh4 * HRT * tempFactor));
-
-        outletWater = inletWater;
-        outletWater.updateParameter(BOD, BOD_in - BOD_removal);
-        outletWater.updateParameter(COD, COD_in - COD_removal);
-        outletWater.updateParameter(NH4, NH4_in - NH4_removal);
-        outletWater.updateParameter(NO3, inletWater.getParameter(NO3) + NH4_removal * 0.9f);
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        thetas.parameters(refs);
+    }
 
-        float DO_consumed = (BOD_removal + COD_removal + NH4_removal * 4.57f) * 1.5f;
-        outletWater.updateParameter(DO, inletWater.getParameter(DO) - DO_consumed);
-        if (outletWater.getParameter(DO) < 0) outletWater.updateParameter(DO, 0);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        using std::exp;
+        T k_bod = 0.2;
+        T k_cod = 0.1;
+        T k_nh4 = 0.05;
+        T bodFactor = temperatureFactor(thetas.of(value, thetas.bod), in.getParameter(TEMP));
+        T codFactor = temperatureFactor(thetas.of(value, thetas.cod), in.getParameter(TEMP));
+        T nh4Factor = temperatureFactor(thetas.of(value, thetas.nh4), in.getParameter(TEMP));
+
+        T BOD_in = in.getParameter(BOD);
+        T COD_in = in.getParameter(COD);
+        T NH4_in = in.getParameter(NH4);
+
+        T BOD_removal = BOD_in * (1 - exp(-k_bod * value(HRT) * bodFactor));
+        T COD_removal = COD_in * (1 - exp(-k_cod * value(HRT) * codFactor));
+        T NH4_removal = NH4_in * (1 - exp(-k_nh4 * value(HRT) * nh4Factor));
+
+        out = in;
+        out.updateParameter(BOD, BOD_in - BOD_removal);
+        out.updateParameter(COD, COD_in - COD_removal);
+        out.updateParameter(NH4, NH4_in - NH4_removal);
+        out.updateParameter(NO3, in.getParameter(NO3) + NH4_removal * T(0.9));
+
+        T DO_consumed = (BOD_removal + COD_removal + NH4_removal * T(4.57)) * T(1.5);
+        out.updateParameter(DO, in.getParameter(DO) - DO_consumed);
+        if (out.getParameter(DO) < 0) out.updateParameter(DO, 0);
     }
 };
 
 //|........||Primary Sedimentation Tank: removes suspended solids and some BOD
-class PrimarySedimentationTank : public Component {
+class PrimarySedimentationTank : public Kinetic<PrimarySedimentationTank, SettlingUnit> {
 public:
-    PrimarySedimentationTank(const sf::Vector2f& pos) : Component(
+    PrimarySedimentationTank(const sf::Vector2f& pos) : Kinetic(
         "Primary Sedimentation Tank",
         "Removes settleable solids and reduces BOD through sedimentation.",
         pos) {
         shape.setFillColor(sf::Color(139, 69, 19));
     }
 
-    void simulate(float deltaTime) override {
-        float removalEfficiencyTSS = 0.60f;
-        float removalEfficiencyBOD = 0.35f;
-        //pathogen
-        float removalEfficiencyPathogen = 0.60f;
-        outletWater = inletWater;
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) * (1 - removalEfficiencyTSS));
-        outletWater.updateParameter(BOD, inletWater.getParameter(BOD) * (1 - removalEfficiencyBOD));
-        outletWater.updateParameter(TURBIDITY, inletWater.getParameter(TURBIDITY) * 0.5f);
-        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) * (1 - removalEfficiencyPathogen));
+    float removalEfficiencyTSS = 0.60f;
+    float removalEfficiencyBOD = 0.35f;
+    float removalEfficiencyPathogen = 0.60f;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        SettlingUnit::parameters(refs);
+        refs.push_back({"removalTSS", &removalEfficiencyTSS, 0.0f, 1.0f});
+        refs.push_back({"removalBOD", &removalEfficiencyBOD, 0.0f, 1.0f});
+        refs.push_back({"removalPathogens", &removalEfficiencyPathogen, 0.0f, 1.0f});
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, W& underflow, const Values& value) const {
+        typedef typename W::Scalar T;
+        out = in;
+        out.updateParameter(TSS, in.getParameter(TSS) * (1 - value(removalEfficiencyTSS)));
+        out.updateParameter(BOD, in.getParameter(BOD) * (1 - value(removalEfficiencyBOD)));
+        out.updateParameter(TURBIDITY, in.getParameter(TURBIDITY) * T(0.5));
+        out.updateParameter(PATHOGENS, in.getParameter(PATHOGENS) * (1 - value(removalEfficiencyPathogen)));
+        drawOffUnderflow(in, out, underflow, value);
     }
 };
 
 //|........||Aeration Tank: aerobic biological treatment to remove BOD and ammonium
-class AerationTank : public Component {
+class AerationTank : public Kinetic<AerationTank> {
 public:
-    AerationTank(const sf::Vector2f& pos) : Component(
+    Aeration aeration;
+
+    AerationTank(const sf::Vector2f& pos) : Kinetic(
         "Aeration Tank",
         "Promotes microbial degradation of organic matter under aerobic conditions.",
         pos) {
         shape.setFillColor(sf::Color(70, 130, 180));
     }
 
+    Aeration* aerationSystem() override {
+        return &aeration;
+    }
+
+    EnergyMeter* energyMeter() override {
+        return &aeration.meter;
+    }
+
+    float k_bod = 0.2f;    //|........||1/h first-order BOD removal at 20 °C
+    float k_nh4 = 0.1f;    //|........||1/h first-order nitrification at 20 °C
+    ProcessThetas thetas;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"k_bod", &k_bod, 0.0f, 10.0f});
+        refs.push_back({"k_nh4", &k_nh4, 0.0f, 10.0f});
+        thetas.parameters(refs, ProcessThetas::BOD_PROCESS | ProcessThetas::NH4_PROCESS);
+        refs.push_back({"DO_setpoint", &aeration.control.setpoint, 0.0f, 8.0f});
+    }
+
     void simulate(float deltaTime) override {
-        float k_bod = 0.2f;
-        float k_nh4 = 0.1f;
-        float tempFactor = std::pow(1.035f, inletWater.getParameter(TEMP) - 20.0f);
+        float demand = react(inletWater, outletWater, PlainValues());
+        outletWater.updateParameter(DO, aeration.apply(inletWater.getParameter(DO), demand,
+            inletWater.getParameter(TEMP), HRT, volume, inletWater.flow, deltaTime));
+    }
+
+    //|........||The outlet DO is the steady state of the aeration loop, differentiated along with the kinetics
+    void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds& seeds) override {
+        steadyOutputs(in, out, seeds);
+    }
+    void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) override {
+        steadyOutputs(in, out, PreciseValues());
+    }
 
-        float BOD_in = inletWater.getParameter(BOD);
-        float NH4_in = inletWater.getParameter(NH4);
+    template <typename W, typename Values>
+    void steadyOutputs(const W& in, std::vector<W>& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        out.assign(std::max<size_t>(outputs.size(), 1), in);
+        T demand = react(in, out[0], value);
+        T kla;
+        out[0].parameters[DO] = aeration.steadyOxygen(in.parameters[DO], demand, in.parameters[TEMP], value(HRT), value, kla);
+    }
 
-        float BOD_removal = BOD_in * (1 - std::exp(-k_bod * HRT * tempFactor));
-        float NH4_removal = NH4_in * (1 - std::exp(-k_nh4 * HRT * tempFactor));
+    //|........||Returns the oxygen demand; the DO itself comes from the aeration loop
+    template <typename W, typename Values>
+    typename W::Scalar react(const W& in, W& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        using std::exp;
+        T bodFactor = temperatureFactor(thetas.of(value, thetas.bod), in.getParameter(TEMP));
+        T nh4Factor = temperatureFactor(thetas.of(value, thetas.nh4), in.getParameter(TEMP));
 
-        outletWater = inletWater;
-        outletWater.updateParameter(BOD, BOD_in - BOD_removal);
-        outletWater.updateParameter(NH4, NH4_in - NH4_removal);
-        outletWater.updateParameter(NO3, inletWater.getParameter(NO3) + NH4_removal * 0.9f);
+        T BOD_in = in.getParameter(BOD);
+        T NH4_in = in.getParameter(NH4);
 
-        float DO_consumed = (BOD_removal + NH4_removal * 4.57f) * 1.5f;
-        outletWater.updateParameter(DO, inletWater.getParameter(DO) - DO_consumed);
-        if (outletWater.getParameter(DO) < 0) outletWater.updateParameter(DO, 0);
+        T BOD_removal = BOD_in * (1 - exp(-value(k_bod) * value(HRT) * bodFactor));
+        T NH4_removal = NH4_in * (1 - exp(-value(k_nh4) * value(HRT) * nh4Factor));
+
+        out = in;
+        out.updateParameter(BOD, BOD_in - BOD_removal);
+        out.updateParameter(NH4, NH4_in - NH4_removal);
+        out.updateParameter(NO3, in.getParameter(NO3) + NH4_removal * T(0.9));
+
+        T DO_consumed = (BOD_removal + NH4_removal * T(4.57)) * T(1.5);
+        return DO_consumed;
     }
 };
 
 //|........||Secondary Clarifier: removes biomass generated in the aeration tank
-class SecondaryClarifier : public Component {
+class SecondaryClarifier : public Kinetic<SecondaryClarifier, SettlingUnit> {
 public:
-    SecondaryClarifier(const sf::Vector2f& pos) : Component(
+    SecondaryClarifier(const sf::Vector2f& pos) : Kinetic(
         "Secondary Clarifier",
         "Settles out microbial biomass from the aeration tank.",
         pos) {
         shape.setFillColor(sf::Color(210, 180, 140));
     }
 
-    void simulate(float deltaTime) override {
-        float TSS_removal = inletWater.getParameter(TSS) * 0.85f;
-        outletWater = inletWater;
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) - TSS_removal);
-        outletWater.updateParameter(TURBIDITY, inletWater.getParameter(TURBIDITY) * 0.7f);
+    float removalEfficiencyTSS = 0.85f;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        SettlingUnit::parameters(refs);
+        refs.push_back({"removalTSS", &removalEfficiencyTSS, 0.0f, 1.0f});
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, W& underflow, const Values& value) const {
+        typedef typename W::Scalar T;
+        T TSS_removal = in.getParameter(TSS) * value(removalEfficiencyTSS);
+        out = in;
+        out.updateParameter(TSS, in.getParameter(TSS) - TSS_removal);
+        out.updateParameter(TURBIDITY, in.getParameter(TURBIDITY) * T(0.7));
+        drawOffUnderflow(in, out, underflow, value);
     }
 };
 
 //|........||Chlorine Disinfection Unit: eliminates pathogens using chlorine
-class ChlorineDisinfectionUnit : public Component {
+class ChlorineDisinfectionUnit : public Kinetic<ChlorineDisinfectionUnit> {
 public:
-    ChlorineDisinfectionUnit(const sf::Vector2f& pos) : Component(
+    ChlorineDisinfectionUnit(const sf::Vector2f& pos) : Kinetic(
         "Chlorine Disinfection Unit",
         "Uses chlorine to disinfect water, killing remaining pathogens.",
         pos) {
         shape.setFillColor(sf::Color(255, 215, 0));
     }
 
-    void simulate(float deltaTime) override {
-        float pathogen_removal = inletWater.getParameter(PATHOGENS) * 0.99999f;
-        outletWater = inletWater;
-        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) - pathogen_removal);
-        outletWater.updateParameter(RESIDUAL_CHLORINE, 0.7f); //|........||Add residual chlorine
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T pathogen_removal = in.getParameter(PATHOGENS) * T(0.99999);
+        out = in;
+        out.updateParameter(PATHOGENS, in.getParameter(PATHOGENS) - pathogen_removal);
+        out.updateParameter(RESIDUAL_CHLORINE, T(0.7)); //|........||Add residual chlorine
         //Adds chlorides 46% more than the original value
-        outletWater.updateParameter(CHLORIDES, inletWater.getParameter(CHLORIDES) * 1.46f);
+        out.updateParameter(CHLORIDES, in.getParameter(CHLORIDES) * T(1.46));
     }
 };
 
 //|........||Nitrification Tank: converts ammonium to nitrate through nitrification
-class NitrificationTank : public Component {
+class NitrificationTank : public Kinetic<NitrificationTank> {
 public:
-    NitrificationTank(const sf::Vector2f& pos) : Component(
+    NitrificationTank(const sf::Vector2f& pos) : Kinetic(
         "Nitrification Tank",
         "Biological process to convert ammonium to nitrate through nitrification.",
         pos) {
         shape.setFillColor(sf::Color(255, 165, 0));
     }
 
-    void simulate(float deltaTime) override {
-        float k_nh4 = 0.1f;
-        float tempFactor = std::pow(1.035f, inletWater.getParameter(TEMP) - 20.0f);
-        float alkalinityremoval = 0.5f;
+    float k_nh4 = 0.1f;    //|........||1/h first-order nitrification at 20 °C
+    ProcessThetas thetas;
+    float alkalinityremoval = 0.5f;
 
-        float NH4_in = inletWater.getParameter(NH4);
-        float NO3_in = inletWater.getParameter(NO3);
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"k_nh4", &k_nh4, 0.0f, 10.0f});
+        thetas.parameters(refs, ProcessThetas::NH4_PROCESS);
+        refs.push_back({"alkalinityRemoval", &alkalinityremoval, 0.0f, 100.0f});
+    }
 
-        float NH4_removal = NH4_in * (1 - std::exp(-k_nh4 * HRT * tempFactor));
-        float NO3_generated = NH4_removal * 0.9f;
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        using std::exp;
+        T tempFactor = temperatureFactor(thetas.of(value, thetas.nh4), in.getParameter(TEMP));
 
-        outletWater = inletWater;
-        outletWater.updateParameter(NH4, NH4_in - NH4_removal);
-        outletWater.updateParameter(NO3, NO3_in + NO3_generated);
-        outletWater.updateParameter(ALKALINITY, inletWater.getParameter(ALKALINITY) - alkalinityremoval);
+        T NH4_in = in.getParameter(NH4);
+        T NO3_in = in.getParameter(NO3);
+
+        T NH4_removal = NH4_in * (1 - exp(-value(k_nh4) * value(HRT) * tempFactor));
+        T NO3_generated = NH4_removal * T(0.9);
+
+        out = in;
+        out.updateParameter(NH4, NH4_in - NH4_removal);
+        out.updateParameter(NO3, NO3_in + NO3_generated);
+        out.updateParameter(ALKALINITY, in.getParameter(ALKALINITY) - value(alkalinityremoval));
     }
 };
 
 //|........||UV Disinfection: uses ultraviolet light to eliminate pathogens without chemicals
-class UVDisinfection : public Component {
+class UVDisinfection : public Kinetic<UVDisinfection> {
 public:
-    UVDisinfection(const sf::Vector2f& pos) : Component(
+    UVDisinfection(const sf::Vector2f& pos) : Kinetic(
         "UV Disinfection",
         "Utilizes UV radiation to inactivate pathogens without chemical additives.",
         pos) {
         shape.setFillColor(sf::Color(255, 255, 224));
     }
 
-    void simulate(float deltaTime) override {
-        float pathogen_removal = inletWater.getParameter(PATHOGENS) * 0.999f;
-        outletWater = inletWater;
-        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) - pathogen_removal);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T pathogen_removal = in.getParameter(PATHOGENS) * T(0.999);
+        out = in;
+        out.updateParameter(PATHOGENS, in.getParameter(PATHOGENS) - pathogen_removal);
     }
 };
 
 //|........||Anaerobic Filter: removes organic matter through anaerobic processes
-class AnaerobicFilter : public Component {
+class AnaerobicFilter : public Kinetic<AnaerobicFilter> {
 public:
-    AnaerobicFilter(const sf::Vector2f& pos) : Component(
+    AnaerobicFilter(const sf::Vector2f& pos) : Kinetic(
         "Anaerobic Filter",
         "Employs anaerobic bacteria to degrade organic pollutants.",
         pos) {
         shape.setFillColor(sf::Color(85, 107, 47));
     }
 
-    void simulate(float deltaTime) override {
-        float COD_in = inletWater.getParameter(COD);
-        float COD_removal = COD_in * 0.65f;
-        outletWater = inletWater;
-        outletWater.updateParameter(COD, COD_in - COD_removal);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T COD_in = in.getParameter(COD);
+        T COD_removal = COD_in * T(0.65);
+        out = in;
+        out.updateParameter(COD, COD_in - COD_removal);
         //|........||Biogas production (e.g., methane)
     }
 };
 
 //|........||Coagulation and Flocculation: destabilizes particles for COD removal
-class CoagulationFlocculation : public Component {
+class CoagulationFlocculation : public Kinetic<CoagulationFlocculation> {
 public:
-    CoagulationFlocculation(const sf::Vector2f& pos) : Component(
+    CoagulationFlocculation(const sf::Vector2f& pos) : Kinetic(
         "Coagulation and Flocculation",
         "Destabilizes particles for subsequent removal of COD and TSS.",
         pos) {
         shape.setFillColor(sf::Color(128, 0, 128));
     }
 
-    void simulate(float deltaTime) override {
-        float COD_removal = inletWater.getParameter(COD) * 0.40f;
-        float TSS_removal = inletWater.getParameter(TSS) * 0.60f;
-        outletWater = inletWater;
-        outletWater.updateParameter(COD, inletWater.getParameter(COD) - COD_removal);
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) - TSS_removal);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T COD_removal = in.getParameter(COD) * T(0.40);
+        T TSS_removal = in.getParameter(TSS) * T(0.60);
+        out = in;
+        out.updateParameter(COD, in.getParameter(COD) - COD_removal);
+        out.updateParameter(TSS, in.getParameter(TSS) - TSS_removal);
     }
 };
 
 //|........||Membrane Filtration: uses ultrafiltration to remove particles and pathogens and COD
-class MembraneFiltration : public Component {
+class MembraneFiltration : public Kinetic<MembraneFiltration> {
 public:
-    MembraneFiltration(const sf::Vector2f& pos) : Component(
+    MembraneFiltration(const sf::Vector2f& pos) : Kinetic(
         "Membrane Filtration",
         "Removes particles, pathogens, and COD through ultrafiltration membranes.",
         pos) {
         shape.setFillColor(sf::Color(0, 0, 255));
     }
 
-    void simulate(float deltaTime) override {
-        float COD_removal = inletWater.getParameter(COD) * 0.20f;
-        float TSS_removal = inletWater.getParameter(TSS) * 0.45f;
-        float pathogen_removal = inletWater.getParameter(PATHOGENS) * 0.9999f;
-        outletWater = inletWater;
-        outletWater.updateParameter(COD, inletWater.getParameter(COD) - COD_removal);
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) - TSS_removal);
-        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) - pathogen_removal);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T COD_removal = in.getParameter(COD) * T(0.20);
+        T TSS_removal = in.getParameter(TSS) * T(0.45);
+        T pathogen_removal = in.getParameter(PATHOGENS) * T(0.9999);
+        out = in;
+        out.updateParameter(COD, in.getParameter(COD) - COD_removal);
+        out.updateParameter(TSS, in.getParameter(TSS) - TSS_removal);
+        out.updateParameter(PATHOGENS, in.getParameter(PATHOGENS) - pathogen_removal);
     }
 };
 
 //|........||Chemical Oxidation: uses oxidizing agents to remove COD and color
-class ChemicalOxidation : public Component {
+class ChemicalOxidation : public Kinetic<ChemicalOxidation> {
 public:
-    ChemicalOxidation(const sf::Vector2f& pos) : Component(
+    ChemicalOxidation(const sf::Vector2f& pos) : Kinetic(
         "Chemical Oxidation",
         "Applies strong oxidants to degrade organic pollutants and color.",
         pos) {
         shape.setFillColor(sf::Color(255, 0, 0));
     }
 
-    void simulate(float deltaTime) override {
-        float COD_removal = inletWater.getParameter(COD) * 0.70f;
-        outletWater = inletWater;
-        outletWater.updateParameter(COD, inletWater.getParameter(COD) - COD_removal);
-        outletWater.updateParameter(TURBIDITY, inletWater.getParameter(TURBIDITY) * 0.8f);
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T COD_removal = in.getParameter(COD) * T(0.70);
+        out = in;
+        out.updateParameter(COD, in.getParameter(COD) - COD_removal);
+        out.updateParameter(TURBIDITY, in.getParameter(TURBIDITY) * T(0.8));
     }
 };
 
 //|........||Active Sludge Process: aerobic biological treatment for BOD, COD and TSS removal
-class ActiveSludgeProcess : public Component {
+class ActiveSludgeProcess : public Kinetic<ActiveSludgeProcess> {
 public:
-    ActiveSludgeProcess(const sf::Vector2f& pos) : Component(
+    Aeration aeration;
+
+    ActiveSludgeProcess(const sf::Vector2f& pos) : Kinetic(
         "Active Sludge Process",
         "Biological treatment to remove BOD, COD, and TSS through aeration and sedimentation.",
         pos) {
         shape.setFillColor(sf::Color(70, 130, 180));
     }
 
-    void simulate(float deltaTime) override {
-        float k_bod = 0.2f;
-        float k_nh4 = 0.1f;
-        float tempFactor = std::pow(1.035f, inletWater.getParameter(TEMP) - 20.0f);
-
-        float BOD_in = inletWater.getParameter(BOD);
-        float NH4_in = inletWater.getParameter(NH4);
-
-        float BOD_removal = BOD_in * (1 - std::exp(-k_bod * HRT * tempFactor));
-        float NH4_removal = NH4_in * (1 - std::exp(-k_nh4 * HRT * tempFactor));
-
-        outletWater = inletWater;
-        outletWater.updateParameter(BOD, BOD_in - BOD_removal);
-        outletWater.updateParameter(NH4, NH4_in - NH4_removal);
-        outletWater.updateParameter(NO3, inletWater.getParameter(NO3) + NH4_removal * 0.9f);
+    Aeration* aerationSystem() override {
+        return &aeration;
+    }
 
-        float DO_consumed = (BOD_removal + NH4_removal * 4.57f) * 1.5f;
-        outletWater.updateParameter(DO, inletWater.getParameter(DO) - DO_consumed);
-        if (outletWater.getParameter(DO) < 0) outletWater.updateParameter(DO, 0);
-        //COD removal
-        float COD_removal = inletWater.getParameter(COD) * 0.79f;
-        outletWater.updateParameter(COD, inletWater.getParameter(COD) - COD_removal);
+    EnergyMeter* energyMeter() override {
+        return &aeration.meter;
     }
-};
 
-//|........||Sludge Digester: stabilizes sludge through anaerobic digestion
-class SludgeDigester : public Component {
-public:
-    SludgeDigester(const sf::Vector2f& pos) : Component(
-        "Sludge Digester",
-        "Reduces sludge volume and stabilizes organic content anaerobically.",
-        pos) {
-        shape.setFillColor(sf::Color(165, 42, 42));
+    float k_bod = 0.2f;    //|........||1/h first-order BOD removal at 20 °C
+    float k_nh4 = 0.1f;    //|........||1/h first-order nitrification at 20 °C
+    ProcessThetas thetas;
+    float removalEfficiencyCOD = 0.79f;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"k_bod", &k_bod, 0.0f, 10.0f});
+        refs.push_back({"k_nh4", &k_nh4, 0.0f, 10.0f});
+        thetas.parameters(refs, ProcessThetas::BOD_PROCESS | ProcessThetas::NH4_PROCESS);
+        refs.push_back({"removalCOD", &removalEfficiencyCOD, 0.0f, 1.0f});
+        refs.push_back({"DO_setpoint", &aeration.control.setpoint, 0.0f, 8.0f});
     }
 
     void simulate(float deltaTime) override {
-        float VSS_removal = inletWater.getParameter(TSS) * 0.55f;
-        outletWater = inletWater;
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) - VSS_removal);
-        //|........||Further pathogen reduction
+        float demand = react(inletWater, outletWater, PlainValues());
+        outletWater.updateParameter(DO, aeration.apply(inletWater.getParameter(DO), demand,
+            inletWater.getParameter(TEMP), HRT, volume, inletWater.flow, deltaTime));
     }
-};
 
-//|........||Oil and Grease Separator: removes oils and greases through flotation
-class OilSeparator : public Component {
-public:
-    OilSeparator(const sf::Vector2f& pos) : Component(
-        "Oil and Grease Separator",
-        "Separates oils and greases from water by flotation mechanisms.",
-        pos) {
-        shape.setFillColor(sf::Color(255, 160, 122));
+    //|........||The outlet DO is the steady state of the aeration loop, differentiated along with the kinetics
+    void differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds& seeds) override {
+        steadyOutputs(in, out, seeds);
     }
-
-    void simulate(float deltaTime) override {
-        float oil_removal = inletWater.getParameter(OIL) * 0.90f;
-        outletWater = inletWater;
-        outletWater.updateParameter(OIL, inletWater.getParameter(OIL) - oil_removal);
-        outletWater.updateParameter(TURBIDITY, inletWater.getParameter(TURBIDITY) * 0.9f);
+    void evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) override {
+        steadyOutputs(in, out, PreciseValues());
     }
-};
 
-//|........||Phosphorus Removal Unit: chemical precipitation to remove phosphorus
-class PhosphorusRemovalUnit : public Component {
-public:
-    PhosphorusRemovalUnit(const sf::Vector2f& pos) : Component(
-        "Phosphorus Removal Unit",
-        "Eliminates phosphorus via chemical precipitation methods.",
-        pos) {
-        shape.setFillColor(sf::Color(138, 43, 226));
+    template <typename W, typename Values>
+    void steadyOutputs(const W& in, std::vector<W>& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        out.assign(std::max<size_t>(outputs.size(), 1), in);
+        T demand = react(in, out[0], value);
+        T kla;
+        out[0].parameters[DO] = aeration.steadyOxygen(in.parameters[DO], demand, in.parameters[TEMP], value(HRT), value, kla);
     }
 
-    void simulate(float deltaTime) override {
-        float P_removal = inletWater.getParameter(P) * 0.75f;
-        outletWater = inletWater;
-        outletWater.updateParameter(P, inletWater.getParameter(P) - P_removal);
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) + P_removal * 2); //|........||Precipitate formation
+    //|........||Returns the oxygen demand; the DO itself comes from the aeration loop
+    template <typename W, typename Values>
+    typename W::Scalar react(const W& in, W& out, const Values& value) const {
+        typedef typename W::Scalar T;
+        using std::exp;
+        T bodFactor = temperatureFactor(thetas.of(value, thetas.bod), in.getParameter(TEMP));
+        T nh4Factor = temperatureFactor(thetas.of(value, thetas.nh4), in.getParameter(TEMP));
+
+        T BOD_in = in.getParameter(BOD);
+        T NH4_in = in.getParameter(NH4);
+
+        T BOD_removal = BOD_in * (1 - exp(-value(k_bod) * value(HRT) * bodFactor));
+        T NH4_removal = NH4_in * (1 - exp(-value(k_nh4) * value(HRT) * nh4Factor));
+
+        out = in;
+        out.updateParameter(BOD, BOD_in - BOD_removal);
+        out.updateParameter(NH4, NH4_in - NH4_removal);
+        out.updateParameter(NO3, in.getParameter(NO3) + NH4_removal * T(0.9));
+
+        T DO_consumed = (BOD_removal + NH4_removal * T(4.57)) * T(1.5);
+        //COD removal
+        T COD_removal = in.getParameter(COD) * value(removalEfficiencyCOD);
+        out.updateParameter(COD, in.getParameter(COD) - COD_removal);
+        return DO_consumed;
     }
 };
 
-//|........||Drying Bed: removes moisture from sludge for final disposal
-class DryingBed : public Component {
+//|........||IWA Anaerobic Digestion Model No. 1 with the BSM2 parameter set (Rosen & Jeppsson, 2006).
+//|........||Units are kg COD/m³ (kmol/m³ for inorganic carbon, nitrogen and ions) and days. The acid-base
+//|........||equilibria are not integrated: pH is solved from the charge balance at every evaluation, which
+//|........||removes the stiffest modes. The remaining ODEs are stepped with backward Euler and a modified
+//|........||Newton iteration that keeps one factored Jacobian across steps. The Jacobian is built by finite
+//|........||differences over groups of columns that share no row (column colouring), so a rebuild costs a
+//|........||handful of evaluations instead of one per state.
+class ADM1 {
 public:
-    DryingBed(const sf::Vector2f& pos) : Component(
-        "Drying Bed",
-        "Allows for dewatering of sludge through evaporation and drainage.",
-        pos) {
-        shape.setFillColor(sf::Color(222, 184, 135));
+    enum State {
+        S_SU, S_AA, S_FA, S_VA, S_BU, S_PRO, S_AC, S_H2, S_CH4, S_IC, S_IN, S_I,
+        X_XC, X_CH, X_PR, X_LI, X_SU, X_AA, X_FA, X_C4, X_PRO, X_AC, X_H2, X_I,
+        S_CAT, S_AN, GAS_H2, GAS_CH4, GAS_CO2,
+        STATE_COUNT
+    };
+    typedef std::array<double, STATE_COUNT> Vector;
+
+    Vector state;
+    Vector feed;                 //|........||influent concentrations; the gas entries are unused
+    double feedFlow = 170.0;     //|........||m³/day
+    double liquidVolume = 3400.0;
+    double gasVolume = 300.0;
+    double temperature = 35.0;   //|........||°C
+
+    //|........||Outputs of the last evaluation
+    double pH = 7.0;
+    double bicarbonate = 0.0;    //|........||kmol/m³
+    double gasFlow = 0.0;        //|........||m³/day at digester conditions
+    double methaneFraction = 0.0;
+    //|........||Solver counters
+    long steps = 0;
+    long newtonIterations = 0;
+    long jacobianBuilds = 0;
+    long denseFactorizations = 0;   //|........||Jacobians whose sparse pivots failed the threshold
+
+    ADM1() { reset(); }
+
+    //|........||BSM2 steady state and influent
+    void reset() {
+        static const double influent[STATE_COUNT] = {
+            0.01, 0.001, 0.001, 0.001, 0.001, 0.001, 0.001, 1e-8, 1e-5, 0.04, 0.01, 0.02,
+            2.0, 5.0, 20.0, 5.0, 0.0, 0.01, 0.01, 0.01, 0.01, 0.01, 0.01, 25.0,
+            0.04, 0.02, 0.0, 0.0, 0.0 };
+        std::copy(influent, influent + STATE_COUNT, feed.begin());
+        steps = newtonIterations = jacobianBuilds = denseFactorizations = 0;
+        coldStart();
     }
 
-    void simulate(float deltaTime) override {
-        float moisture_removal = inletWater.getParameter(TSS) * 0.95f;
-        outletWater = inletWater;
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) - moisture_removal);
+    //|........||Back to the BSM2 steady state, keeping the current feed and conditions
+    void coldStart() {
+        static const double initial[STATE_COUNT] = {
+            0.0124, 0.0055, 0.1074, 0.0123, 0.0140, 0.0176, 0.0893, 2.5055e-7, 0.0555, 0.0951, 0.0945, 0.1309,
+            0.1079, 0.0205, 0.0842, 0.0436, 0.3122, 0.9317, 0.3384, 0.3258, 0.1011, 0.6772, 0.2848, 17.2162,
+            0.04, 0.02, 1.1032e-5, 1.6535, 0.0135 };
+        std::copy(initial, initial + STATE_COUNT, state.begin());
+        jacobianValid = false;
+        finish(std::pow(10.0, -7.46));
     }
-};
 
-//|........||Pump: increases fluid energy to move it through the system
-class Pump : public Component {
-public:
-    Pump(const sf::Vector2f& pos) : Component(
-        "Pump",
-        "Boosts water pressure to facilitate flow through the treatment processes.",
-        pos) {
-        shape.setFillColor(sf::Color(105, 105, 105));
+    //|........||One backward Euler step of h days. Returns false if Newton did not converge even with a
+    //|........||fresh Jacobian; the state is then left unchanged.
+    bool step(double h) {
+        updateConstants();
+        Vector previous = state;
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (attempt > 0 || !jacobianValid || h != factoredStep) buildJacobian(previous, h);
+            Vector y = previous;
+            double ion = hydrogenIon;
+            double lastNorm = HUGE_VAL;
+            for (int iteration = 0; iteration < MAX_NEWTON; ++iteration) {
+                ++newtonIterations;
+                Vector rate, correction;
+                derivatives(y, rate, ion);
+                for (int i = 0; i < STATE_COUNT; ++i) correction[i] = -(y[i] - previous[i] - h * rate[i]);
+                solveFactored(correction);
+                double norm = 0.0;
+                for (int i = 0; i < STATE_COUNT; ++i) {
+                    double next = std::max(0.0, y[i] + correction[i]);   //|........||concentrations stay non-negative
+                    norm = std::max(norm, std::fabs(next - y[i]) / (RELATIVE_TOLERANCE * next + ABSOLUTE_TOLERANCE));
+                    y[i] = next;
+                }
+                if (norm <= 1.0) {
+                    state = y;
+                    finish(ion);
+                    ++steps;
+                    return true;
+                }
+                if (norm > 0.9 * lastNorm) break;   //|........||stale Jacobian: rebuild and retry
+                lastNorm = norm;
+            }
+        }
+        jacobianValid = false;
+        return false;
     }
 
-    void simulate(float deltaTime) override {
-        //|........||Pressure or head increase calculations
-        outletWater = inletWater;
+    //|........||Integrate for the given number of days with steps of at most maxStep. A failed step is
+    //|........||retried in halves; false if a step fails even at 1e-6 days, with the state where it stopped.
+    bool advance(double days, double maxStep) {
+        double remaining = days;
+        double h = maxStep;
+        while (remaining > 1e-12) {
+            double taken = std::min(h, remaining);
+            if (step(taken)) {
+                remaining -= taken;
+                h = maxStep;
+            } else if (taken > 1e-6) {
+                h = taken * 0.5;
+            } else {
+                return false;
+            }
+        }
+        return true;
     }
-};
 
-//|........||Flow Meter: measures the flow rate in the system
-class FlowMeter : public Component {
-public:
-    FlowMeter(const sf::Vector2f& pos) : Component(
-        "Flow Meter",
-        "Monitors the flow rate of water for system control and optimization.",
-        pos) {
-        shape.setFillColor(sf::Color(0, 191, 255));
+    //|........||Steady state by pseudo-transient continuation: backward Euler with a growing step is
+    //|........||Newton on f(x) = 0 in the limit, but stays robust far from the solution. Converged once a step
+    //|........||of at least STEADY_STEP days moves no state by more than 10 relative tolerances, i.e. every rate
+    //|........||is below about 1e-9 of its state per day. False, with the state of the last accepted step, if
+    //|........||that takes more than maxSteps steps or the step has to shrink below 1e-6 days.
+    bool steadyState(int maxSteps = 2000) {
+        double h = 1.0;
+        for (int k = 0; k < maxSteps; ++k) {
+            Vector before = state;
+            if (!step(h)) {
+                h *= 0.25;
+                if (h < 1e-6) return false;
+                continue;
+            }
+            double change = 0.0;
+            for (int i = 0; i < STATE_COUNT; ++i) {
+                change = std::max(change, std::fabs(state[i] - before[i]) / (std::fabs(state[i]) + ABSOLUTE_TOLERANCE * 100.0));
+            }
+            if (change < 10.0 * RELATIVE_TOLERANCE && h >= STEADY_STEP) return true;
+            h = std::min(h * 4.0, 1e5);
+        }
+        return false;
     }
 
-    void simulate(float deltaTime) override {
-        //|........||Flow measurement logic
-        outletWater = inletWater;
+    int jacobianColours() const {
+        return int(sparsity().groups.size());
     }
-};
 
-//|........||Water Softener: removes hardness through ion exchange
-class WaterSoftener : public Component {
-public:
-    WaterSoftener(const sf::Vector2f& pos) : Component(
-        "Water Softener",
-        "Reduces water hardness by exchanging calcium and magnesium ions for sodium ions.",
-        pos) {
-        shape.setFillColor(sf::Color(176, 196, 222));
+    //|........||Nonzeros of the LU factors, fill-in included, out of STATE_COUNT² for a dense factorization
+    int factorNonzeros() const {
+        return sparsity().factorNonzeros;
     }
 
-    void simulate(float deltaTime) override {
-        float hardness_removal = inletWater.getParameter(HARDNESS) * 0.90f;
-        outletWater = inletWater;
-        outletWater.updateParameter(HARDNESS, inletWater.getParameter(HARDNESS) - hardness_removal);
-        //|........||Increase of sodium in water
+    //|........||True if d(rate of row)/d(state of column) can be nonzero
+    static bool coupled(int row, int column) {
+        return sparsity().pattern[row][column];
     }
-};
 
-//|........||Activated Carbon Filter: removes organic compounds and improves taste and odor
-class ActivatedCarbonFilter : public Component {
-public:
-    ActivatedCarbonFilter(const sf::Vector2f& pos) : Component(
-        "Activated Carbon Filter",
-        "Adsorbs organic pollutants, enhancing taste and odor quality.",
-        pos) {
-        shape.setFillColor(sf::Color(47, 79, 79));
+    //|........||Total COD (kg/m³) in the soluble and particulate fractions of the liquid phase
+    double solubleCOD() const {
+        double total = 0.0;
+        for (int i = S_SU; i <= S_I; ++i) {
+            if (i != S_IC && i != S_IN) total += state[i];
+        }
+        return total;
     }
-
-    void simulate(float deltaTime) override {
-        float COD_removal = inletWater.getParameter(COD) * 0.30f;
-        outletWater = inletWater;
-        outletWater.updateParameter(COD, inletWater.getParameter(COD) - COD_removal);
-        //|........||Removal of volatile organic compounds
+    double particulateCOD() const {
+        double total = 0.0;
+        for (int i = X_XC; i <= X_I; ++i) total += state[i];
+        return total;
     }
-};
 
-//|........||Heat Exchanger: adjusts the temperature of the water
-class HeatExchanger : public Component {
-public:
-    HeatExchanger(const sf::Vector2f& pos) : Component(
-        "Heat Exchanger",
-        "Regulates water temperature for optimal treatment conditions.",
-        pos) {
-        shape.setFillColor(sf::Color(250, 128, 114));
+    //|........||Right-hand side. The hydrogen ion concentration is both the starting guess and the result of
+    //|........||the charge balance solve.
+    void derivatives(const Vector& x, Vector& dx, double& ion) {
+        updateConstants();
+        ion = solveCharge(x, ion);
+        const double SH = ion;
+
+        //|........||Inhibition: Hill-type pH functions (smooth, as in BSM2), hydrogen, free ammonia, nitrogen limit
+        double I_pH_aa = KpH_aa_n / (std::pow(SH, nAA) + KpH_aa_n);
+        double I_pH_ac = KpH_ac_n / (std::pow(SH, nAC) + KpH_ac_n);
+        double I_pH_h2 = KpH_h2_n / (std::pow(SH, nH2) + KpH_h2_n);
+        double I_IN_lim = x[S_IN] / (x[S_IN] + K_S_IN);
+        double I_h2_fa = 1.0 / (1.0 + x[S_H2] / K_I_h2_fa);
+        double I_h2_c4 = 1.0 / (1.0 + x[S_H2] / K_I_h2_c4);
+        double I_h2_pro = 1.0 / (1.0 + x[S_H2] / K_I_h2_pro);
+        double S_nh3 = Ka_IN * x[S_IN] / (Ka_IN + SH);
+        double I_nh3 = 1.0 / (1.0 + S_nh3 / K_I_nh3);
+
+        double I5 = I_pH_aa * I_IN_lim;
+        double I7 = I5 * I_h2_fa;
+        double I8 = I5 * I_h2_c4;
+        double I10 = I5 * I_h2_pro;
+        double I11 = I_pH_ac * I_IN_lim * I_nh3;
+        double I12 = I_pH_h2 * I_IN_lim;
+
+        double c4 = x[S_BU] + x[S_VA] + 1e-6;
+        double rho[20];
+        rho[1] = k_dis * x[X_XC];
+        rho[2] = k_hyd_ch * x[X_CH];
+        rho[3] = k_hyd_pr * x[X_PR];
+        rho[4] = k_hyd_li * x[X_LI];
+        rho[5] = k_m_su * x[S_SU] / (K_S_su + x[S_SU]) * x[X_SU] * I5;
+        rho[6] = k_m_aa * x[S_AA] / (K_S_aa + x[S_AA]) * x[X_AA] * I5;
+        rho[7] = k_m_fa * x[S_FA] / (K_S_fa + x[S_FA]) * x[X_FA] * I7;
+        rho[8] = k_m_c4 * x[S_VA] / (K_S_c4 + x[S_VA]) * x[X_C4] * (x[S_VA] / c4) * I8;
+        rho[9] = k_m_c4 * x[S_BU] / (K_S_c4 + x[S_BU]) * x[X_C4] * (x[S_BU] / c4) * I8;
+        rho[10] = k_m_pro * x[S_PRO] / (K_S_pro + x[S_PRO]) * x[X_PRO] * I10;
+        rho[11] = k_m_ac * x[S_AC] / (K_S_ac + x[S_AC]) * x[X_AC] * I11;
+        rho[12] = k_m_h2 * x[S_H2] / (K_S_h2 + x[S_H2]) * x[X_H2] * I12;
+        for (int k = 0; k < 7; ++k) rho[13 + k] = k_dec * x[X_SU + k];
+        double decay = rho[13] + rho[14] + rho[15] + rho[16] + rho[17] + rho[18] + rho[19];
+
+        //|........||Gas transfer and headspace pressure
+        double p_h2 = x[GAS_H2] * RT / 16.0;
+        double p_ch4 = x[GAS_CH4] * RT / 64.0;
+        double p_co2 = x[GAS_CO2] * RT;
+        double S_hco3 = Ka_co2 * x[S_IC] / (Ka_co2 + SH);
+        double S_co2 = x[S_IC] - S_hco3;
+        double transferH2 = kLa * (x[S_H2] - 16.0 * KH_h2 * p_h2);
+        double transferCH4 = kLa * (x[S_CH4] - 64.0 * KH_ch4 * p_ch4);
+        double transferCO2 = kLa * (S_co2 - KH_co2 * p_co2);
+        double P_gas = p_h2 + p_ch4 + p_co2 + p_h2o;
+        double q_gas = std::max(0.0, k_p * liquidVolume * (P_gas - P_ATM) * P_gas / P_ATM);
+
+        const double D = feedFlow / liquidVolume;
+        for (int i = 0; i <= S_AN; ++i) dx[i] = D * (feed[i] - x[i]);
+
+        dx[S_SU] += rho[2] + (1.0 - f_fa_li) * rho[4] - rho[5];
+        dx[S_AA] += rho[3] - rho[6];
+        dx[S_FA] += f_fa_li * rho[4] - rho[7];
+        dx[S_VA] += (1.0 - Y_aa) * f_va_aa * rho[6] - rho[8];
+        dx[S_BU] += (1.0 - Y_su) * f_bu_su * rho[5] + (1.0 - Y_aa) * f_bu_aa * rho[6] - rho[9];
+        dx[S_PRO] += (1.0 - Y_su) * f_pro_su * rho[5] + (1.0 - Y_aa) * f_pro_aa * rho[6]
+            + (1.0 - Y_c4) * 0.54 * rho[8] - rho[10];
+        dx[S_AC] += (1.0 - Y_su) * f_ac_su * rho[5] + (1.0 - Y_aa) * f_ac_aa * rho[6]
+            + (1.0 - Y_fa) * 0.7 * rho[7] + (1.0 - Y_c4) * 0.31 * rho[8] + (1.0 - Y_c4) * 0.8 * rho[9]
+            + (1.0 - Y_pro) * 0.57 * rho[10] - rho[11];
+        dx[S_H2] += (1.0 - Y_su) * f_h2_su * rho[5] + (1.0 - Y_aa) * f_h2_aa * rho[6]
+            + (1.0 - Y_fa) * 0.3 * rho[7] + (1.0 - Y_c4) * 0.15 * rho[8] + (1.0 - Y_c4) * 0.2 * rho[9]
+            + (1.0 - Y_pro) * 0.43 * rho[10] - rho[12] - transferH2;
+        dx[S_CH4] += (1.0 - Y_ac) * rho[11] + (1.0 - Y_h2) * rho[12] - transferCH4;
+        double carbon = 0.0;
+        for (int j = 1; j <= 12; ++j) carbon += carbonYield[j] * rho[j];
+        dx[S_IC] -= carbon + carbonYield[13] * decay + transferCO2;
+        dx[S_IN] += (N_xc - f_xI_xc * N_I - f_sI_xc * N_I - f_pr_xc * N_aa) * rho[1]
+            - Y_su * N_bac * rho[5] + (N_aa - Y_aa * N_bac) * rho[6] - Y_fa * N_bac * rho[7]
+            - Y_c4 * N_bac * (rho[8] + rho[9]) - Y_pro * N_bac * rho[10] - Y_ac * N_bac * rho[11]
+            - Y_h2 * N_bac * rho[12] + (N_bac - N_xc) * decay;
+        dx[S_I] += f_sI_xc * rho[1];
+        dx[X_XC] += -rho[1] + decay;
+        dx[X_CH] += f_ch_xc * rho[1] - rho[2];
+        dx[X_PR] += f_pr_xc * rho[1] - rho[3];
+        dx[X_LI] += f_li_xc * rho[1] - rho[4];
+        dx[X_SU] += Y_su * rho[5] - rho[13];
+        dx[X_AA] += Y_aa * rho[6] - rho[14];
+        dx[X_FA] += Y_fa * rho[7] - rho[15];
+        dx[X_C4] += Y_c4 * (rho[8] + rho[9]) - rho[16];
+        dx[X_PRO] += Y_pro * rho[10] - rho[17];
+        dx[X_AC] += Y_ac * rho[11] - rho[18];
+        dx[X_H2] += Y_h2 * rho[12] - rho[19];
+        dx[X_I] += f_xI_xc * rho[1];
+
+        const double ratio = liquidVolume / gasVolume;
+        dx[GAS_H2] = -x[GAS_H2] * q_gas / gasVolume + transferH2 * ratio;
+        dx[GAS_CH4] = -x[GAS_CH4] * q_gas / gasVolume + transferCH4 * ratio;
+        dx[GAS_CO2] = -x[GAS_CO2] * q_gas / gasVolume + transferCO2 * ratio;
+
+        lastGasFlow = q_gas;
+        lastMethane = P_gas > p_h2o ? p_ch4 / (P_gas - p_h2o) : 0.0;
+        lastBicarbonate = S_hco3;
     }
 
-    void simulate(float deltaTime) override {
-        outletWater = inletWater;
-        outletWater.updateParameter(TEMP, 25.0f); //|........||Sets temperature to 25°C
+private:
+    static constexpr int MAX_NEWTON = 6;
+    static constexpr double STEADY_STEP = 1e4;   //|........||days
+    static constexpr double RELATIVE_TOLERANCE = 1e-6;
+    static constexpr double ABSOLUTE_TOLERANCE = 1e-10;
+    static constexpr double P_ATM = 1.013;       //|........||bar
+    static constexpr double R = 0.083145;        //|........||bar·m³/(kmol·K)
+    static constexpr double T_BASE = 298.15;
+
+    //|........||Stoichiometry (BSM2)
+    static constexpr double f_sI_xc = 0.1, f_xI_xc = 0.2, f_ch_xc = 0.2, f_pr_xc = 0.2, f_li_xc = 0.3;
+    static constexpr double N_xc = 0.0376 / 14.0, N_I = 0.06 / 14.0, N_aa = 0.007, N_bac = 0.08 / 14.0;
+    static constexpr double C_xc = 0.02786, C_sI = 0.03, C_ch = 0.0313, C_pr = 0.03, C_li = 0.022, C_xI = 0.03;
+    static constexpr double C_su = 0.0313, C_aa = 0.03, C_fa = 0.0217, C_va = 0.024, C_bu = 0.025;
+    static constexpr double C_pro = 0.0268, C_ac = 0.0313, C_bac = 0.0313, C_ch4 = 0.0156;
+    static constexpr double f_fa_li = 0.95;
+    static constexpr double f_h2_su = 0.19, f_bu_su = 0.13, f_pro_su = 0.27, f_ac_su = 0.41;
+    static constexpr double f_h2_aa = 0.06, f_va_aa = 0.23, f_bu_aa = 0.26, f_pro_aa = 0.05, f_ac_aa = 0.40;
+    static constexpr double Y_su = 0.1, Y_aa = 0.08, Y_fa = 0.06, Y_c4 = 0.06, Y_pro = 0.04, Y_ac = 0.05, Y_h2 = 0.06;
+
+    //|........||Kinetics (1/day, kg COD/m³)
+    static constexpr double k_dis = 0.5, k_hyd_ch = 10.0, k_hyd_pr = 10.0, k_hyd_li = 10.0;
+    static constexpr double K_S_IN = 1e-4;
+    static constexpr double k_m_su = 30.0, K_S_su = 0.5, k_m_aa = 50.0, K_S_aa = 0.3;
+    static constexpr double k_m_fa = 6.0, K_S_fa = 0.4, K_I_h2_fa = 5e-6;
+    static constexpr double k_m_c4 = 20.0, K_S_c4 = 0.2, K_I_h2_c4 = 1e-5;
+    static constexpr double k_m_pro = 13.0, K_S_pro = 0.1, K_I_h2_pro = 3.5e-6;
+    static constexpr double k_m_ac = 8.0, K_S_ac = 0.15, K_I_nh3 = 0.0018;
+    static constexpr double k_m_h2 = 35.0, K_S_h2 = 7e-6;
+    static constexpr double k_dec = 0.02;
+    static constexpr double pH_LL_aa = 4.0, pH_UL_aa = 5.5, pH_LL_ac = 6.0, pH_UL_ac = 7.0, pH_LL_h2 = 5.0, pH_UL_h2 = 6.0;
+    static constexpr double kLa = 200.0;
+    static constexpr double k_p = 5e4 / 3400.0;   //|........||BSM2 gas outlet friction per m³ of liquid volume
+    static constexpr double Ka_va = 1.3803842646028839e-5;   //|........||10^-4.86
+    static constexpr double Ka_bu = 1.5135612484362071e-5;   //|........||10^-4.82
+    static constexpr double Ka_pro = 1.3182567385564074e-5;  //|........||10^-4.88
+    static constexpr double Ka_ac = 1.7378008287493763e-5;   //|........||10^-4.76
+
+    //|........||Temperature-dependent constants, refreshed when the temperature changes
+    double constantsTemperature = NAN;
+    double RT = 0, Kw = 0, Ka_co2 = 0, Ka_IN = 0, KH_co2 = 0, KH_ch4 = 0, KH_h2 = 0, p_h2o = 0;
+    double nAA = 0, nAC = 0, nH2 = 0, KpH_aa_n = 0, KpH_ac_n = 0, KpH_h2_n = 0;
+    double carbonYield[14] = {};
+
+    double hydrogenIon = 3.5e-8;
+    double lastGasFlow = 0.0, lastMethane = 0.0, lastBicarbonate = 0.0;
+
+    //|........||Modified Newton: M = I - h·J, LU-factored along the structural sparsity of J
+    static constexpr double PIVOT_THRESHOLD = 0.01;
+    bool jacobianValid = false;
+    double factoredStep = 0.0;
+    double matrix[STATE_COUNT][STATE_COUNT];
+    bool denseFactor = false;   //|........||factored by factorDense() instead of along the sparsity
+    int pivots[STATE_COUNT];
+
+    void updateConstants() {
+        if (temperature == constantsTemperature) return;
+        constantsTemperature = temperature;
+        double T = temperature + 273.15;
+        double factor = 1.0 / T_BASE - 1.0 / T;
+        RT = R * T;
+        Kw = 1e-14 * std::exp(55900.0 / (100.0 * R) * factor);
+        Ka_co2 = std::pow(10.0, -6.35) * std::exp(7646.0 / (100.0 * R) * factor);
+        Ka_IN = std::pow(10.0, -9.25) * std::exp(51965.0 / (100.0 * R) * factor);
+        KH_co2 = 0.035 * std::exp(-19410.0 / (100.0 * R) * factor);
+        KH_ch4 = 0.0014 * std::exp(-14240.0 / (100.0 * R) * factor);
+        KH_h2 = 7.8e-4 * std::exp(-4180.0 / (100.0 * R) * factor);
+        p_h2o = 0.0313 * std::exp(5290.0 * factor);
+        nAA = 3.0 / (pH_UL_aa - pH_LL_aa);
+        nAC = 3.0 / (pH_UL_ac - pH_LL_ac);
+        nH2 = 3.0 / (pH_UL_h2 - pH_LL_h2);
+        KpH_aa_n = std::pow(std::pow(10.0, -(pH_LL_aa + pH_UL_aa) / 2.0), nAA);
+        KpH_ac_n = std::pow(std::pow(10.0, -(pH_LL_ac + pH_UL_ac) / 2.0), nAC);
+        KpH_h2_n = std::pow(std::pow(10.0, -(pH_LL_h2 + pH_UL_h2) / 2.0), nH2);
+
+        //|........||Carbon content change of each process (kmol C per kg COD converted)
+        carbonYield[1] = -C_xc + f_sI_xc * C_sI + f_ch_xc * C_ch + f_pr_xc * C_pr + f_li_xc * C_li + f_xI_xc * C_xI;
+        carbonYield[2] = -C_ch + C_su;
+        carbonYield[3] = -C_pr + C_aa;
+        carbonYield[4] = -C_li + (1.0 - f_fa_li) * C_su + f_fa_li * C_fa;
+        carbonYield[5] = -C_su + (1.0 - Y_su) * (f_bu_su * C_bu + f_pro_su * C_pro + f_ac_su * C_ac) + Y_su * C_bac;
+        carbonYield[6] = -C_aa + (1.0 - Y_aa) * (f_va_aa * C_va + f_bu_aa * C_bu + f_pro_aa * C_pro + f_ac_aa * C_ac)
+            + Y_aa * C_bac;
+        carbonYield[7] = -C_fa + (1.0 - Y_fa) * 0.7 * C_ac + Y_fa * C_bac;
+        carbonYield[8] = -C_va + (1.0 - Y_c4) * 0.54 * C_pro + (1.0 - Y_c4) * 0.31 * C_ac + Y_c4 * C_bac;
+        carbonYield[9] = -C_bu + (1.0 - Y_c4) * 0.8 * C_ac + Y_c4 * C_bac;
+        carbonYield[10] = -C_pro + (1.0 - Y_pro) * 0.57 * C_ac + Y_pro * C_bac;
+        carbonYield[11] = -C_ac + (1.0 - Y_ac) * C_ch4 + Y_ac * C_bac;
+        carbonYield[12] = (1.0 - Y_h2) * C_ch4 + Y_h2 * C_bac;
+        carbonYield[13] = -C_bac + C_xc;
+        jacobianValid = false;
     }
-};
 
-//|........||Heavy Metals Removal Unit: removes heavy metals through adsorption or precipitation
-class MetalsRemovalUnit : public Component {
-public:
-    MetalsRemovalUnit(const sf::Vector2f& pos) : Component(
-        "Metals Removal Unit",
-        "Eliminates heavy metals to prevent toxicity in the environment.",
-        pos) {
-        shape.setFillColor(sf::Color(112, 128, 144));
+    //|........||Charge balance in the unknown S_H+. Every term grows with S_H+, so the root is unique; Newton
+    //|........||runs on ln(S_H+) from the previous value and usually needs two or three iterations.
+    double solveCharge(const Vector& x, double guess) const {
+        double u = std::log(std::min(std::max(guess, 1e-14), 1e-1));
+        for (int iteration = 0; iteration < 50; ++iteration) {
+            double SH = std::exp(u);
+            double nh3 = Ka_IN + SH, co2 = Ka_co2 + SH;
+            double ac = Ka_ac + SH, pro = Ka_pro + SH, bu = Ka_bu + SH, va = Ka_va + SH;
+            double balance = x[S_CAT] + x[S_IN] * SH / nh3 + SH
+                - Ka_co2 * x[S_IC] / co2
+                - Ka_ac * x[S_AC] / ac / 64.0 - Ka_pro * x[S_PRO] / pro / 112.0
+                - Ka_bu * x[S_BU] / bu / 160.0 - Ka_va * x[S_VA] / va / 208.0
+                - Kw / SH - x[S_AN];
+            double slope = x[S_IN] * Ka_IN / (nh3 * nh3) + 1.0
+                + Ka_co2 * x[S_IC] / (co2 * co2)
+                + Ka_ac * x[S_AC] / (ac * ac) / 64.0 + Ka_pro * x[S_PRO] / (pro * pro) / 112.0
+                + Ka_bu * x[S_BU] / (bu * bu) / 160.0 + Ka_va * x[S_VA] / (va * va) / 208.0
+                + Kw / (SH * SH);
+            double du = -balance / (slope * SH);
+            du = std::max(-2.0, std::min(2.0, du));
+            u += du;
+            if (std::fabs(du) < 1e-12) break;
+        }
+        return std::exp(u);
     }
 
-    void simulate(float deltaTime) override {
-        float metals_removal = inletWater.getParameter(METALS) * 0.85f;
-        outletWater = inletWater;
-        outletWater.updateParameter(METALS, inletWater.getParameter(METALS) - metals_removal);
-        //|........||Handling of metal-laden sludge
+    void finish(double ion) {
+        Vector rate;
+        hydrogenIon = ion;
+        derivatives(state, rate, hydrogenIon);
+        pH = -std::log10(hydrogenIon);
+        gasFlow = lastGasFlow;
+        methaneFraction = lastMethane;
+        bicarbonate = lastBicarbonate;
     }
-};
 
-//|........||Membrane Filtration Unit: employs membranes to remove fine particles and microbes
-class MembraneFiltrationUnit : public Component {
-public:
-    MembraneFiltrationUnit(const sf::Vector2f& pos) : Component(
-        "Membrane Filtration Unit",
-        "Uses microfiltration or ultrafiltration membranes for fine particle removal.",
+    //|........||Sparsity of df/dx, taken from the structure of derivatives(): each process rate reads some states
+    //|........||and writes the derivatives of others. Rates with pH inhibition (and CO2 transfer, through the
+    //|........||bicarbonate fraction) also read every state of the charge balance, since S_H+ is solved from them.
+    //|........||Dilution puts each state on the diagonal. From the pattern come a greedy colouring of the columns
+    //|........||for the finite-difference Jacobian and a static pivot order, chosen by minimum Markowitz cost
+    //|........||(rows × columns left in the pivot's row and column), with the fill-in it creates.
+    struct Sparsity {
+        bool pattern[STATE_COUNT][STATE_COUNT] = {};
+        std::vector<std::vector<int>> groups;   //|........||columns perturbed together
+        std::vector<std::vector<int>> rows;     //|........||nonzero rows of each column
+        int order[STATE_COUNT];                 //|........||pivot sequence
+        std::vector<std::vector<int>> lower;    //|........||for each pivot, the rows of L below it
+        std::vector<std::vector<int>> upper;    //|........||for each pivot, the columns of U right of it
+        int factorNonzeros = STATE_COUNT;
+    };
+
+    struct Process {
+        bool readsCharge;
+        std::vector<int> reads;
+        std::vector<int> writes;
+    };
+
+    static const Sparsity& sparsity() {
+        static const Sparsity shared = [] {
+            std::vector<Process> processes = {
+                {false, {X_XC}, {X_XC, X_CH, X_PR, X_LI, X_I, S_I, S_IN, S_IC}},   //|........||disintegration
+                {false, {X_CH}, {X_CH, S_SU, S_IC}},                              //|........||hydrolysis
+                {false, {X_PR}, {X_PR, S_AA, S_IC}},
+                {false, {X_LI}, {X_LI, S_SU, S_FA, S_IC}},
+                {true, {S_SU, X_SU, S_IN}, {S_SU, S_BU, S_PRO, S_AC, S_H2, S_IN, S_IC, X_SU}},   //|........||uptake
+                {true, {S_AA, X_AA, S_IN}, {S_AA, S_VA, S_BU, S_PRO, S_AC, S_H2, S_IN, S_IC, X_AA}},
+                {true, {S_FA, X_FA, S_IN, S_H2}, {S_FA, S_AC, S_H2, S_IN, S_IC, X_FA}},
+                {true, {S_VA, S_BU, X_C4, S_IN, S_H2}, {S_VA, S_PRO, S_AC, S_H2, S_IN, S_IC, X_C4}},
+                {true, {S_BU, S_VA, X_C4, S_IN, S_H2}, {S_BU, S_AC, S_H2, S_IN, S_IC, X_C4}},
+                {true, {S_PRO, X_PRO, S_IN, S_H2}, {S_PRO, S_AC, S_H2, S_IN, S_IC, X_PRO}},
+                {true, {S_AC, X_AC, S_IN}, {S_AC, S_CH4, S_IN, S_IC, X_AC}},
+                {true, {S_H2, X_H2, S_IN}, {S_H2, S_CH4, S_IN, S_IC, X_H2}},
+                {false, {S_H2, GAS_H2}, {S_H2, GAS_H2}},                          //|........||gas transfer
+                {false, {S_CH4, GAS_CH4}, {S_CH4, GAS_CH4}},
+                {true, {S_IC, GAS_CO2}, {S_IC, GAS_CO2}},
+                {false, {GAS_H2, GAS_CH4, GAS_CO2}, {GAS_H2, GAS_CH4, GAS_CO2}},  //|........||headspace outflow
+            };
+            for (int k = X_SU; k <= X_H2; ++k) processes.push_back({false, {k}, {k, X_XC, S_IN, S_IC}});   //|........||decay
+            static const int charge[] = {S_CAT, S_AN, S_IN, S_IC, S_AC, S_PRO, S_BU, S_VA};
+
+            Sparsity result;
+            for (int i = 0; i < STATE_COUNT; ++i) result.pattern[i][i] = true;
+            for (const Process& process : processes) {
+                for (int i : process.writes) {
+                    for (int j : process.reads) result.pattern[i][j] = true;
+                    if (process.readsCharge) {
+                        for (int j : charge) result.pattern[i][j] = true;
+                    }
+                }
+            }
+
+            result.rows.resize(STATE_COUNT);
+            for (int j = 0; j < STATE_COUNT; ++j) {
+                for (int i = 0; i < STATE_COUNT; ++i) {
+                    if (result.pattern[i][j]) result.rows[j].push_back(i);
+                }
+            }
+            std::vector<int> colourOf(STATE_COUNT, -1);
+            for (int j = 0; j < STATE_COUNT; ++j) {
+                for (int c = 0;; ++c) {
+                    bool clash = false;
+                    for (int k = 0; k < j && !clash; ++k) {
+                        if (colourOf[k] != c) continue;
+                        for (int i = 0; i < STATE_COUNT; ++i) {
+                            if (result.pattern[i][j] && result.pattern[i][k]) { clash = true; break; }
+                        }
+                    }
+                    if (!clash) { colourOf[j] = c; break; }
+                }
+                if (colourOf[j] >= (int)result.groups.size()) result.groups.resize(colourOf[j] + 1);
+                result.groups[colourOf[j]].push_back(j);
+            }
+
+            bool filled[STATE_COUNT][STATE_COUNT];
+            std::copy(&result.pattern[0][0], &result.pattern[0][0] + STATE_COUNT * STATE_COUNT, &filled[0][0]);
+            bool done[STATE_COUNT] = {};
+            result.lower.resize(STATE_COUNT);
+            result.upper.resize(STATE_COUNT);
+            for (int p = 0; p < STATE_COUNT; ++p) {
+                int best = -1;
+                int bestCost = 0;
+                for (int k = 0; k < STATE_COUNT; ++k) {
+                    if (done[k]) continue;
+                    int inRow = 0, inColumn = 0;
+                    for (int i = 0; i < STATE_COUNT; ++i) {
+                        if (done[i] || i == k) continue;
+                        inRow += filled[k][i];
+                        inColumn += filled[i][k];
+                    }
+                    if (best < 0 || inRow * inColumn < bestCost) {
+                        best = k;
+                        bestCost = inRow * inColumn;
+                    }
+                }
+                result.order[p] = best;
+                done[best] = true;
+                for (int i = 0; i < STATE_COUNT; ++i) {
+                    if (done[i]) continue;
+                    if (filled[i][best]) result.lower[p].push_back(i);
+                    if (filled[best][i]) result.upper[p].push_back(i);
+                }
+                for (int i : result.lower[p]) {
+                    for (int j : result.upper[p]) filled[i][j] = true;
+                }
+                result.factorNonzeros += int(result.lower[p].size() + result.upper[p].size());
+            }
+            return result;
+        }();
+        return shared;
+    }
+
+    void buildJacobian(const Vector& x, double h) {
+        ++jacobianBuilds;
+        const Sparsity& structure = sparsity();
+        Vector base, rate;
+        double ion = hydrogenIon;
+        derivatives(x, base, ion);
+        for (int i = 0; i < STATE_COUNT; ++i) {
+            for (int j = 0; j < STATE_COUNT; ++j) matrix[i][j] = i == j ? 1.0 : 0.0;
+        }
+        for (const std::vector<int>& group : structure.groups) {
+            Vector perturbed = x;
+            double delta[STATE_COUNT];
+            for (int j : group) {
+                delta[j] = 1e-7 * std::max(std::fabs(x[j]), 1e-6);
+                perturbed[j] += delta[j];
+            }
+            double perturbedIon = ion;
+            derivatives(perturbed, rate, perturbedIon);
+            for (int j : group) {
+                for (int i : structure.rows[j]) matrix[i][j] -= h * (rate[i] - base[i]) / delta[j];
+            }
+        }
+        factor();
+        factoredStep = h;
+        jacobianValid = true;
+    }
+
+    //|........||LU along the sparsity, pivoting on the diagonal in the static order. A pivot below a hundredth of
+    //|........||the largest entry under it could grow the rows it updates without bound; the matrix then goes
+    //|........||through the dense factorization with partial pivoting instead. A pivot row with nothing right of
+    //|........||it (S_CAT and S_AN only dilute) updates nothing, so any nonzero pivot is stable there.
+    void factor() {
+        const Sparsity& structure = sparsity();
+        double unfactored[STATE_COUNT][STATE_COUNT];
+        std::copy(&matrix[0][0], &matrix[0][0] + STATE_COUNT * STATE_COUNT, &unfactored[0][0]);
+        denseFactor = false;
+        for (int p = 0; p < STATE_COUNT; ++p) {
+            int k = structure.order[p];
+            double diagonal = matrix[k][k];
+            double largest = 0.0;
+            for (int i : structure.lower[p]) largest = std::max(largest, std::fabs(matrix[i][k]));
+            bool updates = !structure.upper[p].empty();
+            if (diagonal == 0.0 || (updates && std::fabs(diagonal) < PIVOT_THRESHOLD * largest)) {
+                std::copy(&unfactored[0][0], &unfactored[0][0] + STATE_COUNT * STATE_COUNT, &matrix[0][0]);
+                denseFactor = true;
+                ++denseFactorizations;
+                factorDense();
+                return;
+            }
+            for (int i : structure.lower[p]) {
+                double m = matrix[i][k] / diagonal;
+                matrix[i][k] = m;
+                if (m == 0.0) continue;
+                for (int j : structure.upper[p]) matrix[i][j] -= m * matrix[k][j];
+            }
+        }
+    }
+
+    void solveFactored(Vector& b) const {
+        if (denseFactor) {
+            solveDense(b);
+            return;
+        }
+        const Sparsity& structure = sparsity();
+        for (int p = 0; p < STATE_COUNT; ++p) {
+            int k = structure.order[p];
+            for (int i : structure.lower[p]) b[i] -= matrix[i][k] * b[k];
+        }
+        for (int p = STATE_COUNT - 1; p >= 0; --p) {
+            int k = structure.order[p];
+            for (int j : structure.upper[p]) b[k] -= matrix[k][j] * b[j];
+            b[k] /= matrix[k][k];
+        }
+    }
+
+    void factorDense() {
+        for (int k = 0; k < STATE_COUNT; ++k) {
+            int best = k;
+            for (int i = k + 1; i < STATE_COUNT; ++i) {
+                if (std::fabs(matrix[i][k]) > std::fabs(matrix[best][k])) best = i;
+            }
+            pivots[k] = best;
+            if (best != k) {
+                for (int j = 0; j < STATE_COUNT; ++j) std::swap(matrix[k][j], matrix[best][j]);
+            }
+            double diagonal = matrix[k][k];
+            if (diagonal == 0.0) continue;
+            for (int i = k + 1; i < STATE_COUNT; ++i) {
+                double m = matrix[i][k] / diagonal;
+                matrix[i][k] = m;
+                if (m == 0.0) continue;
+                for (int j = k + 1; j < STATE_COUNT; ++j) matrix[i][j] -= m * matrix[k][j];
+            }
+        }
+    }
+
+    void solveDense(Vector& b) const {
+        for (int k = 0; k < STATE_COUNT; ++k) std::swap(b[k], b[pivots[k]]);
+        for (int k = 0; k < STATE_COUNT; ++k) {
+            for (int i = k + 1; i < STATE_COUNT; ++i) b[i] -= matrix[i][k] * b[k];
+        }
+        for (int k = STATE_COUNT - 1; k >= 0; --k) {
+            for (int j = k + 1; j < STATE_COUNT; ++j) b[k] -= matrix[k][j] * b[j];
+            if (matrix[k][k] != 0.0) b[k] /= matrix[k][k];
+        }
+    }
+};
+
+//|........||Sludge Digester: stabilizes sludge through anaerobic digestion
+class SludgeDigester : public Component {
+public:
+    SludgeDigester(const sf::Vector2f& pos) : Component(
+        "Sludge Digester",
+        "Reduces sludge volume and stabilizes organic content anaerobically.",
         pos) {
-        shape.setFillColor(sf::Color(72, 61, 139));
+        shape.setFillColor(sf::Color(165, 42, 42));
+        temperature = 35.0f;
+    }
+
+    float volatileFraction = 0.7f;   //|........||VS/TS of the feed
+    float cationFeed = 0.04f;        //|........||kmol/m³ of strong cations in the feed
+    float anionFeed = 0.02f;         //|........||kmol/m³ of strong anions in the feed
+    float solverStep = 900.0f;       //|........||simulated seconds per implicit step in dynamic mode
+    float methaneFraction = 0.0f;    //|........||dry biogas
+    float biogasFlow = 0.0f;         //|........||m³/day
+    bool converged = true;           //|........||false if the last steady solve or dynamic step failed
+    ADM1 model;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"volatileFraction", &volatileFraction, 0.0f, 1.0f});
+        refs.push_back({"cationFeed", &cationFeed, 0.0f, 1.0f});
+        refs.push_back({"anionFeed", &anionFeed, 0.0f, 1.0f});
+    }
+
+    void responseSlots(std::vector<float*>& slots) override {
+        Component::responseSlots(slots);
+        slots.push_back(&biogasFlow);
+        slots.push_back(&methaneFraction);
+    }
+
+    void saveState() override {
+        savedModel = model;
+        savedSolved = solved;
+        savedConverged = converged;
+        savedSolvedConverged = solvedConverged;
+        savedFeed = solvedFeed;
+        savedConditions = solvedConditions;
+    }
+
+    void restoreState() override {
+        model = savedModel;
+        solved = savedSolved;
+        converged = savedConverged;
+        solvedConverged = savedSolvedConverged;
+        solvedFeed = savedFeed;
+        solvedConditions = savedConditions;
+    }
+
+    const char* solverError() const override {
+        return converged ? nullptr : "ADM1 did not converge";
+    }
+
+    void beginLoopSolve() override {
+        inLoopSolve = true;
+        warmStart = false;
+    }
+
+    void endLoopSolve() override {
+        inLoopSolve = false;
+    }
+
+    StreamKind outputKind(size_t) const override {
+        return SLUDGE_STREAM;
+    }
+
+    //|........||The feed is mapped onto ADM1 inputs: volatile solids become composite particulates
+    //|........||(1.42 kg COD/kg VSS), the dissolved COD becomes sugars, ammonium and alkalinity the inorganic
+    //|........||nitrogen and carbon. Steady state solves the digester to equilibrium; dynamic mode steps it
+    //|........||every `solverStep` of simulated time and holds the outlet in between.
+    void simulate(float deltaTime) override {
+        outletWater = inletWater;
+        converged = true;
+        if (inletWater.flow <= 0.0f || volume <= 0.0f) {
+            biogasFlow = 0.0f;
+            return;
+        }
+        loadFeed();
+        if (deltaTime <= 0.0f) {
+            //|........||A sweep that reaches the digester with the same feed reuses the last equilibrium. Any
+            //|........||other feed is solved from the BSM2 state: ADM1 can have more than one stable equilibrium
+            //|........||(a working and a soured digester), and a warm start would pick one by what ran before.
+            //|........||Only the later sweeps of one recycle-loop solve start from the previous answer.
+            if (!solved || model.feed != solvedFeed || model.feedFlow != solvedConditions[0]
+                || model.liquidVolume != solvedConditions[1] || model.temperature != solvedConditions[2]) {
+                bool warm = inLoopSolve && warmStart;
+                if (!warm) model.coldStart();
+                solvedConverged = model.steadyState();
+                if (!solvedConverged && warm) {
+                    model.coldStart();
+                    solvedConverged = model.steadyState();
+                }
+                warmStart = inLoopSolve && solvedConverged;
+                solved = true;
+                solvedFeed = model.feed;
+                solvedConditions = {model.feedFlow, model.liquidVolume, model.temperature};
+            }
+            converged = solvedConverged;
+            pendingTime = 0.0;
+        } else {
+            solved = false;
+            pendingTime += deltaTime;
+            double stepDays = std::max(solverStep, 1.0f) / 86400.0;
+            while (pendingTime >= solverStep) {
+                converged = model.advance(stepDays, stepDays) && converged;
+                pendingTime -= std::max(solverStep, 1.0f);
+            }
+        }
+
+        double fed = model.feed[ADM1::S_SU] + model.feed[ADM1::X_XC];
+        double left = model.solubleCOD() + model.particulateCOD();
+        float fixedSolids = (1.0f - volatileFraction) * inletWater.getParameter(TSS);
+        outletWater.updateParameter(TSS, float(model.particulateCOD() / 1.42 * 1000.0) + fixedSolids);
+        float remaining = fed > 0.0 ? float(left / fed) : 1.0f;
+        outletWater.updateParameter(COD, inletWater.getParameter(COD) * remaining);
+        outletWater.updateParameter(BOD, inletWater.getParameter(BOD) * remaining);
+        outletWater.updateParameter(NH4, float(model.state[ADM1::S_IN] * 14000.0));
+        outletWater.updateParameter(ALKALINITY, float(model.bicarbonate * 50000.0));   //|........||mg/L as CaCO3
+        outletWater.updateParameter(PH, float(model.pH));
+        outletWater.updateParameter(TEMP, temperature);
+        //|........||Further pathogen reduction
+        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) * 0.1f);
+        biogasFlow = float(model.gasFlow);
+        methaneFraction = float(model.methaneFraction);
+    }
+
+    //|........||Back to the BSM2 reference state, e.g. when the plant changes mode
+    void restart() {
+        model.reset();
+        pendingTime = 0.0;
+        solved = false;
+        converged = true;
+    }
+
+private:
+    double pendingTime = 0.0;
+    bool solved = false;
+    bool solvedConverged = true;
+    bool inLoopSolve = false;
+    bool warmStart = false;   //|........||the model holds a converged equilibrium of this loop solve
+    ADM1::Vector solvedFeed;
+    std::array<double, 3> solvedConditions;
+    ADM1 savedModel;
+    ADM1::Vector savedFeed;
+    std::array<double, 3> savedConditions;
+    bool savedSolved = false;
+    bool savedConverged = true;
+    bool savedSolvedConverged = true;
+
+    void loadFeed() {
+        model.feed.fill(0.0);
+        model.feed[ADM1::X_XC] = 1.42 * volatileFraction * inletWater.getParameter(TSS) / 1000.0;
+        model.feed[ADM1::S_SU] = inletWater.getParameter(COD) * (1.0f - PARTICULATE_FRACTION[COD]) / 1000.0;
+        model.feed[ADM1::S_IN] = inletWater.getParameter(NH4) / 14000.0;
+        model.feed[ADM1::S_IC] = inletWater.getParameter(ALKALINITY) / 50000.0;
+        model.feed[ADM1::S_CAT] = cationFeed;
+        model.feed[ADM1::S_AN] = anionFeed;
+        model.feedFlow = inletWater.flow;
+        model.liquidVolume = volume;
+        model.gasVolume = 0.1 * volume;
+        model.temperature = temperature;
+    }
+};
+
+//|........||Oil and Grease Separator: removes oils and greases through flotation
+class OilSeparator : public Kinetic<OilSeparator> {
+public:
+    OilSeparator(const sf::Vector2f& pos) : Kinetic(
+        "Oil and Grease Separator",
+        "Separates oils and greases from water by flotation mechanisms.",
+        pos) {
+        shape.setFillColor(sf::Color(255, 160, 122));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T oil_removal = in.getParameter(OIL) * T(0.90);
+        out = in;
+        out.updateParameter(OIL, in.getParameter(OIL) - oil_removal);
+        out.updateParameter(TURBIDITY, in.getParameter(TURBIDITY) * T(0.9));
+    }
+};
+
+//|........||Phosphorus Removal Unit: chemical precipitation to remove phosphorus
+class PhosphorusRemovalUnit : public Kinetic<PhosphorusRemovalUnit> {
+public:
+    PhosphorusRemovalUnit(const sf::Vector2f& pos) : Kinetic(
+        "Phosphorus Removal Unit",
+        "Eliminates phosphorus via chemical precipitation methods.",
+        pos) {
+        shape.setFillColor(sf::Color(138, 43, 226));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T P_removal = in.getParameter(P) * T(0.75);
+        out = in;
+        out.updateParameter(P, in.getParameter(P) - P_removal);
+        out.updateParameter(TSS, in.getParameter(TSS) + P_removal * 2); //|........||Precipitate formation
+    }
+};
+
+//|........||Drying Bed: removes moisture from sludge for final disposal
+class DryingBed : public Component {
+public:
+    DryingBed(const sf::Vector2f& pos) : Component(
+        "Drying Bed",
+        "Allows for dewatering of sludge through evaporation and drainage.",
+        pos) {
+        shape.setFillColor(sf::Color(222, 184, 135));
+    }
+
+    float cakeSolids = 200000.0f;  //|........||mg/L of TSS in the cake (20 % dry solids)
+    float capture = 0.9f;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"cakeSolids", &cakeSolids, 1.0f, 1e6f});
+        refs.push_back({"capture", &capture, 0.0f, 1.0f});
+    }
+    Water filtrate;
+
+    //|........||Output 0 is the cake, output 1 the drained water, returned to the headworks
+    const Water& outletFor(size_t output) const override {
+        return output == 1 ? filtrate : outletWater;
+    }
+
+    StreamKind outputKind(size_t output) const override {
+        return output == 1 ? REJECT_STREAM : SLUDGE_STREAM;
+    }
+
+    void simulate(float deltaTime) override {
+        float cakeFlow = capture * inletWater.flow * inletWater.getParameter(TSS) / std::max(cakeSolids, 1.0f);
+        separateSolids(inletWater, capture, cakeFlow, outletWater, filtrate);
+    }
+};
+
+//|........||Gravity Thickener: concentrates wasted sludge before digestion.
+//|........||Output 0 is the thickened sludge, output 1 the supernatant, returned to the headworks.
+class Thickener : public Component {
+public:
+    float targetSolids = 40000.0f; //|........||mg/L of TSS in the underflow (4 % solids)
+    float capture = 0.95f;
+
+    void parameters(std::vector<ParameterRef>& refs) override {
+        Component::parameters(refs);
+        refs.push_back({"targetSolids", &targetSolids, 1.0f, 1e6f});
+        refs.push_back({"capture", &capture, 0.0f, 1.0f});
+    }
+    Water supernatant;
+
+    Thickener(const sf::Vector2f& pos) : Component(
+        "Thickener",
+        "Concentrates sludge by gravity settling; the supernatant goes back to the headworks.",
+        pos) {
+        shape.setFillColor(sf::Color(160, 120, 80));
+    }
+
+    const Water& outletFor(size_t output) const override {
+        return output == 1 ? supernatant : outletWater;
+    }
+
+    StreamKind outputKind(size_t output) const override {
+        return output == 1 ? REJECT_STREAM : SLUDGE_STREAM;
+    }
+
+    void simulate(float) override {
+        float thickenedFlow = capture * inletWater.flow * inletWater.getParameter(TSS) / std::max(targetSolids, 1.0f);
+        separateSolids(inletWater, capture, thickenedFlow, outletWater, supernatant);
+    }
+};
+
+//|........||Pump: increases fluid energy to move it through the system. The plant sets the flow; the pump
+//|........||has to supply the static lift plus the friction in its discharge line. Head and efficiency curves
+//|........||are given at rated speed and moved to the VFD speed with the affinity laws.
+class Pump : public Component {
+public:
+    std::vector<float> curveFlow = {0.0f, 100.0f, 200.0f, 300.0f, 400.0f, 500.0f};   //|........||m³/h, rated speed
+    std::vector<float> curveHead = {32.0f, 31.0f, 29.0f, 26.0f, 21.5f, 15.0f};       //|........||m
+    std::vector<float> curveEfficiency = {0.0f, 0.45f, 0.65f, 0.75f, 0.74f, 0.62f};
+    float staticHead = 8.0f;        //|........||m of lift
+    bool speedControl = true;       //|........||VFD trims the speed to the head required, else `speed` is fixed
+    float speed = 1.0f;             //|........||Fraction of rated speed
+    float minSpeed = 0.3f;
+    float maxSpeed = 1.0f;
+    float motorEfficiency = 0.93f;
+    float driveEfficiency = 0.97f;
+
+    float head = 0.0f;              //|........||m delivered at the operating point
+    float requiredHead = 0.0f;      //|........||m, static lift plus discharge losses
+    float efficiency = 0.0f;
+    EnergyMeter meter;              //|........||Wire-to-water
+
+    Pump(const sf::Vector2f& pos) : Component(
+        "Pump",
+        "Boosts water pressure to facilitate flow through the treatment processes.",
+        pos) {
+        shape.setFillColor(sf::Color(105, 105, 105));
+    }
+
+    EnergyMeter* energyMeter() override {
+        return &meter;
+    }
+
+    //|........||Call after editing the curve points
+    void invalidateCurves() {
+        headTable = CurveTable();
+        markDirty();
     }
 
     void simulate(float deltaTime) override {
-        float pathogens_removal = inletWater.getParameter(PATHOGENS) * 0.9999f;
-        float TSS_removal = inletWater.getParameter(TSS) * 0.99f;
         outletWater = inletWater;
-        outletWater.updateParameter(PATHOGENS, inletWater.getParameter(PATHOGENS) - pathogens_removal);
-        outletWater.updateParameter(TSS, inletWater.getParameter(TSS) - TSS_removal);
+        if (headTable.empty()) {
+            headTable.build(curveFlow, curveHead);
+            efficiencyTable.build(curveFlow, curveEfficiency);
+            if (headTable.empty()) return;
+        }
+
+        float flow = inletWater.flow / 24.0f; //|........||m³/h
+        requiredHead = staticHead + dischargeLosses(inletWater.flow);
+        if (speedControl) speed = speedFor(flow, requiredHead);
+        head = headAt(flow, speed);
+        efficiency = std::max(efficiencyTable(flow / std::max(speed, 1e-3f)), 0.05f);
+
+        float hydraulic = 9.81f * (flow / 3600.0f) * head; //|........||kW, rho g Q H
+        meter.record(hydraulic / (efficiency * motorEfficiency * driveEfficiency), inletWater.flow, deltaTime);
+    }
+
+    //|........||Defined after Connection: friction in the pipes from this pump to the next pump or the outlet
+    float dischargeLosses(float flow) const;
+
+private:
+    CurveTable headTable;
+    CurveTable efficiencyTable;
+
+    float headAt(float flow, float n) const {
+        n = std::max(n, 1e-3f);
+        return n * n * headTable(flow / n);
+    }
+
+    //|........||n² H(Q/n) grows with n for a falling curve, so the speed is bracketed and found by
+    //|........||regula falsi (Illinois variant), a handful of table lookups
+    float speedFor(float flow, float target) const {
+        float low = minSpeed;
+        float high = maxSpeed;
+        float lowError = headAt(flow, low) - target;
+        float highError = headAt(flow, high) - target;
+        if (highError <= 0.0f) return high;
+        if (lowError >= 0.0f) return low;
+        int side = 0;
+        for (int i = 0; i < 30 && high - low > 1e-4f; ++i) {
+            float n = (low * highError - high * lowError) / (highError - lowError);
+            float error = headAt(flow, n) - target;
+            if (std::fabs(error) < 1e-4f) return n;
+            if (error < 0.0f) {
+                low = n;
+                lowError = error;
+                if (side == -1) highError *= 0.5f;
+                side = -1;
+            } else {
+                high = n;
+                highError = error;
+                if (side == 1) lowError *= 0.5f;
+                side = 1;
+            }
+        }
+        return high;
+    }
+};
+
+//|........||Flow Meter: measures the flow rate in the system
+class FlowMeter : public Kinetic<FlowMeter> {
+public:
+    FlowMeter(const sf::Vector2f& pos) : Kinetic(
+        "Flow Meter",
+        "Monitors the flow rate of water for system control and optimization.",
+        pos) {
+        shape.setFillColor(sf::Color(0, 191, 255));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        //|........||Flow measurement logic
+        out = in;
+    }
+};
+
+//|........||Water Softener: removes hardness through ion exchange
+class WaterSoftener : public Kinetic<WaterSoftener> {
+public:
+    WaterSoftener(const sf::Vector2f& pos) : Kinetic(
+        "Water Softener",
+        "Reduces water hardness by exchanging calcium and magnesium ions for sodium ions.",
+        pos) {
+        shape.setFillColor(sf::Color(176, 196, 222));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T hardness_removal = in.getParameter(HARDNESS) * T(0.90);
+        out = in;
+        out.updateParameter(HARDNESS, in.getParameter(HARDNESS) - hardness_removal);
+        //|........||Increase of sodium in water
+    }
+};
+
+//|........||Activated Carbon Filter: removes organic compounds and improves taste and odor
+class ActivatedCarbonFilter : public Kinetic<ActivatedCarbonFilter> {
+public:
+    ActivatedCarbonFilter(const sf::Vector2f& pos) : Kinetic(
+        "Activated Carbon Filter",
+        "Adsorbs organic pollutants, enhancing taste and odor quality.",
+        pos) {
+        shape.setFillColor(sf::Color(47, 79, 79));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T COD_removal = in.getParameter(COD) * T(0.30);
+        out = in;
+        out.updateParameter(COD, in.getParameter(COD) - COD_removal);
+        //|........||Removal of volatile organic compounds
+    }
+};
+
+//|........||Heat Exchanger: adjusts the temperature of the water
+class HeatExchanger : public Kinetic<HeatExchanger> {
+public:
+    HeatExchanger(const sf::Vector2f& pos) : Kinetic(
+        "Heat Exchanger",
+        "Regulates water temperature for optimal treatment conditions.",
+        pos) {
+        shape.setFillColor(sf::Color(250, 128, 114));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        out = in;
+        out.updateParameter(TEMP, T(25.0)); //|........||Sets temperature to 25°C
+    }
+};
+
+//|........||Heavy Metals Removal Unit: removes heavy metals through adsorption or precipitation
+class MetalsRemovalUnit : public Kinetic<MetalsRemovalUnit> {
+public:
+    MetalsRemovalUnit(const sf::Vector2f& pos) : Kinetic(
+        "Metals Removal Unit",
+        "Eliminates heavy metals to prevent toxicity in the environment.",
+        pos) {
+        shape.setFillColor(sf::Color(112, 128, 144));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T metals_removal = in.getParameter(METALS) * T(0.85);
+        out = in;
+        out.updateParameter(METALS, in.getParameter(METALS) - metals_removal);
+        //|........||Handling of metal-laden sludge
+    }
+};
+
+//|........||Membrane Filtration Unit: employs membranes to remove fine particles and microbes
+class MembraneFiltrationUnit : public Kinetic<MembraneFiltrationUnit> {
+public:
+    MembraneFiltrationUnit(const sf::Vector2f& pos) : Kinetic(
+        "Membrane Filtration Unit",
+        "Uses microfiltration or ultrafiltration membranes for fine particle removal.",
+        pos) {
+        shape.setFillColor(sf::Color(72, 61, 139));
+    }
+
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T pathogens_removal = in.getParameter(PATHOGENS) * T(0.9999);
+        T TSS_removal = in.getParameter(TSS) * T(0.99);
+        out = in;
+        out.updateParameter(PATHOGENS, in.getParameter(PATHOGENS) - pathogens_removal);
+        out.updateParameter(TSS, in.getParameter(TSS) - TSS_removal);
     }
 };
 
 //|........||Reverse Osmosis Unit: removes dissolved salts and small molecules
-class ReverseOsmosisUnit : public Component {
+class ReverseOsmosisUnit : public Kinetic<ReverseOsmosisUnit> {
 public:
-    ReverseOsmosisUnit(const sf::Vector2f& pos) : Component(
+    ReverseOsmosisUnit(const sf::Vector2f& pos) : Kinetic(
         "Reverse Osmosis Unit",
         "Employs semi-permeable membranes to desalinate and purify water.",
         pos) {
         shape.setFillColor(sf::Color(60, 179, 113));
     }
 
-    void simulate(float deltaTime) override {
-        float salinity_removal = inletWater.getParameter(SALINITY) * 0.95f;
+    template <typename W, typename Values>
+    void react(const W& in, W& out, const Values&) const {
+        typedef typename W::Scalar T;
+        T salinity_removal = in.getParameter(SALINITY) * T(0.95);
+        out = in;
+        out.updateParameter(SALINITY, in.getParameter(SALINITY) - salinity_removal);
         //Conductivity reduction
-        float EC_removal = inletWater.getParameter(EC) * 0.95f;
-        outletWater = inletWater;
-        outletWater.updateParameter(SALINITY, inletWater.getParameter(SALINITY) - salinity_removal);
-        outletWater.updateParameter(EC, inletWater.getParameter(EC) * 0.05f);
+        out.updateParameter(EC, in.getParameter(EC) * T(0.05));
     }
 };
 
-//|........||Connections between components
-class Connection {
+//|........||Transport delay of a pipe: a power-of-two ring of the waters that entered it. A slot covers
+//|........||`stride` engine steps, doubled whenever the delay would not fit in MAX_SLOTS, so memory stays
+//|........||bounded for long pipes or short steps. Reading a fractional number of slots back blends the two
+//|........||neighbouring slots: a step is O(1), and the ring reallocates only while growing to its cap.
+class DelayLine {
 public:
-    Component* from;
-    Component* to;
-    std::vector<sf::CircleShape> flowParticles;
-    float particleSpawnTime = 0.0f;
-    float diameter = 10.0f; //|........||Pipe diameter in cm
+    static const int MAX_SLOTS = 256;
 
-    Connection(Component* f, Component* t) : from(f), to(t) {}
+    void reset() {
+        primed = false;
+        stride = 1;
+        phase = 0;
+    }
 
-    void update(float deltaTime) {
+    //|........||Stores `in` as the newest entry and writes the water that entered `steps` steps ago into `out`.
+    //|........||The stride follows `steps` both ways; it only refines once the finer line would be at most half
+    //|........||full, so a flow hovering near a boundary does not coarsen and refine on alternate steps.
+    void advance(const Water& in, float steps, Water& out) {
+        steps = std::clamp(steps, 0.0f, 1e9f);
+        while (steps / stride > MAX_SLOTS - 2) coarsen();
+        while (stride > 1 && steps / (stride / 2) <= (MAX_SLOTS - 2) / 2) refine();
+        float back = steps / stride;
+        size_t whole = (size_t)back;
+        if (slots.size() < whole + 2) grow(whole + 2);
+        if (!primed) {
+            std::fill(slots.begin(), slots.end(), in);
+            primed = true;
+        }
+        if (++phase >= stride) {
+            phase = 0;
+            head = (head + 1) & mask;
+        }
+        slots[head] = in;
+
+        float fraction = back - whole;
+        const Water& newer = slots[(head - whole) & mask];
+        const Water& older = slots[(head - whole - 1) & mask];
+        for (int p = 0; p < PARAMETER_COUNT; ++p) {
+            out.parameters[p] = newer.parameters[p] + (older.parameters[p] - newer.parameters[p]) * fraction;
+        }
+    }
+
+private:
+    std::vector<Water> slots;
+    size_t mask = 0;
+    size_t head = 0;
+    size_t stride = 1;  //|........||Engine steps per slot
+    size_t phase = 0;
+    bool primed = false;
+
+    //|........||Keeps the stored history, oldest slot repeated into the new room
+    void grow(size_t needed) {
+        size_t capacity = 16;
+        while (capacity < needed) capacity *= 2;
+        std::vector<Water> larger(capacity);
+        if (primed) {
+            for (size_t age = 0; age < capacity; ++age) {
+                size_t from = std::min(age, slots.size() - 1);
+                larger[capacity - 1 - age] = slots[(head - from) & mask];
+            }
+        }
+        slots.swap(larger);
+        mask = capacity - 1;
+        head = capacity - 1;
+    }
+
+    //|........||Halves the time resolution in place: the slot of age a takes the one of age 2a
+    void coarsen() {
+        if (slots.size() < (size_t)MAX_SLOTS) grow(MAX_SLOTS);
+        size_t oldest = slots.size() - 1;
+        for (size_t age = 1; age <= oldest; ++age) {
+            slots[(head - age) & mask] = slots[(head - std::min(2 * age, oldest)) & mask];
+        }
+        stride *= 2;
+    }
+
+    //|........||Doubles the time resolution in place: the slots of age 2a and 2a + 1 both take the one of age a.
+    //|........||Detail lost by coarsen stays lost, but the line again spans its steps at the finer stride.
+    void refine() {
+        size_t oldest = slots.size() - 1;
+        for (size_t age = oldest; age >= 1; --age) {
+            slots[(head - age) & mask] = slots[(head - age / 2) & mask];
+        }
+        stride /= 2;
+        phase %= stride;
+    }
+};
+
+//|........||Connections between components
+class Connection {
+public:
+    Component* from;
+    Component* to;
+    bool backEdge = false; //|........||Closes a loop, ignored by the evaluation order
+    StreamKind kind = LIQUID_STREAM; //|........||Set from the upstream unit's output when connected
+    Water water; //|........||Last water sent through this pipe
+    std::vector<sf::CircleShape> flowParticles;
+    float particleSpawnTime = 0.0f;
+    float diameter = 10.0f; //|........||Pipe diameter in cm
+    float length = 20.0f;   //|........||Pipe length in m
+    float roughness = 0.05f; //|........||Absolute wall roughness in mm
+
+    //|........||Dynamic mode: concentrations reach the far end after the pipe residence time V/Q (plug flow).
+    //|........||With dispersionTanks > 0, `dispersionFraction` of that time is spent in a cascade of mixed tanks.
+    bool transportDelay = true;
+    int dispersionTanks = 0;
+    float dispersionFraction = 0.2f;
+    DelayLine delay;
+    std::vector<Water> tanks;
+
+    Connection(Component* f, Component* t) : from(f), to(t) {}
+
+    float volume() const {
+        float d = diameter / 100.0f;
+        return 0.785398f * d * d * length;
+    }
+
+    //|........||Residence time in seconds at `flow` m³/day
+    float residenceTime(float flow) const {
+        return flow > 0.0f ? volume() * 86400.0f / flow : 1e30f;
+    }
+
+    //|........||Sends `in` into the pipe for one engine step and sets `water` to what leaves it. The flow is
+    //|........||passed on at once (incompressible); only the concentrations are delayed.
+    void transport(const Water& in, float deltaTime) {
+        if (!transportDelay || deltaTime <= 0.0f) {
+            water = in;
+            return;
+        }
+        float residence = residenceTime(in.flow);
+        int count = std::clamp(dispersionTanks, 0, 16);
+        float mixed = count > 0 ? residence * std::clamp(dispersionFraction, 0.0f, 1.0f) : 0.0f;
+        delay.advance(in, (residence - mixed) / deltaTime, water);
+
+        if (count > 0) {
+            if ((int)tanks.size() != count) tanks.assign(count, water);
+            //|........||Exact step of each tank for an inflow held over the step
+            float keep = std::exp(-deltaTime * count / std::max(mixed, 1e-6f));
+            const Water* feed = &water;
+            for (auto& tank : tanks) {
+                for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                    tank.parameters[p] = feed->parameters[p] + (tank.parameters[p] - feed->parameters[p]) * keep;
+                }
+                feed = &tank;
+            }
+            water.parameters = tanks.back().parameters;
+        }
+        water.flow = in.flow;
+    }
+
+    //|........||Forgets the pipe contents; the next dynamic step fills it with what enters
+    void resetTransport() {
+        delay.reset();
+        tanks.clear();
+    }
+
+    //|........||Darcy-Weisbach friction loss (m) at `flow` m³/day; Swamee-Jain friction factor when turbulent.
+    //|........||Not memoized: pumps on parallel trains call it concurrently through the same const pipe.
+    float headLoss(float flow) const {
+        float d = std::max(diameter, 0.1f) / 100.0f;
+        float area = 0.785398f * d * d;
+        float velocity = flow / 86400.0f / area;
+        float reynolds = velocity * d / 1.0e-6f;
+        if (reynolds < 1.0f) return 0.0f;
+        float friction;
+        if (reynolds < 2000.0f) {
+            friction = 64.0f / reynolds;
+        } else {
+            float term = std::log10(roughness / 1000.0f / (3.7f * d) + 5.74f / std::pow(reynolds, 0.9f));
+            friction = 0.25f / (term * term);
+        }
+        return friction * length / d * velocity * velocity / (2.0f * 9.81f);
+    }
+
+    sf::Vector2f start() const {
+        return sf::Vector2f(from->position.x + from->width, from->position.y + from->height / 2);
+    }
+
+    sf::Vector2f end() const {
+        return sf::Vector2f(to->position.x, to->position.y + to->height / 2);
+    }
+
+    void update(float deltaTime) {
         particleSpawnTime += deltaTime;
         if (particleSpawnTime >= 0.02f) {
             particleSpawnTime = 0.0f;
             sf::CircleShape particle(3.0f);
-            float bod = from->outletWater.getParameter(BOD);
+            float bod = water.getParameter(BOD);
             sf::Color color = sf::Color::Cyan;
             if (bod > 200) color = sf::Color(139, 0, 0);
             else if (bod > 100) color = sf::Color(255, 69, 0);
@@ -948,140 +3470,5155 @@ public:
             else color = sf::Color(0, 255, 0);
 
             particle.setFillColor(color);
-            particle.setPosition(from->position.x + from->width, from->position.y + from->height / 2);
+            particle.setPosition(start());
             flowParticles.push_back(particle);
         }
-
-        for (auto& particle : flowParticles) {
-            sf::Vector2f direction = to->position - from->position;
-            float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
-            direction /= length;
-            particle.move(direction * 150.0f * deltaTime);
+
+        sf::Vector2f origin = start();
+        sf::Vector2f direction = end() - origin;
+        float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+        if (length > 0) direction /= length;
+        for (auto& particle : flowParticles) {
+            particle.move(direction * 150.0f * deltaTime);
+        }
+
+        //|........||Particles leave once they have travelled the whole pipe, whichever way it points
+        flowParticles.erase(std::remove_if(flowParticles.begin(), flowParticles.end(),
+            [&](sf::CircleShape& p) {
+                sf::Vector2f travelled = p.getPosition() - origin;
+                return travelled.x * direction.x + travelled.y * direction.y >= length;
+            }), flowParticles.end());
+    }
+
+    void draw(sf::RenderWindow& window) {
+        sf::Vector2f origin = start();
+        sf::Vector2f direction = end() - origin;
+        sf::RectangleShape pipe;
+        pipe.setSize(sf::Vector2f(std::sqrt(direction.x * direction.x + direction.y * direction.y), diameter));
+        pipe.setOrigin(0, diameter / 2);
+        pipe.setPosition(origin);
+        pipe.setRotation(std::atan2(direction.y, direction.x) * 180.0f / 3.14159265f);
+        if (kind == SLUDGE_STREAM) pipe.setFillColor(sf::Color(110, 80, 50));
+        else if (kind == REJECT_STREAM) pipe.setFillColor(sf::Color(120, 120, 160));
+        else pipe.setFillColor(sf::Color(70, 70, 70));
+        window.draw(pipe);
+
+        for (auto& particle : flowParticles) {
+            window.draw(particle);
+        }
+    }
+};
+
+//|........||Flow-weighted blend of every stream arriving through `inputs`, in one pass over the parameter array.
+//|........||Loads (flow × concentration) are summed in double, so the blended mass matches the inputs to float precision.
+//|........||Intensive parameters (pH, temperature) are flow-weighted the same way.
+void blendStreams(const std::vector<Connection*>& inputs, Water& out) {
+    std::array<double, PARAMETER_COUNT> load{};
+    double totalFlow = 0.0;
+    for (const auto& conn : inputs) {
+        const Water& in = conn->water;
+        double flow = in.flow;
+        totalFlow += flow;
+        for (int p = 0; p < PARAMETER_COUNT; ++p) {
+            load[p] += flow * in.parameters[p];
+        }
+    }
+    if (totalFlow <= 0.0) {
+        out = inputs.front()->water;
+        return;
+    }
+    double inverse = 1.0 / totalFlow;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        out.parameters[p] = float(load[p] * inverse);
+    }
+    out.flow = float(totalFlow);
+}
+
+//|........||blendStreams on the waters of the derivative and double-precision sweeps
+template <typename W>
+void blendSlots(const std::vector<const W*>& inputs, W& out) {
+    typedef typename W::Scalar T;
+    out = *inputs.front();
+    if (inputs.size() == 1) return;
+    T totalFlow = 0.0;
+    std::array<T, PARAMETER_COUNT> load{};
+    for (const W* in : inputs) {
+        totalFlow += in->flow;
+        for (int p = 0; p < PARAMETER_COUNT; ++p) load[p] += in->flow * in->parameters[p];
+    }
+    if (totalFlow <= 0.0) return;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) out.parameters[p] = load[p] / totalFlow;
+    out.flow = totalFlow;
+}
+
+//|........||Losses are taken at the pumped flow along the main (first forward output) of each unit
+float Pump::dischargeLosses(float flow) const {
+    float losses = 0.0f;
+    const Component* comp = this;
+    for (int hops = 0; hops < 256 && !comp->outputs.empty(); ++hops) {
+        const Connection* pipe = comp->outputs.front();
+        if (pipe->backEdge) break;
+        losses += pipe->headLoss(flow);
+        comp = pipe->to;
+        if (dynamic_cast<const Pump*>(comp)) break;
+    }
+    return losses;
+}
+
+StreamKind Mixer::outputKind(size_t) const {
+    return inputs.empty() ? LIQUID_STREAM : inputs.front()->kind;
+}
+
+void Component::gatherInlet() {
+    if (inputs.empty()) return;
+    if (inputs.size() == 1) inletWater = inputs.front()->water;
+    else blendStreams(inputs, inletWater);
+}
+
+//|........||Fallback for units without a Dual kernel: central differences, stepping the most sensitive input
+//|........||(or the unit's own seeded parameter) 1 % each way. That is exact for the linear units; the digester
+//|........||curves enough that a one-sided step was off by up to 10 %, where this keeps it near 0.2 %.
+//|........||Unseeded directions cost nothing.
+void Component::differentiate(const DualWater& in, std::vector<DualWater>& out, const DualSeeds& seeds) {
+    const size_t count = std::max<size_t>(outputs.size(), 1);
+    const Water base = valueOf(in);
+    inletWater = base;
+    simulate(0.0f);
+    saveState();
+    std::vector<Water> baseOut(count), upOut(count);
+    out.resize(count);
+    for (size_t k = 0; k < count; ++k) {
+        baseOut[k] = outletFor(k);
+        out[k] = dualOf(baseOut[k]);
+    }
+    std::vector<ParameterRef> refs;
+    parameters(refs);
+    for (int j = 0; j < seeds.width; ++j) {
+        double scale = 0.0;
+        auto widen = [&](const Dual& x) {
+            scale = std::max(scale, std::fabs(x.d[j]) / std::max(std::fabs(x.value), 1e-3));
+        };
+        widen(in.flow);
+        for (const Dual& x : in.parameters) widen(x);
+        float* own = nullptr;
+        for (const ParameterRef& ref : refs) {
+            if (seeds.fields[j] == ref.value) own = ref.value;
+        }
+        if (own) scale = std::max(scale, 1.0 / std::max(std::fabs(double(*own)), 1e-3));
+        if (scale == 0.0) continue;
+        double h = 1e-2 / scale;
+        float saved = own ? *own : 0.0f;
+        auto shift = [&](double t) {
+            inletWater.flow = float(in.flow.value + t * in.flow.d[j]);
+            for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                inletWater.parameters[p] = float(in.parameters[p].value + t * in.parameters[p].d[j]);
+            }
+            if (own) *own = float(saved + t);
+            restoreState();
+            simulate(0.0f);
+            if (own) *own = saved;
+        };
+        shift(h);
+        for (size_t k = 0; k < count; ++k) upOut[k] = outletFor(k);
+        shift(-h);
+        for (size_t k = 0; k < count; ++k) {
+            const Water& down = outletFor(k);
+            out[k].flow.d[j] = (upOut[k].flow - down.flow) / (2.0 * h);
+            for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                out[k].parameters[p].d[j] = (upOut[k].parameters[p] - down.parameters[p]) / (2.0 * h);
+            }
+        }
+    }
+    inletWater = base;
+    restoreState();
+    simulate(0.0f);
+}
+
+//|........||Outlets first (flow, then every parameter, per output), then the meter. The references returned
+//|........||by outletFor are the unit's own members, so they can be written back.
+void Component::responseSlots(std::vector<float*>& slots) {
+    slots.clear();
+    for (size_t k = 0; k < std::max<size_t>(outputs.size(), 1); ++k) {
+        Water& water = const_cast<Water&>(outletFor(k));
+        slots.push_back(&water.flow);
+        for (float& value : water.parameters) slots.push_back(&value);
+    }
+    if (EnergyMeter* meter = energyMeter()) {
+        slots.push_back(&meter->power);
+        slots.push_back(&meter->flow);
+    }
+}
+
+//|........||Fallback for units without a templated kernel: one float solve, after which what the engine reads
+//|........||(outlets, meter, inlet) is put back. A warm-started unit is left where the solve ended, so the next
+//|........||one starts close; saveState()/restoreState() around the sweep undo that too.
+void Component::evaluatePrecise(const PreciseWater& in, std::vector<PreciseWater>& out) {
+    thread_local std::vector<float*> slots;
+    thread_local std::vector<float> kept;
+    responseSlots(slots);
+    kept.resize(slots.size());
+    for (size_t i = 0; i < slots.size(); ++i) kept[i] = *slots[i];
+    const Water keptInlet = inletWater;
+    inletWater = roundedOf(in);
+    simulate(0.0f);
+    out.resize(std::max<size_t>(outputs.size(), 1));
+    for (size_t k = 0; k < out.size(); ++k) out[k] = preciseOf(outletFor(k));
+    for (size_t i = 0; i < slots.size(); ++i) *slots[i] = kept[i];
+    inletWater = keptInlet;
+}
+
+//|........||Tabulated steady-state response of one unit, for units whose simulate() is costly (the ADM1 digester).
+//|........||The table spans a box over a few inlet values (flow or parameters) on a tensor grid and is
+//|........||interpolated multilinearly; node values are stored node after node, so the 2^d corners of a cell
+//|........||are a few contiguous rows. Every other inlet value is held at the water the unit saw when the
+//|........||table was built, and a call whose inlet strays from it by more than the tolerance, or leaves the
+//|........||box, runs simulate() instead.
+//|........||The grid starts at three points per input and is refined adaptively: each round spot-checks the
+//|........||midpoints of random cells along every input, and doubles the points of each input whose error
+//|........||exceeds the tolerance, until a final check at random points of the whole box passes. At run time
+//|........||one call in `spotInterval`, starting with the first, also runs simulate() and compares; a miss
+//|........||disables the table. Units whose steady answer depends on what they solved before (a solver that
+//|........||stops short of convergence and warm-starts) are refused at build time; the digester solves every new
+//|........||feed cold to its tolerance, so it passes.
+//|........||Errors are relative, with a floor of 0.01 in the output's own unit.
+class SurrogateTable {
+public:
+    static const int MAX_INPUTS = 6;
+    static const int FLOW_INPUT = -1;
+
+    struct Input {
+        int parameter;   //|........||WaterParameter or FLOW_INPUT
+        float low;
+        float high;
+    };
+
+    std::vector<Input> inputs;
+    float tolerance = 0.01f;
+    int maxNodes = 20000;
+    int spotInterval = 64;
+
+    bool valid = false;
+    std::string status = "not built";
+    std::vector<int> levels;    //|........||grid points per input
+    long evaluations = 0;       //|........||simulate() calls spent building
+    float buildError = 0.0f;    //|........||worst error of the final check
+    long calls = 0;
+    long hits = 0;
+    long spotChecks = 0;
+    float spotError = 0.0f;
+
+    static float error(const float* approx, const float* exact, size_t count) {
+        float worst = 0.0f;
+        for (size_t m = 0; m < count; ++m) {
+            worst = std::max(worst, std::fabs(approx[m] - exact[m]) / std::max(std::fabs(exact[m]), 0.01f));
+        }
+        return worst;
+    }
+
+    //|........||Tabulates `unit` around its current inlet water; the unit's outlets and state are left as found
+    bool build(Component& unit) {
+        valid = false;
+        reference = unit.inletWater;
+        unit.responseSlots(slots);
+        std::vector<float> found(slots.size());
+        for (size_t m = 0; m < slots.size(); ++m) found[m] = *slots[m];
+        std::vector<ParameterRef> refs;
+        unit.parameters(refs);
+        watched.clear();
+        watchedValues.clear();
+        for (const ParameterRef& ref : refs) {
+            watched.push_back(ref.value);
+            watchedValues.push_back(*ref.value);
+        }
+        unit.saveState();
+
+        const size_t d = inputs.size();
+        const size_t m = slots.size();
+        levels.assign(d, 3);
+        evaluations = 0;
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> unit01(0.0f, 1.0f);
+        std::vector<float> point(d), exact(m), approx(m);
+
+        //|........||The table holds one answer per inlet, so the unit must answer the same whatever it solved
+        //|........||before: go out to a few random points and back, without restoring its state in between
+        std::vector<float> centre(d), before(m);
+        for (size_t k = 0; k < d; ++k) centre[k] = 0.5f * (inputs[k].low + inputs[k].high);
+        evaluate(unit, centre, before.data());
+        bool history = false;
+        for (int excursion = 0; excursion < 4 && !history; ++excursion) {
+            for (size_t k = 0; k < d; ++k) point[k] = inputs[k].low + (inputs[k].high - inputs[k].low) * unit01(random);
+            evaluate(unit, point, exact.data(), false);
+            evaluate(unit, centre, approx.data(), false);
+            buildError = error(approx.data(), before.data(), m);
+            history = buildError > tolerance;
+        }
+        if (history) {
+            std::ostringstream text;
+            text << "steady response depends on the unit's previous state (off by " << buildError << ")";
+            status = text.str();
+        }
+        while (!history) {
+            size_t nodes = 1;
+            for (int n : levels) nodes *= size_t(n);
+            if (nodes > size_t(maxNodes)) {
+                std::ostringstream text;
+                text << "over " << maxNodes << " nodes before reaching the tolerance";
+                status = text.str();
+                break;
+            }
+            strides.assign(d, 1);
+            for (size_t i = d; i-- > 1;) strides[i - 1] = strides[i] * levels[i];
+            values.resize(nodes * m);
+            for (size_t node = 0; node < nodes; ++node) {
+                for (size_t i = 0; i < d; ++i) {
+                    int index = int(node / strides[i]) % levels[i];
+                    point[i] = inputs[i].low + (inputs[i].high - inputs[i].low) * index / (levels[i] - 1);
+                }
+                evaluate(unit, point, &values[node * m]);
+            }
+
+            //|........||Along one input at a time, so an error points at the input that needs more points
+            std::vector<float> along(d, 0.0f);
+            for (size_t i = 0; i < d; ++i) {
+                for (int check = 0; check < 16; ++check) {
+                    for (size_t k = 0; k < d; ++k) {
+                        int intervals = levels[k] - 1;
+                        float index = float(std::min(int(unit01(random) * (k == i ? intervals : levels[k])),
+                            k == i ? intervals - 1 : levels[k] - 1));
+                        if (k == i) index += 0.5f;
+                        point[k] = inputs[k].low + (inputs[k].high - inputs[k].low) * index / intervals;
+                    }
+                    evaluate(unit, point, exact.data());
+                    interpolate(point.data(), approx.data());
+                    along[i] = std::max(along[i], error(approx.data(), exact.data(), m));
+                }
+            }
+            buildError = 0.0f;
+            for (int check = 0; check < 64; ++check) {
+                for (size_t k = 0; k < d; ++k) point[k] = inputs[k].low + (inputs[k].high - inputs[k].low) * unit01(random);
+                evaluate(unit, point, exact.data());
+                interpolate(point.data(), approx.data());
+                buildError = std::max(buildError, error(approx.data(), exact.data(), m));
+            }
+            if (buildError <= tolerance && *std::max_element(along.begin(), along.end()) <= tolerance) {
+                valid = true;
+                status = "ok";
+                break;
+            }
+            bool refined = false;
+            for (size_t i = 0; i < d; ++i) {
+                if (along[i] > tolerance) {
+                    levels[i] = 2 * levels[i] - 1;
+                    refined = true;
+                }
+            }
+            if (!refined) {
+                size_t worst = size_t(std::max_element(along.begin(), along.end()) - along.begin());
+                levels[worst] = 2 * levels[worst] - 1;
+            }
+        }
+        unit.inletWater = reference;
+        unit.restoreState();
+        for (size_t k = 0; k < slots.size(); ++k) *slots[k] = found[k];
+        calls = hits = spotChecks = 0;
+        spotError = 0.0f;
+        return valid;
+    }
+
+    //|........||Answers a steady-state evaluation of `unit` from the table; false when simulate() must run
+    bool apply(Component& unit) {
+        if (!valid) return false;
+        ++calls;
+        for (size_t i = 0; i < watched.size(); ++i) {
+            if (*watched[i] != watchedValues[i]) {
+                valid = false;
+                status = "unit parameters changed since the table was built";
+                return false;
+            }
+        }
+        const Water& in = unit.inletWater;
+        float point[MAX_INPUTS];
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            point[i] = inputValue(in, inputs[i].parameter);
+            if (!(point[i] >= inputs[i].low && point[i] <= inputs[i].high)) return false;
+        }
+        for (int p = FLOW_INPUT; p < PARAMETER_COUNT; ++p) {
+            if (tabulated(p)) continue;
+            float held = inputValue(reference, p);
+            if (std::fabs(inputValue(in, p) - held) > tolerance * std::max(std::fabs(held), 0.01f)) return false;
+        }
+        scratch.resize(slots.size());
+        interpolate(point, scratch.data());
+        if (spotInterval > 0 && (calls - 1) % spotInterval == 0) {
+            unit.simulate(0.0f);
+            exact.resize(slots.size());
+            for (size_t m = 0; m < slots.size(); ++m) exact[m] = *slots[m];
+            float miss = error(scratch.data(), exact.data(), slots.size());
+            ++spotChecks;
+            spotError = std::max(spotError, miss);
+            if (miss > tolerance) {
+                valid = false;
+                std::ostringstream text;
+                text << "spot check missed by " << miss;
+                status = text.str();
+            }
+            return true;
+        }
+        for (size_t m = 0; m < slots.size(); ++m) *slots[m] = scratch[m];
+        ++hits;
+        return true;
+    }
+
+    //|........||Multilinear interpolation over the 2^d corners of the cell holding `point`
+    void interpolate(const float* point, float* out) const {
+        const size_t d = inputs.size();
+        const size_t m = slots.size();
+        size_t base = 0;
+        float weight[MAX_INPUTS];
+        for (size_t i = 0; i < d; ++i) {
+            float t = (point[i] - inputs[i].low) / (inputs[i].high - inputs[i].low) * (levels[i] - 1);
+            int index = std::clamp(int(t), 0, levels[i] - 2);
+            weight[i] = t - index;
+            base += size_t(index) * strides[i];
+        }
+        std::fill(out, out + m, 0.0f);
+        for (size_t corner = 0; corner < (size_t(1) << d); ++corner) {
+            float w = 1.0f;
+            size_t node = base;
+            for (size_t i = 0; i < d; ++i) {
+                bool upper = (corner >> i) & 1;
+                w *= upper ? weight[i] : 1.0f - weight[i];
+                node += upper ? strides[i] : 0;
+            }
+            if (w == 0.0f) continue;
+            const float* row = &values[node * m];
+            for (size_t k = 0; k < m; ++k) out[k] += w * row[k];
+        }
+    }
+
+    const Water& referenceWater() const { return reference; }
+
+    static float inputValue(const Water& water, int parameter) {
+        return parameter == FLOW_INPUT ? water.flow : water.parameters[parameter];
+    }
+
+private:
+    Water reference;
+    std::vector<float*> slots;
+    std::vector<float*> watched;
+    std::vector<float> watchedValues;
+    std::vector<size_t> strides;
+    std::vector<float> values;
+    std::vector<float> scratch;
+    std::vector<float> exact;
+
+    bool tabulated(int parameter) const {
+        for (const Input& input : inputs) {
+            if (input.parameter == parameter) return true;
+        }
+        return false;
+    }
+
+    void evaluate(Component& unit, const std::vector<float>& point, float* out, bool fromSaved = true) {
+        unit.inletWater = reference;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i].parameter == FLOW_INPUT) unit.inletWater.flow = point[i];
+            else unit.inletWater.parameters[inputs[i].parameter] = point[i];
+        }
+        if (fromSaved) unit.restoreState();
+        unit.simulate(0.0f);
+        ++evaluations;
+        for (size_t k = 0; k < slots.size(); ++k) out[k] = *slots[k];
+    }
+};
+
+Component::~Component() {
+    delete surrogate;
+}
+
+//|........||Sends the current outlets downstream, flagging only the units whose supply changed
+bool Component::pushOutlets() {
+    bool changed = false;
+    for (size_t k = 0; k < outputs.size(); ++k) {
+        const Water& out = outletFor(k);
+        if (outputs[k]->water != out) {
+            outputs[k]->water = out;
+            outputs[k]->to->markDirty();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+//|........||Steady state re-evaluates only units downstream of a change; dynamic steps every unit every frame
+enum SimulationMode {
+    STEADY_STATE,
+    DYNAMIC
+};
+
+//|........||Fixed pool of worker threads. Tasks are plain function pointers so dispatching a step
+//|........||allocates nothing; the thread waiting on a batch runs queued tasks itself instead of idling.
+class ThreadPool {
+public:
+    struct Task {
+        void (*run)(void* context, int index);
+        void* context;
+        int index;
+    };
+
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    void submit(const Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+        }
+        ready.notify_one();
+    }
+
+    //|........||Helps with queued work until `remaining` reaches zero
+    void helpUntil(const std::atomic<int>& remaining) {
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            Task task;
+            if (tryPop(task)) task.run(task.context, task.index);
+            else std::this_thread::yield();
+        }
+    }
+
+    //|........||Calls body(begin, end) over [0, count) split into about one chunk per thread
+    template <typename Body>
+    void parallelFor(int count, const Body& body) {
+        struct Batch {
+            const Body* body;
+            int count;
+            int chunk;
+            std::atomic<int> remaining;
+        };
+        int chunks = std::max(1, std::min(count, (int)workers.size() + 1));
+        Batch batch{&body, count, (count + chunks - 1) / chunks, {chunks}};
+        auto run = [](void* context, int index) {
+            Batch* b = static_cast<Batch*>(context);
+            int begin = index * b->chunk;
+            (*b->body)(begin, std::min(begin + b->chunk, b->count));
+            b->remaining.fetch_sub(1, std::memory_order_release);
+        };
+        for (int i = 1; i < chunks; ++i) submit({run, &batch, i});
+        run(&batch, 0);
+        helpUntil(batch.remaining);
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::vector<Task> tasks;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool stopping = false;
+
+    bool tryPop(Task& task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty()) return false;
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+
+    void workerLoop() {
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = tasks.back();
+                tasks.pop_back();
+            }
+            task.run(task.context, task.index);
+        }
+    }
+};
+
+//|........||Runs body(i) for every i in [0, count) on `threads` threads with work stealing: each thread owns
+//|........||a deque seeded with a contiguous block, works from its back and, once empty, takes from the front
+//|........||of another thread's deque. Meant for few long tasks of uneven length (whole plant runs); the
+//|........||ThreadPool above serves the short ones inside a plant step. Tasks do not spawn tasks, so a thread
+//|........||that finds every deque empty is done.
+template <typename Body>
+void runWorkStealing(int count, unsigned threads, const Body& body) {
+    if (count <= 0) return;
+    threads = std::max(1u, std::min(threads, (unsigned)count));
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> items;
+    };
+    std::vector<Queue> queues(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        for (int i = int(t * size_t(count) / threads); i < int((t + 1) * size_t(count) / threads); ++i) {
+            queues[t].items.push_back(i);
+        }
+    }
+    auto worker = [&](unsigned self) {
+        while (true) {
+            int item = -1;
+            {
+                std::lock_guard<std::mutex> lock(queues[self].mutex);
+                if (!queues[self].items.empty()) {
+                    item = queues[self].items.back();
+                    queues[self].items.pop_back();
+                }
+            }
+            for (unsigned k = 1; item < 0 && k < threads; ++k) {
+                Queue& victim = queues[(self + k) % threads];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.items.empty()) {
+                    item = victim.items.front();
+                    victim.items.pop_front();
+                }
+            }
+            if (item < 0) return;
+            body(item);
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (unsigned t = 1; t < threads; ++t) helpers.emplace_back(worker, t);
+    worker(0);
+    for (auto& helper : helpers) helper.join();
+}
+
+//|........||Maximal run of units that feed only each other; a plant step schedules whole segments
+struct ScheduleSegment {
+    std::vector<Component*> units;
+    std::vector<int> dependents; //|........||Segments fed by the last unit of this one
+    int dependencies = 0;        //|........||Distinct upstream segments that must finish first
+};
+
+//|........||Outcome of a recycle solve: sweeps spent and the scaled tear-stream residual after each one
+struct SteadyStateReport {
+    int iterations = 0;
+    int evaluations = 0;  //|........||Plant sweeps, i.e. evaluations of the fixed-point map
+    double residual = 0.0;
+    bool converged = true;
+    std::vector<double> residuals;
+};
+
+//|........||Anderson acceleration for x = G(x): the next iterate combines the last `depth` images so that
+//|........||the combined residual is smallest in least squares. depth 0 is plain successive substitution.
+class AndersonAccelerator {
+public:
+    int depth = 5;
+
+    void reset() {
+        deltaG.clear();
+        deltaF.clear();
+        previousG.clear();
+        previousF.clear();
+    }
+
+    //|........||`x` is the current iterate and `g` its image G(x); `x` is overwritten with the next iterate
+    void next(std::vector<double>& x, const std::vector<double>& g) {
+        size_t n = x.size();
+        std::vector<double> f(n);
+        for (size_t i = 0; i < n; ++i) f[i] = g[i] - x[i];
+
+        if (depth > 0 && previousF.size() == n) {
+            deltaG.emplace_back(n);
+            deltaF.emplace_back(n);
+            for (size_t i = 0; i < n; ++i) {
+                deltaG.back()[i] = g[i] - previousG[i];
+                deltaF.back()[i] = f[i] - previousF[i];
+            }
+            while ((int)deltaF.size() > depth) {
+                deltaG.pop_front();
+                deltaF.pop_front();
+            }
+        }
+        previousG = g;
+        previousF = f;
+        x = g;
+
+        //|........||Normal equations of min |f - dF gamma|, at most depth x depth, solved in double
+        size_t m = deltaF.size();
+        if (m == 0) return;
+        std::vector<double> normal(m * m);
+        std::vector<double> gamma(m);
+        double trace = 0.0;
+        for (size_t a = 0; a < m; ++a) {
+            for (size_t c = 0; c < m; ++c) normal[a * m + c] = dot(deltaF[a], deltaF[c]);
+            gamma[a] = dot(deltaF[a], f);
+            trace += normal[a * m + a];
+        }
+        for (size_t a = 0; a < m; ++a) normal[a * m + a] += 1e-10 * trace;
+        if (!solve(normal, gamma, m)) {
+            //|........||Degenerate history: drop it and fall back to a plain substitution step
+            deltaG.clear();
+            deltaF.clear();
+            return;
+        }
+        for (size_t c = 0; c < m; ++c) {
+            for (size_t i = 0; i < n; ++i) x[i] -= gamma[c] * deltaG[c][i];
+        }
+    }
+
+private:
+    std::deque<std::vector<double>> deltaG;
+    std::deque<std::vector<double>> deltaF;
+    std::vector<double> previousG;
+    std::vector<double> previousF;
+
+    static double dot(const std::vector<double>& a, const std::vector<double>& b) {
+        double sum = 0.0;
+        for (size_t i = 0; i < a.size(); ++i) sum += a[i] * b[i];
+        return sum;
+    }
+
+    //|........||Gaussian elimination with partial pivoting; the solution replaces `rhs`
+    static bool solve(std::vector<double>& matrix, std::vector<double>& rhs, size_t m) {
+        for (size_t col = 0; col < m; ++col) {
+            size_t pivot = col;
+            for (size_t row = col + 1; row < m; ++row) {
+                if (std::fabs(matrix[row * m + col]) > std::fabs(matrix[pivot * m + col])) pivot = row;
+            }
+            if (!(std::fabs(matrix[pivot * m + col]) > 1e-300)) return false;
+            if (pivot != col) {
+                for (size_t c = 0; c < m; ++c) std::swap(matrix[col * m + c], matrix[pivot * m + c]);
+                std::swap(rhs[col], rhs[pivot]);
+            }
+            for (size_t row = col + 1; row < m; ++row) {
+                double factor = matrix[row * m + col] / matrix[col * m + col];
+                for (size_t c = col; c < m; ++c) matrix[row * m + c] -= factor * matrix[col * m + c];
+                rhs[row] -= factor * rhs[col];
+            }
+        }
+        for (size_t row = m; row-- > 0;) {
+            double sum = rhs[row];
+            for (size_t c = row + 1; c < m; ++c) sum -= matrix[row * m + c] * rhs[c];
+            rhs[row] = sum / matrix[row * m + row];
+        }
+        return true;
+    }
+};
+
+//|........||Samples in a sliding time window (now - span, now] with an incremental sum for the mean and a
+//|........||monotonic deque for the maximum, so each sample costs amortised O(1). The newest sample always
+//|........||stays, so a zero span is the instantaneous value.
+class RollingWindow {
+public:
+    double span = 86400.0;   //|........||s
+
+    void add(double time, double value) {
+        if (samples.empty() && !started) {
+            firstTime = time;
+            started = true;
+        }
+        samples.push_back({time, value});
+        sum += value;
+        while (!peaks.empty() && peaks.back().value <= value) peaks.pop_back();
+        peaks.push_back({time, value});
+        while (samples.size() > 1 && samples.front().time <= time - span) {
+            sum -= samples.front().value;
+            samples.pop_front();
+        }
+        while (peaks.size() > 1 && peaks.front().time <= time - span) peaks.pop_front();
+        //|........||Re-add from scratch now and then so rounding in the running sum cannot drift
+        if (++sinceRefresh >= REFRESH_EVERY) {
+            sinceRefresh = 0;
+            sum = 0.0;
+            for (const Sample& sample : samples) sum += sample.value;
+        }
+    }
+
+    double mean() const {
+        return samples.empty() ? 0.0 : sum / samples.size();
+    }
+
+    double max() const {
+        return peaks.empty() ? 0.0 : peaks.front().value;
+    }
+
+    //|........||True once the record covers a whole window, which is when a permit starts to apply
+    bool full(double time) const {
+        return started && time - firstTime >= span * (1.0 - 1e-9);
+    }
+
+    void reset() {
+        samples.clear();
+        peaks.clear();
+        sum = 0.0;
+        started = false;
+        sinceRefresh = 0;
+    }
+
+private:
+    struct Sample {
+        double time;
+        double value;
+    };
+    static constexpr int REFRESH_EVERY = 4096;
+    std::deque<Sample> samples;
+    std::deque<Sample> peaks;   //|........||Decreasing values; the front is the window maximum
+    double sum = 0.0;
+    double firstTime = 0.0;
+    bool started = false;
+    int sinceRefresh = 0;
+};
+
+//|........||Streaming quantile estimate with the P² algorithm (Jain & Chlamtac, 1985): five markers whose
+//|........||heights follow a piecewise-parabolic fit, constant memory and time per sample
+class P2Quantile {
+public:
+    explicit P2Quantile(double p = 0.95) : p(p) {}
+
+    void add(double x) {
+        if (count < 5) {
+            heights[count++] = x;
+            if (count == 5) {
+                std::sort(heights, heights + 5);
+                for (int i = 0; i < 5; ++i) positions[i] = i + 1;
+                desired[0] = 1.0;
+                desired[1] = 1.0 + 2.0 * p;
+                desired[2] = 1.0 + 4.0 * p;
+                desired[3] = 3.0 + 2.0 * p;
+                desired[4] = 5.0;
+                increments[0] = 0.0;
+                increments[1] = p / 2.0;
+                increments[2] = p;
+                increments[3] = (1.0 + p) / 2.0;
+                increments[4] = 1.0;
+            }
+            return;
+        }
+        int cell;
+        if (x < heights[0]) {
+            heights[0] = x;
+            cell = 0;
+        } else if (x >= heights[4]) {
+            heights[4] = x;
+            cell = 3;
+        } else {
+            cell = 0;
+            while (x >= heights[cell + 1]) ++cell;
+        }
+        for (int i = cell + 1; i < 5; ++i) positions[i] += 1.0;
+        for (int i = 0; i < 5; ++i) desired[i] += increments[i];
+        for (int i = 1; i <= 3; ++i) {
+            double d = desired[i] - positions[i];
+            if ((d >= 1.0 && positions[i + 1] - positions[i] > 1.0) || (d <= -1.0 && positions[i - 1] - positions[i] < -1.0)) {
+                int s = d > 0.0 ? 1 : -1;
+                double candidate = parabolic(i, s);
+                heights[i] = heights[i - 1] < candidate && candidate < heights[i + 1] ? candidate
+                    : heights[i] + s * (heights[i + s] - heights[i]) / (positions[i + s] - positions[i]);
+                positions[i] += s;
+            }
+        }
+        ++count;
+    }
+
+    double value() const {
+        if (count >= 5) return heights[2];
+        if (count <= 0) return 0.0;
+        //|........||Bounded explicitly: the compiler cannot see that count < 5 here
+        const int n = int(std::min<long>(count, 4));
+        double sorted[5];
+        std::copy(heights, heights + n, sorted);
+        std::sort(sorted, sorted + n);
+        return sorted[std::clamp(int(std::lround(p * (n - 1))), 0, n - 1)];
+    }
+
+    void reset() {
+        count = 0;
+    }
+
+private:
+    double p;
+    long count = 0;
+    double heights[5] = {};
+    double positions[5] = {};
+    double desired[5] = {};
+    double increments[5] = {};
+
+    double parabolic(int i, int s) const {
+        return heights[i] + s / (positions[i + 1] - positions[i - 1])
+            * ((positions[i] - positions[i - 1] + s) * (heights[i + 1] - heights[i]) / (positions[i + 1] - positions[i])
+             + (positions[i + 1] - positions[i] - s) * (heights[i] - heights[i - 1]) / (positions[i] - positions[i - 1]));
+    }
+};
+
+//|........||Effluent permit terms: a rolling mean or maximum over a window (a zero window is each sample),
+//|........||or a percentile of every sample so far
+enum PermitStatistic {
+    PERMIT_MEAN,
+    PERMIT_MAX,
+    PERMIT_PERCENTILE
+};
+
+struct PermitLimit {
+    WaterParameter parameter = BOD;
+    PermitStatistic statistic = PERMIT_MEAN;
+    double window = 7.0 * 86400.0;   //|........||s
+    double percentile = 0.95;
+    float limit = 25.0f;
+};
+
+//|........||Reads as in plant files: "BOD mean 7d 25", "NH4 max 1d 5", "TSS p95 35", "pH 9" (each sample)
+std::string formatPermit(const PermitLimit& permit) {
+    std::ostringstream text;
+    text << parameterKey(permit.parameter);
+    if (permit.statistic == PERMIT_PERCENTILE) {
+        text << " p" << std::lround(permit.percentile * 100.0);
+    } else if (permit.statistic == PERMIT_MEAN || permit.window > 0.0) {
+        text << (permit.statistic == PERMIT_MEAN ? " mean " : " max ");
+        if (std::fmod(permit.window, 86400.0) == 0.0) text << permit.window / 86400.0 << "d";
+        else if (std::fmod(permit.window, 3600.0) == 0.0) text << permit.window / 3600.0 << "h";
+        else text << permit.window << "s";
+    }
+    text << " " << permit.limit;
+    return text.str();
+}
+
+bool parsePermit(std::istream& words, PermitLimit& permit) {
+    std::vector<std::string> tokens;
+    for (std::string token; words >> token;) tokens.push_back(token);
+    if (tokens.size() < 2 || !parameterFromKey(tokens[0], permit.parameter)) return false;
+    permit.limit = float(std::atof(tokens.back().c_str()));
+    if (tokens.size() == 2) {
+        permit.statistic = PERMIT_MAX;
+        permit.window = 0.0;
+        return true;
+    }
+    const std::string& kind = tokens[1];
+    if (kind.size() > 1 && kind[0] == 'p' && std::isdigit((unsigned char)kind[1]) && tokens.size() == 3) {
+        permit.statistic = PERMIT_PERCENTILE;
+        permit.percentile = std::clamp(std::atof(kind.c_str() + 1) / 100.0, 0.0, 1.0);
+        return true;
+    }
+    if ((kind != "mean" && kind != "max") || tokens.size() != 4) return false;
+    permit.statistic = kind == "mean" ? PERMIT_MEAN : PERMIT_MAX;
+    const std::string& window = tokens[2];
+    char unit = window.empty() ? 'd' : window.back();
+    double scale = unit == 'h' ? 3600.0 : unit == 's' ? 1.0 : 86400.0;
+    permit.window = std::atof(window.c_str()) * scale;
+    return permit.window >= 0.0;
+}
+
+//|........||Where a permit term stands: its latest value, the worst evaluation and how many evaluations
+//|........||broke the limit. Rolling terms are evaluated at every sample once a full window is on record.
+struct PermitStatus {
+    double current = 0.0;
+    double worst = 0.0;
+    long evaluations = 0;
+    long exceedances = 0;
+};
+
+//|........||Streaming compliance over outlet samples taken every `sampleInterval` of simulated time
+class ComplianceMonitor {
+public:
+    float sampleInterval = 900.0f;   //|........||s
+    std::vector<PermitLimit> limits; //|........||Call reset() after editing
+    std::vector<PermitStatus> status;
+    long samples = 0;
+
+    void reset() {
+        status.assign(limits.size(), PermitStatus());
+        windows.assign(limits.size(), RollingWindow());
+        quantiles.clear();
+        for (size_t i = 0; i < limits.size(); ++i) {
+            windows[i].span = limits[i].window;
+            quantiles.emplace_back(limits[i].percentile);
+        }
+        samples = 0;
+        nextSample = 0.0;
+    }
+
+    //|........||Takes a sample when `time` (s) reaches the next sampling instant
+    void sample(double time, const Water& effluent) {
+        if (time + 1e-9 < nextSample) return;
+        record(time, effluent);
+        nextSample = std::max(nextSample + sampleInterval, time);
+    }
+
+    void record(double time, const Water& effluent) {
+        if (status.size() != limits.size()) reset();
+        ++samples;
+        for (size_t i = 0; i < limits.size(); ++i) {
+            const PermitLimit& permit = limits[i];
+            PermitStatus& state = status[i];
+            double value = effluent.getParameter(permit.parameter);
+            bool applies = true;
+            if (permit.statistic == PERMIT_PERCENTILE) {
+                quantiles[i].add(value);
+                state.current = quantiles[i].value();
+                applies = false;   //|........||judged on the whole record, see percentileExceeded()
+            } else {
+                windows[i].add(time, value);
+                state.current = permit.statistic == PERMIT_MEAN ? windows[i].mean() : windows[i].max();
+                applies = windows[i].full(time);
+            }
+            if (!applies) continue;
+            state.worst = state.evaluations == 0 ? state.current : std::max(state.worst, state.current);
+            ++state.evaluations;
+            if (state.current > permit.limit) ++state.exceedances;
+        }
+    }
+
+    //|........||Percentile terms have one verdict for the whole record
+    bool violated(size_t i) const {
+        if (limits[i].statistic == PERMIT_PERCENTILE) return samples > 0 && status[i].current > limits[i].limit;
+        return status[i].exceedances > 0;
+    }
+
+    long exceedances() const {
+        long total = 0;
+        for (size_t i = 0; i < status.size(); ++i) {
+            total += limits[i].statistic == PERMIT_PERCENTILE ? (violated(i) ? 1 : 0) : status[i].exceedances;
+        }
+        return total;
+    }
+
+    bool compliant() const {
+        for (size_t i = 0; i < status.size(); ++i) {
+            if (violated(i)) return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<RollingWindow> windows;
+    std::vector<P2Quantile> quantiles;
+    double nextSample = 0.0;
+};
+
+//|........||A unit parameter studied between two bounds (sensitivity factors, calibration unknowns)
+struct ParameterRange {
+    Component* unit;
+    std::string parameter;   //|........||ParameterRef name
+    float low;
+    float high;
+};
+
+//|........||Steady sweep of a plain chain compiled for one sequence of unit types (see Pipeline)
+class FusedChain {
+public:
+    virtual ~FusedChain() {}
+    virtual const char* describe() const = 0;
+    virtual void step() = 0;
+};
+
+//|........||Plant graph: owns components and connections and keeps a cached evaluation order.
+//|........||Edits only touch the connections, order slots and positions they affect.
+class Plant {
+public:
+    std::vector<Component*> components; //|........||Evaluation order, upstream first
+    std::vector<Connection*> connections;
+    Component* inlet;
+    Component* outlet;
+    SimulationMode mode = STEADY_STATE;
+
+    //|........||Optional pool for independent branches; plants smaller than parallelMinUnits stay serial
+    ThreadPool* pool = nullptr;
+    size_t parallelMinUnits = 128;
+
+    //|........||Recycle solver settings (steady state with back edges) and the result of the last solve
+    int andersonDepth = 5;
+    double steadyTolerance = 1e-5;
+    int steadyMaxIterations = 100;
+    SteadyStateReport lastSolve;
+
+    //|........||Dynamic mode runs a fixed-step engine: frame time is scaled to simulated time and spent in
+    //|........||steps of fixedStep seconds (0 takes one step per call). Controllers sample on this clock.
+    float fixedStep = 1.0f;
+    float timeScale = 60.0f;
+    int maxStepsPerCall = 1000;
+    double simulatedTime = 0.0;  //|........||s
+    double treatedVolume = 0.0;  //|........||m³ through the inlet since the last reset
+
+    //|........||Effluent permits, sampled on the dynamic clock
+    ComplianceMonitor compliance;
+    std::vector<ParameterRange> vary;   //|........||Factors of sensitivity and calibration studies
+
+    //|........||Replaces the steady sweep while set; any topology edit drops it (see Plant::fuse)
+    std::unique_ptr<FusedChain> fused;
+
+    const float UNIT_SPACING = 150.0f;
+
+    Plant(Component* in, Component* out) : inlet(in), outlet(out) {
+        components.push_back(inlet);
+        components.push_back(outlet);
+        reindexFrom(0);
+        connect(inlet, outlet);
+    }
+
+    ~Plant() {
+        for (auto& conn : connections) delete conn;
+        for (auto& comp : components) delete comp;
+    }
+
+    //|........||Adds an edge and repairs the evaluation order around it
+    Connection* connect(Component* from, Component* to) {
+        Connection* conn = new Connection(from, to);
+        topologyChanged();
+        conn->kind = from->outputKind(from->outputs.size());
+        from->outputs.push_back(conn);
+        to->inputs.push_back(conn);
+        from->markDirty(); //|........||Re-pushes its outlets, filling the new pipe
+        to->markDirty();
+        connections.push_back(conn);
+        repairOrder(conn);
+        return conn;
+    }
+
+    void disconnect(Connection* conn) {
+        topologyChanged();
+        conn->to->markDirty();
+        eraseValue(conn->from->outputs, conn);
+        eraseValue(conn->to->inputs, conn);
+        eraseValue(connections, conn);
+        delete conn;
+    }
+
+    //|........||Splits `edge` (A -> B) into A -> comp -> B, reusing `edge` for A -> comp
+    void insertBetween(Component* comp, Connection* edge) {
+        topologyChanged();
+        Component* downstream = edge->to;
+        Connection* out = new Connection(comp, downstream);
+        out->backEdge = edge->backEdge;
+        out->kind = comp->outputKind(0);
+        std::replace(downstream->inputs.begin(), downstream->inputs.end(), edge, out);
+        downstream->markDirty();
+        edge->to = comp;
+        edge->backEdge = false;
+        edge->flowParticles.clear();
+        comp->inputs.push_back(edge);
+        comp->outputs.push_back(out);
+        connections.push_back(out);
+
+        //|........||Right after its only upstream unit is always a valid slot
+        int slot = edge->from->orderIndex + 1;
+        components.insert(components.begin() + slot, comp);
+        reindexFrom(slot);
+
+        comp->moveTo(sf::Vector2f(edge->from->position.x + UNIT_SPACING, edge->from->position.y));
+        relayoutFrom(comp);
+    }
+
+    //|........||Inserts a unit just before the outlet
+    void append(Component* comp) {
+        insertBetween(comp, outlet->inputs.front());
+    }
+
+    //|........||Adds a unit off the main line (e.g. the sludge line); wire it up with connect()
+    void add(Component* comp) {
+        topologyChanged();
+        components.push_back(comp);
+        reindexFrom(components.size() - 1);
+        comp->markDirty();
+    }
+
+    //|........||Removes a unit, bridging its first input to its first output
+    void removeUnit(Component* comp) {
+        if (comp == inlet || comp == outlet) return;
+        topologyChanged();
+        vary.erase(std::remove_if(vary.begin(), vary.end(),
+            [comp](const ParameterRange& range) { return range.unit == comp; }), vary.end());
+        Connection* in = comp->inputs.empty() ? nullptr : comp->inputs.front();
+        Connection* out = comp->outputs.empty() ? nullptr : comp->outputs.front();
+        if (in && out) {
+            Component* downstream = out->to;
+            std::replace(downstream->inputs.begin(), downstream->inputs.end(), out, in);
+            comp->inputs.erase(comp->inputs.begin());
+            in->to = downstream;
+            downstream->markDirty();
+            in->backEdge = in->backEdge || out->backEdge;
+            in->flowParticles.clear();
+        }
+        while (!comp->inputs.empty()) disconnect(comp->inputs.back());
+        while (!comp->outputs.empty()) disconnect(comp->outputs.back());
+
+        int slot = comp->orderIndex;
+        components.erase(components.begin() + slot);
+        reindexFrom(slot);
+        delete comp;
+
+        if (in) relayoutFrom(in->from);
+    }
+
+    //|........||Points an existing edge at a new downstream unit
+    void rewire(Connection* conn, Component* newTo) {
+        if (newTo == inlet || newTo == conn->to) return;
+        topologyChanged();
+        eraseValue(conn->to->inputs, conn);
+        conn->to->markDirty();
+        conn->to = newTo;
+        newTo->inputs.push_back(conn);
+        newTo->markDirty();
+        conn->backEdge = false;
+        conn->flowParticles.clear();
+        repairOrder(conn);
+    }
+
+    //|........||Drops every unit between inlet and outlet
+    void clear() {
+        for (auto& conn : connections) delete conn;
+        connections.clear();
+        for (auto& comp : components) {
+            if (comp != inlet && comp != outlet) delete comp;
+        }
+        components.clear();
+        inlet->outputs.clear();
+        outlet->inputs.clear();
+        components.push_back(inlet);
+        components.push_back(outlet);
+        reindexFrom(0);
+        connect(inlet, outlet);
+        markAllDirty();
+        simulatedTime = 0.0;
+        treatedVolume = 0.0;
+        compliance.reset();
+        vary.clear();
+    }
+
+    void step(float deltaTime) {
+        PROFILE_SCOPE(PROFILE_PLANT_STEP);
+        TRACE_SCOPE(mode == STEADY_STATE ? "Plant step (steady state)" : "Plant step (dynamic)");
+        bool parallel = pool && components.size() >= parallelMinUnits;
+        if (mode == STEADY_STATE) {
+            if (fused) {
+                fused->step();
+                return;
+            }
+            if (hasLoops()) {
+                if (anyDirty()) lastSolve = solveSteadyState();
+                return;
+            }
+            if (parallel && !scheduleValid) buildSchedule();
+            if (parallel && segments.size() > 1 && !hasBackEdges) stepSteadyStateParallel();
+            else stepSteadyState();
+        } else {
+            float simulated = deltaTime * timeScale;
+            if (fixedStep <= 0.0f) {
+                advanceClock(simulated, parallel);
+                return;
+            }
+            stepBacklog += simulated;
+            int steps = 0;
+            while (stepBacklog >= fixedStep && steps < maxStepsPerCall) {
+                advanceClock(fixedStep, parallel);
+                stepBacklog -= fixedStep;
+                ++steps;
+            }
+            //|........||Falling behind (e.g. a slow frame) drops the backlog instead of spiralling
+            if (steps == maxStepsPerCall) stepBacklog = 0.0f;
+        }
+    }
+
+    //|........||One pass in evaluation order; clean units are skipped, so an idle plant only checks flags
+    void stepSteadyState() {
+        for (auto& comp : components) {
+            evaluateSteady(comp);
+        }
+    }
+
+    //|........||Segments start as soon as every upstream segment is done, so parallel trains run
+    //|........||concurrently and a join (e.g. a Mixer) starts after its last branch finishes
+    void stepSteadyStateParallel() {
+        if (!anyDirty()) return;
+
+        for (size_t i = 0; i < segments.size(); ++i) {
+            pending[i].store(segments[i].dependencies, std::memory_order_relaxed);
+        }
+        remaining.store((int)segments.size(), std::memory_order_release);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i].dependencies == 0) pool->submit({&Plant::runSegment, this, (int)i});
+        }
+        pool->helpUntil(remaining);
+    }
+
+    //|........||Recycle loops: the waters on the back edges (tear streams) are the unknowns of x = G(x),
+    //|........||where G is one sweep of the evaluation order. Starting from the last solution and with
+    //|........||Anderson acceleration this takes tens of sweeps instead of thousands of substitution steps.
+    SteadyStateReport solveSteadyState() {
+        SteadyStateReport report;
+        std::vector<Connection*> tears;
+        for (auto& conn : connections) {
+            if (conn->backEdge) tears.push_back(conn);
+        }
+        report.evaluations = 1;
+        if (tears.empty()) {
+            stepSteadyState();
+            return report;
+        }
+
+        //|........||Unknowns are scaled by their starting magnitude so pathogens (1e6) and pH weigh alike
+        std::vector<double> x = packTears(tears);
+        std::vector<double> scale(x.size());
+        for (size_t i = 0; i < x.size(); ++i) {
+            scale[i] = std::max(std::fabs(x[i]), 1.0);
+            x[i] /= scale[i];
+        }
+        AndersonAccelerator accelerator;
+        accelerator.depth = andersonDepth;
+        LoopSolveScope scope(components);
+        report.converged = false;
+        report.evaluations = 0;
+        for (int iteration = 0; iteration < steadyMaxIterations; ++iteration) {
+            for (size_t k = 0; k < tears.size(); ++k) {
+                Water& water = tears[k]->water;
+                const double* values = &x[k * TEAR_STRIDE];
+                const double* scales = &scale[k * TEAR_STRIDE];
+                for (int p = 0; p < PARAMETER_COUNT; ++p) water.parameters[p] = float(values[p] * scales[p]);
+                water.flow = float(values[PARAMETER_COUNT] * scales[PARAMETER_COUNT]);
+                tears[k]->to->markDirty();
+            }
+            stepSteadyState();
+            ++report.evaluations;
+
+            std::vector<double> g = packTears(tears);
+            double residual = 0.0;
+            for (size_t i = 0; i < g.size(); ++i) {
+                g[i] /= scale[i];
+                residual = std::max(residual, std::fabs(g[i] - x[i]));
+            }
+            report.iterations = iteration + 1;
+            report.residual = residual;
+            report.residuals.push_back(residual);
+            if (residual <= steadyTolerance) {
+                //|........||Everything downstream already saw water within tolerance of the fixed point
+                for (auto& conn : tears) conn->to->dirty.store(false, std::memory_order_relaxed);
+                report.converged = true;
+                break;
+            }
+            accelerator.next(x, g);
+            for (auto& value : x) value = std::max(value, 0.0);
+        }
+        return report;
+    }
+
+    //|........||Every unit advances, then water moves one connection downstream
+    void stepDynamic(float deltaTime) {
+        for (auto& comp : components) {
+            advanceDynamic(comp, deltaTime);
+        }
+        for (auto& comp : components) {
+            sendOutlets(comp, deltaTime);
+        }
+        for (auto& comp : components) {
+            if (comp != inlet) comp->gatherInlet();
+        }
+    }
+
+    //|........||Same three phases as stepDynamic, each one split across the pool
+    void stepDynamicParallel(float deltaTime) {
+        int count = (int)components.size();
+        pool->parallelFor(count, [this, deltaTime](int begin, int end) {
+            for (int i = begin; i < end; ++i) advanceDynamic(components[i], deltaTime);
+        });
+        pool->parallelFor(count, [this, deltaTime](int begin, int end) {
+            for (int i = begin; i < end; ++i) sendOutlets(components[i], deltaTime);
+        });
+        pool->parallelFor(count, [this](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                if (components[i] != inlet) components[i]->gatherInlet();
+            }
+        });
+    }
+
+    //|........||Binds the first compiled pipeline matching this plant, if any. Defined after pipelineCatalog.
+    bool fuse();
+
+    //|........||Builds the table of every unit with a surrogate around the water it sees now, so call it after
+    //|........||a steady solve at a representative influent. Returns how many reached their tolerance.
+    int buildSurrogates() {
+        int built = 0;
+        for (auto& comp : components) {
+            if (comp->surrogate && comp->surrogate->build(*comp)) ++built;
+        }
+        return built;
+    }
+
+    void setMode(SimulationMode newMode) {
+        mode = newMode;
+        markAllDirty();
+        for (auto& conn : connections) conn->resetTransport();
+        resetEnergy();
+        compliance.reset();
+    }
+
+    //|........||"unit: reason" for the first unit whose last solve did not converge; empty if every one did
+    std::string solverError() const {
+        for (auto& comp : components) {
+            if (const char* reason = comp->solverError()) return comp->name + ": " + reason;
+        }
+        return "";
+    }
+
+    //|........||Power summed over every metered unit (blowers, pumps) and the energy spent per m³ of
+    //|........||influent: accumulated over the dynamic run, or instantaneous in steady state
+    float powerDraw() const {
+        float total = 0.0f;
+        for (auto& comp : components) {
+            if (EnergyMeter* meter = comp->energyMeter()) total += meter->power;
+        }
+        return total;
+    }
+
+    float aerationPower() const {
+        float total = 0.0f;
+        for (auto& comp : components) {
+            if (Aeration* aeration = comp->aerationSystem()) total += aeration->meter.power;
+        }
+        return total;
+    }
+
+    double energyPerVolume() const {
+        double energy = 0.0;
+        for (auto& comp : components) {
+            if (EnergyMeter* meter = comp->energyMeter()) energy += meter->energy;
+        }
+        if (treatedVolume > 0.0) return energy / treatedVolume;
+        float flow = inlet->outletWater.flow;
+        return flow > 0.0f ? powerDraw() * 24.0 / flow : 0.0;
+    }
+
+    void resetEnergy() {
+        treatedVolume = 0.0;
+        for (auto& comp : components) {
+            if (EnergyMeter* meter = comp->energyMeter()) meter->reset();
+        }
+    }
+
+    void markAllDirty() {
+        for (auto& comp : components) comp->markDirty();
+    }
+
+    bool hasLoops() const {
+        for (auto& conn : connections) {
+            if (conn->backEdge) return true;
+        }
+        return false;
+    }
+
+    //|........||Derivatives of the steady-state effluent with respect to `fields` (unit parameters, or inlet
+    //|........||flow and concentrations), by forward-mode AD: after the float solve, one Dual sweep of the
+    //|........||evaluation order per DUAL_WIDTH fields. Around recycle loops the sweep repeats until the
+    //|........||derivatives on the back edges settle. gradient[i][p] = d effluent[p] / d *fields[i].
+    bool differentiateSteadyState(const std::vector<const float*>& fields,
+        std::vector<std::array<double, PARAMETER_COUNT>>& gradient, std::string& error) {
+        if (mode != STEADY_STATE) {
+            error = "derivatives are taken at steady state";
+            return false;
+        }
+        step(0.0f);
+        error = solverError();
+        if (!error.empty()) return false;
+        gradient.assign(fields.size(), {});
+        //|........||One dual water per connection; each unit reads and writes its own by pointer
+        std::vector<DualWater> carried(connections.size());
+        std::map<const Connection*, DualWater*> slotOf;
+        for (size_t c = 0; c < connections.size(); ++c) slotOf[connections[c]] = &carried[c];
+        std::vector<std::vector<const DualWater*>> inputSlots(components.size());
+        std::vector<std::vector<DualWater*>> outputSlots(components.size());
+        for (size_t u = 0; u < components.size(); ++u) {
+            for (auto& conn : components[u]->inputs) inputSlots[u].push_back(slotOf[conn]);
+            for (auto& conn : components[u]->outputs) outputSlots[u].push_back(slotOf[conn]);
+        }
+        std::vector<DualWater> outs;
+        DualWater in, effluent;
+        const int maxSweeps = hasLoops() ? 500 : 1;
+        LoopSolveScope scope(components);
+        for (size_t first = 0; first < fields.size(); first += DUAL_WIDTH) {
+            DualSeeds seeds;
+            seeds.width = int(std::min<size_t>(DUAL_WIDTH, fields.size() - first));
+            for (int j = 0; j < seeds.width; ++j) seeds.fields[j] = fields[first + j];
+            for (size_t c = 0; c < connections.size(); ++c) {
+                carried[c].flow = connections[c]->water.flow;
+                for (int p = 0; p < PARAMETER_COUNT; ++p) carried[c].parameters[p] = connections[c]->water.parameters[p];
+            }
+            bool settled = false;
+            for (int sweep = 0; sweep < maxSweeps && !settled; ++sweep) {
+                double change = 0.0;
+                for (size_t u = 0; u < components.size(); ++u) {
+                    Component* comp = components[u];
+                    if (comp == inlet) {
+                        in.flow = seeds(inlet->outletWater.flow);
+                        for (int p = 0; p < PARAMETER_COUNT; ++p) in.parameters[p] = seeds(inlet->outletWater.parameters[p]);
+                        outs.assign(std::max<size_t>(comp->outputs.size(), 1), in);
+                    } else {
+                        if (inputSlots[u].empty()) in = DualWater();
+                        else blendSlots(inputSlots[u], in);
+                        if (comp == outlet) effluent = in;
+                        comp->differentiate(in, outs, seeds);
+                    }
+                    for (size_t k = 0; k < outputSlots[u].size() && k < outs.size(); ++k) {
+                        DualWater& slot = *outputSlots[u][k];
+                        if (comp->outputs[k]->backEdge) {
+                            for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                                for (int j = 0; j < seeds.width; ++j) {
+                                    double before = slot.parameters[p].d[j], after = outs[k].parameters[p].d[j];
+                                    change = std::max(change, std::fabs(after - before) / std::max(1.0, std::fabs(after)));
+                                }
+                            }
+                        }
+                        slot = outs[k];
+                    }
+                }
+                settled = maxSweeps == 1 || change < 1e-9;
+            }
+            if (!settled) {
+                error = "derivatives around the recycle loops did not settle";
+                return false;
+            }
+            for (int j = 0; j < seeds.width; ++j) {
+                for (int p = 0; p < PARAMETER_COUNT; ++p) gradient[first + j][p] = effluent.parameters[p].d[j];
+            }
+        }
+        return true;
+    }
+
+    //|........||Steady-state effluent in double precision: the float engine's results carry rounding of about
+    //|........||1e-7 per operation, which cancellation (a pathogen count less 99.999 % of itself) magnifies.
+    //|........||One sweep of the evaluation order over a double water per connection, repeated around
+    //|........||recycle loops until the back edges settle. `carried` holds those waters between calls, so the
+    //|........||next solve starts where this one ended; an empty one starts from the connections' float waters.
+    bool solvePrecise(std::vector<PreciseWater>& carried, PreciseWater& effluent, std::string& error) {
+        if (mode != STEADY_STATE) {
+            error = "double precision solves the steady state";
+            return false;
+        }
+        if (preciseInputs.size() != components.size()) {
+            std::map<const Connection*, int> indexOf;
+            for (size_t c = 0; c < connections.size(); ++c) indexOf[connections[c]] = int(c);
+            preciseInputs.assign(components.size(), {});
+            preciseOutputs.assign(components.size(), {});
+            for (size_t u = 0; u < components.size(); ++u) {
+                for (auto& conn : components[u]->inputs) preciseInputs[u].push_back(indexOf[conn]);
+                for (auto& conn : components[u]->outputs) preciseOutputs[u].push_back(indexOf[conn]);
+            }
+        }
+        if (carried.size() != connections.size()) {
+            carried.resize(connections.size());
+            for (size_t c = 0; c < connections.size(); ++c) carried[c] = preciseOf(connections[c]->water);
+        }
+        const int maxSweeps = hasLoops() ? 2000 : 1;
+        LoopSolveScope scope(components);
+        thread_local std::vector<PreciseWater> outs;
+        thread_local std::vector<const PreciseWater*> sources;
+        PreciseWater in;
+        bool settled = false;
+        for (int sweep = 0; sweep < maxSweeps && !settled; ++sweep) {
+            double change = 0.0;
+            for (size_t u = 0; u < components.size(); ++u) {
+                Component* comp = components[u];
+                if (comp == inlet) {
+                    in = preciseOf(inlet->outletWater);
+                    outs.assign(std::max<size_t>(comp->outputs.size(), 1), in);
+                } else {
+                    const std::vector<int>& inputs = preciseInputs[u];
+                    if (inputs.empty()) in = PreciseWater();
+                    else if (inputs.size() == 1) in = carried[inputs.front()];
+                    else {
+                        sources.clear();
+                        for (int c : inputs) sources.push_back(&carried[c]);
+                        blendSlots(sources, in);
+                    }
+                    if (comp == outlet) effluent = in;
+                    comp->evaluatePrecise(in, outs);
+                }
+                const std::vector<int>& targets = preciseOutputs[u];
+                for (size_t k = 0; k < targets.size() && k < outs.size(); ++k) {
+                    PreciseWater& slot = carried[targets[k]];
+                    if (comp->outputs[k]->backEdge) {
+                        auto moved = [&](double before, double after) {
+                            change = std::max(change, std::fabs(after - before) / std::max(1.0, std::fabs(after)));
+                        };
+                        moved(slot.flow, outs[k].flow);
+                        for (int p = 0; p < PARAMETER_COUNT; ++p) moved(slot.parameters[p], outs[k].parameters[p]);
+                    }
+                    slot = outs[k];
+                }
+            }
+            settled = maxSweeps == 1 || change < 1e-13;
+        }
+        if (!settled) {
+            error = "the recycle loops did not settle";
+            return false;
+        }
+        error = solverError();
+        return error.empty();
+    }
+
+private:
+    int visitEpoch = 0;
+
+    //|........||Brackets the sweeps of one recycle-loop solve for every unit (see Component::beginLoopSolve)
+    struct LoopSolveScope {
+        const std::vector<Component*>& units;
+        explicit LoopSolveScope(const std::vector<Component*>& u) : units(u) {
+            for (auto& comp : units) comp->beginLoopSolve();
+        }
+        ~LoopSolveScope() {
+            for (auto& comp : units) comp->endLoopSolve();
+        }
+    };
+
+    //|........||Parallel schedule, rebuilt lazily after a topology edit
+    bool scheduleValid = false;
+    bool hasBackEdges = false;
+    std::vector<ScheduleSegment> segments;
+    std::vector<std::atomic<int>> pending;
+    std::atomic<int> remaining{0};
+    float stepBacklog = 0.0f;  //|........||Simulated seconds not yet stepped
+
+    static const int TEAR_STRIDE = PARAMETER_COUNT + 1; //|........||Parameters then flow, per tear stream
+
+    //|........||Per unit, the connection indices of its inputs and outputs for solvePrecise
+    std::vector<std::vector<int>> preciseInputs;
+    std::vector<std::vector<int>> preciseOutputs;
+
+    void topologyChanged() {
+        scheduleValid = false;
+        fused.reset();
+        preciseInputs.clear();
+    }
+
+    bool anyDirty() const {
+        for (auto& comp : components) {
+            if (comp->dirty.load(std::memory_order_relaxed)) return true;
+        }
+        return false;
+    }
+
+    static std::vector<double> packTears(const std::vector<Connection*>& tears) {
+        std::vector<double> values(tears.size() * TEAR_STRIDE);
+        for (size_t k = 0; k < tears.size(); ++k) {
+            const Water& water = tears[k]->water;
+            for (int p = 0; p < PARAMETER_COUNT; ++p) values[k * TEAR_STRIDE + p] = water.parameters[p];
+            values[k * TEAR_STRIDE + PARAMETER_COUNT] = water.flow;
+        }
+        return values;
+    }
+
+    void advanceClock(float deltaTime, bool parallel) {
+        if (parallel) stepDynamicParallel(deltaTime);
+        else stepDynamic(deltaTime);
+        simulatedTime += deltaTime;
+        treatedVolume += inlet->outletWater.flow * deltaTime / 86400.0;
+        compliance.sample(simulatedTime, outlet->inletWater);
+    }
+
+    void evaluateSteady(Component* comp) {
+        if (!comp->dirty.load(std::memory_order_relaxed)) return;
+        comp->dirty.store(false, std::memory_order_relaxed);
+        if (comp != inlet) {
+            comp->gatherInlet();
+            PROFILE_SCOPE(PROFILE_UNIT_SIMULATE(comp));
+            TRACE_SCOPE(comp->name.c_str());
+            if (!comp->surrogate || !comp->surrogate->apply(*comp)) comp->simulate(0.0f);
+        }
+        comp->pushOutlets();
+    }
+
+    void advanceDynamic(Component* comp, float deltaTime) {
+        if (comp == inlet) return;
+        PROFILE_SCOPE(PROFILE_UNIT_SIMULATE(comp));
+        TRACE_SCOPE(comp->name.c_str());
+        comp->simulate(deltaTime);
+    }
+
+    static void sendOutlets(Component* comp, float deltaTime) {
+        for (size_t k = 0; k < comp->outputs.size(); ++k) {
+            comp->outputs[k]->transport(comp->outletFor(k), deltaTime);
+        }
+    }
+
+    static void runSegment(void* context, int index) {
+        Plant* plant = static_cast<Plant*>(context);
+        const ScheduleSegment& segment = plant->segments[index];
+        {
+            TRACE_SCOPE("Segment");
+            for (auto& comp : segment.units) plant->evaluateSteady(comp);
+        }
+        for (int next : segment.dependents) {
+            if (plant->pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                plant->pool->submit({&Plant::runSegment, plant, next});
+            }
+        }
+        plant->remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    //|........||A unit extends its upstream unit's segment when it is that unit's only successor and
+    //|........||has no other input; splits and joins start new segments
+    void buildSchedule() {
+        segments.clear();
+        std::vector<int> segmentOf(components.size(), -1);
+        hasBackEdges = false;
+        for (auto& conn : connections) hasBackEdges |= conn->backEdge;
+
+        auto forwardCount = [](const std::vector<Connection*>& links) {
+            int count = 0;
+            for (auto& link : links) count += !link->backEdge;
+            return count;
+        };
+
+        for (auto& comp : components) {
+            std::vector<int> upstream;
+            for (auto& link : comp->inputs) {
+                if (link->backEdge) continue;
+                int seg = segmentOf[link->from->orderIndex];
+                if (std::find(upstream.begin(), upstream.end(), seg) == upstream.end()) upstream.push_back(seg);
+            }
+            bool extends = false;
+            if (upstream.size() == 1 && forwardCount(comp->inputs) == 1) {
+                Component* prev = nullptr;
+                for (auto& link : comp->inputs) {
+                    if (!link->backEdge) prev = link->from;
+                }
+                extends = forwardCount(prev->outputs) == 1 && segments[upstream[0]].units.back() == prev;
+            }
+            if (extends) {
+                segments[upstream[0]].units.push_back(comp);
+                segmentOf[comp->orderIndex] = upstream[0];
+                continue;
+            }
+            int index = (int)segments.size();
+            segments.push_back(ScheduleSegment());
+            segments.back().units.push_back(comp);
+            segments.back().dependencies = (int)upstream.size();
+            for (int seg : upstream) segments[seg].dependents.push_back(index);
+            segmentOf[comp->orderIndex] = index;
+        }
+        pending = std::vector<std::atomic<int>>(segments.size());
+        scheduleValid = true;
+    }
+
+    template <typename T>
+    static void eraseValue(std::vector<T>& values, const T& value) {
+        values.erase(std::remove(values.begin(), values.end(), value), values.end());
+    }
+
+    void reindexFrom(size_t first) {
+        for (size_t i = first; i < components.size(); ++i) {
+            components[i]->orderIndex = (int)i;
+        }
+    }
+
+    //|........||Packs the chain after `start`, stopping at the first unit already in place
+    void relayoutFrom(Component* start) {
+        Component* prev = start;
+        while (!prev->outputs.empty() && !prev->outputs.front()->backEdge) {
+            Component* next = prev->outputs.front()->to;
+            float x = prev->position.x + UNIT_SPACING;
+            if (next->position.x == x) break;
+            next->moveTo(sf::Vector2f(x, next->position.y));
+            prev = next;
+        }
+    }
+
+    //|........||Pearce-Kelly repair: only units ordered between the edge endpoints are moved.
+    //|........||An edge whose target already reaches its source closes a loop and is marked as a back edge.
+    void repairOrder(Connection* conn) {
+        int lower = conn->to->orderIndex;
+        int upper = conn->from->orderIndex;
+        if (lower > upper) return;
+
+        std::vector<Component*> forward;
+        std::vector<Component*> backward;
+        ++visitEpoch;
+        if (!collect(conn->to, upper, true, forward)) {
+            conn->backEdge = true;
+            return;
+        }
+        collect(conn->from, lower, false, backward);
+
+        auto byOrder = [](Component* a, Component* b) { return a->orderIndex < b->orderIndex; };
+        std::sort(forward.begin(), forward.end(), byOrder);
+        std::sort(backward.begin(), backward.end(), byOrder);
+
+        std::vector<int> slots;
+        for (auto& comp : backward) slots.push_back(comp->orderIndex);
+        for (auto& comp : forward) slots.push_back(comp->orderIndex);
+        std::sort(slots.begin(), slots.end());
+
+        size_t next = 0;
+        for (auto& comp : backward) components[slots[next++]] = comp;
+        for (auto& comp : forward) components[slots[next++]] = comp;
+        for (int slot : slots) components[slot]->orderIndex = slot;
+    }
+
+    //|........||Depth-first walk bounded to the affected slice; returns false if the walk reaches `limit` itself
+    bool collect(Component* comp, int limit, bool downstream, std::vector<Component*>& found) {
+        comp->visitMark = visitEpoch;
+        found.push_back(comp);
+        const std::vector<Connection*>& links = downstream ? comp->outputs : comp->inputs;
+        for (auto& link : links) {
+            if (link->backEdge) continue;
+            Component* next = downstream ? link->to : link->from;
+            if (downstream && next->orderIndex == limit) return false;
+            if (next->visitMark == visitEpoch) continue;
+            if (downstream ? next->orderIndex < limit : next->orderIndex > limit) {
+                if (!collect(next, limit, downstream, found)) return false;
+            }
+        }
+        return true;
+    }
+};
+
+//|........||Plant::step for a fixed chain inlet -> Units... -> outlet, e.g.
+//|........||Pipeline<PrimaryClarifier, AerationTank, SecondaryClarifier, UVDisinfection>. The stages expand at
+//|........||compile time into one function that calls each unit's own simulate() by name, so the kernels inline
+//|........||into it instead of sitting behind a virtual call each. Each stage keeps evaluateSteady's rules (a
+//|........||clean unit is skipped, a downstream unit is flagged only when its water changed) and the waters
+//|........||stay in the chain's pipes, so the UI, monitors and the dynamic engine see the plant as the sweep
+//|........||leaves it. Units with a surrogate table are not fused.
+template <typename... Units>
+class Pipeline : public FusedChain {
+public:
+    static constexpr size_t LENGTH = sizeof...(Units);
+
+    //|........||nullptr unless `plant` is exactly that chain, one pipe between neighbours
+    static std::unique_ptr<FusedChain> bind(Plant& plant) {
+        if (plant.components.size() != LENGTH + 2 || plant.connections.size() != LENGTH + 1
+            || typeid(*plant.inlet) != typeid(Inlet) || typeid(*plant.outlet) != typeid(Outlet)) {
+            return nullptr;
+        }
+        std::unique_ptr<Pipeline> chain(new Pipeline());
+        std::array<Component*, LENGTH + 1> stages;
+        Component* from = plant.inlet;
+        for (size_t k = 0; k <= LENGTH; ++k) {
+            if (from->outputs.size() != 1) return nullptr;
+            Connection* pipe = from->outputs.front();
+            if (pipe->backEdge || pipe->to->inputs.size() != 1) return nullptr;
+            chain->pipes[k] = pipe;
+            from = stages[k] = pipe->to;
+        }
+        if (from != plant.outlet || !chain->take(stages, std::index_sequence_for<Units...>())) return nullptr;
+        chain->inlet = plant.inlet;
+        chain->outlet = plant.outlet;
+        for (size_t k = 0; k < LENGTH; ++k) chain->text += (k ? " -> " : "") + stages[k]->name;
+        return chain;
+    }
+
+    const char* describe() const override {
+        return text.c_str();
+    }
+
+    void step() override {
+        TRACE_SCOPE("Fused chain");
+        if (takeDirty(inlet)) send(pipes[0], inlet->outletWater);
+        run(std::index_sequence_for<Units...>());
+        if (takeDirty(outlet)) {
+            outlet->inletWater = pipes[LENGTH]->water;
+            outlet->Component::simulate(0.0f);
+        }
+    }
+
+private:
+    Component* inlet = nullptr;
+    Component* outlet = nullptr;
+    std::tuple<Units*...> units;
+    std::array<Connection*, LENGTH + 1> pipes{};   //|........||pipes[k] feeds stage k
+    std::string text;
+
+    template <size_t... I>
+    bool take(const std::array<Component*, LENGTH + 1>& stages, std::index_sequence<I...>) {
+        bool exact = ((typeid(*stages[I]) == typeid(Units) && !stages[I]->surrogate) && ...);
+        if (exact) units = std::make_tuple(static_cast<Units*>(stages[I])...);
+        return exact;
+    }
+
+    template <size_t... I>
+    void run(std::index_sequence<I...>) {
+        (stage<I>(), ...);
+    }
+
+    template <size_t I>
+    void stage() {
+        auto* unit = std::get<I>(units);
+        typedef typename std::remove_pointer<decltype(unit)>::type Unit;
+        if (!takeDirty(unit)) return;
+        unit->inletWater = pipes[I]->water;
+        unit->Unit::simulate(0.0f);
+        send(pipes[I + 1], unit->outletWater);
+    }
+
+    static bool takeDirty(Component* comp) {
+        if (!comp->dirty.load(std::memory_order_relaxed)) return false;
+        comp->dirty.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    static void send(Connection* pipe, const Water& water) {
+        if (pipe->water != water) {
+            pipe->water = water;
+            pipe->to->markDirty();
+        }
+    }
+};
+
+//|........||Chains compiled into the engine; add the designs that sensitivity and calibration studies run most
+const std::vector<std::unique_ptr<FusedChain> (*)(Plant&)>& pipelineCatalog() {
+    static const std::vector<std::unique_ptr<FusedChain> (*)(Plant&)> catalog = {
+        &Pipeline<PrimaryClarifier, AerationTank, SecondaryClarifier, UVDisinfection>::bind,
+        &Pipeline<PrimaryClarifier, AerationTank, SecondaryClarifier, ChlorineDisinfectionUnit>::bind,
+        &Pipeline<PrimaryClarifier, AerationTank, SecondaryClarifier>::bind,
+        &Pipeline<PrimaryClarifier, AerationTank, NitrificationTank, SecondaryClarifier>::bind,
+        &Pipeline<PrimarySedimentationTank, AerationTank, SecondaryClarifier, UVDisinfection>::bind,
+    };
+    return catalog;
+}
+
+bool Plant::fuse() {
+    fused.reset();
+    for (auto bind : pipelineCatalog()) {
+        fused = bind(*this);
+        if (fused) return true;
+    }
+    return false;
+}
+
+//|........||Inlet -> Splitter -> `trains` identical trains -> Mixer -> UV Disinfection -> Outlet.
+//|........||Each train repeats Primary Clarifier, Aeration Tank, Secondary Clarifier `stages` times.
+void buildParallelTrains(Plant& plant, int trains, int stages = 1) {
+    plant.clear();
+    Splitter* splitter = new Splitter(sf::Vector2f(0, 440));
+    Mixer* mixer = new Mixer(sf::Vector2f(0, 440));
+    plant.append(splitter);
+    plant.append(mixer);
+    plant.append(new UVDisinfection(sf::Vector2f(0, 440)));
+    for (int t = 1; t < trains; ++t) {
+        plant.connect(splitter, mixer);
+    }
+    for (int t = 0; t < trains; ++t) {
+        float y = 440 + (t - (trains - 1) * 0.5f) * 150.0f;
+        Connection* edge = splitter->outputs[t];
+        for (int stage = 0; stage < stages; ++stage) {
+            sf::Vector2f pos(0, y);
+            Component* units[] = {new PrimaryClarifier(pos), new AerationTank(pos), new SecondaryClarifier(pos)};
+            for (Component* unit : units) {
+                plant.insertBetween(unit, edge);
+                unit->moveTo(sf::Vector2f(unit->position.x, y));
+                edge = unit->outputs.front();
+            }
+        }
+    }
+}
+
+//|........||Inlet -> Mixer -> Aeration Tank -> Secondary Clarifier -> Splitter -> Outlet, with the splitter
+//|........||returning `recycleRatio` times the influent flow to the mixer (return activated sludge)
+void buildRecycleLoop(Plant& plant, float recycleRatio) {
+    plant.clear();
+    Mixer* mixer = new Mixer(sf::Vector2f(0, 440));
+    Splitter* splitter = new Splitter(sf::Vector2f(0, 440));
+    plant.append(mixer);
+    plant.append(new AerationTank(sf::Vector2f(0, 440)));
+    plant.append(new SecondaryClarifier(sf::Vector2f(0, 440)));
+    plant.append(splitter);
+    Connection* recycle = plant.connect(splitter, mixer);
+    recycle->diameter = 6.0f;
+    splitter->splitFractions = {1.0f, recycleRatio};
+}
+
+//|........||Liquid line with a sludge line below it: primary and waste activated sludge are thickened, digested
+//|........||and dewatered; supernatant and filtrate return to the headworks mixer (loops solved as recycles)
+void buildSludgeLine(Plant& plant) {
+    plant.clear();
+    Mixer* headworks = new Mixer(sf::Vector2f(0, 440));
+    PrimaryClarifier* primary = new PrimaryClarifier(sf::Vector2f(0, 440));
+    SecondaryClarifier* secondary = new SecondaryClarifier(sf::Vector2f(0, 440));
+    plant.append(headworks);
+    plant.append(primary);
+    plant.append(new AerationTank(sf::Vector2f(0, 440)));
+    plant.append(secondary);
+    plant.append(new UVDisinfection(sf::Vector2f(0, 440)));
+
+    float x = primary->position.x;
+    Mixer* sludgeMixer = new Mixer(sf::Vector2f(x, 700));
+    Thickener* thickener = new Thickener(sf::Vector2f(x + 150, 700));
+    SludgeDigester* digester = new SludgeDigester(sf::Vector2f(x + 300, 700));
+    digester->volume = 1000.0f;   //|........||about 20 days of the thickened sludge at 10000 m³/day
+    DryingBed* dewatering = new DryingBed(sf::Vector2f(x + 450, 700));
+    Outlet* cake = new Outlet(sf::Vector2f(x + 600, 700));
+    cake->name = "Sludge Cake";
+    for (Component* unit : std::initializer_list<Component*>{sludgeMixer, thickener, digester, dewatering, cake}) {
+        plant.add(unit);
+    }
+    //|........||Output order matters: a settling unit's second output is its underflow, and for the
+    //|........||thickener and the drying bed the solids leave through the first and the water through the second
+    plant.connect(primary, sludgeMixer);
+    plant.connect(secondary, sludgeMixer);
+    plant.connect(sludgeMixer, thickener);
+    plant.connect(thickener, digester);
+    plant.connect(thickener, headworks);
+    plant.connect(digester, dewatering);
+    plant.connect(dewatering, cake);
+    plant.connect(dewatering, headworks);
+}
+
+//|........||Estructura para almacenar datos históricos
+struct ParameterHistory {
+    std::deque<float> values;
+    size_t maxSize;
+    ParameterHistory(size_t size = 100) : maxSize(size) {}
+    void addValue(float val) {
+        if (values.size() >= maxSize) values.pop_front();
+        values.push_back(val);
+    }
+};
+
+//|........||Mapa para almacenar el historial de cada parámetro
+std::map<WaterParameter, ParameterHistory> parameterHistories;
+
+//|........||Actualizar los historiales después de cada simulación
+void updateHistories(const std::vector<Component*>& components) {
+    PROFILE_SCOPE(PROFILE_HISTORIES);
+    TRACE_SCOPE("updateHistories");
+    for (const auto& comp : components) {
+        for (int p = 0; p < PARAMETER_COUNT; ++p) {
+            parameterHistories[(WaterParameter)p].addValue(comp->outletWater.parameters[p]);
+        }
+    }
+}
+
+//|........||Función para dibujar gráficos
+void drawGraphs() {
+    PROFILE_SCOPE(PROFILE_GRAPHS);
+    TRACE_SCOPE("drawGraphs");
+    ImGui::Begin("Gráficos de Parámetros");
+
+    for (auto& [param, history] : parameterHistories) {
+        std::string label = parameterToString(param);
+        if (ImGui::CollapsingHeader(label.c_str())) {
+            if (!history.values.empty()) {
+                std::vector<float> plotData(history.values.begin(), history.values.end());
+                ImGui::PlotLines(" ", plotData.data(), plotData.size(), 0, NULL, 0.0f, 1000.0f, ImVec2(0, 100));
+            }
+        }
+    }
+
+    ImGui::End();
+}
+
+#ifdef WWTPSIM_PROFILE
+//|........||Profiler window: frame phases and the most expensive units, with rolling percentiles
+void drawProfiler(const Plant& plant) {
+    Profiler& profiler = Profiler::instance();
+    ImGui::Begin("Profiler");
+
+    static std::vector<float> frameSeries;
+    profiler.series(PROFILE_FRAME, frameSeries);
+    float frameMs = profiler.frameMs(PROFILE_FRAME);
+    ImGui::Text("Frame: %.2f ms (p50 %.2f, p95 %.2f, p99 %.2f)", frameMs,
+        profiler.percentileMs(PROFILE_FRAME, 0.50f), profiler.percentileMs(PROFILE_FRAME, 0.95f),
+        profiler.percentileMs(PROFILE_FRAME, 0.99f));
+    if (!frameSeries.empty()) {
+        ImGui::PlotLines("##frame", frameSeries.data(), (int)frameSeries.size(), 0, NULL, 0.0f, 50.0f, ImVec2(0, 60));
+    }
+    if (int extra = profiler.overflowThreads()) {
+        ImGui::Text("%d threads past %d share one overflow counter set", extra, Profiler::MAX_THREADS);
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Phases (share of frame | p50 / p95 / p99 ms):");
+    for (int zone = PROFILE_PLANT_STEP; zone < PROFILE_PHASE_COUNT; ++zone) {
+        float ms = profiler.frameMs(zone);
+        char label[160];
+        std::snprintf(label, sizeof(label), "%s %.3f ms | %.3f / %.3f / %.3f", profileZoneName(zone), ms,
+            profiler.percentileMs(zone, 0.50f), profiler.percentileMs(zone, 0.95f), profiler.percentileMs(zone, 0.99f));
+        ImGui::ProgressBar(frameMs > 0.0f ? ms / frameMs : 0.0f, ImVec2(-1, 0), label);
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Units by rolling mean (simulate + update):");
+    std::vector<std::pair<float, const Component*>> units;
+    for (const auto& comp : plant.components) {
+        units.push_back({profiler.meanMs(PROFILE_UNIT_SIMULATE(comp)) + profiler.meanMs(PROFILE_UNIT_UPDATE(comp)), comp});
+    }
+    std::sort(units.begin(), units.end(), [](const std::pair<float, const Component*>& a, const std::pair<float, const Component*>& b) {
+        return a.first > b.first;
+    });
+    float heaviest = units.empty() ? 0.0f : units.front().first;
+    for (size_t i = 0; i < units.size() && i < 15; ++i) {
+        const Component* comp = units[i].second;
+        char label[160];
+        std::snprintf(label, sizeof(label), "%s  sim %.4f ms (p95 %.4f)  update %.4f ms", comp->name.c_str(),
+            profiler.frameMs(PROFILE_UNIT_SIMULATE(comp)), profiler.percentileMs(PROFILE_UNIT_SIMULATE(comp), 0.95f),
+            profiler.frameMs(PROFILE_UNIT_UPDATE(comp)));
+        ImGui::ProgressBar(heaviest > 0.0f ? units[i].first / heaviest : 0.0f, ImVec2(-1, 0), label);
+    }
+
+    ImGui::End();
+}
+#endif
+
+void setImGuiStyle() {
+    ImGui::StyleColorsDark(); //|........||Usar colores oscuros como base
+
+    ImGuiStyle& style = ImGui::GetStyle();
+    style.WindowRounding = 5.0f;
+    style.FrameRounding = 3.0f;
+    style.GrabRounding = 3.0f;
+
+    //|........||Personalizar colores
+    style.Colors[ImGuiCol_WindowBg] = ImVec4(0.1f, 0.105f, 0.11f, 1.0f);
+    style.Colors[ImGuiCol_Header] = ImVec4(0.2f, 0.205f, 0.21f, 1.0f);
+    style.Colors[ImGuiCol_HeaderHovered] = ImVec4(0.3f, 0.305f, 0.31f, 1.0f);
+    style.Colors[ImGuiCol_HeaderActive] = ImVec4(0.15f, 0.1505f, 0.151f, 1.0f);
+    //|........||Puedes personalizar más colores según prefieras
+}
+
+//|........||Rough costs for train synthesis: installed cost per m³/day of capacity, and the energy per m³ of
+//|........||units whose drive is not metered (metered blowers and pumps add their own power)
+struct UnitCost {
+    float capital = 0.0f;
+    float energy = 0.0f;     //|........||kWh/m³
+};
+
+//|........||Catalogue of unit types by the label shown in "Add Component" and written in plant files
+struct ComponentType {
+    const char* label;
+    Component* (*make)(const sf::Vector2f& position);
+    const std::type_info& type;
+    UnitCost cost;
+};
+
+template <typename T>
+Component* makeComponent(const sf::Vector2f& position) {
+    return new T(position);
+}
+
+//|........||Every unit type in "Add Component" order; plant files, the batch runner and the UI look labels up here
+const std::vector<ComponentType>& componentCatalog() {
+    static const std::vector<ComponentType> catalog = {
+        {"Primary Sedimentation Tank", makeComponent<PrimarySedimentationTank>, typeid(PrimarySedimentationTank), {150.0f, 0.01f}},
+        {"Primary Clarifier", makeComponent<PrimaryClarifier>, typeid(PrimaryClarifier), {180.0f, 0.01f}},
+        {"Aeration Tank", makeComponent<AerationTank>, typeid(AerationTank), {400.0f, 0.0f}},
+        {"Secondary Clarifier", makeComponent<SecondaryClarifier>, typeid(SecondaryClarifier), {200.0f, 0.01f}},
+        {"Chlorine Disinfection Unit", makeComponent<ChlorineDisinfectionUnit>, typeid(ChlorineDisinfectionUnit), {60.0f, 0.01f}},
+        {"UV Disinfection", makeComponent<UVDisinfection>, typeid(UVDisinfection), {90.0f, 0.05f}},
+        {"Anaerobic Filter", makeComponent<AnaerobicFilter>, typeid(AnaerobicFilter), {300.0f, 0.02f}},
+        {"Sludge Digester", makeComponent<SludgeDigester>, typeid(SludgeDigester), {500.0f, 0.05f}},
+        {"Oil and Grease Separator", makeComponent<OilSeparator>, typeid(OilSeparator), {80.0f, 0.01f}},
+        {"Phosphorus Removal Unit", makeComponent<PhosphorusRemovalUnit>, typeid(PhosphorusRemovalUnit), {150.0f, 0.05f}},
+        {"Drying Bed", makeComponent<DryingBed>, typeid(DryingBed), {100.0f, 0.0f}},
+        {"Pump", makeComponent<Pump>, typeid(Pump), {50.0f, 0.0f}},
+        {"Flow Meter", makeComponent<FlowMeter>, typeid(FlowMeter), {10.0f, 0.0f}},
+        {"Water Softener", makeComponent<WaterSoftener>, typeid(WaterSoftener), {200.0f, 0.05f}},
+        {"Activated Carbon Filter", makeComponent<ActivatedCarbonFilter>, typeid(ActivatedCarbonFilter), {350.0f, 0.05f}},
+        {"Heat Exchanger", makeComponent<HeatExchanger>, typeid(HeatExchanger), {120.0f, 0.02f}},
+        {"Metals Removal Unit", makeComponent<MetalsRemovalUnit>, typeid(MetalsRemovalUnit), {250.0f, 0.1f}},
+        {"Membrane Filtration Unit", makeComponent<MembraneFiltrationUnit>, typeid(MembraneFiltrationUnit), {600.0f, 0.3f}},
+        {"Reverse Osmosis Unit", makeComponent<ReverseOsmosisUnit>, typeid(ReverseOsmosisUnit), {1200.0f, 1.5f}},
+        {"Coagulation and Flocculation", makeComponent<CoagulationFlocculation>, typeid(CoagulationFlocculation), {150.0f, 0.05f}},
+        {"Membrane Filtration", makeComponent<MembraneFiltration>, typeid(MembraneFiltration), {550.0f, 0.3f}},
+        {"Chemical Oxidation", makeComponent<ChemicalOxidation>, typeid(ChemicalOxidation), {300.0f, 0.3f}},
+        {"Active Sludge Process", makeComponent<ActiveSludgeProcess>, typeid(ActiveSludgeProcess), {500.0f, 0.0f}},
+        {"Nitrification Tank", makeComponent<NitrificationTank>, typeid(NitrificationTank), {350.0f, 0.15f}},
+        {"Biofilter", makeComponent<Biofilter>, typeid(Biofilter), {300.0f, 0.1f}},
+        {"Filtration", makeComponent<Filtration>, typeid(Filtration), {200.0f, 0.05f}},
+        {"Membrane Bioreactor", makeComponent<MBR>, typeid(MBR), {900.0f, 0.6f}},
+        {"Ozone Disinfection", makeComponent<OzoneDisinfection>, typeid(OzoneDisinfection), {250.0f, 0.15f}},
+        {"Anaerobic-Aerobic Treatment", makeComponent<AnaerobicAerobicFilter>, typeid(AnaerobicAerobicFilter), {450.0f, 0.2f}},
+        {"Electrocoagulation Unit", makeComponent<ElectrocoagulationUnit>, typeid(ElectrocoagulationUnit), {300.0f, 0.5f}},
+        {"Mixer", makeComponent<Mixer>, typeid(Mixer), {0.0f, 0.0f}},
+        {"Splitter", makeComponent<Splitter>, typeid(Splitter), {0.0f, 0.0f}},
+        {"Thickener", makeComponent<Thickener>, typeid(Thickener), {120.0f, 0.02f}},
+        {"Outlet", makeComponent<Outlet>, typeid(Outlet), {0.0f, 0.0f}},
+    };
+    return catalog;
+}
+
+//|........||nullptr for an unknown label
+Component* createComponent(const std::string& label, const sf::Vector2f& position) {
+    for (const ComponentType& entry : componentCatalog()) {
+        if (label == entry.label) return entry.make(position);
+    }
+    return nullptr;
+}
+
+//|........||Catalogue label of a unit, or nullptr for types that cannot be created by name (the inlet)
+const char* componentLabel(const Component* comp) {
+    for (const ComponentType& entry : componentCatalog()) {
+        if (typeid(*comp) == entry.type) return entry.label;
+    }
+    return nullptr;
+}
+
+//|........||Pipe settings by name; integer and flag fields go through float
+const char* const CONNECTION_FIELDS[] = {"diameter", "length", "roughness", "transportDelay", "dispersionTanks",
+    "dispersionFraction"};
+
+bool connectionField(const Connection* conn, const std::string& field, float& value) {
+    if (field == "diameter") value = conn->diameter;
+    else if (field == "length") value = conn->length;
+    else if (field == "roughness") value = conn->roughness;
+    else if (field == "transportDelay") value = conn->transportDelay ? 1.0f : 0.0f;
+    else if (field == "dispersionTanks") value = float(conn->dispersionTanks);
+    else if (field == "dispersionFraction") value = conn->dispersionFraction;
+    else return false;
+    return true;
+}
+
+bool setConnectionField(Connection* conn, const std::string& field, float value) {
+    if (field == "diameter") conn->diameter = value;
+    else if (field == "length") conn->length = value;
+    else if (field == "roughness") conn->roughness = value;
+    else if (field == "transportDelay") conn->transportDelay = value != 0.0f;
+    else if (field == "dispersionTanks") conn->dispersionTanks = std::max(0, int(value));
+    else if (field == "dispersionFraction") conn->dispersionFraction = value;
+    else return false;
+    return true;
+}
+
+//|........||How a plant file asks to be run headless
+struct PlantRun {
+    std::string name;
+    SimulationMode mode = DYNAMIC;
+    double days = 1.0;
+    float step = 60.0f;              //|........||s, dynamic engine step
+    float sampleInterval = 900.0f;   //|........||s between effluent samples
+    std::string influent;            //|........||CSV path, resolved against the plant file's directory
+    std::string measured;            //|........||CSV of measured effluent, for calibration
+    std::vector<PermitLimit> limits;
+    std::map<std::string, UnitCost> costs;   //|........||by catalogue label, over the catalogue's own
+};
+
+//|........||Cost of a unit type for this plant file
+UnitCost unitCost(const std::string& label, const PlantRun& run) {
+    auto it = run.costs.find(label);
+    if (it != run.costs.end()) return it->second;
+    for (const ComponentType& entry : componentCatalog()) {
+        if (label == entry.label) return entry.cost;
+    }
+    return UnitCost();
+}
+
+//|........||Plant files are line based; '#' starts a comment. Ids name units within the file, and
+//|........||"inlet" and "outlet" are predefined.
+//|........||    plant <name>                     mode steady|dynamic     days <d>    step <s>    sample <s>
+//|........||    influent <file.csv>              measured <file.csv>     inlet flow|<KEY> <value>
+//|........||    limit <KEY> [mean|max <window>|p<NN>] <value>   window in d, h or s, e.g. "limit BOD mean 7d 25"
+//|........||    unit <id> <Type>                 appends to the main line, just before the outlet
+//|........||    side <id> <x> <y> <Type>         adds a unit off the main line, wired with connect
+//|........||    connect <from> <to>              disconnect <from> <to>
+//|........||    set <id> <field> <value>         label <id> <display name>
+//|........||    split <id> <fraction>...         pipe <from> <to> <field> <value>
+//|........||    vary <id> <field> <low> <high>   a factor for sensitivity analysis and calibration
+//|........||    cost <capital> <kWh/m³> <Type>   overrides a unit type's cost for train synthesis
+//|........||    surrogate <id> <tolerance> <flow|KEY> <low> <high>...   tabulates the unit (see SurrogateTable)
+//|........||Connections leave a unit in file order, so a settler's second connect is its underflow.
+//|........||`path` names the source in messages and anchors relative influent paths; `ids`, if given,
+//|........||receives the unit of every id.
+bool readPlant(Plant& plant, std::istream& in, const std::string& path, PlantRun& run, std::string& error,
+    std::map<std::string, Component*>* ids = nullptr) {
+    plant.clear();
+    run = PlantRun();
+    run.name = std::filesystem::path(path).stem().string();
+    std::map<std::string, Component*> units = {{"inlet", plant.inlet}, {"outlet", plant.outlet}};
+    std::string line;
+    int number = 0;
+    auto fail = [&](const std::string& message) {
+        error = path + ":" + std::to_string(number) + ": " + message;
+        return false;
+    };
+    auto rest = [](std::istringstream& words) {
+        std::string text;
+        std::getline(words >> std::ws, text);
+        while (!text.empty() && std::isspace((unsigned char)text.back())) text.pop_back();
+        return text;
+    };
+    auto find = [&](const std::string& id) -> Component* {
+        auto it = units.find(id);
+        return it == units.end() ? nullptr : it->second;
+    };
+
+    while (std::getline(in, line)) {
+        ++number;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword)) continue;
+
+        if (keyword == "unit" || keyword == "side") {
+            std::string id;
+            float x = 0.0f, y = 440.0f;
+            words >> id;
+            if (keyword == "side" && !(words >> x >> y)) return fail("side needs <id> <x> <y> <Type>");
+            std::string type = rest(words);
+            if (id.empty() || units.count(id)) return fail("missing or duplicate unit id '" + id + "'");
+            Component* comp = createComponent(type, sf::Vector2f(x, y));
+            if (!comp) return fail("unknown unit type '" + type + "'");
+            if (keyword == "unit") plant.append(comp);
+            else plant.add(comp);
+            units[id] = comp;
+        } else if (keyword == "connect" || keyword == "disconnect") {
+            std::string a, b;
+            words >> a >> b;
+            Component* from = find(a);
+            Component* to = find(b);
+            if (!from || !to) return fail("unknown unit in '" + line + "'");
+            if (keyword == "connect") {
+                plant.connect(from, to);
+            } else {
+                auto it = std::find_if(from->outputs.begin(), from->outputs.end(),
+                    [to](Connection* conn) { return conn->to == to; });
+                if (it == from->outputs.end()) return fail("no connection " + a + " -> " + b);
+                plant.disconnect(*it);
+            }
+        } else if (keyword == "set") {
+            std::string id, field;
+            float value;
+            if (!(words >> id >> field >> value)) return fail("set needs <id> <field> <value>");
+            Component* comp = find(id);
+            if (!comp) return fail("unknown unit '" + id + "'");
+            float* target = comp->parameter(field);
+            if (!target) return fail("unknown field '" + field + "'");
+            *target = value;
+            comp->markDirty();
+        } else if (keyword == "split") {
+            std::string id;
+            words >> id;
+            Splitter* splitter = dynamic_cast<Splitter*>(find(id));
+            if (!splitter) return fail("'" + id + "' is not a splitter");
+            splitter->splitFractions.clear();
+            for (float fraction; words >> fraction;) splitter->splitFractions.push_back(fraction);
+            splitter->markDirty();
+        } else if (keyword == "pipe") {
+            std::string a, b, field;
+            float value;
+            if (!(words >> a >> b >> field >> value)) return fail("pipe needs <from> <to> <field> <value>");
+            Component* from = find(a);
+            Component* to = find(b);
+            if (!from || !to) return fail("unknown unit in '" + line + "'");
+            auto it = std::find_if(from->outputs.begin(), from->outputs.end(),
+                [to](Connection* conn) { return conn->to == to; });
+            if (it == from->outputs.end()) return fail("no connection " + a + " -> " + b);
+            if (!setConnectionField(*it, field, value)) return fail("unknown pipe field '" + field + "'");
+        } else if (keyword == "label") {
+            std::string id;
+            words >> id;
+            Component* comp = find(id);
+            if (!comp) return fail("unknown unit '" + id + "'");
+            comp->name = rest(words);
+        } else if (keyword == "inlet") {
+            std::string key;
+            float value;
+            WaterParameter param;
+            if (!(words >> key >> value)) return fail("inlet needs <flow|KEY> <value>");
+            if (key == "flow") plant.inlet->outletWater.flow = value;
+            else if (parameterFromKey(key, param)) plant.inlet->outletWater.updateParameter(param, value);
+            else return fail("unknown parameter '" + key + "'");
+            plant.inlet->markDirty();
+        } else if (keyword == "limit") {
+            PermitLimit permit;
+            if (!parsePermit(words, permit)) return fail("limit needs <KEY> [mean|max <window>|p<NN>] <value>");
+            run.limits.push_back(permit);
+        } else if (keyword == "vary") {
+            std::string id;
+            ParameterRange range;
+            if (!(words >> id >> range.parameter >> range.low >> range.high) || range.high < range.low) {
+                return fail("vary needs <id> <field> <low> <high>");
+            }
+            range.unit = find(id);
+            if (!range.unit) return fail("unknown unit '" + id + "'");
+            if (!range.unit->parameter(range.parameter)) return fail("unknown field '" + range.parameter + "'");
+            plant.vary.push_back(range);
+        } else if (keyword == "surrogate") {
+            std::string id, key;
+            std::unique_ptr<SurrogateTable> table(new SurrogateTable());
+            if (!(words >> id >> table->tolerance) || table->tolerance <= 0.0f) {
+                return fail("surrogate needs <id> <tolerance> <flow|KEY> <low> <high>...");
+            }
+            Component* comp = find(id);
+            if (!comp || comp == plant.inlet || comp == plant.outlet) return fail("unknown unit '" + id + "'");
+            while (words >> key) {
+                SurrogateTable::Input input;
+                WaterParameter param;
+                if (key == "flow") input.parameter = SurrogateTable::FLOW_INPUT;
+                else if (parameterFromKey(key, param)) input.parameter = param;
+                else return fail("unknown parameter '" + key + "'");
+                if (!(words >> input.low >> input.high) || !(input.high > input.low)) {
+                    return fail("surrogate input " + key + " needs <low> <high> with low < high");
+                }
+                table->inputs.push_back(input);
+            }
+            if (table->inputs.empty() || table->inputs.size() > size_t(SurrogateTable::MAX_INPUTS)) {
+                return fail("surrogate needs 1 to " + std::to_string(SurrogateTable::MAX_INPUTS) + " inputs");
+            }
+            delete comp->surrogate;
+            comp->surrogate = table.release();
+        } else if (keyword == "cost") {
+            UnitCost cost;
+            if (!(words >> cost.capital >> cost.energy) || cost.capital < 0.0f || cost.energy < 0.0f) {
+                return fail("cost needs <capital> <kWh/m3> <Type>");
+            }
+            std::string type = rest(words);
+            std::unique_ptr<Component> probe(createComponent(type, sf::Vector2f()));
+            if (!probe) return fail("unknown unit type '" + type + "'");
+            run.costs[type] = cost;
+        } else if (keyword == "plant") {
+            run.name = rest(words);
+        } else if (keyword == "mode") {
+            std::string mode;
+            words >> mode;
+            if (mode == "steady") run.mode = STEADY_STATE;
+            else if (mode == "dynamic") run.mode = DYNAMIC;
+            else return fail("mode is steady or dynamic");
+        } else if (keyword == "days") {
+            if (!(words >> run.days) || run.days <= 0.0) return fail("days needs a positive number");
+        } else if (keyword == "step") {
+            if (!(words >> run.step) || run.step <= 0.0f) return fail("step needs a positive number");
+        } else if (keyword == "sample") {
+            if (!(words >> run.sampleInterval) || run.sampleInterval <= 0.0f) return fail("sample needs a positive number");
+        } else if (keyword == "influent" || keyword == "measured") {
+            std::filesystem::path file = rest(words);
+            //|........||Kept absolute so that writing the plant elsewhere (or to text) and reading it back finds it
+            if (file.is_relative()) file = std::filesystem::absolute(std::filesystem::path(path).parent_path() / file);
+            (keyword == "influent" ? run.influent : run.measured) = file.string();
+        } else {
+            return fail("unknown keyword '" + keyword + "'");
+        }
+    }
+    plant.markAllDirty();
+    if (ids) *ids = units;
+    return true;
+}
+
+bool loadPlant(Plant& plant, const std::string& path, PlantRun& run, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    return readPlant(plant, in, path, run, error);
+}
+
+//|........||Writes a plant so that readPlant rebuilds the same graph: the chain of first outputs from the
+//|........||inlet to the outlet becomes `unit` lines, everything else `side` units and `connect` lines.
+//|........||Only fields that differ from a new unit of the same type are written.
+bool writePlant(const Plant& plant, std::ostream& out, const PlantRun& run, std::string& error) {
+    std::map<const Component*, std::string> ids = {{plant.inlet, "inlet"}, {plant.outlet, "outlet"}};
+    std::vector<const Component*> mainLine;
+    for (const Component* comp = plant.inlet; !comp->outputs.empty();) {
+        comp = comp->outputs.front()->to;
+        if (comp == plant.outlet) break;
+        if (ids.count(comp) || comp->outputs.empty()) {
+            mainLine.clear();   //|........||the first-output chain does not reach the outlet
+            break;
+        }
+        ids[comp] = "u" + std::to_string(ids.size() - 1);
+        mainLine.push_back(comp);
+    }
+    bool chained = !mainLine.empty()
+        || (!plant.inlet->outputs.empty() && plant.inlet->outputs.front()->to == plant.outlet);
+    if (!chained) {
+        ids = {{plant.inlet, "inlet"}, {plant.outlet, "outlet"}};
+    }
+
+    out << "plant " << run.name << "\n";
+    out << "mode " << (run.mode == STEADY_STATE ? "steady" : "dynamic") << "\n";
+    out << "days " << run.days << "\nstep " << run.step << "\nsample " << run.sampleInterval << "\n";
+    if (!run.influent.empty()) out << "influent " << run.influent << "\n";
+    if (!run.measured.empty()) out << "measured " << run.measured << "\n";
+    for (const PermitLimit& permit : run.limits) out << "limit " << formatPermit(permit) << "\n";
+    for (const auto& entry : run.costs) {
+        out << "cost " << entry.second.capital << " " << entry.second.energy << " " << entry.first << "\n";
+    }
+    const Water& feed = plant.inlet->outletWater;
+    out << "inlet flow " << feed.flow << "\n";
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        out << "inlet " << parameterKey(WaterParameter(p)) << " " << feed.parameters[p] << "\n";
+    }
+
+    std::vector<const Component*> written;
+    for (const Component* comp : mainLine) {
+        const char* label = componentLabel(comp);
+        if (!label) {
+            error = comp->name + " has no catalogue type";
+            return false;
+        }
+        out << "unit " << ids[comp] << " " << label << "\n";
+        written.push_back(comp);
+    }
+    if (!chained) out << "disconnect inlet outlet\n";
+    for (const Component* comp : plant.components) {
+        if (ids.count(comp)) continue;
+        const char* label = componentLabel(comp);
+        if (!label) {
+            error = comp->name + " has no catalogue type";
+            return false;
+        }
+        ids[comp] = "u" + std::to_string(ids.size() - 1);
+        out << "side " << ids[comp] << " " << comp->position.x << " " << comp->position.y << " " << label << "\n";
+        written.push_back(comp);
+    }
+    for (const Component* comp : written) {
+        std::unique_ptr<Component> fresh(createComponent(componentLabel(comp), comp->position));
+        if (comp->name != fresh->name) out << "label " << ids[comp] << " " << comp->name << "\n";
+        std::vector<ParameterRef> refs, defaults;
+        const_cast<Component*>(comp)->parameters(refs);
+        fresh->parameters(defaults);
+        for (size_t r = 0; r < refs.size(); ++r) {
+            if (*refs[r].value != *defaults[r].value) {
+                out << "set " << ids[comp] << " " << refs[r].name << " " << *refs[r].value << "\n";
+            }
+        }
+    }
+    std::vector<const Component*> sources = {plant.inlet};
+    sources.insert(sources.end(), written.begin(), written.end());
+    for (const Component* comp : sources) {
+        bool onMainLine = chained && (comp == plant.inlet
+            || std::find(mainLine.begin(), mainLine.end(), comp) != mainLine.end());
+        for (size_t k = onMainLine ? 1 : 0; k < comp->outputs.size(); ++k) {
+            out << "connect " << ids[comp] << " " << ids[comp->outputs[k]->to] << "\n";
+        }
+    }
+    for (const Component* comp : written) {
+        const Splitter* splitter = dynamic_cast<const Splitter*>(comp);
+        if (!splitter || splitter->splitFractions.empty()) continue;
+        out << "split " << ids[comp];
+        for (float fraction : splitter->splitFractions) out << " " << fraction;
+        out << "\n";
+    }
+    Connection standard(nullptr, nullptr);
+    for (const Connection* conn : plant.connections) {
+        for (const char* field : CONNECTION_FIELDS) {
+            float value, usual;
+            connectionField(conn, field, value);
+            connectionField(&standard, field, usual);
+            if (value != usual) {
+                out << "pipe " << ids[conn->from] << " " << ids[conn->to] << " " << field << " " << value << "\n";
+            }
+        }
+    }
+    for (const ParameterRange& range : plant.vary) {
+        out << "vary " << ids[range.unit] << " " << range.parameter << " " << range.low << " " << range.high << "\n";
+    }
+    for (const Component* comp : written) {
+        if (!comp->surrogate) continue;
+        out << "surrogate " << ids[comp] << " " << comp->surrogate->tolerance;
+        for (const SurrogateTable::Input& input : comp->surrogate->inputs) {
+            out << " " << (input.parameter == SurrogateTable::FLOW_INPUT ? "flow" : parameterKey(WaterParameter(input.parameter)))
+                << " " << input.low << " " << input.high;
+        }
+        out << "\n";
+    }
+    return bool(out);
+}
+
+bool savePlant(const Plant& plant, const std::string& path, const PlantRun& run, std::string& error) {
+    std::ofstream out(path);
+    if (!out) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return writePlant(plant, out, run, error);
+}
+
+//|........||Comma-separated cells of one CSV line, trimmed
+std::vector<std::string> splitCsvLine(const std::string& line) {
+    std::vector<std::string> cells;
+    std::stringstream stream(line);
+    std::string cell;
+    while (std::getline(stream, cell, ',')) {
+        size_t begin = cell.find_first_not_of(" \t\r");
+        size_t end = cell.find_last_not_of(" \t\r");
+        cells.push_back(begin == std::string::npos ? "" : cell.substr(begin, end - begin + 1));
+    }
+    return cells;
+}
+
+//|........||Influent time series in CSV: a header naming the columns, then one row per change. The first
+//|........||column is time in hours, "flow" is m³/day and the others are parameter keys (BOD, TSS, NH4, ...).
+//|........||Each row holds until the next. The file is read as time advances, so a series of any length
+//|........||costs two rows of memory.
+class InfluentSeries {
+public:
+    bool open(const std::string& path, std::string& error) {
+        file.open(path);
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        std::string header;
+        std::getline(file, header);
+        std::vector<std::string> names = splitCsvLine(header);
+        columns.clear();
+        for (size_t c = 1; c < names.size(); ++c) {
+            WaterParameter param;
+            if (names[c] == "flow") columns.push_back(FLOW_COLUMN);
+            else if (parameterFromKey(names[c], param)) columns.push_back(param);
+            else {
+                error = path + ": unknown column '" + names[c] + "'";
+                return false;
+            }
+        }
+        hasNext = readRow(nextTime, next);
+        return true;
+    }
+
+    //|........||Applies every row due by `time` (s) to `water`; true when the water changed
+    bool apply(double time, Water& water) {
+        bool changed = false;
+        while (hasNext && nextTime <= time) {
+            for (size_t c = 0; c < columns.size() && c < next.size(); ++c) {
+                float& target = columns[c] == FLOW_COLUMN ? water.flow : water.parameters[columns[c]];
+                changed |= target != next[c];
+                target = next[c];
+            }
+            hasNext = readRow(nextTime, next);
+        }
+        return changed;
+    }
+
+private:
+    static constexpr int FLOW_COLUMN = -1;
+    std::ifstream file;
+    std::vector<int> columns;
+    std::vector<float> next;
+    double nextTime = 0.0;
+    bool hasNext = false;
+
+    bool readRow(double& time, std::vector<float>& values) {
+        std::string line;
+        while (std::getline(file, line)) {
+            std::vector<std::string> cells = splitCsvLine(line);
+            if (cells.empty() || cells[0].empty() || cells[0][0] == '#') continue;
+            time = std::atof(cells[0].c_str()) * 3600.0;
+            values.assign(columns.size(), 0.0f);
+            for (size_t c = 0; c < columns.size() && c + 1 < cells.size(); ++c) {
+                values[c] = float(std::atof(cells[c + 1].c_str()));
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+//|........||One steady-state sample as the batch run consumed it
+struct ResultFileTick {
+    Water feed;
+    Water effluent;
+    float power;     //|........||kW metered
+    double biogas;   //|........||m³/day
+};
+
+//|........||Outcome of one headless plant run: effluent statistics over the samples, limit exceedances and energy
+struct BatchResult {
+    std::string file;
+    std::string name;
+    bool ok = false;
+    std::string error;
+    int units = 0;
+    double simulatedDays = 0.0;
+    double treatedVolume = 0.0;   //|........||m³
+    double energy = 0.0;          //|........||kWh
+    double biogas = 0.0;          //|........||m³/day, mean over the samples
+    int samples = 0;
+    long exceedances = 0;
+    bool compliant = false;
+    std::string permits;          //|........||one "term: value / limit (exceedances)" entry per permit
+    std::array<double, PARAMETER_COUNT> mean{};
+    std::array<double, PARAMETER_COUNT> peak{};
+    double wallSeconds = 0.0;
+    std::vector<ResultFileTick> ticks;   //|........||steady-state samples, kept for the result cache
+};
+
+//|........||Adds one effluent sample to the running means and peaks
+void addBatchSample(BatchResult& result, const Water& effluent, double biogas) {
+    ++result.samples;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        double value = effluent.parameters[p];
+        result.mean[p] += (value - result.mean[p]) / result.samples;
+        result.peak[p] = result.samples == 1 ? value : std::max(result.peak[p], value);
+    }
+    result.biogas += (biogas - result.biogas) / result.samples;
+}
+
+//|........||Permit summary of a finished run that simulated `time` seconds
+void finishBatchResult(BatchResult& result, const ComplianceMonitor& compliance, double time) {
+    for (size_t i = 0; i < compliance.limits.size(); ++i) {
+        const PermitStatus& state = compliance.status[i];
+        std::ostringstream entry;
+        entry << (i ? "; " : "") << formatPermit(compliance.limits[i]) << ": ";
+        if (compliance.limits[i].statistic == PERMIT_PERCENTILE) entry << state.current;
+        else if (state.evaluations == 0) entry << "record shorter than the window";
+        else entry << "worst " << state.worst << " (" << state.exceedances << "/" << state.evaluations << " over)";
+        result.permits += entry.str();
+    }
+    result.exceedances = compliance.exceedances();
+    result.compliant = compliance.compliant();
+    result.simulatedDays = time / 86400.0;
+    result.ok = true;
+}
+
+//|........||Result cache: finished runs are stored under a directory, addressed by content. A plant file's key
+//|........||hashes the engine version, the plant as writePlant writes it (so comments, ids and file layout do
+//|........||not matter) and its run settings; a run's key adds the influent file's bytes and the run length.
+//|........||Entries live at <cache>/<plant key>/<run key>.run: a fixed header, the steady-state ticks and the
+//|........||permit text, written in host layout so they can be mapped and read in place.
+//|........||Bump ENGINE_VERSION whenever a change to a unit, the engine or the batch statistics alters results.
+const uint32_t ENGINE_VERSION = 4;
+
+struct Fnv1a {
+    uint64_t hash = 1469598103934665603ull;
+
+    void add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    void add(const std::string& text) {
+        add(text.data(), text.size());
+    }
+};
+
+struct ResultFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tickSize;
+    uint32_t ticks;
+    uint32_t permitsLength;
+    uint32_t units;
+    uint32_t samples;
+    int64_t exceedances;
+    uint64_t compliant;
+    double simulatedDays;
+    double treatedVolume;
+    double energy;
+    double biogas;
+    double mean[PARAMETER_COUNT];
+    double peak[PARAMETER_COUNT];
+};
+
+const char RESULT_FILE_MAGIC[8] = {'W', 'W', 'T', 'P', 'R', 'U', 'N', '1'};
+
+//|........||Read-only view of a whole file: mapped where the platform has mmap, read into memory otherwise
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                bytes = static_cast<const char*>(view);
+                length = size_t(info.st_size);
+                mapped = true;
+            }
+        }
+        ::close(fd);
+        if (mapped) return true;
+#endif
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+        return true;
+    }
+
+    void close() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapped) munmap(const_cast<char*>(bytes), length);
+#endif
+        mapped = false;
+        bytes = nullptr;
+        length = 0;
+        buffer.clear();
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<char> buffer;
+};
+
+//|........||A cache entry checked against the running engine; ticks and permits point into the mapping
+struct ResultFile {
+    MappedFile file;
+    const ResultFileHeader* header = nullptr;
+    const ResultFileTick* ticks = nullptr;
+    std::string permits;
+
+    bool open(const std::string& path) {
+        header = nullptr;
+        if (!file.open(path) || file.size() < sizeof(ResultFileHeader)) return false;
+        const ResultFileHeader* head = reinterpret_cast<const ResultFileHeader*>(file.data());
+        if (std::memcmp(head->magic, RESULT_FILE_MAGIC, sizeof(head->magic)) != 0 || head->version != ENGINE_VERSION
+            || head->tickSize != sizeof(ResultFileTick)
+            || file.size() != sizeof(ResultFileHeader) + size_t(head->ticks) * sizeof(ResultFileTick) + head->permitsLength) {
+            return false;
+        }
+        header = head;
+        ticks = reinterpret_cast<const ResultFileTick*>(file.data() + sizeof(ResultFileHeader));
+        permits.assign(file.data() + file.size() - header->permitsLength, header->permitsLength);
+        return true;
+    }
+
+    void fill(BatchResult& result) const {
+        result.ok = true;
+        result.units = int(header->units);
+        result.samples = int(header->samples);
+        result.exceedances = long(header->exceedances);
+        result.compliant = header->compliant != 0;
+        result.simulatedDays = header->simulatedDays;
+        result.treatedVolume = header->treatedVolume;
+        result.energy = header->energy;
+        result.biogas = header->biogas;
+        for (int p = 0; p < PARAMETER_COUNT; ++p) {
+            result.mean[p] = header->mean[p];
+            result.peak[p] = header->peak[p];
+        }
+        result.permits = permits;
+    }
+};
+
+//|........||Writes next to the final name and renames, so readers in other threads or processes never see a
+//|........||partial entry
+bool writeResultFile(const std::string& path, const BatchResult& result) {
+    ResultFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+    header.version = ENGINE_VERSION;
+    header.tickSize = sizeof(ResultFileTick);
+    header.ticks = uint32_t(result.ticks.size());
+    header.permitsLength = uint32_t(result.permits.size());
+    header.units = uint32_t(result.units);
+    header.samples = uint32_t(result.samples);
+    header.exceedances = result.exceedances;
+    header.compliant = result.compliant ? 1 : 0;
+    header.simulatedDays = result.simulatedDays;
+    header.treatedVolume = result.treatedVolume;
+    header.energy = result.energy;
+    header.biogas = result.biogas;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        header.mean[p] = result.mean[p];
+        header.peak[p] = result.peak[p];
+    }
+    std::error_code code;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), code);
+    std::ostringstream suffix;
+    suffix << ".tmp" << std::this_thread::get_id();
+    std::string temporary = path + suffix.str();
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!result.ticks.empty()) {
+            out.write(reinterpret_cast<const char*>(result.ticks.data()), result.ticks.size() * sizeof(ResultFileTick));
+        }
+        out.write(result.permits.data(), result.permits.size());
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temporary, code);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, code);
+    if (code) std::filesystem::remove(temporary, code);
+    return !code;
+}
+
+//|........||Where a plant file's results live in the cache. Steady-state runs without recycle loops (whose
+//|........||solves warm-start) are a sequence of independent equilibria, so a run whose influent only
+//|........||changed after some tick can take the earlier ticks from another entry of the same plant key;
+//|........||for those, `feeds` receives the inlet water of every tick.
+struct ResultKey {
+    std::string directory;   //|........||<cache>/<plant key>
+    std::string path;        //|........||the run's entry
+    std::string name;        //|........||run.name, which is not part of the key
+    bool reusable = false;
+    std::vector<Water> feeds;
+};
+
+static std::string hexKey(uint64_t hash) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+}
+
+bool resultKey(const std::string& cache, const std::string& path, ResultKey& key) {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    PlantRun run;
+    std::string error;
+    if (!loadPlant(plant, path, run, error)) return false;
+    PlantRun canonical = run;
+    canonical.name.clear();
+    canonical.influent.clear();
+    canonical.measured.clear();
+    canonical.days = 1.0;
+    std::ostringstream text;
+    text.precision(9);
+    if (!writePlant(plant, text, canonical, error)) return false;
+    Fnv1a plantHash;
+    plantHash.add(&ENGINE_VERSION, sizeof(ENGINE_VERSION));
+    plantHash.add(text.str());
+
+    Fnv1a runHash = plantHash;
+    runHash.add(&run.days, sizeof(run.days));
+    if (!run.influent.empty()) {
+        std::ifstream in(run.influent, std::ios::binary);
+        if (!in) return false;
+        char chunk[1 << 14];
+        while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0) runHash.add(chunk, size_t(in.gcount()));
+    }
+    key.directory = (std::filesystem::path(cache) / hexKey(plantHash.hash)).string();
+    key.path = (std::filesystem::path(key.directory) / (hexKey(runHash.hash) + ".run")).string();
+    key.name = run.name;
+
+    key.reusable = run.mode == STEADY_STATE && !plant.hasLoops();
+    key.feeds.clear();
+    if (key.reusable) {
+        InfluentSeries influent;
+        if (!run.influent.empty() && !influent.open(run.influent, error)) return false;
+        Water feed = plant.inlet->outletWater;
+        influent.apply(0.0, feed);
+        const double end = run.days * 86400.0;
+        for (double time = 0.0; time < end; time += run.sampleInterval) {
+            influent.apply(time, feed);
+            key.feeds.push_back(feed);
+        }
+    }
+    return true;
+}
+
+//|........||Loads and runs one plant file headless. Everything the run allocates is released on return,
+//|........||so a batch holds at most one plant per worker thread at a time. With `keepTicks` the steady-state
+//|........||samples are kept in the result; the first `reuseTicks` of them are taken from `reuse` instead of
+//|........||solved (see ResultKey for when that is exact).
+BatchResult runPlantFile(const std::string& path, bool keepTicks = false, const ResultFileTick* reuse = nullptr,
+    int reuseTicks = 0) {
+    BatchResult result;
+    result.file = std::filesystem::path(path).filename().string();
+    auto start = std::chrono::steady_clock::now();
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    PlantRun run;
+    InfluentSeries influent;
+    if (!loadPlant(plant, path, run, result.error)
+        || (!run.influent.empty() && !influent.open(run.influent, result.error))) {
+        return result;
+    }
+    result.name = run.name;
+    result.units = int(plant.components.size()) - 2;
+    plant.fuse();
+    //|........||Dynamic runs start from the steady state of the first influent row, not from empty tanks
+    Water& feed = plant.inlet->outletWater;
+    influent.apply(0.0, feed);
+    plant.setMode(STEADY_STATE);
+    plant.step(0.0f);
+    result.error = plant.solverError();
+    if (!result.error.empty()) return result;
+    if (run.mode == STEADY_STATE) plant.buildSurrogates();
+    plant.setMode(run.mode);
+    plant.fixedStep = run.step;
+    plant.timeScale = 1.0f;
+    plant.compliance.limits = run.limits;
+    plant.compliance.sampleInterval = run.sampleInterval;
+    plant.compliance.reset();
+
+    const double end = run.days * 86400.0;
+    double time = 0.0;
+    double nextSample = 0.0;
+    auto biogasFlow = [&plant]() {
+        double biogas = 0.0;
+        for (auto& comp : plant.components) {
+            if (SludgeDigester* digester = dynamic_cast<SludgeDigester*>(comp)) biogas += digester->biogasFlow;
+        }
+        return biogas;
+    };
+    int tick = 0;
+    while (time < end) {
+        if (influent.apply(time, feed)) plant.inlet->markDirty();
+        if (run.mode == STEADY_STATE) {
+            //|........||One equilibrium per sample; energy and volume are integrated over the interval
+            ResultFileTick sample;
+            if (tick < reuseTicks) {
+                sample = reuse[tick];
+            } else {
+                plant.step(0.0f);
+                result.error = plant.solverError();
+                if (!result.error.empty()) return result;
+                sample.feed = feed;
+                sample.effluent = plant.outlet->inletWater;
+                sample.power = plant.powerDraw();
+                sample.biogas = biogasFlow();
+            }
+            ++tick;
+            if (keepTicks) result.ticks.push_back(sample);
+            float interval = run.sampleInterval;
+            result.energy += sample.power * interval / 3600.0;
+            result.treatedVolume += feed.flow * interval / 86400.0;
+            time += interval;
+            nextSample += run.sampleInterval;
+            plant.compliance.record(time, sample.effluent);
+            addBatchSample(result, sample.effluent, sample.biogas);
+            continue;
+        }
+        plant.step(run.step);
+        time += run.step;
+        result.error = plant.solverError();
+        if (!result.error.empty()) return result;
+        if (time < nextSample) continue;
+        nextSample += run.sampleInterval;
+        addBatchSample(result, plant.outlet->inletWater, biogasFlow());
+    }
+    if (run.mode == DYNAMIC) {
+        result.energy = plant.energyPerVolume() * plant.treatedVolume;
+        result.treatedVolume = plant.treatedVolume;
+    }
+    finishBatchResult(result, plant.compliance, time);
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+//|........||Sweeps usually vary the tail of a chain, so many files of a batch feed the same influent through
+//|........||the same first units. Files whose plant is a plain chain (inlet, units with one input and one
+//|........||output, outlet) are merged into a trie: one root per influent and run settings, one node per unit
+//|........||type, parameters and inbound pipe. Each node runs its unit once for every file below it and keeps
+//|........||the outlet water of every tick (sample in steady state, engine step in dynamic runs), so only
+//|........||the units after the point where two files diverge are simulated twice. A node sees the calls its
+//|........||unit would see inside the full plant, so the results are the same to the bit.
+struct SharedRunNode {
+    std::string label;                  //|........||catalogue type; empty at the root
+    std::vector<float> values;          //|........||unit parameters, in parameters() order
+    Connection pipe{nullptr, nullptr};  //|........||settings of the pipe into the unit
+    std::vector<std::unique_ptr<SharedRunNode>> children;
+    std::vector<int> entries;           //|........||files whose chain ends at this unit
+    std::vector<int> userTicks;         //|........||ticks of every file whose chain runs through this unit
+    int ticks = 0;                      //|........||the longest of them
+    long runs = 0;                      //|........||simulate() calls
+    long unsharedRuns = 0;              //|........||the calls its users would have made on their own
+};
+
+struct SharedRun {
+    std::string influent;
+    Water inlet;
+    SimulationMode mode = DYNAMIC;
+    float step = 60.0f;
+    float sampleInterval = 900.0f;
+    SharedRunNode root;
+    std::vector<double> times;    //|........||simulated time after each tick
+    std::vector<char> sampled;    //|........||ticks that take an effluent sample
+    std::vector<double> volume;   //|........||m³ treated up to each tick
+    bool keepTicks = false;       //|........||steady-state samples go to the result cache
+};
+
+struct SharedEntry {
+    int file = 0;
+    int shared = 0;   //|........||index of its SharedRun
+    PlantRun run;
+    int units = 0;
+    int ticks = 0;
+    Connection outletPipe{nullptr, nullptr};
+};
+
+//|........||What a chain prefix produces, tick by tick. Power, biogas and energy are summed over its units in
+//|........||chain order, as Plant sums them over the components.
+struct SharedSeries {
+    Water initial;               //|........||steady state the dynamic run starts from
+    std::vector<Water> out;
+    std::vector<float> power;    //|........||kW metered (steady state)
+    std::vector<double> biogas;  //|........||m³/day
+    double energy = 0.0;         //|........||kWh metered (dynamic)
+    double seconds = 0.0;        //|........||wall time, each node's shared out among its users
+    std::string error;           //|........||first unit of the prefix whose solve did not converge
+};
+
+static bool samePipe(const Connection& a, const Connection& b) {
+    return a.diameter == b.diameter && a.length == b.length && a.roughness == b.roughness
+        && a.transportDelay == b.transportDelay && a.dispersionTanks == b.dispersionTanks
+        && a.dispersionFraction == b.dispersionFraction;
+}
+
+static void copyPipe(const Connection& from, Connection& to) {
+    to.diameter = from.diameter;
+    to.length = from.length;
+    to.roughness = from.roughness;
+    to.transportDelay = from.transportDelay;
+    to.dispersionTanks = from.dispersionTanks;
+    to.dispersionFraction = from.dispersionFraction;
+}
+
+//|........||Ticks runPlantFile takes for `run`
+static int batchTicks(const PlantRun& run) {
+    const double end = run.days * 86400.0;
+    const float increment = run.mode == STEADY_STATE ? run.sampleInterval : run.step;
+    int ticks = 0;
+    for (double time = 0.0; time < end; time += increment) ++ticks;
+    return ticks;
+}
+
+//|........||Adds a plant file to the trie; false if it is not a plain chain (it then runs on its own). Pumps
+//|........||read the pipes downstream and splitters their fractions, so neither is shared; nor are units
+//|........||with a surrogate table, which is built per plant.
+bool addSharedEntry(std::vector<std::unique_ptr<SharedRun>>& runs, std::vector<SharedEntry>& entries, int file,
+    const std::string& path) {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    SharedEntry entry;
+    std::string error;
+    if (!loadPlant(plant, path, entry.run, error)) return false;
+    std::vector<Component*> chain;
+    const Component* comp = plant.inlet;
+    while (comp->outputs.size() == 1 && comp != plant.outlet) {
+        comp = comp->outputs.front()->to;
+        if (comp->inputs.size() != 1) return false;
+        if (comp != plant.outlet) chain.push_back(const_cast<Component*>(comp));
+    }
+    if (comp != plant.outlet || chain.empty() || chain.size() + 2 != plant.components.size()) return false;
+    for (Component* unit : chain) {
+        if (dynamic_cast<Pump*>(unit) || dynamic_cast<Splitter*>(unit) || !componentLabel(unit) || unit->surrogate) {
+            return false;
+        }
+    }
+
+    const PlantRun& run = entry.run;
+    SharedRun* shared = nullptr;
+    for (size_t r = 0; r < runs.size() && !shared; ++r) {
+        SharedRun* candidate = runs[r].get();
+        if (candidate->influent == run.influent && candidate->inlet == plant.inlet->outletWater
+            && candidate->mode == run.mode && candidate->step == run.step
+            && candidate->sampleInterval == run.sampleInterval) {
+            shared = candidate;
+            entry.shared = int(r);
+        }
+    }
+    if (!shared) {
+        entry.shared = int(runs.size());
+        runs.emplace_back(new SharedRun());
+        shared = runs.back().get();
+        shared->influent = run.influent;
+        shared->inlet = plant.inlet->outletWater;
+        shared->mode = run.mode;
+        shared->step = run.step;
+        shared->sampleInterval = run.sampleInterval;
+    }
+    entry.file = file;
+    entry.units = int(chain.size());
+    entry.ticks = batchTicks(run);
+    copyPipe(*plant.outlet->inputs.front(), entry.outletPipe);
+
+    SharedRunNode* node = &shared->root;
+    node->userTicks.push_back(entry.ticks);
+    node->ticks = std::max(node->ticks, entry.ticks);
+    for (Component* unit : chain) {
+        std::vector<ParameterRef> refs;
+        unit->parameters(refs);
+        std::vector<float> values;
+        for (const ParameterRef& ref : refs) values.push_back(*ref.value);
+        const Connection& pipe = *unit->inputs.front();
+        SharedRunNode* next = nullptr;
+        for (auto& child : node->children) {
+            if (child->label == componentLabel(unit) && child->values == values && samePipe(child->pipe, pipe)) {
+                next = child.get();
+            }
+        }
+        if (!next) {
+            node->children.emplace_back(new SharedRunNode());
+            next = node->children.back().get();
+            next->label = componentLabel(unit);
+            next->values = values;
+            copyPipe(pipe, next->pipe);
+        }
+        node = next;
+        node->userTicks.push_back(entry.ticks);
+        node->ticks = std::max(node->ticks, entry.ticks);
+    }
+    node->entries.push_back(int(entries.size()));
+    entries.push_back(entry);
+    return true;
+}
+
+//|........||Influent, tick times and treated volume of a shared run, the root of its trie
+bool prepareSharedRun(SharedRun& shared, SharedSeries& series, std::string& error) {
+    InfluentSeries influent;
+    if (!shared.influent.empty() && !influent.open(shared.influent, error)) return false;
+    const int ticks = shared.root.ticks;
+    Water feed = shared.inlet;
+    influent.apply(0.0, feed);
+    series.initial = feed;
+    series.out.resize(ticks);
+    series.power.assign(ticks, 0.0f);
+    series.biogas.assign(ticks, 0.0);
+    shared.times.resize(ticks);
+    shared.sampled.resize(ticks);
+    shared.volume.resize(ticks);
+    double time = 0.0;
+    double nextSample = 0.0;
+    double volume = 0.0;
+    for (int k = 0; k < ticks; ++k) {
+        influent.apply(time, feed);
+        series.out[k] = feed;
+        if (shared.mode == STEADY_STATE) {
+            float interval = shared.sampleInterval;
+            volume += feed.flow * interval / 86400.0;
+            time += interval;
+            shared.sampled[k] = 1;
+        } else {
+            volume += feed.flow * shared.step / 86400.0;
+            time += shared.step;
+            shared.sampled[k] = time >= nextSample;
+        }
+        if (shared.sampled[k]) nextSample += shared.sampleInterval;
+        shared.times[k] = time;
+        shared.volume[k] = volume;
+    }
+    return true;
+}
+
+//|........||The result of one file from the series of the last unit of its chain; `root` holds the feeds
+void finishSharedEntry(const SharedRun& shared, const SharedSeries& root, const SharedEntry& entry,
+    const SharedSeries& series, const std::string& path, BatchResult& result) {
+    auto start = std::chrono::steady_clock::now();
+    result.file = std::filesystem::path(path).filename().string();
+    result.name = entry.run.name;
+    result.units = entry.units;
+    if (!series.error.empty()) {
+        result.error = series.error;
+        return;
+    }
+    ComplianceMonitor compliance;
+    compliance.limits = entry.run.limits;
+    compliance.sampleInterval = entry.run.sampleInterval;
+    compliance.reset();
+    Connection pipe = entry.outletPipe;
+    for (int k = 0; k < entry.ticks; ++k) {
+        const Water* effluent = &series.out[k];
+        if (shared.mode == STEADY_STATE) {
+            float interval = shared.sampleInterval;
+            result.energy += series.power[k] * interval / 3600.0;
+            compliance.record(shared.times[k], *effluent);
+        } else {
+            pipe.transport(series.out[k], shared.step);
+            effluent = &pipe.water;
+            compliance.sample(shared.times[k], *effluent);
+            if (!shared.sampled[k]) continue;
+        }
+        addBatchSample(result, *effluent, series.biogas[k]);
+        if (shared.keepTicks && shared.mode == STEADY_STATE) {
+            ResultFileTick sample;
+            sample.feed = root.out[k];
+            sample.effluent = *effluent;
+            sample.power = series.power[k];
+            sample.biogas = series.biogas[k];
+            result.ticks.push_back(sample);
+        }
+    }
+    result.treatedVolume = shared.volume[entry.ticks - 1];
+    if (shared.mode == DYNAMIC) {
+        //|........||Rounded as runPlantFile rounds energyPerVolume() * treatedVolume, which is not always the
+        //|........||energy itself; the summary must match a separate run to the bit
+        result.energy = result.treatedVolume > 0.0 ? series.energy / result.treatedVolume * result.treatedVolume : 0.0;
+    }
+    finishBatchResult(result, compliance, shared.times[entry.ticks - 1]);
+    result.wallSeconds = series.seconds
+        + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//|........||Runs the unit of `node` on the series of its parent, finishes the files that end there and
+//|........||recurses. A fresh unit is fed as the plant would feed it: one steady solve, then in steady state
+//|........||a new solve at the first tick and whenever the inlet changes (the engine's dirty flags), or one
+//|........||simulate() per engine step behind the inbound pipe in dynamic runs.
+void runSharedNode(SharedRunNode& node, const SharedRun& shared, const SharedSeries& root, const SharedSeries& parent,
+    const std::vector<SharedEntry>& entries, const std::vector<std::string>& files, std::vector<BatchResult>& results) {
+    auto start = std::chrono::steady_clock::now();
+    SharedSeries series;
+    series.error = parent.error;
+    {
+        std::unique_ptr<Component> unit(createComponent(node.label, sf::Vector2f()));
+        std::vector<ParameterRef> refs;
+        unit->parameters(refs);
+        for (size_t i = 0; i < refs.size() && i < node.values.size(); ++i) *refs[i].value = node.values[i];
+        Connection pipe(unit.get(), unit.get());
+        Connection tail(unit.get(), unit.get());
+        copyPipe(node.pipe, pipe);
+        pipe.water = parent.initial;
+        unit->inputs.push_back(&pipe);
+        unit->outputs.push_back(&tail);
+        EnergyMeter* meter = unit->energyMeter();
+        SludgeDigester* digester = dynamic_cast<SludgeDigester*>(unit.get());
+
+        const int ticks = node.ticks;
+        series.out.resize(ticks);
+        series.power.resize(ticks);
+        series.biogas.resize(ticks);
+        unit->gatherInlet();
+        unit->simulate(0.0f);
+        ++node.runs;
+        auto checkSolve = [&]() {
+            const char* reason = unit->solverError();
+            if (reason && series.error.empty()) series.error = unit->name + ": " + reason;
+        };
+        checkSolve();
+        series.initial = unit->outletFor(0);
+        if (shared.mode == DYNAMIC && meter) meter->reset();
+        std::vector<long> runsBefore(ticks + 1);
+        for (int k = 0; k < ticks; ++k) {
+            runsBefore[k] = node.runs;
+            if (shared.mode == STEADY_STATE) {
+                if (k == 0 || parent.out[k] != pipe.water) {
+                    pipe.water = parent.out[k];
+                    unit->gatherInlet();
+                    unit->simulate(0.0f);
+                    ++node.runs;
+                    checkSolve();
+                }
+            } else {
+                unit->simulate(shared.step);
+                ++node.runs;
+                checkSolve();
+            }
+            series.out[k] = unit->outletFor(0);
+            series.power[k] = parent.power[k] + (meter ? meter->power : 0.0f);
+            series.biogas[k] = parent.biogas[k] + (digester ? double(digester->biogasFlow) : 0.0);
+            if (shared.mode == DYNAMIC) {
+                pipe.transport(parent.out[k], shared.step);
+                unit->gatherInlet();
+            }
+        }
+        runsBefore[ticks] = node.runs;
+        for (int userTicks : node.userTicks) node.unsharedRuns += runsBefore[userTicks];
+        series.energy = parent.energy + (meter && shared.mode == DYNAMIC ? meter->energy : 0.0);
+        unit->inputs.clear();
+        unit->outputs.clear();
+    }
+    series.seconds = parent.seconds
+        + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / node.userTicks.size();
+    for (int index : node.entries) {
+        const SharedEntry& entry = entries[index];
+        finishSharedEntry(shared, root, entry, series, files[entry.file], results[entry.file]);
+    }
+    for (auto& child : node.children) runSharedNode(*child, shared, root, series, entries, files, results);
+}
+
+static void countSharedRuns(const SharedRunNode& node, long& runs, long& unsharedRuns) {
+    runs += node.runs;
+    unsharedRuns += node.unsharedRuns;
+    for (auto& child : node.children) countSharedRuns(*child, runs, unsharedRuns);
+}
+
+//|........||Effluent parameters reported per plant in the batch summary
+const WaterParameter SUMMARY_PARAMETERS[] = {BOD, COD, TSS, NH4, NO3, P};
+
+//|........||Runs every *.plant file of `directory` on `threads` threads and writes one summary row per plant.
+//|........||With `sharePrefixes`, plain chains go through the prefix trie (one task per first unit of a
+//|........||trie) and the other files run on their own (one task each); all tasks share one work-stealing
+//|........||pool. With a `cache` directory, files found there are not run, steady-state runs whose influent
+//|........||changed after some tick start from a cached run of the same plant, and new results are stored.
+//|........||Returns the process exit code: 1 if any plant failed.
+int runBatch(const std::string& directory, unsigned threads, const std::string& summaryPath,
+    bool sharePrefixes = true, const std::string& cache = "") {
+    std::vector<std::string> files;
+    std::error_code code;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, code)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".plant") files.push_back(entry.path().string());
+    }
+    if (code) {
+        std::fprintf(stderr, "cannot read %s: %s\n", directory.c_str(), code.message().c_str());
+        return 1;
+    }
+    std::sort(files.begin(), files.end());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results(files.size());
+    std::vector<std::unique_ptr<SharedRun>> shared;
+    std::vector<SharedEntry> entries;
+    std::vector<int> alone;
+    std::vector<ResultKey> keys(files.size());
+    std::vector<char> keyed(files.size(), 0);
+    std::vector<std::unique_ptr<ResultFile>> reuse(files.size());
+    std::vector<int> reuseTicks(files.size(), 0);
+    int hits = 0;
+    for (int i = 0; i < int(files.size()); ++i) {
+        if (!cache.empty() && resultKey(cache, files[i], keys[i])) {
+            keyed[i] = 1;
+            auto lookup = std::chrono::steady_clock::now();
+            ResultFile hit;
+            if (hit.open(keys[i].path)) {
+                BatchResult& result = results[i];
+                result.file = std::filesystem::path(files[i]).filename().string();
+                result.name = keys[i].name;
+                hit.fill(result);
+                result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - lookup).count();
+                keyed[i] = 0;
+                ++hits;
+                continue;
+            }
+            //|........||The cached run of this plant that agrees with this one's feed for the most ticks
+            std::error_code listing;
+            for (const auto& entry : std::filesystem::directory_iterator(keys[i].directory, listing)) {
+                if (!keys[i].reusable || entry.path().extension() != ".run") continue;
+                std::unique_ptr<ResultFile> candidate(new ResultFile());
+                if (!candidate->open(entry.path().string())) continue;
+                int agree = 0;
+                int most = int(std::min<size_t>(candidate->header->ticks, keys[i].feeds.size()));
+                while (agree < most && candidate->ticks[agree].feed == keys[i].feeds[agree]) ++agree;
+                if (agree > reuseTicks[i]) {
+                    reuseTicks[i] = agree;
+                    reuse[i] = std::move(candidate);
+                }
+            }
+            if (reuse[i]) {
+                alone.push_back(i);
+                continue;
+            }
+        }
+        if (!sharePrefixes || !addSharedEntry(shared, entries, i, files[i])) alone.push_back(i);
+    }
+    for (auto& run : shared) run->keepTicks = !cache.empty();
+    std::vector<SharedSeries> roots(shared.size());
+    std::vector<std::pair<int, SharedRunNode*>> subtrees;
+    size_t sharedFiles = 0;
+    for (size_t r = 0; r < shared.size(); ++r) {
+        std::string error;
+        if (prepareSharedRun(*shared[r], roots[r], error)) {
+            for (auto& child : shared[r]->root.children) subtrees.push_back({int(r), child.get()});
+            sharedFiles += shared[r]->root.userTicks.size();
+            continue;
+        }
+        //|........||An unreadable influent is reported by each file's own run
+        for (const SharedEntry& entry : entries) {
+            if (entry.shared == int(r)) alone.push_back(entry.file);
+        }
+    }
+    runWorkStealing(int(alone.size() + subtrees.size()), threads, [&](int i) {
+        if (i < int(alone.size())) {
+            int file = alone[i];
+            const ResultFileTick* ticks = reuse[file] ? reuse[file]->ticks : nullptr;
+            results[file] = runPlantFile(files[file], keyed[file] && keys[file].reusable, ticks, reuseTicks[file]);
+            return;
+        }
+        auto& task = subtrees[i - alone.size()];
+        runSharedNode(*task.second, *shared[task.first], roots[task.first], roots[task.first], entries, files, results);
+    });
+    int stored = 0, partial = 0;
+    long reused = 0, ticks = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        BatchResult& result = results[i];
+        if (reuse[i]) {
+            ++partial;
+            reused += reuseTicks[i];
+            ticks += long(keys[i].feeds.size());
+        }
+        if (!keyed[i] || !result.ok) continue;
+        if (!keys[i].reusable) result.ticks.clear();
+        stored += writeResultFile(keys[i].path, result) ? 1 : 0;
+        result.ticks = std::vector<ResultFileTick>();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream out(summaryPath);
+    if (!out) {
+        std::fprintf(stderr, "cannot write %s\n", summaryPath.c_str());
+        return 1;
+    }
+    out << "file,name,status,units,days,treated_m3,kWh_per_m3,biogas_m3_per_day,samples,exceedances,compliant";
+    for (WaterParameter param : SUMMARY_PARAMETERS) {
+        out << ",mean_" << parameterKey(param) << ",max_" << parameterKey(param);
+    }
+    out << ",permits,wall_s,error\n";
+    int failed = 0;
+    for (const BatchResult& r : results) {
+        failed += r.ok ? 0 : 1;
+        std::string error = r.error;
+        std::replace(error.begin(), error.end(), ',', ';');
+        std::replace(error.begin(), error.end(), '"', '\'');
+        out << r.file << ",\"" << r.name << "\"," << (r.ok ? "ok" : "error") << "," << r.units << ","
+            << r.simulatedDays << "," << r.treatedVolume << ","
+            << (r.treatedVolume > 0.0 ? r.energy / r.treatedVolume : 0.0) << "," << r.biogas << ","
+            << r.samples << "," << r.exceedances << "," << (r.ok && r.compliant ? "yes" : "no");
+        for (WaterParameter param : SUMMARY_PARAMETERS) out << "," << r.mean[param] << "," << r.peak[param];
+        out << ",\"" << r.permits << "\"," << r.wallSeconds << "," << error << "\n";
+    }
+    std::printf("%zu plants (%d failed) on %u threads in %.2f s -> %s\n", files.size(), failed, threads, wall,
+        summaryPath.c_str());
+    if (sharedFiles) {
+        long runs = 0, unsharedRuns = 0;
+        for (auto& run : shared) countSharedRuns(run->root, runs, unsharedRuns);
+        std::printf("%zu plain chains share prefixes: %ld unit runs instead of %ld\n", sharedFiles, runs,
+            unsharedRuns);
+    }
+    if (!cache.empty()) {
+        std::printf("result cache %s: %d hits, %d runs resumed (%ld of %ld ticks reused), %d stored\n",
+            cache.c_str(), hits, partial, reused, ticks, stored);
+    }
+    return failed ? 1 : 0;
+}
+
+//|........||Global sensitivity analysis of the steady-state effluent. Each evaluation sets the factors from a
+//|........||point u of the unit hypercube (factor = low + u·(high - low)) on a private copy of the plant and
+//|........||solves it. Factors are the plant's `vary` lines or, if it has none, every unit parameter at
+//|........||±spread of its current value.
+enum SensitivityMethod { MORRIS, SOBOL };
+
+struct SensitivityOptions {
+    SensitivityMethod method = SOBOL;
+    int samples = 256;         //|........||Sobol: base sample N, N·(k+2) runs; Morris: trajectories r, r·(k+1) runs
+    int levels = 4;            //|........||Morris grid levels (even)
+    float spread = 0.5f;       //|........||default factor range as a fraction of the nominal value
+    std::vector<WaterParameter> outputs = {NH4, TSS};
+    int resamples = 500;       //|........||bootstrap resamples behind the 95 % intervals
+    unsigned threads = 1;
+    unsigned seed = 1;
+    bool precise = false;      //|........||every run in double (Plant::solvePrecise) rather than the float engine
+    int precisionChecks = 64;  //|........||a float study repeats one run in this many in double
+};
+
+struct SensitivityFactor {
+    std::string unit;          //|........||plant file id
+    std::string parameter;
+    std::string label;         //|........||"<unit name>.<parameter>"
+    float low;
+    float high;
+};
+
+//|........||Morris fills mu/muStar/sigma (elementary effects over the whole factor range), Sobol fills
+//|........||first/total; the Low/High pairs are bootstrap 95 % intervals
+struct SensitivityIndex {
+    double mu = 0.0, muStar = 0.0, muStarLow = 0.0, muStarHigh = 0.0, sigma = 0.0;
+    double first = 0.0, firstLow = 0.0, firstHigh = 0.0;
+    double total = 0.0, totalLow = 0.0, totalHigh = 0.0;
+};
+
+struct SensitivityResult {
+    bool ok = false;
+    std::string error;
+    SensitivityMethod method = SOBOL;
+    std::vector<SensitivityFactor> factors;
+    std::vector<WaterParameter> outputs;
+    std::vector<std::vector<SensitivityIndex>> indices;   //|........||[output][factor]
+    std::vector<double> mean;                              //|........||per output, over the valid runs
+    std::vector<double> variance;
+    long evaluations = 0;
+    long failed = 0;           //|........||runs whose solve failed or effluent was not finite; their samples are dropped
+    double wallSeconds = 0.0;
+    double precisionError = 0.0; //|........||float studies: worst relative difference of the outputs from double
+    long precisionChecks = 0;    //|........||runs it was measured on
+};
+
+//|........||A private copy of a plant, rebuilt from its file text, that solves steady states at factor
+//|........||settings. Consecutive solves start from the previous one, which keeps recycle loops cheap.
+class PlantEvaluator {
+public:
+    Plant plant;
+    PlantRun run;
+    std::map<std::string, Component*> ids;
+    bool precise = false;      //|........||solve in double rather than with the float engine
+    //|........||Float solves repeat one in checkInterval (0: none) in double; precisionError is the worst
+    //|........||difference of the outputs seen over precisionChecks of them
+    int checkInterval = 0;
+    double precisionError = 0.0;
+    long precisionChecks = 0;
+
+    PlantEvaluator() : plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440))) {}
+
+    //|........||Dynamic plant files are studied at the steady state of their first influent row
+    bool load(const std::string& text, const std::string& source, std::string& error) {
+        std::istringstream in(text);
+        if (!readPlant(plant, in, source, run, error, &ids)) return false;
+        plant.fuse();
+        if (!run.influent.empty()) {
+            InfluentSeries influent;
+            if (!influent.open(run.influent, error)) return false;
+            influent.apply(0.0, plant.inlet->outletWater);
+        }
+        plant.setMode(STEADY_STATE);
+        return true;
+    }
+
+    bool bind(const std::vector<SensitivityFactor>& factors, std::string& error) {
+        targets.clear();
+        for (const SensitivityFactor& factor : factors) {
+            auto it = ids.find(factor.unit);
+            float* target = it == ids.end() ? nullptr : it->second->parameter(factor.parameter);
+            if (!target) {
+                error = "no parameter " + factor.unit + "." + factor.parameter;
+                return false;
+            }
+            targets.push_back({target, factor.low, factor.high - factor.low});
+        }
+        return true;
+    }
+
+    //|........||u holds one coordinate in [0, 1] per bound factor
+    void setFactors(const double* u) {
+        for (size_t k = 0; k < targets.size(); ++k) *targets[k].value = targets[k].low + float(u[k]) * targets[k].span;
+    }
+
+    //|........||Steady-state effluent at u; false if any output is not finite or the solve failed
+    bool evaluate(const double* u, const std::vector<WaterParameter>& outputs, double* y) {
+        setFactors(u);
+        bool finite = solve(precise, outputs, y);
+        for (size_t o = 0; o < outputs.size(); ++o) finite = finite && std::isfinite(y[o]);
+        if (finite && !precise && checkInterval > 0 && solves++ % checkInterval == 0) {
+            std::vector<double> exact(outputs.size());
+            if (solveAside(true, outputs, exact.data())) {
+                for (size_t o = 0; o < outputs.size(); ++o) {
+                    precisionError = std::max(precisionError, precisionDifference(y[o], exact[o]));
+                }
+                ++precisionChecks;
+            }
+        }
+        return finite;
+    }
+
+    //|........||The effluent outputs at the current settings, in double or with the float engine
+    bool solve(bool inDouble, const std::vector<WaterParameter>& outputs, double* y) {
+        if (inDouble) {
+            PreciseWater effluent;
+            std::string error;
+            if (!plant.solvePrecise(carried, effluent, error)) return false;
+            for (size_t o = 0; o < outputs.size(); ++o) y[o] = effluent.parameters[outputs[o]];
+            return true;
+        }
+        plant.markAllDirty();
+        plant.step(0.0f);
+        for (size_t o = 0; o < outputs.size(); ++o) y[o] = plant.outlet->inletWater.parameters[outputs[o]];
+        return plant.solverError().empty();
+    }
+
+    //|........||solve() that leaves the units' warm-start state as it found it, so the study's own solves go
+    //|........||on exactly as if this one had not run
+    bool solveAside(bool inDouble, const std::vector<WaterParameter>& outputs, double* y) {
+        for (auto& comp : plant.components) comp->saveState();
+        bool solved = solve(inDouble, outputs, y);
+        for (auto& comp : plant.components) comp->restoreState();
+        return solved;
+    }
+
+    //|........||Relative to the double value, or absolute below 1e-3 so that outputs near zero do not blow up
+    static double precisionDifference(double value, double exact) {
+        return std::fabs(value - exact) / std::max(std::fabs(exact), 1e-3);
+    }
+
+    //|........||The bound parameters, in factor order, as seeds for Plant::differentiateSteadyState
+    std::vector<const float*> fields() const {
+        std::vector<const float*> out;
+        for (const Target& target : targets) out.push_back(target.value);
+        return out;
+    }
+
+private:
+    struct Target {
+        float* value;
+        float low;
+        float span;
+    };
+    std::vector<Target> targets;
+    std::vector<PreciseWater> carried;  //|........||Per-connection waters of the double solves
+    long solves = 0;
+};
+
+//|........||The plant's `vary` lines, or every parameter of every unit at ±spread of its value. flowRate is
+//|........||skipped (only the inlet reads it) and so are parameters at zero, which have no relative range.
+std::vector<SensitivityFactor> sensitivityFactors(PlantEvaluator& master, float spread) {
+    std::map<const Component*, std::string> idOf;
+    for (auto& entry : master.ids) idOf[entry.second] = entry.first;
+    std::vector<SensitivityFactor> factors;
+    for (const ParameterRange& range : master.plant.vary) {
+        factors.push_back({idOf[range.unit], range.parameter, range.unit->name + "." + range.parameter,
+            range.low, range.high});
+    }
+    if (!factors.empty()) return factors;
+    for (Component* comp : master.plant.components) {
+        if (comp == master.plant.inlet || comp == master.plant.outlet || !idOf.count(comp)) continue;
+        std::vector<ParameterRef> refs;
+        comp->parameters(refs);
+        for (const ParameterRef& ref : refs) {
+            float nominal = *ref.value;
+            if (std::string(ref.name) == "flowRate" || nominal == 0.0f) continue;
+            float low = std::max(ref.min, nominal * (1.0f - spread));
+            float high = std::min(ref.max, nominal * (1.0f + spread));
+            if (low > high) std::swap(low, high);
+            factors.push_back({idOf[comp], ref.name, comp->name + "." + ref.name, low, high});
+        }
+    }
+    return factors;
+}
+
+//|........||Linear-interpolated quantile of an unsorted sample (sorts it)
+double sampleQuantile(std::vector<double>& values, double q) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    double position = q * double(values.size() - 1);
+    size_t below = size_t(position);
+    if (below + 1 >= values.size()) return values.back();
+    return values[below] + (position - below) * (values[below + 1] - values[below]);
+}
+
+//|........||Runs the sensitivity study of the plant in `text` (plant file syntax; `source` anchors relative
+//|........||paths). Design rows are generated on the fly and evaluated in chunks, one plant copy per chunk,
+//|........||with work stealing across threads; only the outputs of each row are kept.
+SensitivityResult runSensitivity(const std::string& text, const std::string& source, const SensitivityOptions& options) {
+    SensitivityResult result;
+    result.method = options.method;
+    result.outputs = options.outputs;
+    auto start = std::chrono::steady_clock::now();
+    {
+        PlantEvaluator master;
+        if (!master.load(text, source, result.error)) return result;
+        result.factors = sensitivityFactors(master, options.spread);
+    }
+    const int k = int(result.factors.size());
+    const int m = int(options.outputs.size());
+    if (k == 0 || m == 0) {
+        result.error = k == 0 ? "the plant has no parameters to vary" : "no outputs selected";
+        return result;
+    }
+    const int n = std::max(2, options.samples);
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    //|........||Morris: r trajectories of k+1 points on a p-level grid, each step moving one factor by
+    //|........||delta = p / (2(p-1)), in random order and direction. Stored, as they are random.
+    //|........||Sobol (Saltelli): A and B are the two halves of a 2k-dimensional R2 low-discrepancy sequence
+    //|........||with a random shift; block 2+i is A with column i taken from B. Generated from the row index.
+    std::vector<double> morrisPoints;
+    std::vector<int> morrisOrder;      //|........||[t][j]: factor moved by step j of trajectory t
+    std::vector<double> morrisStep;    //|........||[t][i]: signed delta of factor i in trajectory t
+    std::vector<double> alpha, shift;
+    long rows;
+    if (options.method == MORRIS) {
+        int levels = std::max(2, options.levels + options.levels % 2);
+        double delta = levels / (2.0 * (levels - 1));
+        std::uniform_int_distribution<int> baseLevel(0, levels / 2 - 1);
+        rows = long(n) * (k + 1);
+        morrisPoints.resize(size_t(rows) * k);
+        morrisOrder.resize(size_t(n) * k);
+        morrisStep.resize(size_t(n) * k);
+        std::vector<int> order(k);
+        for (int t = 0; t < n; ++t) {
+            double* point = &morrisPoints[size_t(t) * (k + 1) * k];
+            for (int i = 0; i < k; ++i) {
+                bool down = uniform(rng) < 0.5;
+                point[i] = baseLevel(rng) / double(levels - 1) + (down ? delta : 0.0);
+                morrisStep[size_t(t) * k + i] = down ? -delta : delta;
+            }
+            for (int i = 0; i < k; ++i) order[i] = i;
+            std::shuffle(order.begin(), order.end(), rng);
+            for (int j = 0; j < k; ++j) {
+                int factor = order[j];
+                morrisOrder[size_t(t) * k + j] = factor;
+                std::copy(point + size_t(j) * k, point + size_t(j + 1) * k, point + size_t(j + 1) * k);
+                point[size_t(j + 1) * k + factor] += morrisStep[size_t(t) * k + factor];
+            }
+        }
+    } else {
+        rows = long(n) * (k + 2);
+        //|........||phi is the root of x^(d+1) = x + 1 and alpha_j = phi^-(j+1) (Roberts' generalised golden ratio)
+        int d = 2 * k;
+        double phi = 2.0;
+        for (int it = 0; it < 50; ++it) phi -= (std::pow(phi, d + 1) - phi - 1.0) / ((d + 1) * std::pow(phi, d) - 1.0);
+        for (int j = 0; j < d; ++j) {
+            alpha.push_back(std::fmod(std::pow(1.0 / phi, j + 1), 1.0));
+            shift.push_back(uniform(rng));
+        }
+    }
+    auto designRow = [&](long row, double* u) {
+        if (options.method == MORRIS) {
+            std::copy(&morrisPoints[size_t(row) * k], &morrisPoints[size_t(row + 1) * k], u);
+            return;
+        }
+        long j = row % n;
+        long block = row / n;
+        auto coordinate = [&](int dim) {
+            double value = shift[dim] + double(j + 1) * alpha[dim];
+            return value - std::floor(value);
+        };
+        for (int i = 0; i < k; ++i) u[i] = coordinate(block == 1 ? k + i : i);
+        if (block >= 2) u[block - 2] = coordinate(k + int(block - 2));
+    };
+
+    std::vector<double> y(size_t(rows) * m, std::nan(""));
+    std::vector<char> valid(size_t(rows), 0);
+    const unsigned threads = std::max(1u, options.threads);
+    const long chunk = std::clamp(rows / (long(threads) * 16), 16L, 512L);
+    const int chunks = int((rows + chunk - 1) / chunk);
+    std::mutex errorLock;
+    std::string firstError;
+    runWorkStealing(chunks, threads, [&](int c) {
+        PlantEvaluator evaluator;
+        std::string error;
+        if (!evaluator.load(text, source, error) || !evaluator.bind(result.factors, error)) {
+            std::lock_guard<std::mutex> lock(errorLock);
+            if (firstError.empty()) firstError = error;
+            return;
+        }
+        evaluator.precise = options.precise;
+        evaluator.checkInterval = options.precisionChecks;
+        std::vector<double> u(k);
+        for (long row = c * chunk; row < std::min(rows, (c + 1) * chunk); ++row) {
+            designRow(row, u.data());
+            valid[row] = evaluator.evaluate(u.data(), options.outputs, &y[size_t(row) * m]);
+        }
+        std::lock_guard<std::mutex> lock(errorLock);
+        result.precisionError = std::max(result.precisionError, evaluator.precisionError);
+        result.precisionChecks += evaluator.precisionChecks;
+    });
+    if (!firstError.empty()) {
+        result.error = firstError;
+        return result;
+    }
+    result.evaluations = rows;
+    result.failed = long(std::count(valid.begin(), valid.end(), 0));
+
+    //|........||Samples that survive: whole trajectories for Morris, whole A/B/AB_i row sets for Sobol
+    std::vector<int> kept;
+    for (int j = 0; j < n; ++j) {
+        bool whole = true;
+        for (long b = 0; b < (options.method == MORRIS ? k + 1 : k + 2) && whole; ++b) {
+            whole = valid[options.method == MORRIS ? size_t(j) * (k + 1) + b : size_t(b) * n + j];
+        }
+        if (whole) kept.push_back(j);
+    }
+    if (kept.size() < 2) {
+        result.error = "fewer than two complete samples";
+        return result;
+    }
+
+    result.indices.assign(m, std::vector<SensitivityIndex>(k));
+    result.mean.assign(m, 0.0);
+    result.variance.assign(m, 0.0);
+    std::uniform_int_distribution<size_t> pick(0, kept.size() - 1);
+    std::vector<std::vector<size_t>> resamples(std::max(0, options.resamples), std::vector<size_t>(kept.size()));
+    for (auto& resample : resamples) {
+        for (size_t& index : resample) index = pick(rng);
+    }
+    for (int o = 0; o < m; ++o) {
+        auto f = [&](size_t row) { return y[row * m + o]; };
+        std::vector<SensitivityIndex>& index = result.indices[o];
+        if (options.method == MORRIS) {
+            //|........||ee[t][i]: elementary effect of factor i in trajectory t, per unit of normalised range
+            std::vector<double> ee(kept.size() * k);
+            for (size_t s = 0; s < kept.size(); ++s) {
+                size_t t = kept[s];
+                for (int j = 0; j < k; ++j) {
+                    int factor = morrisOrder[t * k + j];
+                    size_t row = t * (k + 1) + j;
+                    ee[s * k + factor] = (f(row + 1) - f(row)) / morrisStep[t * k + factor];
+                }
+                for (int j = 0; j <= k; ++j) {
+                    double value = f(t * (k + 1) + j);
+                    double count = double(s * (k + 1) + j + 1);
+                    double previous = result.mean[o];
+                    result.mean[o] += (value - previous) / count;
+                    result.variance[o] += (value - previous) * (value - result.mean[o]);
+                }
+            }
+            result.variance[o] /= double(kept.size() * (k + 1) - 1);
+            auto muStar = [&](const std::vector<size_t>* resample, int i) {
+                double sum = 0.0;
+                for (size_t s = 0; s < kept.size(); ++s) sum += std::fabs(ee[(resample ? (*resample)[s] : s) * k + i]);
+                return sum / kept.size();
+            };
+            std::vector<double> boot(resamples.size());
+            for (int i = 0; i < k; ++i) {
+                double sum = 0.0, squares = 0.0;
+                for (size_t s = 0; s < kept.size(); ++s) sum += ee[s * k + i];
+                index[i].mu = sum / kept.size();
+                for (size_t s = 0; s < kept.size(); ++s) squares += (ee[s * k + i] - index[i].mu) * (ee[s * k + i] - index[i].mu);
+                index[i].sigma = std::sqrt(squares / (kept.size() - 1));
+                index[i].muStar = muStar(nullptr, i);
+                for (size_t b = 0; b < resamples.size(); ++b) boot[b] = muStar(&resamples[b], i);
+                index[i].muStarLow = boot.empty() ? index[i].muStar : sampleQuantile(boot, 0.025);
+                index[i].muStarHigh = boot.empty() ? index[i].muStar : sampleQuantile(boot, 0.975);
+            }
+        } else {
+            //|........||Saltelli (2010) first order S_i = E[f_B (f_ABi - f_A)] / V and Jansen total
+            //|........||ST_i = E[(f_A - f_ABi)^2] / 2V, V the variance of f_A and f_B pooled
+            auto indices = [&](const std::vector<size_t>* resample, std::vector<double>& first, std::vector<double>& total) {
+                double sum = 0.0, squares = 0.0;
+                size_t count = kept.size();
+                for (size_t s = 0; s < count; ++s) {
+                    size_t j = kept[resample ? (*resample)[s] : s];
+                    sum += f(j) + f(n + j);
+                    squares += f(j) * f(j) + f(n + j) * f(n + j);
+                }
+                double mean = sum / (2 * count);
+                double variance = squares / (2 * count) - mean * mean;
+                for (int i = 0; i < k; ++i) {
+                    double firstSum = 0.0, totalSum = 0.0;
+                    for (size_t s = 0; s < count; ++s) {
+                        size_t j = kept[resample ? (*resample)[s] : s];
+                        double a = f(j), b = f(n + j), ab = f(size_t(2 + i) * n + j);
+                        firstSum += b * (ab - a);
+                        totalSum += (a - ab) * (a - ab);
+                    }
+                    first[i] = variance > 0.0 ? firstSum / count / variance : 0.0;
+                    total[i] = variance > 0.0 ? totalSum / (2 * count) / variance : 0.0;
+                }
+                return std::make_pair(mean, variance);
+            };
+            std::vector<double> first(k), total(k);
+            std::tie(result.mean[o], result.variance[o]) = indices(nullptr, first, total);
+            std::vector<std::vector<double>> bootFirst(k), bootTotal(k);
+            std::vector<double> resampledFirst(k), resampledTotal(k);
+            for (const auto& resample : resamples) {
+                indices(&resample, resampledFirst, resampledTotal);
+                for (int i = 0; i < k; ++i) {
+                    bootFirst[i].push_back(resampledFirst[i]);
+                    bootTotal[i].push_back(resampledTotal[i]);
+                }
+            }
+            for (int i = 0; i < k; ++i) {
+                index[i].first = first[i];
+                index[i].total = total[i];
+                index[i].firstLow = resamples.empty() ? first[i] : sampleQuantile(bootFirst[i], 0.025);
+                index[i].firstHigh = resamples.empty() ? first[i] : sampleQuantile(bootFirst[i], 0.975);
+                index[i].totalLow = resamples.empty() ? total[i] : sampleQuantile(bootTotal[i], 0.025);
+                index[i].totalHigh = resamples.empty() ? total[i] : sampleQuantile(bootTotal[i], 0.975);
+            }
+        }
+    }
+    result.ok = true;
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+//|........||Factor order from most to least influential on output o (mu* for Morris, total index for Sobol)
+std::vector<int> sensitivityRanking(const SensitivityResult& result, int o) {
+    std::vector<int> order(result.factors.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = int(i);
+    auto weight = [&](int i) {
+        const SensitivityIndex& index = result.indices[o][i];
+        return result.method == MORRIS ? index.muStar : index.total;
+    };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return weight(a) > weight(b); });
+    return order;
+}
+
+bool writeSensitivity(const SensitivityResult& result, const std::string& path, std::string& error) {
+    std::ofstream out(path);
+    if (!out) {
+        error = "cannot write " + path;
+        return false;
+    }
+    out << "output,factor,low,high,";
+    if (result.method == MORRIS) out << "mu_star,mu_star_low,mu_star_high,mu,sigma\n";
+    else out << "S1,S1_low,S1_high,ST,ST_low,ST_high\n";
+    for (size_t o = 0; o < result.outputs.size(); ++o) {
+        for (int i : sensitivityRanking(result, int(o))) {
+            const SensitivityFactor& factor = result.factors[i];
+            const SensitivityIndex& index = result.indices[o][i];
+            out << parameterKey(result.outputs[o]) << ",\"" << factor.label << "\"," << factor.low << "," << factor.high << ",";
+            if (result.method == MORRIS) {
+                out << index.muStar << "," << index.muStarLow << "," << index.muStarHigh << "," << index.mu << "," << index.sigma << "\n";
+            } else {
+                out << index.first << "," << index.firstLow << "," << index.firstHigh << ","
+                    << index.total << "," << index.totalLow << "," << index.totalHigh << "\n";
+            }
+        }
+    }
+    return bool(out);
+}
+
+//|........||Headless entry point: runs the study, prints the leading factors per output and writes the CSV
+int runSensitivityFile(const std::string& path, const SensitivityOptions& options, const std::string& csvPath) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    SensitivityResult result = runSensitivity(text.str(), path, options);
+    std::string error;
+    if (!result.ok || !writeSensitivity(result, csvPath, error)) {
+        std::fprintf(stderr, "%s\n", result.ok ? error.c_str() : result.error.c_str());
+        return 1;
+    }
+    std::printf("%s: %zu factors, %ld runs (%ld failed) on %u threads in %.2f s (%.1f us/run) -> %s\n",
+        options.method == MORRIS ? "Morris" : "Sobol", result.factors.size(), result.evaluations, result.failed,
+        std::max(1u, options.threads), result.wallSeconds, 1e6 * result.wallSeconds / result.evaluations, csvPath.c_str());
+    if (result.precisionChecks > 0) {
+        std::printf("float outputs within %.2g of double precision over %ld checked runs\n", result.precisionError,
+            result.precisionChecks);
+    }
+    for (size_t o = 0; o < result.outputs.size(); ++o) {
+        std::printf("%s (mean %.4g, variance %.4g)\n", parameterKey(result.outputs[o]), result.mean[o], result.variance[o]);
+        std::vector<int> ranking = sensitivityRanking(result, int(o));
+        for (size_t r = 0; r < ranking.size() && r < 8; ++r) {
+            const SensitivityIndex& index = result.indices[o][ranking[r]];
+            if (options.method == MORRIS) {
+                std::printf("  %-32s mu* %.4g [%.4g, %.4g]  sigma %.4g\n", result.factors[ranking[r]].label.c_str(),
+                    index.muStar, index.muStarLow, index.muStarHigh, index.sigma);
+            } else {
+                std::printf("  %-32s S1 %.3f [%.3f, %.3f]  ST %.3f [%.3f, %.3f]\n", result.factors[ranking[r]].label.c_str(),
+                    index.first, index.firstLow, index.firstHigh, index.total, index.totalLow, index.totalHigh);
+            }
+        }
+    }
+    return 0;
+}
+
+//|........||Local derivatives of the steady-state effluent at the file's nominal parameters, for sizing and
+//|........||gradient-based design: one forward-mode AD pass per DUAL_WIDTH factors, printed beside central
+//|........||differences (2 runs per factor) as a check
+int runGradientFile(const std::string& path, const std::vector<WaterParameter>& outputs) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    PlantEvaluator evaluator;
+    std::string error;
+    std::vector<SensitivityFactor> factors;
+    if (evaluator.load(text.str(), path, error)) {
+        factors = sensitivityFactors(evaluator, 0.5f);
+        if (factors.empty()) error = "no parameters to differentiate";
+        else evaluator.bind(factors, error);
+    }
+    if (!error.empty()) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    const std::vector<const float*> fields = evaluator.fields();
+    const size_t k = fields.size();
+    std::vector<double> nominal(k);
+    for (size_t i = 0; i < k; ++i) nominal[i] = (*fields[i] - factors[i].low) / (factors[i].high - factors[i].low);
+    std::vector<double> y(outputs.size()), yUp(outputs.size()), yDown(outputs.size());
+    if (!evaluator.evaluate(nominal.data(), outputs, y.data())) {
+        error = evaluator.plant.solverError();
+        std::fprintf(stderr, "%s\n", error.empty() ? "effluent is not finite" : error.c_str());
+        return 1;
+    }
+
+    std::vector<std::array<double, PARAMETER_COUNT>> gradient;
+    auto begin = std::chrono::steady_clock::now();
+    if (!evaluator.plant.differentiateSteadyState(fields, gradient, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    double automaticSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::vector<std::vector<double>> differences(k, std::vector<double>(outputs.size(), NAN));
+    begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < k; ++i) {
+        //|........||Not clamped to [0, 1]: a plant's nominal value may sit outside its vary range. A step of 1 % of
+        //|........||the range: recycle loops settle only to 1e-5, which swamps a smaller one.
+        std::vector<double> up = nominal, down = nominal;
+        up[i] += 1e-2;
+        down[i] -= 1e-2;
+        if (!evaluator.evaluate(up.data(), outputs, yUp.data()) || !evaluator.evaluate(down.data(), outputs, yDown.data())) continue;
+        double span = (up[i] - down[i]) * (factors[i].high - factors[i].low);
+        for (size_t o = 0; o < outputs.size(); ++o) differences[i][o] = (yUp[o] - yDown[o]) / span;
+    }
+    double differenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    evaluator.evaluate(nominal.data(), outputs, y.data());
+
+    std::printf("%zu factors: forward-mode AD %.3f ms in %zu sweeps, central differences %.3f ms in %zu runs\n", k,
+        1e3 * automaticSeconds, (k + DUAL_WIDTH - 1) / DUAL_WIDTH, 1e3 * differenceSeconds, 2 * k);
+    for (size_t o = 0; o < outputs.size(); ++o) {
+        std::printf("d %s / d factor (effluent %.4g)\n", parameterKey(outputs[o]), y[o]);
+        for (size_t i = 0; i < k; ++i) {
+            std::printf("  %-36s %12.5g  (differences %12.5g)\n", factors[i].label.c_str(), gradient[i][outputs[o]],
+                differences[i][o]);
+        }
+    }
+    return 0;
+}
+
+//|........||The steady-state effluent of a plant file at its first influent row from the float engine and in
+//|........||double, with the time per solve and each parameter's relative difference: what a study gives up
+//|........||by running in float on this plant
+int runPrecisionFile(const std::string& path, const std::vector<WaterParameter>& outputs) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    PlantEvaluator evaluator;
+    std::string error;
+    if (!evaluator.load(text.str(), path, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    //|........||The double solve starts from the float one, as the checks of a study do
+    std::vector<double> y[2] = {std::vector<double>(outputs.size()), std::vector<double>(outputs.size())};
+    for (int precise = 0; precise < 2; ++precise) {
+        if (!evaluator.solveAside(precise, outputs, y[precise].data())) {
+            std::fprintf(stderr, "the %s solve failed\n", precise ? "double" : "float");
+            return 1;
+        }
+    }
+    //|........||Then warm repeats of each, as a study would run them
+    double microseconds[2];
+    std::vector<double> scratch(outputs.size());
+    for (int precise = 0; precise < 2; ++precise) {
+        long solves = 0;
+        auto begin = std::chrono::steady_clock::now();
+        double seconds = 0.0;
+        while (seconds < 0.2) {
+            for (int r = 0; r < 100; ++r) evaluator.solve(precise, outputs, scratch.data());
+            solves += 100;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+        microseconds[precise] = 1e6 * seconds / solves;
+    }
+    std::printf("float %.3f us/solve, double %.3f us/solve\n", microseconds[0], microseconds[1]);
+    std::printf("%-12s %14s %14s %10s\n", "", "float", "double", "relative");
+    double worst = 0.0;
+    for (size_t o = 0; o < outputs.size(); ++o) {
+        double difference = PlantEvaluator::precisionDifference(y[0][o], y[1][o]);
+        worst = std::max(worst, difference);
+        std::printf("%-12s %14.8g %14.8g %10.2g\n", parameterKey(outputs[o]), y[0][o], y[1][o], difference);
+    }
+    std::printf("worst relative difference %.2g\n", worst);
+    return 0;
+}
+
+//|........||Builds the surrogate tables of a plant file at its first influent row and reports, per table, the
+//|........||grid, the build cost and the error and time of table lookups against simulate() at `samples`
+//|........||random points of its box
+int runSurrogateFile(const std::string& path, int samples) {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    PlantRun run;
+    InfluentSeries influent;
+    std::string error;
+    if (!loadPlant(plant, path, run, error) || (!run.influent.empty() && !influent.open(run.influent, error))) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    influent.apply(0.0, plant.inlet->outletWater);
+    plant.setMode(STEADY_STATE);
+    plant.step(0.0f);
+    int tables = 0;
+    for (auto& comp : plant.components) {
+        SurrogateTable* table = comp->surrogate;
+        if (!table) continue;
+        ++tables;
+        auto begin = std::chrono::steady_clock::now();
+        table->build(*comp);
+        double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::printf("%s: %s\n", comp->name.c_str(), table->status.c_str());
+        std::printf("  grid");
+        for (size_t i = 0; i < table->inputs.size(); ++i) {
+            const SurrogateTable::Input& input = table->inputs[i];
+            std::printf(" %s %d [%g, %g]", input.parameter == SurrogateTable::FLOW_INPUT ? "flow"
+                : parameterKey(WaterParameter(input.parameter)), table->levels[i], input.low, input.high);
+        }
+        std::printf("\n  built from %ld evaluations in %.3f s, worst check error %.3g (tolerance %g)\n",
+            table->evaluations, buildSeconds, table->buildError, table->tolerance);
+        if (!table->valid) continue;
+
+        //|........||Same points for both, the table without its run-time spot checks
+        std::mt19937 random(7);
+        std::vector<Water> points(samples, table->referenceWater());
+        for (Water& water : points) {
+            for (const SurrogateTable::Input& input : table->inputs) {
+                float value = std::uniform_real_distribution<float>(input.low, input.high)(random);
+                if (input.parameter == SurrogateTable::FLOW_INPUT) water.flow = value;
+                else water.parameters[input.parameter] = value;
+            }
+        }
+        std::vector<float*> slots;
+        comp->responseSlots(slots);
+        std::vector<float> exact(points.size() * slots.size()), approx(exact.size());
+        comp->saveState();
+        begin = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < points.size(); ++n) {
+            comp->inletWater = points[n];
+            comp->restoreState();
+            comp->simulate(0.0f);
+            for (size_t m = 0; m < slots.size(); ++m) exact[n * slots.size() + m] = *slots[m];
+        }
+        double simulateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        comp->restoreState();
+        int interval = table->spotInterval;
+        table->spotInterval = 0;
+        begin = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < points.size(); ++n) {
+            comp->inletWater = points[n];
+            table->apply(*comp);
+            for (size_t m = 0; m < slots.size(); ++m) approx[n * slots.size() + m] = *slots[m];
+        }
+        double tableSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        table->spotInterval = interval;
+        float worst = 0.0f;
+        for (size_t n = 0; n < points.size(); ++n) {
+            worst = std::max(worst, SurrogateTable::error(&approx[n * slots.size()], &exact[n * slots.size()], slots.size()));
+        }
+        std::printf("  %d random points: simulate %.3g us, table %.3g us per call, worst error %.3g\n", samples,
+            1e6 * simulateSeconds / samples, 1e6 * tableSeconds / samples, worst);
+    }
+    if (tables == 0) {
+        std::fprintf(stderr, "%s has no surrogate lines\n", path.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+//|........||Measured effluent for calibration, same layout as an influent CSV: time in hours, then parameter
+//|........||keys. Empty cells are missing measurements. Loaded whole, since every evaluation replays it.
+struct MeasuredSeries {
+    std::vector<double> times;                 //|........||s
+    std::vector<WaterParameter> columns;
+    std::vector<float> values;                 //|........||[row][column], NaN where nothing was measured
+    std::vector<double> scale;                 //|........||per column: spread of the measurements
+};
+
+bool loadMeasured(const std::string& path, MeasuredSeries& series, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    series = MeasuredSeries();
+    std::string line;
+    std::getline(in, line);
+    std::vector<std::string> names = splitCsvLine(line);
+    for (size_t c = 1; c < names.size(); ++c) {
+        WaterParameter param;
+        if (!parameterFromKey(names[c], param)) {
+            error = path + ": unknown column '" + names[c] + "'";
+            return false;
+        }
+        series.columns.push_back(param);
+    }
+    while (std::getline(in, line)) {
+        std::vector<std::string> cells = splitCsvLine(line);
+        if (cells.empty() || cells[0].empty() || cells[0][0] == '#') continue;
+        series.times.push_back(std::atof(cells[0].c_str()) * 3600.0);
+        for (size_t c = 0; c < series.columns.size(); ++c) {
+            bool present = c + 1 < cells.size() && !cells[c + 1].empty();
+            series.values.push_back(present ? float(std::atof(cells[c + 1].c_str())) : std::nanf(""));
+        }
+    }
+    if (series.times.empty() || series.columns.empty()) {
+        error = path + ": no measurements";
+        return false;
+    }
+    //|........||Residuals are divided by the standard deviation of their column so that NH4 in mg/L and
+    //|........||pathogens in counts weigh alike; a constant column falls back to its mean, then to 1
+    const size_t width = series.columns.size();
+    for (size_t c = 0; c < width; ++c) {
+        double sum = 0.0, squares = 0.0;
+        int count = 0;
+        for (size_t r = 0; r < series.times.size(); ++r) {
+            float value = series.values[r * width + c];
+            if (std::isnan(value)) continue;
+            sum += value;
+            squares += double(value) * value;
+            ++count;
+        }
+        double mean = count ? sum / count : 0.0;
+        double deviation = count > 1 ? std::sqrt(std::max(0.0, (squares - count * mean * mean) / (count - 1))) : 0.0;
+        series.scale.push_back(deviation > 1e-9 ? deviation : std::fabs(mean) > 1e-9 ? std::fabs(mean) : 1.0);
+    }
+    return true;
+}
+
+//|........||Runs the plant file's schedule (dynamic from the steady state of the first influent row, or one
+//|........||equilibrium per row in steady mode) through the measured times and appends the scaled residual
+//|........||(simulated - measured) / scale of every measurement. False if the run fails or goes non-finite.
+//|........||With `jacobian`, steady-state files also get d residual / d factor for every residual, one row of
+//|........||jacobian per bound factor, by forward-mode AD at each measured row
+bool trackMeasured(PlantEvaluator& evaluator, const MeasuredSeries& measured, std::vector<double>& residuals,
+    std::string& error, std::vector<std::vector<double>>* jacobian = nullptr) {
+    Plant& plant = evaluator.plant;
+    const PlantRun& run = evaluator.run;
+    InfluentSeries influent;
+    if (!run.influent.empty() && !influent.open(run.influent, error)) return false;
+    Water& feed = plant.inlet->outletWater;
+    influent.apply(0.0, feed);
+    plant.setMode(STEADY_STATE);
+    plant.step(0.0f);
+    if (jacobian && run.mode == DYNAMIC) {
+        error = "derivatives need a steady-state plant file";
+        return false;
+    }
+    const std::vector<const float*> fields = evaluator.fields();
+    std::vector<std::array<double, PARAMETER_COUNT>> gradient;
+    if (jacobian) jacobian->assign(fields.size(), {});
+    if (run.mode == DYNAMIC) {
+        plant.setMode(DYNAMIC);
+        plant.fixedStep = run.step;
+        plant.timeScale = 1.0f;
+    }
+    const size_t width = measured.columns.size();
+    double time = 0.0;
+    for (size_t r = 0; r < measured.times.size(); ++r) {
+        if (run.mode == DYNAMIC) {
+            while (time + 0.5 * run.step <= measured.times[r]) {
+                if (influent.apply(time, feed)) plant.inlet->markDirty();
+                plant.step(run.step);
+                time += run.step;
+            }
+        } else {
+            time = measured.times[r];
+            if (influent.apply(time, feed)) plant.inlet->markDirty();
+            plant.step(0.0f);
+            if (jacobian && !plant.differentiateSteadyState(fields, gradient, error)) return false;
+        }
+        error = plant.solverError();
+        if (!error.empty()) return false;
+        const Water& effluent = plant.outlet->inletWater;
+        for (size_t c = 0; c < width; ++c) {
+            float value = measured.values[r * width + c];
+            if (std::isnan(value)) continue;
+            double residual = (effluent.parameters[measured.columns[c]] - value) / measured.scale[c];
+            if (!std::isfinite(residual)) {
+                error = "effluent is not finite";
+                return false;
+            }
+            residuals.push_back(residual);
+            if (!jacobian) continue;
+            for (size_t i = 0; i < fields.size(); ++i) {
+                (*jacobian)[i].push_back(gradient[i][measured.columns[c]] / measured.scale[c]);
+            }
+        }
+    }
+    return true;
+}
+
+struct CalibrationOptions {
+    int restarts = 8;              //|........||independent Nelder-Mead runs, spread over the threads
+    int evaluations = 300;         //|........||objective evaluations per restart
+    double tolerance = 1e-6;       //|........||relative spread of the simplex values that counts as converged
+    unsigned threads = 1;
+    unsigned seed = 1;
+};
+
+struct CalibrationResult {
+    bool ok = false;
+    std::string error;
+    std::vector<SensitivityFactor> factors;
+    std::vector<double> initial;                   //|........||factor values in the plant file
+    std::vector<double> best;
+    std::vector<double> standardError;             //|........||from the Gauss-Newton covariance at the optimum
+    std::vector<std::vector<double>> correlation;  //|........||NaN where the fit does not determine a factor
+    double objective = 0.0;                        //|........||mean squared scaled residual at the optimum
+    double initialObjective = 0.0;
+    std::vector<double> restartObjectives;
+    std::vector<WaterParameter> columns;
+    std::vector<double> rmse;                      //|........||per measured column, in its own units
+    int measurements = 0;
+    bool automaticJacobian = false;                //|........||Jacobian by forward-mode AD, not finite differences
+    long evaluations = 0;
+    double wallSeconds = 0.0;
+    double secondsPerEvaluation = 0.0;             //|........||time of one objective evaluation on one thread
+};
+
+//|........||Nelder-Mead in the unit cube (candidates are clamped to it), restarted around its best point
+//|........||until a restart no longer improves or the budget is spent. Returns the best value; x is updated.
+template <typename Objective>
+double nelderMead(const Objective& f, std::vector<double>& x, int budget, double tolerance) {
+    const size_t k = x.size();
+    auto clamp = [](std::vector<double>& p) {
+        for (double& v : p) v = std::clamp(v, 0.0, 1.0);
+    };
+    double best = f(x);
+    int used = 1;
+    double step = 0.2;
+    while (used + int(k) + 1 <= budget) {
+        std::vector<std::vector<double>> simplex(k + 1, x);
+        std::vector<double> values(k + 1, best);
+        for (size_t i = 0; i < k; ++i) {
+            simplex[i + 1][i] += x[i] + step <= 1.0 ? step : -step;
+            values[i + 1] = f(simplex[i + 1]);
+        }
+        used += int(k);
+        std::vector<size_t> order(k + 1);
+        while (used < budget) {
+            for (size_t i = 0; i <= k; ++i) order[i] = i;
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return values[a] < values[b]; });
+            double low = values[order[0]], high = values[order[k]];
+            double size = 0.0;
+            for (size_t i = 1; i <= k; ++i) {
+                for (size_t d = 0; d < k; ++d) size = std::max(size, std::fabs(simplex[order[i]][d] - simplex[order[0]][d]));
+            }
+            if (high - low <= tolerance * (std::fabs(low) + 1e-12) || size < 1e-6) break;
+
+            std::vector<double> centroid(k, 0.0);
+            for (size_t i = 0; i < k; ++i) {
+                for (size_t d = 0; d < k; ++d) centroid[d] += simplex[order[i]][d] / k;
+            }
+            auto along = [&](double t) {
+                std::vector<double> p(k);
+                for (size_t d = 0; d < k; ++d) p[d] = centroid[d] + t * (simplex[order[k]][d] - centroid[d]);
+                clamp(p);
+                return p;
+            };
+            std::vector<double> reflected = along(-1.0);
+            double fr = f(reflected);
+            ++used;
+            if (fr < low) {
+                std::vector<double> expanded = along(-2.0);
+                double fe = f(expanded);
+                ++used;
+                simplex[order[k]] = fe < fr ? expanded : reflected;
+                values[order[k]] = std::min(fe, fr);
+            } else if (fr < values[order[k - 1]]) {
+                simplex[order[k]] = reflected;
+                values[order[k]] = fr;
+            } else {
+                std::vector<double> contracted = along(fr < high ? -0.5 : 0.5);
+                double fc = f(contracted);
+                ++used;
+                if (fc < std::min(fr, high)) {
+                    simplex[order[k]] = contracted;
+                    values[order[k]] = fc;
+                } else {
+                    for (size_t i = 1; i <= k; ++i) {
+                        for (size_t d = 0; d < k; ++d) {
+                            simplex[order[i]][d] = 0.5 * (simplex[order[i]][d] + simplex[order[0]][d]);
+                        }
+                        values[order[i]] = f(simplex[order[i]]);
+                    }
+                    used += int(k);
+                }
+            }
+        }
+        size_t winner = std::min_element(values.begin(), values.end()) - values.begin();
+        bool improved = values[winner] < best - tolerance * (std::fabs(best) + 1e-12);
+        if (values[winner] < best) {
+            best = values[winner];
+            x = simplex[winner];
+        }
+        if (!improved) break;
+        step = std::max(0.02, step * 0.5);
+    }
+    return best;
+}
+
+//|........||Fits the plant's `vary` factors to its `measured` effluent. Restarts run concurrently (the first
+//|........||from the file's values, the rest from random points), each evaluation on a fresh copy of the plant.
+CalibrationResult runCalibration(const std::string& text, const std::string& source, const CalibrationOptions& options) {
+    CalibrationResult result;
+    auto start = std::chrono::steady_clock::now();
+    MeasuredSeries measured;
+    {
+        PlantEvaluator master;
+        if (!master.load(text, source, result.error)) return result;
+        if (master.plant.vary.empty()) {
+            result.error = "calibration needs 'vary' lines naming the parameters to fit";
+            return result;
+        }
+        if (master.run.measured.empty()) {
+            result.error = "calibration needs a 'measured' effluent file";
+            return result;
+        }
+        if (!loadMeasured(master.run.measured, measured, result.error)) return result;
+        result.factors = sensitivityFactors(master, 0.0f);
+        for (const ParameterRange& range : master.plant.vary) {
+            result.initial.push_back(*range.unit->parameter(range.parameter));
+        }
+    }
+    const size_t k = result.factors.size();
+    result.columns = measured.columns;
+
+    std::atomic<long> evaluations{0};
+    std::atomic<long> evaluationNanoseconds{0};
+    //|........||Mean squared scaled residual; failed runs are infinitely bad so the simplex moves away
+    auto residualsAt = [&](const std::vector<double>& u, std::vector<double>& residuals) {
+        auto begin = std::chrono::steady_clock::now();
+        PlantEvaluator evaluator;
+        std::string error;
+        residuals.clear();
+        bool ok = evaluator.load(text, source, error) && evaluator.bind(result.factors, error);
+        if (ok) {
+            evaluator.setFactors(u.data());
+            ok = trackMeasured(evaluator, measured, residuals, error);
+        }
+        evaluations.fetch_add(1, std::memory_order_relaxed);
+        evaluationNanoseconds.fetch_add(long(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count()), std::memory_order_relaxed);
+        return ok && !residuals.empty();
+    };
+    auto objective = [&](const std::vector<double>& u) {
+        std::vector<double> residuals;
+        if (!residualsAt(u, residuals)) return std::numeric_limits<double>::infinity();
+        double sum = 0.0;
+        for (double r : residuals) sum += r * r;
+        return sum / residuals.size();
+    };
+
+    std::vector<double> nominal(k);
+    for (size_t i = 0; i < k; ++i) {
+        const SensitivityFactor& factor = result.factors[i];
+        nominal[i] = factor.high > factor.low ? std::clamp((result.initial[i] - factor.low) / (factor.high - factor.low), 0.0, 1.0) : 0.0;
+    }
+    result.initialObjective = objective(nominal);
+
+    const int restarts = std::max(1, options.restarts);
+    std::vector<std::vector<double>> points(restarts, nominal);
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int r = 1; r < restarts; ++r) {
+        for (double& v : points[r]) v = uniform(rng);
+    }
+    result.restartObjectives.assign(restarts, 0.0);
+    runWorkStealing(restarts, std::max(1u, options.threads), [&](int r) {
+        result.restartObjectives[r] = nelderMead(objective, points[r], options.evaluations, options.tolerance);
+    });
+    int winner = int(std::min_element(result.restartObjectives.begin(), result.restartObjectives.end())
+        - result.restartObjectives.begin());
+    result.objective = result.restartObjectives[winner];
+    if (!std::isfinite(result.objective)) {
+        result.error = "no parameter set gave a finite effluent";
+        return result;
+    }
+    const std::vector<double>& u = points[winner];
+    for (size_t i = 0; i < k; ++i) {
+        const SensitivityFactor& factor = result.factors[i];
+        result.best.push_back(factor.low + float(u[i]) * (factor.high - factor.low));
+    }
+
+    //|........||Residual Jacobian in physical units: by forward-mode AD in the same pass as the residuals for
+    //|........||steady-state files, else by central differences (2k runs, in parallel). Then covariance
+    //|........||s²(JᵀJ)⁻¹ with s² = SSE / (n - k) and the correlations between the factors
+    std::vector<double> residuals;
+    std::vector<std::vector<double>> jacobian;
+    {
+        PlantEvaluator evaluator;
+        std::string error;
+        result.automaticJacobian = evaluator.load(text, source, error) && evaluator.bind(result.factors, error) &&
+            evaluator.run.mode == STEADY_STATE;
+        if (result.automaticJacobian) {
+            evaluator.setFactors(u.data());
+            result.automaticJacobian = trackMeasured(evaluator, measured, residuals, error, &jacobian);
+        }
+    }
+    if (!result.automaticJacobian) {
+        residuals.clear();
+        residualsAt(u, residuals);
+    }
+    const size_t n = residuals.size();
+    result.measurements = int(n);
+    const size_t width = measured.columns.size();
+    std::vector<double> sums(width, 0.0);
+    std::vector<int> counts(width, 0);
+    for (size_t row = 0, index = 0; row < measured.times.size() && index < n; ++row) {
+        for (size_t c = 0; c < width; ++c) {
+            if (std::isnan(measured.values[row * width + c])) continue;
+            double error = residuals[index++] * measured.scale[c];
+            sums[c] += error * error;
+            ++counts[c];
+        }
+    }
+    for (size_t c = 0; c < sums.size(); ++c) result.rmse.push_back(counts[c] ? std::sqrt(sums[c] / counts[c]) : 0.0);
+
+    if (!result.automaticJacobian) jacobian.assign(k, std::vector<double>(n, 0.0));
+    runWorkStealing(result.automaticJacobian ? 0 : int(k), std::max(1u, options.threads), [&](int i) {
+        const SensitivityFactor& factor = result.factors[i];
+        double h = std::min(1e-3, 0.5 * std::max(u[i], 1.0 - u[i]));
+        std::vector<double> up = u, down = u;
+        up[i] = std::min(1.0, u[i] + h);
+        down[i] = std::max(0.0, u[i] - h);
+        std::vector<double> rUp, rDown;
+        if (!residualsAt(up, rUp) || !residualsAt(down, rDown) || rUp.size() != n || rDown.size() != n) return;
+        double span = (up[i] - down[i]) * (factor.high - factor.low);
+        if (span <= 0.0) return;
+        for (size_t j = 0; j < n; ++j) jacobian[i][j] = (rUp[j] - rDown[j]) / span;
+    });
+    std::vector<double> normal(k * k, 0.0);
+    for (size_t a = 0; a < k; ++a) {
+        for (size_t b = 0; b < k; ++b) {
+            for (size_t j = 0; j < n; ++j) normal[a * k + b] += jacobian[a][j] * jacobian[b][j];
+        }
+    }
+    //|........||Inverted in correlation form (unit diagonal) with a tiny ridge, so factors the data cannot
+    //|........||separate show up as correlations near ±1 and large errors instead of a failed inverse.
+    //|........||A factor with no effect at all gets an infinite error and no correlations.
+    std::vector<size_t> seen;
+    for (size_t a = 0; a < k; ++a) {
+        if (normal[a * k + a] > 0.0) seen.push_back(a);
+    }
+    const size_t q = seen.size();
+    std::vector<double> scaled(q * q), inverse(q * q, 0.0);
+    for (size_t a = 0; a < q; ++a) {
+        inverse[a * q + a] = 1.0;
+        for (size_t b = 0; b < q; ++b) {
+            scaled[a * q + b] = normal[seen[a] * k + seen[b]]
+                / std::sqrt(normal[seen[a] * k + seen[a]] * normal[seen[b] * k + seen[b]]);
+        }
+        scaled[a * q + a] += 1e-9;
+    }
+    for (size_t col = 0; col < q; ++col) {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < q; ++row) {
+            if (std::fabs(scaled[row * q + col]) > std::fabs(scaled[pivot * q + col])) pivot = row;
+        }
+        for (size_t c = 0; c < q; ++c) {
+            std::swap(scaled[col * q + c], scaled[pivot * q + c]);
+            std::swap(inverse[col * q + c], inverse[pivot * q + c]);
+        }
+        double scale = 1.0 / scaled[col * q + col];
+        for (size_t c = 0; c < q; ++c) {
+            scaled[col * q + c] *= scale;
+            inverse[col * q + c] *= scale;
+        }
+        for (size_t row = 0; row < q; ++row) {
+            if (row == col) continue;
+            double factor = scaled[row * q + col];
+            for (size_t c = 0; c < q; ++c) {
+                scaled[row * q + c] -= factor * scaled[col * q + c];
+                inverse[row * q + c] -= factor * inverse[col * q + c];
+            }
+        }
+    }
+    double variance = n > k ? result.objective * n / double(n - k) : std::nan("");
+    result.standardError.assign(k, std::numeric_limits<double>::infinity());
+    result.correlation.assign(k, std::vector<double>(k, std::nan("")));
+    for (size_t a = 0; a < q; ++a) {
+        result.standardError[seen[a]] = std::sqrt(variance * inverse[a * q + a] / normal[seen[a] * k + seen[a]]);
+        for (size_t b = 0; b < q; ++b) {
+            result.correlation[seen[a]][seen[b]] = inverse[a * q + b] / std::sqrt(inverse[a * q + a] * inverse[b * q + b]);
         }
-
-        flowParticles.erase(std::remove_if(flowParticles.begin(), flowParticles.end(),
-            [this](sf::CircleShape& p) {
-                return p.getPosition().x >= to->position.x;
-            }), flowParticles.end());
     }
 
-    void draw(sf::RenderWindow& window) {
-        sf::RectangleShape pipe;
-        pipe.setPosition(from->position.x + from->width, from->position.y + from->height / 2 - diameter / 2);
-        pipe.setSize(sf::Vector2f(to->position.x - (from->position.x + from->width), diameter));
-        pipe.setFillColor(sf::Color(70, 70, 70));
-        window.draw(pipe);
+    result.evaluations = evaluations.load();
+    result.secondsPerEvaluation = evaluationNanoseconds.load() * 1e-9 / std::max(1L, result.evaluations);
+    result.ok = true;
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
 
-        for (auto& particle : flowParticles) {
-            window.draw(particle);
+//|........||Headless entry point: fits, prints the report and, if `outPath` is set, writes the plant with
+//|........||the fitted values
+int runCalibrationFile(const std::string& path, const CalibrationOptions& options, const std::string& outPath) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    CalibrationResult result = runCalibration(text.str(), path, options);
+    if (!result.ok) {
+        std::fprintf(stderr, "%s\n", result.error.c_str());
+        return 1;
+    }
+    std::printf("%zu factors, %d measurements; objective %.4g -> %.4g (mean squared scaled residual)\n",
+        result.factors.size(), result.measurements, result.initialObjective, result.objective);
+    std::printf("%ld evaluations on %u threads in %.2f s: %.2f ms per evaluation, %.2f ms wall per evaluation\n",
+        result.evaluations, std::max(1u, options.threads), result.wallSeconds, 1e3 * result.secondsPerEvaluation,
+        1e3 * result.wallSeconds / std::max(1L, result.evaluations));
+    std::printf("restarts:");
+    for (double value : result.restartObjectives) std::printf(" %.4g", value);
+    std::printf("\n");
+    for (size_t i = 0; i < result.factors.size(); ++i) {
+        std::printf("  %-32s %.5g -> %.5g +/- %.2g  [%g, %g]\n", result.factors[i].label.c_str(), result.initial[i],
+            result.best[i], result.standardError[i], result.factors[i].low, result.factors[i].high);
+    }
+    std::printf("standard errors from a %s Jacobian\n",
+        result.automaticJacobian ? "forward-mode AD" : "central-difference");
+    std::printf("correlations:\n");
+    for (size_t a = 0; a < result.factors.size(); ++a) {
+        std::printf("  %-32s", result.factors[a].label.c_str());
+        for (size_t b = 0; b <= a; ++b) std::printf(" %6.2f", result.correlation[a][b]);
+        std::printf("\n");
+    }
+    for (size_t c = 0; c < result.columns.size(); ++c) {
+        std::printf("  RMSE %s %.4g\n", parameterKey(result.columns[c]), result.rmse[c]);
+    }
+    if (outPath.empty()) return 0;
+
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    PlantRun run;
+    std::string error;
+    std::istringstream source(text.str());
+    if (readPlant(plant, source, path, run, error)) {
+        for (size_t i = 0; i < plant.vary.size(); ++i) {
+            *plant.vary[i].unit->parameter(plant.vary[i].parameter) = float(result.best[i]);
+        }
+        if (savePlant(plant, outPath, run, error)) {
+            std::printf("calibrated plant -> %s\n", outPath.c_str());
+            return 0;
         }
     }
+    std::fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+}
+
+//|........||Train synthesis: the cheapest series trains of catalogue units that meet the plant file's limits
+//|........||at steady state, for the file's influent (its first row, for dynamic files). Each limit is taken
+//|........||as a ceiling on the steady effluent, where mean, max and percentile all equal that one value.
+struct SynthesisOptions {
+    int maxUnits = 4;                //|........||longest train searched
+    int keep = 5;                    //|........||cheapest compliant trains reported
+    double capitalRecovery = 0.08;   //|........||share of the capital charged per year (about 20 years at 5 %)
+    double energyPrice = 0.12;       //|........||per kWh
+    unsigned threads = 1;
 };
 
-//|........||Estructura para almacenar datos históricos
-struct ParameterHistory {
-    std::deque<float> values;
-    size_t maxSize;
-    ParameterHistory(size_t size = 100) : maxSize(size) {}
-    void addValue(float val) {
-        if (values.size() >= maxSize) values.pop_front();
-        values.push_back(val);
-    }
+struct TrainDesign {
+    std::vector<std::string> units;  //|........||catalogue labels, inlet to outlet
+    double capital = 0.0;
+    double energy = 0.0;             //|........||kWh/day
+    double annualCost = 0.0;         //|........||capitalRecovery · capital + 365 · energyPrice · energy
+    Water effluent;
 };
 
-//|........||Mapa para almacenar el historial de cada parámetro
-std::map<WaterParameter, ParameterHistory> parameterHistories;
+struct SynthesisResult {
+    bool ok = false;
+    std::string error;
+    std::vector<TrainDesign> trains;     //|........||cheapest first
+    TrainDesign current;                 //|........||the file's own units, priced the same way
+    bool currentCompliant = false;
+    std::vector<PermitLimit> limits;
+    int candidates = 0;
+    long nodes = 0;                      //|........||prefixes evaluated, one unit simulate() each
+    long boundPruned = 0;                //|........||prefixes that could not beat the kept trains, or grow
+    long dominated = 0;                  //|........||prefixes that reached a known effluent at no lower cost
+    double wallSeconds = 0.0;
+};
 
-//|........||Actualizar los historiales después de cada simulación
-void updateHistories(const std::vector<Component*>& components) {
-    for (const auto& comp : components) {
-        for (const auto& param : comp->outletWater.parameters) {
-            parameterHistories[param.first].addValue(param.second);
-        }
+bool meetsLimits(const Water& effluent, const std::vector<PermitLimit>& limits) {
+    for (const PermitLimit& permit : limits) {
+        if (!(effluent.parameters[permit.parameter] <= permit.limit)) return false;
     }
+    return true;
 }
 
-//|........||Función para dibujar gráficos
-void drawGraphs() {
-    ImGui::Begin("Gráficos de Parámetros");
+//|........||Branch and bound over unit sequences. A prefix is extended one unit at a time from the effluent
+//|........||of its parent, so every node costs a single simulate(). A branch is cut when
+//|........||  - the unit left the water unchanged (the shorter prefix is the same train, cheaper),
+//|........||  - its cost plus the cheapest possible next unit reaches the cost of the kept trains, or
+//|........||  - another prefix, no longer, already reached the same effluent (bit for bit) at no higher
+//|........||    cost; this memo of prefix results is shared by all threads and removes reorderings.
+//|........||Compliant prefixes are not extended: more units only add cost. Subtrees under each first unit
+//|........||run on runWorkStealing, each thread with its own unit instances.
+SynthesisResult runSynthesis(const std::string& text, const std::string& source, const SynthesisOptions& options) {
+    SynthesisResult result;
+    auto begin = std::chrono::steady_clock::now();
+    PlantEvaluator master;
+    if (!master.load(text, source, result.error)) return result;
+    const PlantRun& run = master.run;
+    result.limits = run.limits;
+    if (run.limits.empty()) {
+        result.error = "the plant file has no limits to meet";
+        return result;
+    }
+    const double recovery = options.capitalRecovery;
+    const double price = 365.0 * options.energyPrice;
+    const int maxUnits = std::max(1, options.maxUnits);
+    const size_t keep = size_t(std::max(1, options.keep));
+
+    //|........||Annual cost of one unit at its inlet flow, after it has simulated
+    auto unitPrice = [&](const UnitCost& cost, Component* comp, float flow, TrainDesign& design) {
+        double capital = double(cost.capital) * flow;
+        double energy = double(cost.energy) * flow;
+        if (EnergyMeter* meter = comp->energyMeter()) energy += meter->power * 24.0;
+        design.capital += capital;
+        design.energy += energy;
+        design.annualCost += recovery * capital + price * energy;
+    };
 
-    for (auto& [param, history] : parameterHistories) {
-        std::string label = parameterToString(param);
-        if (ImGui::CollapsingHeader(label.c_str())) {
-            if (!history.values.empty()) {
-                std::vector<float> plotData(history.values.begin(), history.values.end());
-                ImGui::PlotLines(" ", plotData.data(), plotData.size(), 0, NULL, 0.0f, 1000.0f, ImVec2(0, 100));
-            }
-        }
+    Plant& plant = master.plant;
+    plant.step(0.0f);
+    for (Component* comp : plant.components) {
+        if (comp == plant.inlet || comp == plant.outlet) continue;
+        const char* label = componentLabel(comp);
+        if (!label) continue;
+        result.current.units.push_back(label);
+        unitPrice(unitCost(label, run), comp, comp->inletWater.flow, result.current);
+    }
+    result.current.effluent = plant.outlet->inletWater;
+    result.currentCompliant = meetsLimits(result.current.effluent, run.limits);
+    const Water feed = plant.inlet->outletWater;
+
+    //|........||Liquid-line units only: the sludge line and the outlet do not belong in a train, and in series a
+    //|........||Mixer or Splitter only passes the water on.
+    //|........||The bound needs the cheapest unit that could still change the effluent. Unit costs scale with the
+    //|........||inlet flow and metered power is never negative, so the annual cost per m³/day of the cheapest
+    //|........||unit, times the flow leaving a prefix, bounds any next unit, also after a unit that changed the
+    //|........||flow. Units that pass a fully loaded water through unchanged (flow meters, pumps) would only be
+    //|........||cut, so they do not lower it; a unit the file prices at zero does, to zero.
+    Water loaded = feed;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) loaded.parameters[p] = std::max(loaded.parameters[p], 1.0f);
+    std::vector<std::string> labels;
+    std::vector<UnitCost> costs;
+    double cheapestRate = std::numeric_limits<double>::infinity();
+    for (const ComponentType& entry : componentCatalog()) {
+        if (entry.type == typeid(Outlet) || entry.type == typeid(Mixer) || entry.type == typeid(Splitter)) continue;
+        std::unique_ptr<Component> probe(entry.make(sf::Vector2f()));
+        if (probe->outputKind(0) != LIQUID_STREAM) continue;
+        labels.push_back(entry.label);
+        costs.push_back(unitCost(entry.label, run));
+        probe->inletWater = loaded;
+        probe->simulate(0.0f);
+        if (probe->outletWater == loaded) continue;
+        cheapestRate = std::min(cheapestRate, recovery * costs.back().capital + price * costs.back().energy);
     }
+    const int count = int(labels.size());
+    result.candidates = count;
+
+    //|........||Effluents keyed by their exact float bits, since two effluents a rounding apart may sit on either
+    //|........||side of a limit; the value is the cheapest cost that reached it, per train length
+    typedef std::array<uint32_t, PARAMETER_COUNT + 1> WaterKey;
+    struct WaterKeyHash {
+        size_t operator()(const WaterKey& key) const {
+            uint64_t hash = 1469598103934665603ull;
+            for (uint32_t word : key) hash = (hash ^ word) * 1099511628211ull;
+            return size_t(hash);
+        }
+    };
+    struct MemoShard {
+        std::mutex mutex;
+        std::unordered_map<WaterKey, std::vector<double>, WaterKeyHash> costs;
+    };
+    std::vector<MemoShard> memo(64);
+    auto keyOf = [](const Water& water) {
+        WaterKey key;
+        auto bits = [](float value) {
+            uint32_t word;
+            std::memcpy(&word, &value, sizeof(word));
+            return word;
+        };
+        key[0] = bits(water.flow);
+        for (int p = 0; p < PARAMETER_COUNT; ++p) key[p + 1] = bits(water.parameters[p]);
+        return key;
+    };
+    //|........||False if a prefix of at most `length` units reached `water` at no more than `cost`
+    auto claim = [&](const Water& water, int length, double cost) {
+        WaterKey key = keyOf(water);
+        MemoShard& shard = memo[WaterKeyHash()(key) % memo.size()];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::vector<double>& best = shard.costs[key];
+        if (best.empty()) best.assign(maxUnits + 1, std::numeric_limits<double>::infinity());
+        for (int k = 1; k <= length; ++k) {
+            if (best[k] <= cost) return false;
+        }
+        best[length] = cost;
+        return true;
+    };
 
-    ImGui::End();
-}
+    std::mutex keptMutex;
+    std::vector<TrainDesign> kept;
+    std::atomic<double> bound{std::numeric_limits<double>::infinity()};
+    std::atomic<long> nodes{0}, boundPruned{0}, dominated{0};
+    auto record = [&](const TrainDesign& design) {
+        std::lock_guard<std::mutex> lock(keptMutex);
+        if (kept.size() >= keep && design.annualCost >= kept.back().annualCost) return;
+        auto at = std::upper_bound(kept.begin(), kept.end(), design,
+            [](const TrainDesign& a, const TrainDesign& b) { return a.annualCost < b.annualCost; });
+        kept.insert(at, design);
+        if (kept.size() > keep) kept.pop_back();
+        if (kept.size() == keep) bound.store(kept.back().annualCost);
+    };
 
-void setImGuiStyle() {
-    ImGui::StyleColorsDark(); //|........||Usar colores oscuros como base
+    runWorkStealing(count, std::max(1u, options.threads), [&](int first) {
+        std::vector<std::unique_ptr<Component>> units;
+        for (const std::string& label : labels) units.emplace_back(createComponent(label, sf::Vector2f()));
+        std::vector<int> train;
+        long visited = 0, cut = 0, repeats = 0;
+        auto extend = [&](auto& self, const Water& in, const TrainDesign& prefix, int unit) -> void {
+            Component* comp = units[unit].get();
+            comp->inletWater = in;
+            comp->simulate(0.0f);
+            ++visited;
+            if (comp->outletWater == in) return;
+            TrainDesign design = prefix;
+            design.effluent = comp->outletWater;
+            unitPrice(costs[unit], comp, in.flow, design);
+            bool compliant = meetsLimits(design.effluent, run.limits);
+            int length = int(train.size()) + 1;
+            double next = compliant ? 0.0 : cheapestRate * design.effluent.flow;
+            if (design.annualCost + next >= bound.load(std::memory_order_relaxed)
+                || (!compliant && length == maxUnits)) {
+                ++cut;
+                return;
+            }
+            if (!claim(design.effluent, length, design.annualCost)) {
+                ++repeats;
+                return;
+            }
+            train.push_back(unit);
+            if (compliant) {
+                for (int u : train) design.units.push_back(labels[u]);
+                record(design);
+            } else {
+                for (int next = 0; next < count; ++next) self(self, design.effluent, design, next);
+            }
+            train.pop_back();
+        };
+        extend(extend, feed, TrainDesign(), first);
+        nodes += visited;
+        boundPruned += cut;
+        dominated += repeats;
+    });
+
+    result.trains = kept;
+    result.nodes = nodes.load();
+    result.boundPruned = boundPruned.load();
+    result.dominated = dominated.load();
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.ok = true;
+    if (result.trains.empty()) result.error = "no train of up to " + std::to_string(maxUnits) + " units meets the limits";
+    return result;
+}
 
-    ImGuiStyle& style = ImGui::GetStyle();
-    style.WindowRounding = 5.0f;
-    style.FrameRounding = 3.0f;
-    style.GrabRounding = 3.0f;
+//|........||Replaces every unit of `plant` with a series train of catalogue units
+void buildTrain(Plant& plant, const std::vector<std::string>& units) {
+    plant.clear();
+    for (const std::string& label : units) {
+        if (Component* comp = createComponent(label, sf::Vector2f())) plant.append(comp);
+    }
+    plant.markAllDirty();
+}
 
-    //|........||Personalizar colores
-    style.Colors[ImGuiCol_WindowBg] = ImVec4(0.1f, 0.105f, 0.11f, 1.0f);
-    style.Colors[ImGuiCol_Header] = ImVec4(0.2f, 0.205f, 0.21f, 1.0f);
-    style.Colors[ImGuiCol_HeaderHovered] = ImVec4(0.3f, 0.305f, 0.31f, 1.0f);
-    style.Colors[ImGuiCol_HeaderActive] = ImVec4(0.15f, 0.1505f, 0.151f, 1.0f);
-    //|........||Puedes personalizar más colores según prefieras
+int runSynthesisFile(const std::string& path, const SynthesisOptions& options, const std::string& outPath) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    SynthesisResult result = runSynthesis(text.str(), path, options);
+    if (!result.ok) {
+        std::fprintf(stderr, "%s\n", result.error.c_str());
+        return 1;
+    }
+    std::printf("%d candidate units, trains of up to %d: %ld prefixes, %ld cut by the bound, %ld dominated, "
+        "%.2f s on %u threads\n", result.candidates, std::max(1, options.maxUnits), result.nodes, result.boundPruned,
+        result.dominated, result.wallSeconds, std::max(1u, options.threads));
+    auto show = [&](const TrainDesign& design) {
+        std::printf("%.4g per year (capital %.4g, %.4g kWh/day):", design.annualCost, design.capital, design.energy);
+        for (size_t u = 0; u < design.units.size(); ++u) std::printf("%s %s", u ? " ->" : "", design.units[u].c_str());
+        std::printf("\n   ");
+        for (const PermitLimit& permit : result.limits) {
+            std::printf(" %s %.4g/%.4g", parameterKey(permit.parameter), design.effluent.parameters[permit.parameter],
+                permit.limit);
+        }
+        std::printf("\n");
+    };
+    std::printf("file's train, %s the limits: ", result.currentCompliant ? "meets" : "misses");
+    show(result.current);
+    if (result.trains.empty()) {
+        std::fprintf(stderr, "%s\n", result.error.c_str());
+        return 1;
+    }
+    for (size_t t = 0; t < result.trains.size(); ++t) {
+        std::printf("%zu. ", t + 1);
+        show(result.trains[t]);
+    }
+    if (outPath.empty()) return 0;
+
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    PlantRun run;
+    std::string error;
+    std::istringstream source(text.str());
+    if (readPlant(plant, source, path, run, error)) {
+        buildTrain(plant, result.trains.front().units);
+        if (savePlant(plant, outPath, run, error)) {
+            std::printf("cheapest train -> %s\n", outPath.c_str());
+            return 0;
+        }
+    }
+    std::fprintf(stderr, "%s\n", error.c_str());
+    return 1;
 }
 
-//|........||Main function
-int main() {
+//|........||Main function (left out when another translation unit, e.g. wwtpsim_bench.cpp, includes this file)
+#ifndef WWTPSIM_NO_MAIN
+int main(int argc, char** argv) {
+#ifdef WWTPSIM_TRACE
+    //|........||--trace <file.json> records the whole session
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--trace") Tracer::instance().start(argv[i + 1]);
+    }
+#endif
+    //|........||--batch <dir> [--threads N] [--summary file.csv] [--no-share] [--cache <dir>] runs every plant file
+    //|........||headless and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--batch") continue;
+        std::string directory = argv[i + 1];
+        std::string summary = (std::filesystem::path(directory) / "summary.csv").string();
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        for (int j = 1; j + 1 < argc; ++j) {
+            if (std::string(argv[j]) == "--threads") threads = (unsigned)std::max(1, std::atoi(argv[j + 1]));
+            if (std::string(argv[j]) == "--summary") summary = argv[j + 1];
+        }
+        bool share = true;
+        std::string cache;
+        for (int j = 1; j < argc; ++j) {
+            if (std::string(argv[j]) == "--no-share") share = false;
+            if (std::string(argv[j]) == "--cache" && j + 1 < argc) cache = argv[j + 1];
+        }
+        return runBatch(directory, threads, summary, share, cache);
+    }
+    //|........||--sensitivity <file.plant> [--method morris|sobol] [--samples N] [--spread f] [--outputs NH4,TSS]
+    //|........||[--threads N] [--double] [--out file.csv] runs a global sensitivity study headless and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--sensitivity") continue;
+        std::string path = argv[i + 1];
+        std::filesystem::path out = std::filesystem::path(path).replace_extension(".sensitivity.csv");
+        SensitivityOptions options;
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+        for (int j = 1; j + 1 < argc; ++j) {
+            std::string flag = argv[j];
+            std::string value = argv[j + 1];
+            if (flag == "--method") options.method = value == "morris" ? MORRIS : SOBOL;
+            else if (flag == "--samples") options.samples = std::max(2, std::atoi(value.c_str()));
+            else if (flag == "--spread") options.spread = float(std::atof(value.c_str()));
+            else if (flag == "--threads") options.threads = (unsigned)std::max(1, std::atoi(value.c_str()));
+            else if (flag == "--out") out = value;
+            else if (flag == "--outputs") {
+                options.outputs.clear();
+                std::stringstream keys(value);
+                WaterParameter param;
+                for (std::string key; std::getline(keys, key, ',');) {
+                    if (parameterFromKey(key, param)) options.outputs.push_back(param);
+                    else std::fprintf(stderr, "unknown parameter '%s'\n", key.c_str());
+                }
+            }
+        }
+        for (int j = 1; j < argc; ++j) {
+            if (std::string(argv[j]) == "--double") options.precise = true;
+        }
+        return runSensitivityFile(path, options, out.string());
+    }
+    //|........||--gradient <file.plant> [--outputs NH4,TSS] prints the effluent derivatives with respect to the
+    //|........||file's vary factors (or every unit parameter) at its nominal values and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--gradient") continue;
+        std::vector<WaterParameter> outputs = {NH4, TSS};
+        for (int j = 1; j + 1 < argc; ++j) {
+            if (std::string(argv[j]) != "--outputs") continue;
+            outputs.clear();
+            std::stringstream keys(argv[j + 1]);
+            WaterParameter param;
+            for (std::string key; std::getline(keys, key, ',');) {
+                if (parameterFromKey(key, param)) outputs.push_back(param);
+                else std::fprintf(stderr, "unknown parameter '%s'\n", key.c_str());
+            }
+        }
+        return runGradientFile(argv[i + 1], outputs);
+    }
+    //|........||--precision <file.plant> [--outputs NH4,TSS] compares the file's steady-state effluent in float
+    //|........||and in double (all parameters by default) and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--precision") continue;
+        std::vector<WaterParameter> outputs;
+        for (int p = 0; p < PARAMETER_COUNT; ++p) outputs.push_back(WaterParameter(p));
+        for (int j = 1; j + 1 < argc; ++j) {
+            if (std::string(argv[j]) != "--outputs") continue;
+            outputs.clear();
+            std::stringstream keys(argv[j + 1]);
+            WaterParameter param;
+            for (std::string key; std::getline(keys, key, ',');) {
+                if (parameterFromKey(key, param)) outputs.push_back(param);
+                else std::fprintf(stderr, "unknown parameter '%s'\n", key.c_str());
+            }
+        }
+        return runPrecisionFile(argv[i + 1], outputs);
+    }
+    //|........||--surrogates <file.plant> [--samples N] builds the file's surrogate tables, checks them against
+    //|........||simulate() at N random points each and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--surrogates") continue;
+        int samples = 2000;
+        for (int j = 1; j + 1 < argc; ++j) {
+            if (std::string(argv[j]) == "--samples") samples = std::max(1, std::atoi(argv[j + 1]));
+        }
+        return runSurrogateFile(argv[i + 1], samples);
+    }
+    //|........||--synthesize <file.plant> [--max-units N] [--keep N] [--threads N] [--out best.plant] searches the
+    //|........||cheapest unit trains that meet the file's limits and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--synthesize") continue;
+        SynthesisOptions options;
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+        std::string out;
+        for (int j = 1; j + 1 < argc; ++j) {
+            std::string flag = argv[j];
+            if (flag == "--max-units") options.maxUnits = std::max(1, std::atoi(argv[j + 1]));
+            else if (flag == "--keep") options.keep = std::max(1, std::atoi(argv[j + 1]));
+            else if (flag == "--threads") options.threads = (unsigned)std::max(1, std::atoi(argv[j + 1]));
+            else if (flag == "--out") out = argv[j + 1];
+        }
+        return runSynthesisFile(argv[i + 1], options, out);
+    }
+    //|........||--calibrate <file.plant> [--restarts N] [--evaluations N] [--threads N] [--out fitted.plant] fits the
+    //|........||file's vary factors to its measured effluent and exits
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--calibrate") continue;
+        CalibrationOptions options;
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+        std::string out;
+        for (int j = 1; j + 1 < argc; ++j) {
+            std::string flag = argv[j];
+            if (flag == "--restarts") options.restarts = std::max(1, std::atoi(argv[j + 1]));
+            else if (flag == "--evaluations") options.evaluations = std::max(1, std::atoi(argv[j + 1]));
+            else if (flag == "--threads") options.threads = (unsigned)std::max(1, std::atoi(argv[j + 1]));
+            else if (flag == "--out") out = argv[j + 1];
+        }
+        return runCalibrationFile(argv[i + 1], options, out);
+    }
+
     sf::RenderWindow window(sf::VideoMode(1600, 900), "WWTP Simulator @FECORO");
     window.setFramerateLimit(60);
     ImGui::SFML::Init(window);
     setImGuiStyle();
 
-    std::vector<Component*> components;
-    std::vector<Connection*> connections;
-
     Inlet* inlet = new Inlet(sf::Vector2f(50, 440));
     Outlet* outlet = new Outlet(sf::Vector2f(1650, 440));
-    components.push_back(inlet);
-    components.push_back(outlet);
+    Plant plant(inlet, outlet);
+    std::vector<Component*>& components = plant.components;
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    bool useThreadPool = true;
+    plant.pool = &pool;
+    int exampleTrains = 4;
+    float exampleRecycle = 1.0f;
 
     std::string newComponentType = "Primary Sedimentation Tank";
-    std::vector<std::string> componentTypes = {
-        "Primary Sedimentation Tank",
-        "Primary Clarifier",
-        "Aeration Tank",
-        "Secondary Clarifier",
-        "Chlorine Disinfection Unit",
-        "UV Disinfection",
-        "Anaerobic Filter",
-        "Sludge Digester",
-        "Oil and Grease Separator",
-        "Phosphorus Removal Unit",
-        "Drying Bed",
-        "Pump",
-        "Flow Meter",
-        "Water Softener",
-        "Activated Carbon Filter",
-        "Heat Exchanger",
-        "Metals Removal Unit",
-        "Membrane Filtration Unit",
-        "Reverse Osmosis Unit",
-        "Coagulation and Flocculation",
-        "Membrane Filtration",
-        "Chemical Oxidation",
-        "Active Sludge Process",
-        "Nitrification Tank",
-        "Biofilter",
-        "Filtration",
-        "Membrane Bioreactor",
-        "Ozone Disinfection",
-        "Anaerobic-Aerobic Treatment",
-        "Electrocoagulation Unit",
-    };
+    std::vector<std::string> componentTypes;
+    for (const ComponentType& entry : componentCatalog()) componentTypes.push_back(entry.label);
+    bool addDetached = false;
+    char plantPath[256] = "plant.plant";
+    PlantRun plantRun;          //|........||Run settings of the last loaded file, written back on save
+    std::string plantFileStatus;
+    PermitLimit newPermit;
+    float newPermitDays = 7.0f;
+    SensitivityOptions sensitivityOptions;
+    sensitivityOptions.threads = std::max(1u, std::thread::hardware_concurrency());
+    std::future<SensitivityResult> sensitivityJob;   //|........||Runs on a copy of the plant, off the UI thread
+    SensitivityResult sensitivity;
+    CalibrationOptions calibrationOptions;
+    calibrationOptions.threads = sensitivityOptions.threads;
+    std::future<CalibrationResult> calibrationJob;
+    CalibrationResult calibration;
+    SynthesisOptions synthesisOptions;
+    synthesisOptions.threads = sensitivityOptions.threads;
+    std::future<SynthesisResult> synthesisJob;
+    SynthesisResult synthesis;
+    size_t connectFrom = 0;
+    size_t connectTo = 1;
 
     bool isSimulating = false;
     float simulationSpeed = 1.0f;
@@ -1089,6 +8626,9 @@ int main() {
 
     sf::Clock deltaClock;
     while (window.isOpen()) {
+        PROFILE_END_FRAME();
+        PROFILE_SCOPE(PROFILE_FRAME);
+        TRACE_SCOPE("Frame");
         sf::Event event;
         while (window.pollEvent(event)) {
             ImGui::SFML::ProcessEvent(event);
@@ -1100,30 +8640,46 @@ int main() {
         float deltaTime = deltaClock.restart().asSeconds() * simulationSpeed;
 
         if (isSimulating) {
-            for (size_t i = 0; i < components.size(); ++i) {
-                if (i == 0) continue;
-                components[i]->simulate(deltaTime);
-            }
-
-            for (size_t i = 1; i < components.size(); ++i) {
-                components[i]->inletWater = components[i - 1]->outletWater;
-            }
+            plant.step(deltaTime);
 
             //|........||Actualizar historiales
             updateHistories(components);
         }
-
-        for (auto& comp : components) {
-            comp->update(deltaTime);
+        TRACE_COUNTER("particles", [&plant] {
+            size_t count = 0;
+            for (auto& comp : plant.components) count += comp->waterParticles.size();
+            for (auto& conn : plant.connections) count += conn->flowParticles.size();
+            return (double)count;
+        }());
+        TRACE_COUNTER("history values", [] {
+            size_t count = 0;
+            for (auto& entry : parameterHistories) count += entry.second.values.size();
+            return (double)count;
+        }());
+
+        {
+            PROFILE_SCOPE(PROFILE_COMPONENT_UPDATE);
+            TRACE_SCOPE("Component update");
+            for (auto& comp : components) {
+                PROFILE_SCOPE(PROFILE_UNIT_UPDATE(comp));
+                comp->update(deltaTime);
+            }
         }
-        for (auto& conn : connections) {
-            conn->update(deltaTime);
+        {
+            PROFILE_SCOPE(PROFILE_CONNECTION_UPDATE);
+            TRACE_SCOPE("Connection update");
+            for (auto& conn : plant.connections) {
+                conn->update(deltaTime);
+            }
         }
 
         ImGui::SFML::Update(window, sf::seconds(SIMULATION_TIME_STEP));
 
         //|........||Dibujar gráficos
         drawGraphs();
+#ifdef WWTPSIM_PROFILE
+        drawProfiler(plant);
+#endif
 
         //|........||Ventana adicional de IMGUI para Inlet y Outlet
         if (showInletOutletWindow) {
@@ -1131,19 +8687,83 @@ int main() {
 
             //|........||Parámetros de Inlet
             ImGui::Text("Inlet:");
-            for (const auto& param : inlet->outletWater.parameters) {
-                float value = param.second;
-                if (ImGui::InputFloat(("Inlet " + parameterToString(param.first)).c_str(), &value)) {
-                    inlet->outletWater.updateParameter(param.first, value);
+            if (ImGui::InputFloat("Inlet Flow (m³/day)", &inlet->outletWater.flow)) {
+                inlet->markDirty();
+            }
+            for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                WaterParameter param = (WaterParameter)p;
+                float value = inlet->outletWater.getParameter(param);
+                if (ImGui::InputFloat(("Inlet " + parameterToString(param)).c_str(), &value)) {
+                    inlet->outletWater.updateParameter(param, value);
+                    inlet->markDirty();
                 }
             }
             ImGui::Separator();
 
             //|........||Parámetros de Outlet
             ImGui::Text("Outlet:");
-            for (const auto& param : outlet->inletWater.parameters) {
-                float value = param.second;
-                ImGui::Text("%s: %.2f", ("Outlet " + parameterToString(param.first)).c_str(), value);
+            for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                WaterParameter param = (WaterParameter)p;
+                float value = outlet->inletWater.getParameter(param);
+                ImGui::Text("%s: %.2f", ("Outlet " + parameterToString(param)).c_str(), value);
+            }
+            ImGui::Separator();
+
+            //|........||Permisos de descarga: en modo dinámico se evalúan sobre el muestreo del efluente
+            ComplianceMonitor& compliance = plant.compliance;
+            ImGui::Text("Permit:");
+            if (ImGui::InputFloat("Sample interval (s)", &compliance.sampleInterval)) {
+                compliance.sampleInterval = std::max(compliance.sampleInterval, 1.0f);
+                compliance.reset();
+            }
+            if (compliance.status.size() != compliance.limits.size()) compliance.reset();
+            for (size_t k = 0; k < compliance.limits.size(); ++k) {
+                const PermitLimit& permit = compliance.limits[k];
+                const PermitStatus& state = compliance.status[k];
+                std::string term = formatPermit(permit);
+                if (plant.mode == STEADY_STATE) {
+                    float value = outlet->inletWater.getParameter(permit.parameter);
+                    ImGui::Text("%s: effluent %.2f%s", term.c_str(), value, value > permit.limit ? "  OVER" : "");
+                } else if (permit.statistic == PERMIT_PERCENTILE) {
+                    ImGui::Text("%s: %.2f over %ld samples%s", term.c_str(), state.current, compliance.samples,
+                        compliance.violated(k) ? "  OVER" : "");
+                } else {
+                    ImGui::Text("%s: %.2f now, worst %.2f, %ld of %ld over", term.c_str(), state.current,
+                        state.worst, state.exceedances, state.evaluations);
+                }
+                ImGui::SameLine();
+                if (ImGui::SmallButton(("Remove##permit" + std::to_string(k)).c_str())) {
+                    compliance.limits.erase(compliance.limits.begin() + k);
+                    compliance.reset();
+                    break;
+                }
+            }
+            if (ImGui::BeginCombo("Permit parameter", parameterToString(newPermit.parameter).c_str())) {
+                for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                    if (ImGui::Selectable(parameterToString((WaterParameter)p).c_str(), newPermit.parameter == p)) {
+                        newPermit.parameter = (WaterParameter)p;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            int statistic = newPermit.statistic;
+            ImGui::RadioButton("Rolling mean", &statistic, PERMIT_MEAN);
+            ImGui::SameLine();
+            ImGui::RadioButton("Rolling max", &statistic, PERMIT_MAX);
+            ImGui::SameLine();
+            ImGui::RadioButton("Percentile", &statistic, PERMIT_PERCENTILE);
+            newPermit.statistic = (PermitStatistic)statistic;
+            if (newPermit.statistic == PERMIT_PERCENTILE) {
+                float percent = float(newPermit.percentile * 100.0);
+                if (ImGui::SliderFloat("Percentile (%)", &percent, 50.0f, 100.0f)) newPermit.percentile = percent / 100.0;
+            } else {
+                ImGui::InputFloat("Window (days, 0 = each sample)", &newPermitDays);
+            }
+            ImGui::InputFloat("Limit", &newPermit.limit);
+            if (ImGui::Button("Add permit")) {
+                newPermit.window = std::max(newPermitDays, 0.0f) * 86400.0;
+                compliance.limits.push_back(newPermit);
+                compliance.reset();
             }
 
             ImGui::End();
@@ -1160,27 +8780,11 @@ int main() {
         }
         ImGui::SameLine();
         if (ImGui::Button("Reset")) {
-            for (auto& comp : components) {
-                if (comp != inlet && comp != outlet) {
-                    delete comp;
-                }
-            }
-            components.clear();
-            components.push_back(inlet);
-            components.push_back(outlet);
-            connections.clear();
+            plant.clear();
         }
         if (ImGui::Button("Load Default Example")) {
             //|........||Reset current components
-            for (auto& comp : components) {
-                if (comp != inlet && comp != outlet) {
-                    delete comp;
-                }
-            }
-            components.clear();
-            components.push_back(inlet);
-            components.push_back(outlet);
-            connections.clear();
+            plant.clear();
 
             //|........||Add typical components
             std::vector<std::string> defaultComponents = {
@@ -1188,36 +8792,232 @@ int main() {
                 "Primary Sedimentation Tank",
                 "Aeration Tank",
                 "Active Sludge Process",
-                "Nitrification Unit",
+                "Nitrification Tank",
                 "Secondary Clarifier",
                 "Chlorine Disinfection Unit",
                 "Filtration"
             };
             for (const auto& type : defaultComponents) {
-                sf::Vector2f position(components.back()->position.x - 150 * (components.size() - 1), 440);
-                Component* comp = nullptr;
-                if (type == "Primary Clarifier") comp = new PrimaryClarifier(position);
-                else if (type == "Primary Sedimentation Tank") comp = new PrimarySedimentationTank(position);
-                else if (type == "Aeration Tank") comp = new AerationTank(position);
-                else if (type == "Active Sludge Process") comp = new ActiveSludgeProcess(position);
-                else if (type == "Nitrification Unit") comp = new NitrificationTank(position);
-                else if (type == "Secondary Clarifier") comp = new SecondaryClarifier(position);
-                else if (type == "Chlorine Disinfection Unit") comp = new ChlorineDisinfectionUnit(position);
-                else if (type == "Filtration") comp = new Filtration(position);
-                components.insert(components.end() - 1, comp);
+                sf::Vector2f position(0, 440); //|........||Placed by Plant::append
+                plant.append(createComponent(type, position));
+            }
+        }
+        if (ImGui::Button("Load Parallel Trains Example")) {
+            buildParallelTrains(plant, exampleTrains);
+        }
+        ImGui::SameLine();
+        ImGui::SliderInt("Trains", &exampleTrains, 2, 8);
+        if (ImGui::Button("Load Sludge Line Example")) {
+            buildSludgeLine(plant);
+        }
+        if (ImGui::Button("Load Recycle Example")) {
+            buildRecycleLoop(plant, exampleRecycle);
+        }
+        ImGui::SameLine();
+        ImGui::SliderFloat("Recycle ratio", &exampleRecycle, 0.1f, 4.0f);
+        ImGui::InputText("Plant file", plantPath, sizeof(plantPath));
+        if (ImGui::Button("Load Plant")) {
+            std::string error;
+            if (loadPlant(plant, plantPath, plantRun, error)) {
+                plant.setMode(plantRun.mode);
+                plant.fixedStep = plantRun.step;
+                plant.compliance.limits = plantRun.limits;
+                plant.compliance.sampleInterval = plantRun.sampleInterval;
+                plant.compliance.reset();
+                plantFileStatus = "Loaded " + plantRun.name;
+            } else {
+                plantFileStatus = error;
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Save Plant")) {
+            std::string error;
+            plantRun.mode = plant.mode;
+            plantRun.step = plant.fixedStep;
+            plantRun.limits = plant.compliance.limits;
+            plantRun.sampleInterval = plant.compliance.sampleInterval;
+            plantFileStatus = savePlant(plant, plantPath, plantRun, error) ? std::string("Saved ") + plantPath : error;
+        }
+        if (!plantFileStatus.empty()) ImGui::TextWrapped("%s", plantFileStatus.c_str());
+
+        if (ImGui::CollapsingHeader("Sensitivity analysis")) {
+            int method = sensitivityOptions.method;
+            ImGui::RadioButton("Morris", &method, MORRIS);
+            ImGui::SameLine();
+            ImGui::RadioButton("Sobol", &method, SOBOL);
+            sensitivityOptions.method = (SensitivityMethod)method;
+            ImGui::InputInt(method == MORRIS ? "Trajectories" : "Base samples", &sensitivityOptions.samples);
+            sensitivityOptions.samples = std::max(2, sensitivityOptions.samples);
+            ImGui::SliderFloat("Range (± fraction)", &sensitivityOptions.spread, 0.05f, 0.9f);
+            bool running = sensitivityJob.valid();
+            if (running && sensitivityJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                sensitivity = sensitivityJob.get();
+                running = false;
+            }
+            if (running) {
+                ImGui::Text("Running...");
+            } else if (ImGui::Button("Run sensitivity")) {
+                std::ostringstream text;
+                std::string error;
+                if (writePlant(plant, text, plantRun, error)) {
+                    sensitivityJob = std::async(std::launch::async, runSensitivity, text.str(), std::string(plantPath),
+                        sensitivityOptions);
+                } else {
+                    sensitivity = SensitivityResult();
+                    sensitivity.error = error;
+                }
+            }
+            if (!sensitivity.ok && !sensitivity.error.empty()) ImGui::TextWrapped("%s", sensitivity.error.c_str());
+            if (sensitivity.ok) {
+                ImGui::Text("%zu factors, %ld runs (%ld failed) in %.2f s", sensitivity.factors.size(),
+                    sensitivity.evaluations, sensitivity.failed, sensitivity.wallSeconds);
+                for (size_t o = 0; o < sensitivity.outputs.size(); ++o) {
+                    ImGui::Text("%s:", parameterToString(sensitivity.outputs[o]).c_str());
+                    std::vector<int> ranking = sensitivityRanking(sensitivity, int(o));
+                    for (size_t r = 0; r < ranking.size() && r < 5; ++r) {
+                        const SensitivityIndex& index = sensitivity.indices[o][ranking[r]];
+                        const char* label = sensitivity.factors[ranking[r]].label.c_str();
+                        if (sensitivity.method == MORRIS) {
+                            ImGui::Text("  %s  mu* %.3g [%.3g, %.3g]  sigma %.3g", label, index.muStar,
+                                index.muStarLow, index.muStarHigh, index.sigma);
+                        } else {
+                            ImGui::Text("  %s  S1 %.2f [%.2f, %.2f]  ST %.2f [%.2f, %.2f]", label, index.first,
+                                index.firstLow, index.firstHigh, index.total, index.totalLow, index.totalHigh);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Calibration")) {
+            ImGui::TextWrapped("Fits the plant file's 'vary' parameters to its 'measured' effluent (%s).",
+                plantRun.measured.empty() ? "none loaded" : plantRun.measured.c_str());
+            ImGui::InputInt("Restarts", &calibrationOptions.restarts);
+            ImGui::InputInt("Evaluations per restart", &calibrationOptions.evaluations);
+            calibrationOptions.restarts = std::max(1, calibrationOptions.restarts);
+            calibrationOptions.evaluations = std::max(1, calibrationOptions.evaluations);
+            bool running = calibrationJob.valid();
+            if (running && calibrationJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                calibration = calibrationJob.get();
+                running = false;
             }
-            //|........||Adjust positions
-            for (size_t i = 1; i < components.size(); ++i) {
-                components[i]->position.x = components[i - 1]->position.x + 150;
-                components[i]->shape.setPosition(components[i]->position);
+            if (running) {
+                ImGui::Text("Running...");
+            } else if (ImGui::Button("Calibrate")) {
+                std::ostringstream text;
+                std::string error;
+                if (writePlant(plant, text, plantRun, error)) {
+                    calibrationJob = std::async(std::launch::async, runCalibration, text.str(), std::string(plantPath),
+                        calibrationOptions);
+                } else {
+                    calibration = CalibrationResult();
+                    calibration.error = error;
+                }
+            }
+            if (!calibration.ok && !calibration.error.empty()) ImGui::TextWrapped("%s", calibration.error.c_str());
+            if (calibration.ok) {
+                ImGui::Text("Objective %.4g -> %.4g, %ld evaluations, %.2f ms each", calibration.initialObjective,
+                    calibration.objective, calibration.evaluations, 1e3 * calibration.secondsPerEvaluation);
+                for (size_t i = 0; i < calibration.factors.size(); ++i) {
+                    ImGui::Text("  %s  %.4g -> %.4g +/- %.2g", calibration.factors[i].label.c_str(),
+                        calibration.initial[i], calibration.best[i], calibration.standardError[i]);
+                }
+                for (size_t a = 0; a < calibration.factors.size(); ++a) {
+                    for (size_t b = 0; b < a; ++b) {
+                        if (std::fabs(calibration.correlation[a][b]) < 0.9) continue;
+                        ImGui::Text("  correlated %.2f: %s / %s", calibration.correlation[a][b],
+                            calibration.factors[a].label.c_str(), calibration.factors[b].label.c_str());
+                    }
+                }
+                for (size_t c = 0; c < calibration.columns.size(); ++c) {
+                    ImGui::Text("  RMSE %s %.4g", parameterToString(calibration.columns[c]).c_str(), calibration.rmse[c]);
+                }
+                if (plant.vary.size() == calibration.best.size() && ImGui::Button("Apply fit")) {
+                    for (size_t i = 0; i < plant.vary.size(); ++i) {
+                        *plant.vary[i].unit->parameter(plant.vary[i].parameter) = float(calibration.best[i]);
+                    }
+                    plant.markAllDirty();
+                }
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Train synthesis")) {
+            ImGui::TextWrapped("Cheapest series trains of catalogue units that meet the limits at steady state, "
+                "for the plant's influent. Costs come from the catalogue and the file's 'cost' lines.");
+            ImGui::InputInt("Longest train", &synthesisOptions.maxUnits);
+            ImGui::InputInt("Trains kept", &synthesisOptions.keep);
+            synthesisOptions.maxUnits = std::clamp(synthesisOptions.maxUnits, 1, 6);
+            synthesisOptions.keep = std::max(1, synthesisOptions.keep);
+            bool running = synthesisJob.valid();
+            if (running && synthesisJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                synthesis = synthesisJob.get();
+                running = false;
             }
-            //|........||Create connections
-            for (size_t i = 0; i < components.size() - 1; ++i) {
-                connections.push_back(new Connection(components[i], components[i + 1]));
+            if (running) {
+                ImGui::Text("Searching...");
+            } else if (ImGui::Button("Synthesize")) {
+                std::ostringstream text;
+                std::string error;
+                if (writePlant(plant, text, plantRun, error)) {
+                    synthesisJob = std::async(std::launch::async, runSynthesis, text.str(), std::string(plantPath),
+                        synthesisOptions);
+                } else {
+                    synthesis = SynthesisResult();
+                    synthesis.error = error;
+                }
+            }
+            if (!synthesis.error.empty()) ImGui::TextWrapped("%s", synthesis.error.c_str());
+            if (synthesis.ok) {
+                ImGui::Text("%ld prefixes, %ld cut by the bound, %ld dominated, %.2f s", synthesis.nodes,
+                    synthesis.boundPruned, synthesis.dominated, synthesis.wallSeconds);
+                ImGui::Text("Current train: %.4g per year, %s the limits", synthesis.current.annualCost,
+                    synthesis.currentCompliant ? "meets" : "misses");
+                for (size_t t = 0; t < synthesis.trains.size(); ++t) {
+                    const TrainDesign& design = synthesis.trains[t];
+                    std::string units;
+                    for (size_t u = 0; u < design.units.size(); ++u) units += (u ? " -> " : "") + design.units[u];
+                    ImGui::PushID(int(t));
+                    if (ImGui::SmallButton("Use")) {
+                        buildTrain(plant, design.units);
+                    }
+                    ImGui::SameLine();
+                    ImGui::TextWrapped("%.4g per year: %s", design.annualCost, units.c_str());
+                    ImGui::PopID();
+                }
             }
         }
 
         ImGui::SliderFloat("Simulation Speed", &simulationSpeed, 0.1f, 5.0f);
+        if (ImGui::RadioButton("Steady State", plant.mode == STEADY_STATE)) plant.setMode(STEADY_STATE);
+        ImGui::SameLine();
+        if (ImGui::RadioButton("Dynamic", plant.mode == DYNAMIC)) plant.setMode(DYNAMIC);
+        if (ImGui::Checkbox("Run independent branches on the thread pool", &useThreadPool)) {
+            plant.pool = useThreadPool ? &pool : nullptr;
+        }
+        int minUnits = (int)plant.parallelMinUnits;
+        if (ImGui::InputInt("Parallel from (units)", &minUnits)) {
+            plant.parallelMinUnits = (size_t)std::max(minUnits, 0);
+        }
+        if (plant.mode == DYNAMIC) {
+            ImGui::InputFloat("Fixed step (s)", &plant.fixedStep);
+            ImGui::InputFloat("Simulated s per s", &plant.timeScale);
+            ImGui::Text("Simulated time: %.2f h", plant.simulatedTime / 3600.0);
+        }
+        ImGui::Text("Energy: %.1f kW (aeration %.1f kW), %.3f kWh/m³", plant.powerDraw(), plant.aerationPower(),
+            plant.energyPerVolume());
+        float biogas = 0.0f;
+        for (auto& comp : components) {
+            if (SludgeDigester* digester = dynamic_cast<SludgeDigester*>(comp)) biogas += digester->biogasFlow;
+        }
+        if (biogas > 0.0f) ImGui::Text("Biogas: %.1f m³/day", biogas);
+        if (plant.mode == STEADY_STATE && plant.hasLoops()) {
+            if (ImGui::SliderInt("Anderson depth (0 = substitution)", &plant.andersonDepth, 0, 10)) {
+                plant.markAllDirty();
+            }
+            const SteadyStateReport& solve = plant.lastSolve;
+            ImGui::Text("Recycle solve: %d sweeps, residual %.1e%s", solve.evaluations, solve.residual,
+                solve.converged ? "" : " (not converged)");
+        }
 
         ImGui::Separator();
         ImGui::Text("Add Component:");
@@ -1234,51 +9034,41 @@ int main() {
             ImGui::EndCombo();
         }
         if (ImGui::Button("Add")) {
-            sf::Vector2f position(components.back()->position.x - 150 * (components.size() - 1), 440);
-            Component* comp = nullptr;
-            if (newComponentType == "Primary Sedimentation Tank") comp = new PrimarySedimentationTank(position);
-            else if (newComponentType == "Primary Clarifier") comp = new PrimaryClarifier(position);
-            else if (newComponentType == "Aeration Tank") comp = new AerationTank(position);
-            else if (newComponentType == "Secondary Clarifier") comp = new SecondaryClarifier(position);
-            else if (newComponentType == "Chlorine Disinfection Unit") comp = new ChlorineDisinfectionUnit(position);
-            else if (newComponentType == "UV Disinfection") comp = new UVDisinfection(position);
-            else if (newComponentType == "Anaerobic Filter") comp = new AnaerobicFilter(position);
-            else if (newComponentType == "Sludge Digester") comp = new SludgeDigester(position);
-            else if (newComponentType == "Oil and Grease Separator") comp = new OilSeparator(position);
-            else if (newComponentType == "Phosphorus Removal Unit") comp = new PhosphorusRemovalUnit(position);
-            else if (newComponentType == "Drying Bed") comp = new DryingBed(position);
-            else if (newComponentType == "Pump") comp = new Pump(position);
-            else if (newComponentType == "Flow Meter") comp = new FlowMeter(position);
-            else if (newComponentType == "Water Softener") comp = new WaterSoftener(position);
-            else if (newComponentType == "Activated Carbon Filter") comp = new ActivatedCarbonFilter(position);
-            else if (newComponentType == "Heat Exchanger") comp = new HeatExchanger(position);
-            else if (newComponentType == "Metals Removal Unit") comp = new MetalsRemovalUnit(position);
-            else if (newComponentType == "Membrane Filtration Unit") comp = new MembraneFiltrationUnit(position);
-            else if (newComponentType == "Reverse Osmosis Unit") comp = new ReverseOsmosisUnit(position);
-            else if (newComponentType == "Coagulation and Flocculation") comp = new CoagulationFlocculation(position);
-            else if (newComponentType == "Membrane Filtration") comp = new MembraneFiltration(position);
-            else if (newComponentType == "Chemical Oxidation") comp = new ChemicalOxidation(position);
-            else if (newComponentType == "Active Sludge Process") comp = new ActiveSludgeProcess(position);
-            else if (newComponentType == "Nitrification Unit") comp = new NitrificationTank(position);
-            else if (newComponentType == "Biofilter Unit") comp = new Biofilter(position);
-            else if (newComponentType == "Filtration") comp = new Filtration(position);
-            else if (newComponentType == "Membrane Bioreactor") comp = new MBR(position);
-            else if (newComponentType == "Ozonation Unit") comp = new OzoneDisinfection(position);
-            else if (newComponentType == "Anaerobic-Aerobic Treatment") comp = new AnaerobicAerobicFilter(position);
-            else if (newComponentType == "Electrocoagulation Unit") comp = new ElectrocoagulationUnit(position);
-
-            if (comp) {
-                components.insert(components.end() - 1, comp);
-                for (size_t i = 1; i < components.size(); ++i) {
-                    components[i]->position.x = components[i - 1]->position.x + 150;
-                    components[i]->shape.setPosition(components[i]->position);
-                }
-
-                connections.clear();
-                for (size_t i = 0; i < components.size() - 1; ++i) {
-                    connections.push_back(new Connection(components[i], components[i + 1]));
-                }
+            sf::Vector2f position(0, 440); //|........||Placed by Plant::append
+            Component* comp = createComponent(newComponentType, position);
+
+            if (comp && addDetached) {
+                comp->moveTo(sf::Vector2f(50.0f + 150.0f * (components.size() % 10), 700.0f));
+                plant.add(comp);
+            } else if (comp) {
+                plant.append(comp);
+            }
+        }
+        ImGui::SameLine();
+        ImGui::Checkbox("Off the main line (connect it below)", &addDetached);
+
+        //|........||Extra pipes turn the chain into a graph (bypasses, parallel trains via Splitter/Mixer)
+        ImGui::Text("Connect Components:");
+        connectFrom = std::min(connectFrom, components.size() - 1);
+        connectTo = std::min(connectTo, components.size() - 1);
+        auto componentLabel = [&components](size_t index) {
+            return std::to_string(index) + ": " + components[index]->name;
+        };
+        if (ImGui::BeginCombo("From", componentLabel(connectFrom).c_str())) {
+            for (size_t j = 0; j < components.size(); ++j) {
+                if (ImGui::Selectable(componentLabel(j).c_str(), j == connectFrom)) connectFrom = j;
+            }
+            ImGui::EndCombo();
+        }
+        if (ImGui::BeginCombo("To", componentLabel(connectTo).c_str())) {
+            for (size_t j = 0; j < components.size(); ++j) {
+                if (ImGui::Selectable(componentLabel(j).c_str(), j == connectTo)) connectTo = j;
             }
+            ImGui::EndCombo();
+        }
+        if (ImGui::Button("Connect") && connectFrom != connectTo &&
+            components[connectFrom] != outlet && components[connectTo] != inlet) {
+            plant.connect(components[connectFrom], components[connectTo]);
         }
 
         ImGui::Separator();
@@ -1288,50 +9078,150 @@ int main() {
             ImGui::PushID((int)i);
             if (ImGui::CollapsingHeader(comp->name.c_str())) {
                 ImGui::TextWrapped("%s", comp->description.c_str());
-                if (i == 0) {
+                if (comp == inlet) {
                     ImGui::Text("Input Parameters:");
-                    for (auto& param : comp->outletWater.parameters) {
-                        float value = param.second;
-                        if (ImGui::InputFloat(parameterToString(param.first).c_str(), &value)) {
-                            comp->outletWater.updateParameter(param.first, value);
+                    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                        WaterParameter param = (WaterParameter)p;
+                        float value = comp->outletWater.getParameter(param);
+                        if (ImGui::InputFloat(parameterToString(param).c_str(), &value)) {
+                            comp->outletWater.updateParameter(param, value);
+                            comp->markDirty();
                         }
                     }
-                } else if (i == components.size() - 1) {
+                } else if (comp == outlet) {
                     ImGui::Text("Output Parameters:");
-                    for (auto& param : comp->inletWater.parameters) {
-                        float value = param.second;
-                        ImGui::Text("%s: %.2f", parameterToString(param.first).c_str(), value);
+                    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                        WaterParameter param = (WaterParameter)p;
+                        float value = comp->inletWater.getParameter(param);
+                        ImGui::Text("%s: %.2f", parameterToString(param).c_str(), value);
                     }
                 } else {
-                    ImGui::InputFloat("Volume (m³)", &comp->volume);
-                    ImGui::InputFloat("Flow Rate (m³/day)", &comp->flowRate);
-                    ImGui::InputFloat("HRT (hrs)", &comp->HRT);
-                    ImGui::InputFloat("SRT (days)", &comp->SRT);
-                    ImGui::InputFloat("Temperature (°C)", &comp->temperature);
-                    if (ImGui::Button("Remove")) {
-                        delete comp;
-                        components.erase(components.begin() + i);
-                        connections.clear();
-                        for (size_t j = 0; j < components.size() - 1; ++j) {
-                            connections.push_back(new Connection(components[j], components[j + 1]));
+                    bool edited = false;
+                    edited |= ImGui::InputFloat("Volume (m³)", &comp->volume);
+                    edited |= ImGui::InputFloat("Flow Rate (m³/day)", &comp->flowRate);
+                    edited |= ImGui::InputFloat("HRT (hrs)", &comp->HRT);
+                    edited |= ImGui::InputFloat("SRT (days)", &comp->SRT);
+                    edited |= ImGui::InputFloat("Temperature (°C)", &comp->temperature);
+                    if (Splitter* splitter = dynamic_cast<Splitter*>(comp)) {
+                        splitter->splitFractions.resize(comp->outputs.size(), 1.0f);
+                        for (size_t k = 0; k < comp->outputs.size(); ++k) {
+                            std::string label = "Split to " + comp->outputs[k]->to->name + "##" + std::to_string(k);
+                            edited |= ImGui::SliderFloat(label.c_str(), &splitter->splitFractions[k], 0.0f, 1.0f);
+                        }
+                    }
+                    if (Aeration* aeration = comp->aerationSystem()) {
+                        ImGui::Text("Aeration:");
+                        edited |= ImGui::Checkbox("DO control", &aeration->control.enabled);
+                        if (aeration->control.enabled) {
+                            edited |= ImGui::InputFloat("DO setpoint (mg/L)", &aeration->control.setpoint);
+                            edited |= ImGui::InputFloat("Gain (1/h per mg/L)", &aeration->control.gain);
+                            edited |= ImGui::InputFloat("Integral time (s)", &aeration->control.integralTime);
+                            edited |= ImGui::InputFloat("Derivative time (s)", &aeration->control.derivativeTime);
+                            edited |= ImGui::InputFloat("Sample time (s)", &aeration->control.sampleTime);
+                            edited |= ImGui::InputFloat("Max KLa (1/h)", &aeration->control.outputMax);
+                        } else {
+                            edited |= ImGui::InputFloat("KLa (1/h)", &aeration->manualKLa);
+                        }
+                        edited |= ImGui::InputFloat("Diffuser depth (m)", &aeration->diffuserDepth);
+                        edited |= ImGui::InputFloat("Blower efficiency", &aeration->blowerEfficiency);
+                        ImGui::Text("KLa %.2f 1/h, DO %.2f mg/L, %.1f kW, %.3f kWh/m³", aeration->KLa,
+                            aeration->dissolvedOxygen, aeration->meter.power, aeration->meter.specificEnergy());
+                    }
+                    if (SettlingUnit* settler = dynamic_cast<SettlingUnit*>(comp)) {
+                        edited |= ImGui::SliderFloat("Underflow (fraction of flow)", &settler->underflowFraction, 0.0f, 0.1f);
+                        ImGui::Text("The second output is the sludge underflow");
+                    }
+                    if (Thickener* thickener = dynamic_cast<Thickener*>(comp)) {
+                        edited |= ImGui::InputFloat("Thickened TSS (mg/L)", &thickener->targetSolids);
+                        edited |= ImGui::SliderFloat("Solids capture", &thickener->capture, 0.5f, 1.0f);
+                    }
+                    if (DryingBed* bed = dynamic_cast<DryingBed*>(comp)) {
+                        edited |= ImGui::InputFloat("Cake TSS (mg/L)", &bed->cakeSolids);
+                        edited |= ImGui::SliderFloat("Solids capture", &bed->capture, 0.5f, 1.0f);
+                    }
+                    if (SludgeDigester* digester = dynamic_cast<SludgeDigester*>(comp)) {
+                        edited |= ImGui::SliderFloat("Volatile fraction", &digester->volatileFraction, 0.3f, 0.9f);
+                        edited |= ImGui::InputFloat("Feed cations (kmol/m³)", &digester->cationFeed, 0.0f, 0.0f, "%.4f");
+                        edited |= ImGui::InputFloat("Feed anions (kmol/m³)", &digester->anionFeed, 0.0f, 0.0f, "%.4f");
+                        ImGui::InputFloat("Solver step (s)", &digester->solverStep);
+                        ImGui::Text("Biogas %.1f m³/day (%.0f %% CH4), pH %.2f", digester->biogasFlow,
+                            digester->methaneFraction * 100.0f, digester->model.pH);
+                        ImGui::Text("VFA %.3f kg COD/m³, HRT %.1f days", digester->model.state[ADM1::S_AC]
+                            + digester->model.state[ADM1::S_PRO] + digester->model.state[ADM1::S_BU]
+                            + digester->model.state[ADM1::S_VA],
+                            comp->inletWater.flow > 0.0f ? comp->volume / comp->inletWater.flow : 0.0f);
+                        ImGui::Text("ADM1: %ld steps, %ld Newton iterations, %ld Jacobians (%d colours, %d LU nonzeros)%s",
+                            digester->model.steps, digester->model.newtonIterations, digester->model.jacobianBuilds,
+                            digester->model.jacobianColours(), digester->model.factorNonzeros(),
+                            digester->converged ? "" : " (not converged)");
+                        if (ImGui::Button("Restart from BSM2 state")) {
+                            digester->restart();
+                            edited = true;
+                        }
+                    }
+                    if (Pump* pump = dynamic_cast<Pump*>(comp)) {
+                        ImGui::Text("Pump:");
+                        edited |= ImGui::InputFloat("Static head (m)", &pump->staticHead);
+                        edited |= ImGui::Checkbox("VFD follows required head", &pump->speedControl);
+                        if (!pump->speedControl) edited |= ImGui::SliderFloat("Speed (fraction)", &pump->speed, 0.3f, 1.0f);
+                        for (size_t k = 0; k < pump->curveFlow.size(); ++k) {
+                            float point[3] = {pump->curveFlow[k], pump->curveHead[k], pump->curveEfficiency[k]};
+                            if (ImGui::InputFloat3(("Q m³/h, H m, eff##" + std::to_string(k)).c_str(), point)) {
+                                pump->curveFlow[k] = point[0];
+                                pump->curveHead[k] = point[1];
+                                pump->curveEfficiency[k] = point[2];
+                                pump->invalidateCurves();
+                            }
+                        }
+                        ImGui::Text("Speed %.2f, head %.1f of %.1f m, eff %.2f, %.2f kW, %.4f kWh/m³", pump->speed, pump->head,
+                            pump->requiredHead, pump->efficiency, pump->meter.power, pump->meter.specificEnergy());
+                    }
+                    if (edited) comp->markDirty();
+                    ImGui::Text("Flow: %.2f m³/day in, %.2f m³/day out", comp->inletWater.flow, comp->outletWater.flow);
+                    for (size_t k = 0; k < comp->outputs.size(); ++k) {
+                        Connection* pipe = comp->outputs[k];
+                        ImGui::Text("-> %s (%.2f m³/day, %.3f m loss)", pipe->to->name.c_str(), pipe->water.flow,
+                            pipe->headLoss(pipe->water.flow));
+                        std::string suffix = "##pipe" + std::to_string(k);
+                        bool pipeEdited = ImGui::InputFloat(("Diameter (cm)" + suffix).c_str(), &pipe->diameter);
+                        pipeEdited |= ImGui::InputFloat(("Length (m)" + suffix).c_str(), &pipe->length);
+                        ImGui::Checkbox(("Transport delay" + suffix).c_str(), &pipe->transportDelay);
+                        if (pipe->transportDelay) {
+                            ImGui::SameLine();
+                            ImGui::Text("%.0f s", pipe->residenceTime(pipe->water.flow));
+                            ImGui::SliderInt(("Dispersion tanks" + suffix).c_str(), &pipe->dispersionTanks, 0, 16);
                         }
+                        if (pipeEdited) plant.markAllDirty(); //|........||Any pump upstream sees the new losses
+                        if (comp->outputs.size() > 1) {
+                            ImGui::SameLine();
+                            if (ImGui::SmallButton(("Disconnect##" + std::to_string(k)).c_str())) {
+                                plant.disconnect(comp->outputs[k]);
+                                break;
+                            }
+                        }
+                    }
+                    if (ImGui::Button("Remove")) {
+                        plant.removeUnit(comp);
+                        ImGui::PopID();
                         break;
                     }
                     ImGui::Text("Water Parameters:");
-                    for (auto& param : comp->outletWater.parameters) {
-                        float value_in = comp->inletWater.getParameter(param.first);
-                        float value_out = comp->outletWater.getParameter(param.first);
-                        ImGui::Text("%s - Inlet: %.2f, Outlet: %.2f", parameterToString(param.first).c_str(), value_in, value_out);
+                    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                        WaterParameter param = (WaterParameter)p;
+                        float value_in = comp->inletWater.getParameter(param);
+                        float value_out = comp->outletWater.getParameter(param);
+                        ImGui::Text("%s - Inlet: %.2f, Outlet: %.2f", parameterToString(param).c_str(), value_in, value_out);
                     }
                     ImGui::Separator();
                     ImGui::Text("Removal Efficiencies:");
-                    for (auto& param : comp->outletWater.parameters) {
-                        float efficiency = comp->removalEfficiencies[param.first];
-                        if (ImGui::SliderFloat(("Efficiency " + parameterToString(param.first)).c_str(), &efficiency, -1.0f, 1.0f)) {
-                            comp->addRemovalEfficiency(param.first, efficiency);
+                    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+                        WaterParameter param = (WaterParameter)p;
+                        float efficiency = comp->removalEfficiencies[param];
+                        if (ImGui::SliderFloat(("Efficiency " + parameterToString(param)).c_str(), &efficiency, -1.0f, 1.0f)) {
+                            comp->addRemovalEfficiency(param, efficiency);
                         }
-                        if (ImGui::Button(("Remove " + parameterToString(param.first)).c_str())) {
-                            comp->removeRemovalEfficiency(param.first);
+                        if (ImGui::Button(("Remove " + parameterToString(param)).c_str())) {
+                            comp->removeRemovalEfficiency(param);
                         }
                     }
                 }
@@ -1341,30 +9231,31 @@ int main() {
 
         ImGui::End();
 
-        window.clear(sf::Color::White);
+        {
+            PROFILE_SCOPE(PROFILE_DRAW);
+            TRACE_SCOPE("SFML draw");
+            window.clear(sf::Color::White);
 
-        for (auto& conn : connections) {
-            conn->draw(window);
-        }
+            for (auto& conn : plant.connections) {
+                conn->draw(window);
+            }
 
-        for (auto& comp : components) {
-            comp->draw(window);
-        }
+            for (auto& comp : components) {
+                comp->draw(window);
+            }
 
-        ImGui::SFML::Render(window);
+            ImGui::SFML::Render(window);
+        }
         window.display();
     }
 
-    for (auto& comp : components) {
-        delete comp;
-    }
-    for (auto& conn : connections) {
-        delete conn;
-    }
-
     ImGui::SFML::Shutdown();
+#ifdef WWTPSIM_TRACE
+    Tracer::instance().stop();
+#endif
     return 0;
 }
+#endif
 
 //|........ End of WWTPSIM.cpp ........|
 // @Copyright, all rights reserved.
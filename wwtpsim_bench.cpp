@@ -0,0 +1,519 @@
+/*
+- Benchmark harness for the WWTP Simulator core kernels.
+
+- Builds the simulator sources without their main() and times:
+    - Water copy, access and comparison.
+    - Every Component::simulate override on a default inlet water.
+    - The Arrhenius temperature factor, pow against the shared per-thread cache.
+    - Full plant steps (steady state and dynamic) for chains of 10, 100 and 1000 units.
+    - The 100-unit chain solved in double precision.
+    - The default 4-unit train in steady state, virtual sweep against its compiled Pipeline.
+    - History updates and particle updates.
+
+- For every benchmark it reports ns/op, heap allocations/op and, for plant steps,
+  simulated seconds per wall-clock second.
+
+- Usage:
+    wwtpsim_bench [--filter <text>] [--min-time <seconds>] [--json <out.json>]
+                  [--baseline <baseline.json>] [--threshold <fraction>]
+
+  With --baseline, every benchmark slower than the baseline by more than the threshold
+  (default 0.10 = 10%) or allocating more per op is reported and the exit code is 1,
+  so a saved JSON file can gate regressions.
+
+Made by FERI.
+*/
+
+//|........||wwtpsim_bench.cpp
+
+#define WWTPSIM_NO_MAIN
+#include "wwtpsim.cpp"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+
+//|........||Heap allocation counter, every operator new in the process goes through here
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static std::atomic<unsigned long long> allocationCount(0);
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+//|........||Keeps the optimizer from discarding a benchmarked result
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+//|........||One registered benchmark: `run(n)` performs n operations
+struct Benchmark {
+    std::string name;
+    std::function<void(size_t)> run;
+    double simulatedSecondsPerOp = 0.0; //|........||0 when the op does not advance simulated time
+};
+
+struct BenchmarkResult {
+    std::string name;
+    double nsPerOp = 0.0;
+    double allocsPerOp = 0.0;
+    double simSecondsPerWallSecond = 0.0;
+};
+
+//|........||Grows the iteration count until one batch lasts at least `minTime` seconds
+BenchmarkResult runBenchmark(const Benchmark& bench, double minTime) {
+    using Clock = std::chrono::steady_clock;
+    bench.run(1); //|........||Warm-up
+
+    size_t iterations = 1;
+    while (true) {
+        unsigned long long allocsBefore = allocationCount.load();
+        auto start = Clock::now();
+        bench.run(iterations);
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        unsigned long long allocs = allocationCount.load() - allocsBefore;
+
+        if (elapsed >= minTime || iterations >= (size_t(1) << 30)) {
+            BenchmarkResult result;
+            result.name = bench.name;
+            result.nsPerOp = elapsed * 1e9 / iterations;
+            result.allocsPerOp = double(allocs) / iterations;
+            if (bench.simulatedSecondsPerOp > 0.0 && elapsed > 0.0) {
+                result.simSecondsPerWallSecond = bench.simulatedSecondsPerOp * iterations / elapsed;
+            }
+            return result;
+        }
+        double scale = elapsed > 0.0 ? 1.4 * minTime / elapsed : 10.0;
+        iterations = size_t(iterations * std::min(std::max(scale, 2.0), 100.0));
+    }
+}
+
+//|........||Every unit type in componentCatalog() except the outlet, named by its label in CamelCase
+std::vector<std::pair<std::string, std::function<Component*()>>> unitFactories() {
+    std::vector<std::pair<std::string, std::function<Component*()>>> factories;
+    for (const ComponentType& entry : componentCatalog()) {
+        if (entry.type == typeid(Outlet)) continue;
+        std::string name;
+        bool wordStart = true;
+        for (const char* c = entry.label; *c; ++c) {
+            unsigned char ch = (unsigned char)*c;
+            if (!std::isalnum(ch)) {
+                wordStart = true;
+                continue;
+            }
+            name += wordStart ? (char)std::toupper(ch) : (char)ch;
+            wordStart = false;
+        }
+        auto make = entry.make;
+        factories.push_back({name, [make] { return make(sf::Vector2f(0, 440)); }});
+    }
+    return factories;
+}
+
+//|........||A chain of `units` cycling through every unit type
+std::shared_ptr<Plant> makeChain(size_t units) {
+    auto factories = unitFactories();
+    auto plant = std::make_shared<Plant>(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    for (size_t i = 0; i < units; ++i) {
+        plant->append(factories[i % factories.size()].second());
+    }
+    return plant;
+}
+
+std::vector<Benchmark> registerBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+
+    //|........||Water state
+    benchmarks.push_back({"Water/copy", [](size_t n) {
+        Water a, b;
+        for (size_t i = 0; i < n; ++i) {
+            a.parameters[i % PARAMETER_COUNT] += 1.0f;
+            b = a;
+            doNotOptimize(b);
+        }
+    }});
+    benchmarks.push_back({"Water/get+update", [](size_t n) {
+        Water w;
+        for (size_t i = 0; i < n; ++i) {
+            WaterParameter param = (WaterParameter)(i % PARAMETER_COUNT);
+            w.updateParameter(param, w.getParameter(param) * 0.999f);
+        }
+        doNotOptimize(w);
+    }});
+    benchmarks.push_back({"Water/compare", [](size_t n) {
+        Water a, b;
+        size_t equal = 0;
+        for (size_t i = 0; i < n; ++i) {
+            b.parameters[PARAMETER_COUNT - 1] = float(i & 1);
+            doNotOptimize(b);
+            equal += (a == b);
+        }
+        doNotOptimize(equal);
+    }});
+
+    //|........||Every simulate() override
+    for (auto& factory : unitFactories()) {
+        std::shared_ptr<Component> unit(factory.second());
+        benchmarks.push_back({"Simulate/" + factory.first, [unit](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                unit->simulate(SIMULATION_TIME_STEP);
+                doNotOptimize(unit->outletWater);
+            }
+        }});
+    }
+
+    //|........||DO loops stepped in a sweep; most steps fall between controller samples
+    benchmarks.push_back({"Aeration/10000-loops", [](size_t n) {
+        static std::vector<Aeration> loops(10000);
+        for (size_t i = 0; i < n; ++i) {
+            for (auto& loop : loops) {
+                doNotOptimize(loop.apply(2.0f, 150.0f, 20.0f, 8.0f, 4000.0f, 10000.0f, 1.0f));
+            }
+        }
+    }, 1.0});
+
+    //|........||Arrhenius factor of a kinetic at two water temperatures, pow every call against the shared cache
+    static const float temperatures[2] = {12.5f, 14.0f};
+    benchmarks.push_back({"Temperature/pow", [](size_t n) {
+        float theta = 1.035f;
+        for (size_t i = 0; i < n; ++i) {
+            doNotOptimize(theta);
+            doNotOptimize(std::pow(theta, temperatures[i & 1] - 20.0f));
+        }
+    }});
+    benchmarks.push_back({"Temperature/cached", [](size_t n) {
+        float theta = 1.035f;
+        for (size_t i = 0; i < n; ++i) {
+            doNotOptimize(theta);
+            doNotOptimize(temperatureFactor(theta, temperatures[i & 1]));
+        }
+    }});
+
+    //|........||A BSM2 digester run for 100 days in 15-minute implicit steps, and a cold steady-state solve
+    benchmarks.push_back({"ADM1/100-days", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            ADM1 digester;
+            digester.advance(100.0, 1.0 / 96.0);
+            doNotOptimize(digester.gasFlow);
+        }
+    }, 100.0 * 86400.0});
+    benchmarks.push_back({"ADM1/steady-state", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            ADM1 digester;
+            doNotOptimize(digester.steadyState());
+        }
+    }, 0.0});
+
+    //|........||One Sobol study (64 base samples, 4 factors: 384 steady-state runs) on one thread
+    benchmarks.push_back({"Sensitivity/sobol-384-runs", [](size_t n) {
+        const std::string text = "inlet flow 10000\nunit pc Primary Clarifier\nunit at Aeration Tank\n"
+            "unit sc Secondary Clarifier\nvary at k_nh4 0.05 0.15\nvary at HRT 4 8\n"
+            "vary pc removalTSS 0.6 0.8\nvary sc removalTSS 0.8 0.9\n";
+        SensitivityOptions options;
+        options.samples = 64;
+        options.resamples = 0;
+        for (size_t i = 0; i < n; ++i) {
+            SensitivityResult result = runSensitivity(text, "bench.plant", options);
+            doNotOptimize(result.indices);
+        }
+    }, 0.0});
+
+    //|........||Cheapest trains of up to 4 units meeting BOD, TSS and NH4 limits, on one thread
+    benchmarks.push_back({"Synthesis/4-units", [](size_t n) {
+        const std::string text = "inlet flow 10000\nlimit BOD 25\nlimit TSS 30\nlimit NH4 10\n";
+        SynthesisOptions options;
+        for (size_t i = 0; i < n; ++i) {
+            SynthesisResult result = runSynthesis(text, "bench.plant", options);
+            doNotOptimize(result.trains);
+        }
+    }, 0.0});
+
+    //|........||Effluent derivatives for 8 factors of a 4-unit train: one Dual sweep against 16 steady solves
+    struct Gradient {
+        PlantEvaluator evaluator;
+        std::vector<const float*> fields;
+        Gradient() {
+            std::string error;
+            evaluator.load("inlet flow 10000\nunit pc Primary Clarifier\nunit at Aeration Tank\n"
+                "unit nt Nitrification Tank\nunit sc Secondary Clarifier\n", "bench.plant", error);
+            for (const char* id : {"pc", "at", "nt", "sc"}) {
+                std::vector<ParameterRef> refs;
+                evaluator.ids[id]->parameters(refs);
+                for (size_t k = 0; k < refs.size() && fields.size() < 8; k += 2) fields.push_back(refs[k].value);
+            }
+        }
+    };
+    benchmarks.push_back({"Gradient/8-factors-ad", [](size_t n) {
+        static Gradient gradient;
+        std::vector<std::array<double, PARAMETER_COUNT>> result;
+        std::string error;
+        for (size_t i = 0; i < n; ++i) {
+            gradient.evaluator.plant.differentiateSteadyState(gradient.fields, result, error);
+            doNotOptimize(result);
+        }
+    }, 0.0});
+    benchmarks.push_back({"Gradient/8-factors-differences", [](size_t n) {
+        static Gradient gradient;
+        Plant& plant = gradient.evaluator.plant;
+        for (size_t i = 0; i < n; ++i) {
+            for (const float* field : gradient.fields) {
+                float* value = const_cast<float*>(field);
+                float nominal = *value;
+                for (float h : {1e-3f, -1e-3f}) {
+                    *value = nominal * (1.0f + h);
+                    plant.markAllDirty();
+                    plant.step(0.0f);
+                    doNotOptimize(plant.outlet->inletWater);
+                }
+                *value = nominal;
+            }
+        }
+    }, 0.0});
+
+    //|........||The default 4-unit train swept in steady state, virtual calls against the compiled Pipeline
+    for (bool fused : {false, true}) {
+        auto train = std::make_shared<Plant>(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+        train->append(new PrimaryClarifier(sf::Vector2f(0, 440)));
+        train->append(new AerationTank(sf::Vector2f(0, 440)));
+        train->append(new SecondaryClarifier(sf::Vector2f(0, 440)));
+        train->append(new UVDisinfection(sf::Vector2f(0, 440)));
+        if (fused) train->fuse();
+        benchmarks.push_back({std::string("Plant/train-4/") + (fused ? "fused" : "sweep"), [train](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                train->markAllDirty();
+                train->step(SIMULATION_TIME_STEP);
+            }
+        }, SIMULATION_TIME_STEP});
+    }
+
+    //|........||Whole-plant steps
+    for (size_t units : {10, 100, 1000}) {
+        std::string size = std::to_string(units);
+        std::shared_ptr<Plant> steady = makeChain(units);
+        benchmarks.push_back({"Plant/steady-full/" + size, [steady](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                steady->markAllDirty();
+                steady->step(SIMULATION_TIME_STEP);
+            }
+        }, SIMULATION_TIME_STEP});
+
+        if (units == 100) {
+            std::shared_ptr<Plant> precise = makeChain(units);
+            benchmarks.push_back({"Plant/steady-full/100/double", [precise](size_t n) {
+                std::vector<PreciseWater> carried;
+                PreciseWater effluent;
+                std::string error;
+                for (size_t i = 0; i < n; ++i) precise->solvePrecise(carried, effluent, error);
+                doNotOptimize(effluent);
+            }, SIMULATION_TIME_STEP});
+        }
+
+        std::shared_ptr<Plant> idle = makeChain(units);
+        idle->step(SIMULATION_TIME_STEP);
+        benchmarks.push_back({"Plant/steady-idle/" + size, [idle](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                idle->step(SIMULATION_TIME_STEP);
+            }
+        }, SIMULATION_TIME_STEP});
+
+        std::shared_ptr<Plant> dynamic = makeChain(units);
+        dynamic->setMode(DYNAMIC);
+        dynamic->fixedStep = 0.0f; //|........||One engine step per call
+        dynamic->timeScale = 1.0f;
+        benchmarks.push_back({"Plant/dynamic/" + size, [dynamic](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                dynamic->step(SIMULATION_TIME_STEP);
+            }
+        }, SIMULATION_TIME_STEP});
+    }
+
+    //|........||Parallel trains, serial sweep versus the thread pool (8 trains of ~100 units)
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    for (bool parallel : {false, true}) {
+        auto trains = std::make_shared<Plant>(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+        buildParallelTrains(*trains, 8, 33);
+        trains->pool = parallel ? &pool : nullptr;
+        benchmarks.push_back({std::string("Plant/trains-8x100/") + (parallel ? "pool" : "serial"), [trains](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                trains->markAllDirty();
+                trains->step(SIMULATION_TIME_STEP);
+            }
+        }, SIMULATION_TIME_STEP});
+    }
+
+    //|........||Cold recycle solve (return ratio 4) from raw-influent tear streams
+    for (int depth : {0, 5}) {
+        auto loop = std::make_shared<Plant>(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+        buildRecycleLoop(*loop, 4.0f);
+        loop->andersonDepth = depth;
+        benchmarks.push_back({std::string("Plant/recycle-solve/") + (depth ? "anderson" : "substitution"), [loop](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                for (auto& conn : loop->connections) {
+                    if (conn->backEdge) conn->water = Water();
+                }
+                loop->markAllDirty();
+                loop->step(SIMULATION_TIME_STEP);
+            }
+        }});
+    }
+
+    //|........||Liquid line plus sludge line with its two reject loops, solved from scratch
+    {
+        auto sludge = std::make_shared<Plant>(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+        buildSludgeLine(*sludge);
+        benchmarks.push_back({"Plant/sludge-line/solve", [sludge](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                for (auto& conn : sludge->connections) {
+                    if (conn->backEdge) conn->water = Water();
+                }
+                sludge->markAllDirty();
+                sludge->step(SIMULATION_TIME_STEP);
+            }
+        }});
+    }
+
+    //|........||History and particle bookkeeping done every frame by the UI loop
+    for (size_t units : {10, 100}) {
+        std::string size = std::to_string(units);
+        std::shared_ptr<Plant> plant = makeChain(units);
+        plant->step(SIMULATION_TIME_STEP);
+        benchmarks.push_back({"Histories/update/" + size, [plant](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                updateHistories(plant->components);
+            }
+        }});
+
+        std::shared_ptr<Plant> animated = makeChain(units);
+        animated->step(SIMULATION_TIME_STEP);
+        benchmarks.push_back({"Particles/update/" + size, [animated](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                for (auto& comp : animated->components) comp->update(SIMULATION_TIME_STEP);
+                for (auto& conn : animated->connections) conn->update(SIMULATION_TIME_STEP);
+            }
+        }});
+    }
+
+    return benchmarks;
+}
+
+//|........||One benchmark per line so baselines stay diffable and easy to read back
+void writeJson(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        char line[512];
+        std::snprintf(line, sizeof(line),
+            "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"allocs_per_op\": %.4f, \"sim_s_per_wall_s\": %.3f}%s\n",
+            r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.simSecondsPerWallSecond,
+            i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+}
+
+//|........||Reads back files written by writeJson
+std::map<std::string, BenchmarkResult> readJson(const std::string& path) {
+    std::map<std::string, BenchmarkResult> results;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t nameKey = line.find("\"name\": \"");
+        if (nameKey == std::string::npos) continue;
+        size_t nameStart = nameKey + 9;
+        size_t nameEnd = line.find('"', nameStart);
+        BenchmarkResult r;
+        r.name = line.substr(nameStart, nameEnd - nameStart);
+        auto number = [&line](const char* key) {
+            size_t at = line.find(key);
+            return at == std::string::npos ? 0.0 : std::atof(line.c_str() + at + std::strlen(key));
+        };
+        r.nsPerOp = number("\"ns_per_op\": ");
+        r.allocsPerOp = number("\"allocs_per_op\": ");
+        r.simSecondsPerWallSecond = number("\"sim_s_per_wall_s\": ");
+        results[r.name] = r;
+    }
+    return results;
+}
+
+int main(int argc, char** argv) {
+    std::string filter, jsonPath, baselinePath;
+    double minTime = 0.2;
+    double threshold = 0.10;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--filter" && hasValue) filter = argv[++i];
+        else if (arg == "--json" && hasValue) jsonPath = argv[++i];
+        else if (arg == "--baseline" && hasValue) baselinePath = argv[++i];
+        else if (arg == "--min-time" && hasValue) minTime = std::atof(argv[++i]);
+        else if (arg == "--threshold" && hasValue) threshold = std::atof(argv[++i]);
+        else {
+            std::cerr << "usage: wwtpsim_bench [--filter <text>] [--min-time <s>] [--json <out>] "
+                         "[--baseline <in>] [--threshold <fraction>]\n";
+            return 2;
+        }
+    }
+
+    std::map<std::string, BenchmarkResult> baseline;
+    if (!baselinePath.empty()) baseline = readJson(baselinePath);
+
+    std::vector<BenchmarkResult> results;
+    int regressions = 0;
+    std::printf("%-40s %14s %12s %16s\n", "benchmark", "ns/op", "allocs/op", "sim-s/wall-s");
+    for (const Benchmark& bench : registerBenchmarks()) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) continue;
+        BenchmarkResult r = runBenchmark(bench, minTime);
+        results.push_back(r);
+
+        std::string verdict;
+        auto base = baseline.find(r.name);
+        if (base != baseline.end()) {
+            double change = base->second.nsPerOp > 0.0 ? r.nsPerOp / base->second.nsPerOp - 1.0 : 0.0;
+            char delta[64];
+            std::snprintf(delta, sizeof(delta), "  %+.1f%%", change * 100.0);
+            verdict = delta;
+            if (change > threshold || r.allocsPerOp > base->second.allocsPerOp + 0.01) {
+                verdict += "  REGRESSION";
+                ++regressions;
+            }
+        }
+        std::printf("%-40s %14.2f %12.3f %16.1f%s\n", r.name.c_str(), r.nsPerOp, r.allocsPerOp,
+            r.simSecondsPerWallSecond, verdict.c_str());
+    }
+
+    if (!jsonPath.empty()) writeJson(jsonPath, results);
+    if (regressions > 0) {
+        std::printf("%d benchmark(s) regressed against %s\n", regressions, baselinePath.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,832 @@
+/*
+- Regression tests for the WWTP Simulator core.
+
+- Builds the simulator sources without their main(), like wwtpsim_bench.cpp, and runs
+  each registered test. A test records every failed CHECK with its file line and keeps
+  going, so one run lists every broken expectation.
+
+- Usage:
+    wwtpsim_test [--filter <text>]
+
+  Exits with code 1 when any test fails.
+
+Made by FERI.
+*/
+
+//|........||wwtpsim_test.cpp
+
+#define WWTPSIM_NO_MAIN
+#include "wwtpsim.cpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+
+//|........||Failures of the test being run, as "line: message"
+static std::vector<std::string> failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) failures.push_back(std::to_string(__LINE__) + ": " #condition); \
+    } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+    do { \
+        double checkValue = (value), checkExpected = (expected); \
+        if (!(std::fabs(checkValue - checkExpected) <= (tolerance))) { \
+            char checkText[160]; \
+            std::snprintf(checkText, sizeof(checkText), ": " #value " = %.9g, expected %.9g", checkValue, checkExpected); \
+            failures.push_back(std::to_string(__LINE__) + checkText); \
+        } \
+    } while (0)
+
+struct Test {
+    std::string name;
+    std::function<void()> run;
+};
+
+//|........||Pipe transport: a near-stagnant step must not lose the delay once flow recovers
+void testDelayRecoversAfterLowFlow() {
+    Connection pipe(nullptr, nullptr);
+    const float deltaTime = 10.0f;
+    const float normalFlow = pipe.volume() * 86400.0f / 100.0f; //|........||100 s residence, 10 steps
+    Water in;
+    in.flow = normalFlow;
+    in.parameters[BOD] = 100.0f;
+    for (int step = 0; step < 50; ++step) pipe.transport(in, deltaTime);
+
+    Water stagnant = in;
+    stagnant.flow = 1e-6f;
+    pipe.transport(stagnant, deltaTime);
+    for (int step = 0; step < 300; ++step) pipe.transport(in, deltaTime);
+
+    Water marked = in;
+    marked.parameters[BOD] = 500.0f;
+    pipe.transport(marked, deltaTime);
+    CHECK_NEAR(pipe.water.parameters[BOD], 100.0, 1e-3);
+    for (int step = 1; step < 10; ++step) {
+        pipe.transport(in, deltaTime);
+        CHECK_NEAR(pipe.water.parameters[BOD], 100.0, 1e-3);
+    }
+    pipe.transport(in, deltaTime);
+    CHECK_NEAR(pipe.water.parameters[BOD], 500.0, 1e-3);
+    pipe.transport(in, deltaTime);
+    CHECK_NEAR(pipe.water.parameters[BOD], 100.0, 1e-3);
+}
+
+//|........||The 4000 m³ digester fed 200 m³/day at TSS 30000 and COD 40000
+Water digesterFeed() {
+    Water feed;
+    feed.flow = 200.0f;
+    feed.parameters[TSS] = 30000.0f;
+    feed.parameters[COD] = 40000.0f;
+    return feed;
+}
+
+//|........||Steady digester: a cold solve reaches the equilibrium, and neither an earlier solve with another feed
+//|........||nor a dynamic run beforehand changes the answer
+void testDigesterSteadyStateIgnoresHistory() {
+    SludgeDigester cold(sf::Vector2f(0, 0));
+    cold.volume = 4000.0f;
+    cold.inletWater = digesterFeed();
+    cold.simulate(0.0f);
+    CHECK(cold.solverError() == nullptr);
+    CHECK_NEAR(cold.outletWater.getParameter(NH4), 197.2, 0.1);
+    CHECK_NEAR(cold.outletWater.getParameter(PH), 6.73, 0.01);
+    CHECK_NEAR(cold.biogasFlow, 4642.0, 1.0);
+
+    SludgeDigester warm(sf::Vector2f(0, 0));
+    warm.volume = 4000.0f;
+    warm.inletWater = digesterFeed();
+    warm.inletWater.parameters[TSS] = 10000.0f;
+    warm.inletWater.parameters[COD] = 10000.0f;
+    warm.simulate(0.0f);
+    warm.inletWater = digesterFeed();
+    warm.simulate(0.0f);
+    CHECK(warm.solverError() == nullptr);
+    CHECK(warm.outletWater == cold.outletWater);
+    CHECK(warm.biogasFlow == cold.biogasFlow);
+
+    SludgeDigester dynamic(sf::Vector2f(0, 0));
+    dynamic.volume = 4000.0f;
+    dynamic.inletWater = digesterFeed();
+    for (int step = 0; step < 30; ++step) dynamic.simulate(900.0f);
+    dynamic.simulate(0.0f);
+    CHECK(dynamic.outletWater == cold.outletWater);
+}
+
+//|........||A solve cut short is reported, not taken as the equilibrium
+void testAdm1ReportsNonConvergence() {
+    ADM1 model;
+    CHECK(!model.steadyState(3));
+    model.coldStart();
+    CHECK(model.steadyState());
+}
+
+//|........||Every entry of df/dx that moves when a state is perturbed, at scattered states around the BSM2 point,
+//|........||is in the structural pattern; the LU factors along it stay sparse and rarely need the dense fallback
+void testAdm1StructuralSparsity() {
+    std::mt19937 random(5);
+    int missing = 0;
+    for (int trial = 0; trial < 20; ++trial) {
+        ADM1 probe;
+        for (double& value : probe.state) value *= std::uniform_real_distribution<double>(0.2, 5.0)(random);
+        ADM1::Vector base, rate;
+        double ion = 1e-7;
+        probe.derivatives(probe.state, base, ion);
+        for (int j = 0; j < ADM1::STATE_COUNT; ++j) {
+            ADM1::Vector x = probe.state;
+            x[j] += 1e-3 * std::max(std::fabs(x[j]), 1e-6);
+            ion = 1e-7;   //|........||same charge-balance start as the base, so only the perturbation moves S_H+
+            probe.derivatives(x, rate, ion);
+            for (int i = 0; i < ADM1::STATE_COUNT; ++i) {
+                if (rate[i] != base[i] && !ADM1::coupled(i, j)) ++missing;
+            }
+        }
+    }
+    CHECK(missing == 0);
+
+    ADM1 model;
+    CHECK(model.factorNonzeros() < ADM1::STATE_COUNT * ADM1::STATE_COUNT / 2);
+    CHECK(model.steadyState());
+    CHECK(model.denseFactorizations * 4 < model.jacobianBuilds);
+}
+
+//|........||A plant whose inlet feeds nothing is saved and loaded back
+void testSavePlantWithoutInletOutput() {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    plant.disconnect(plant.inlet->outputs.front());
+    const std::string path = (std::filesystem::temp_directory_path() / "wwtpsim_test_unwired.plant").string();
+    std::string error;
+    CHECK(savePlant(plant, path, PlantRun(), error));
+    std::ifstream saved(path);
+    std::stringstream text;
+    text << saved.rdbuf();
+    CHECK(text.str().find("disconnect inlet outlet") != std::string::npos);
+
+    Plant copy(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    PlantRun run;
+    CHECK(loadPlant(copy, path, run, error));
+    CHECK(copy.inlet->outputs.empty());
+    CHECK(copy.connections.empty());
+    std::filesystem::remove(path);
+}
+
+//|........||Fewer than five samples: the quantile of the sorted samples so far
+void testP2QuantileFewSamples() {
+    P2Quantile quantile(0.95);
+    CHECK(quantile.value() == 0.0);
+    quantile.add(7.0);
+    CHECK(quantile.value() == 7.0);
+    quantile.add(3.0);
+    quantile.add(5.0);
+    quantile.add(1.0);
+    CHECK(quantile.value() == 7.0);
+    P2Quantile median(0.5);
+    for (double x : {4.0, 1.0, 3.0}) median.add(x);
+    CHECK(median.value() == 3.0);
+}
+
+//|........||Sludge line with reject water: primary and secondary sludge are thickened, digested and dried,
+//|........||and the filtrate returns to the head of the plant
+const char* SLUDGE_PLANT = R"(plant sludge
+mode steady
+inlet flow 100
+inlet BOD 300
+inlet COD 600
+inlet TSS 200
+inlet NH4 50
+inlet NO3 5
+inlet pH 6.5
+inlet P 10
+inlet TEMP 20
+unit u1 Mixer
+unit u2 Primary Clarifier
+unit u3 Aeration Tank
+unit u4 Secondary Clarifier
+unit u5 UV Disinfection
+side u6 350 700 Mixer
+side u7 500 700 Thickener
+side u8 650 700 Sludge Digester
+side u9 800 700 Drying Bed
+side u10 950 700 Outlet
+connect u2 u6
+connect u4 u6
+connect u6 u7
+connect u7 u8
+connect u7 u1
+connect u8 u9
+connect u9 u10
+connect u9 u1
+)";
+
+//|........||d effluent / d primary underflowFraction reaches the effluent through the digester, which has no
+//|........||Dual kernel: AD must match central differences of the double-precision solve
+void testGradientThroughDigester() {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    std::istringstream text(SLUDGE_PLANT);
+    PlantRun run;
+    std::string error;
+    CHECK(readPlant(plant, text, "sludge.plant", run, error));
+    plant.setMode(STEADY_STATE);
+    float* fraction = nullptr;
+    for (Component* comp : plant.components) {
+        if (comp->name != "Primary Clarifier") continue;
+        std::vector<ParameterRef> refs;
+        comp->parameters(refs);
+        for (const ParameterRef& ref : refs) {
+            if (std::string(ref.name) == "underflowFraction") fraction = ref.value;
+        }
+    }
+    CHECK(fraction != nullptr);
+    if (!fraction) return;
+
+    std::vector<std::array<double, PARAMETER_COUNT>> gradient;
+    CHECK(plant.differentiateSteadyState({fraction}, gradient, error));
+    if (gradient.empty()) return;
+
+    const float nominal = *fraction;
+    auto effluentAt = [&](float value) {
+        *fraction = value;
+        plant.markAllDirty();
+        plant.step(0.0f);
+        return plant.outlet->inletWater;
+    };
+    const float up = nominal * 1.05f, down = nominal * 0.95f;
+    const Water high = effluentAt(up), low = effluentAt(down);
+    *fraction = nominal;
+    //|........||Steps of 5 %: at 1 % the float solves leave over 10 % of noise on the small NO3 derivative
+    for (WaterParameter p : {NH4, NO3, TSS}) {
+        double differences = (high.parameters[p] - low.parameters[p]) / (double(up) - double(down));
+        CHECK_NEAR(gradient[0][p], differences, 0.03 * std::fabs(differences));
+    }
+}
+
+//|........||The digester answers the same whatever it solved before, so it tabulates, and the table matches
+//|........||simulate() within its tolerance inside the box
+void testSurrogateTabulatesDigester() {
+    SludgeDigester digester(sf::Vector2f(0, 0));
+    digester.volume = 4000.0f;
+    digester.inletWater = digesterFeed();
+    digester.simulate(0.0f);
+    SurrogateTable table;
+    table.inputs = {{SurrogateTable::FLOW_INPUT, 150.0f, 250.0f}, {COD, 30000.0f, 50000.0f}};
+    CHECK(table.build(digester));
+    CHECK(table.status == "ok");
+    if (!table.valid) return;
+
+    std::vector<float*> slots;
+    digester.responseSlots(slots);
+    std::vector<float> approx(slots.size()), exact(slots.size());
+    table.spotInterval = 0;
+    std::mt19937 random(3);
+    float worst = 0.0f;
+    for (int sample = 0; sample < 64; ++sample) {
+        digester.inletWater = digesterFeed();
+        digester.inletWater.flow = std::uniform_real_distribution<float>(150.0f, 250.0f)(random);
+        digester.inletWater.parameters[COD] = std::uniform_real_distribution<float>(30000.0f, 50000.0f)(random);
+        CHECK(table.apply(digester));
+        for (size_t m = 0; m < slots.size(); ++m) approx[m] = *slots[m];
+        digester.simulate(0.0f);
+        CHECK(digester.solverError() == nullptr);
+        for (size_t m = 0; m < slots.size(); ++m) exact[m] = *slots[m];
+        worst = std::max(worst, SurrogateTable::error(approx.data(), exact.data(), slots.size()));
+    }
+    CHECK(worst <= table.tolerance);
+}
+
+//|........||Per-process Arrhenius coefficients: unset ones follow the unit's, set ones are clamped to [1.0, 1.2]
+void testProcessThetas() {
+    ProcessThetas thetas;
+    thetas.theta = 1.05f;
+    thetas.nh4 = 1.07f;
+    thetas.cod = 0.5f;
+    thetas.bod = 3.0f;
+    PlainValues value;
+    CHECK(thetas.of(value, thetas.nh4) == 1.07f);
+    CHECK(thetas.of(value, thetas.cod) == ProcessThetas::MIN);
+    CHECK(thetas.of(value, thetas.bod) == ProcessThetas::MAX);
+    thetas.bod = 0.0f;
+    CHECK(thetas.of(value, thetas.bod) == 1.05f);
+
+    std::vector<ParameterRef> refs;
+    thetas.parameters(refs, ProcessThetas::BOD_PROCESS | ProcessThetas::NH4_PROCESS);
+    CHECK(refs.size() == 3);
+    for (const ParameterRef& ref : refs) {
+        CHECK(ref.min == 1.0f);
+        CHECK(ref.max == 1.2f);
+    }
+
+    //|........||An inherited coefficient passes the unit's derivative on; a set one its own
+    DualSeeds seeds;
+    seeds.width = 2;
+    seeds.fields[0] = &thetas.theta;
+    seeds.fields[1] = &thetas.nh4;
+    Dual inherited = thetas.of(seeds, thetas.bod);
+    Dual own = thetas.of(seeds, thetas.nh4);
+    CHECK(inherited.d[0] == 1.0 && inherited.d[1] == 0.0);
+    CHECK(own.d[0] == 0.0 && own.d[1] == 1.0);
+}
+
+//|........||The double tier keeps its constants in double: 99.999 % of 123457 CFU/mL removed leaves exactly
+//|........||123457e-5, where float cancellation leaves 1.2344
+void testChlorinePreciseClosedForm() {
+    ChlorineDisinfectionUnit unit(sf::Vector2f(0, 0));
+    PreciseWater in;
+    in.parameters[PATHOGENS] = 123457.0;
+    std::vector<PreciseWater> out;
+    unit.evaluatePrecise(in, out);
+    CHECK_NEAR(out[0].parameters[PATHOGENS], 1.23457, 1e-9);
+
+    unit.inletWater = roundedOf(in);
+    unit.simulate(0.0f);
+    CHECK_NEAR(unit.outletWater.getParameter(PATHOGENS), 1.2344, 1e-4);
+}
+
+//|........||An empty directory under the system temp directory, for tests that run plant files
+std::filesystem::path scratchDirectory(const std::string& name) {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    return directory;
+}
+
+void writeText(const std::filesystem::path& path, const std::string& text) {
+    std::ofstream(path) << text;
+}
+
+//|........||Rows of a batch summary without the wall_s column, which changes from run to run
+std::vector<std::string> summaryRows(const std::filesystem::path& path) {
+    std::vector<std::string> rows;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t error = line.rfind(',');
+        size_t wall = error == std::string::npos ? error : line.rfind(',', error - 1);
+        rows.push_back(wall == std::string::npos ? line : line.substr(0, wall) + line.substr(error));
+    }
+    return rows;
+}
+
+const char* CHAIN_INFLUENT = "time_h, flow, BOD, TSS, NH4\n"
+    "0, 10000, 250, 200, 40\n"
+    "6, 12000, 300, 220, 45\n"
+    "12, 9000, 200, 180, 35\n"
+    "24, 10000, 250, 200, 40\n";
+
+//|........||A plain chain; chains of the same mode share the primary clarifier, and the aeration tank if
+//|........||their volumes match
+std::string chainPlant(const std::string& mode, float volume, const std::string& tail, double days = 0.5) {
+    std::ostringstream text;
+    text << "plant " << mode << " " << volume << " " << tail << "\n"
+         << "mode " << mode << "\n"
+         << "days " << days << "\n"
+         << "influent influent.csv\n"
+         << "limit NH4 max 6h 15\n"
+         << "unit pc Primary Clarifier\n"
+         << "unit at Aeration Tank\n"
+         << "set at volume " << volume << "\n"
+         << "unit sc Secondary Clarifier\n"
+         << "unit tail " << tail << "\n";
+    return text.str();
+}
+
+//|........||Files merged into the prefix trie give the same summary, to the bit, as running each on its own
+void testSharedPrefixesMatchSeparateRuns() {
+    std::filesystem::path directory = scratchDirectory("wwtpsim_test_shared");
+    writeText(directory / "influent.csv", CHAIN_INFLUENT);
+    int file = 0;
+    for (const char* mode : {"steady", "dynamic"}) {
+        for (const char* tail : {"UV Disinfection", "Chlorine Disinfection Unit", "Filtration"}) {
+            for (float volume : {1500.0f, 2500.0f}) {
+                writeText(directory / ("chain" + std::to_string(file++) + ".plant"), chainPlant(mode, volume, tail));
+            }
+        }
+    }
+    const std::filesystem::path shared = directory / "shared.csv", separate = directory / "separate.csv";
+    CHECK(runBatch(directory.string(), 2, shared.string(), true) == 0);
+    CHECK(runBatch(directory.string(), 2, separate.string(), false) == 0);
+    std::vector<std::string> sharedRows = summaryRows(shared), separateRows = summaryRows(separate);
+    CHECK(sharedRows.size() == size_t(file) + 1);
+    CHECK(sharedRows == separateRows);
+    std::filesystem::remove_all(directory);
+}
+
+//|........||A steady chain in <directory>/plants with its batch summary, uncached or through <directory>/cache
+struct CachedChain {
+    std::filesystem::path directory, plants, cache;
+    std::string plant;
+
+    explicit CachedChain(const std::string& name) : directory(scratchDirectory(name)) {
+        plants = directory / "plants";
+        cache = directory / "cache";
+        std::filesystem::create_directories(plants);
+        writeText(plants / "influent.csv", CHAIN_INFLUENT);
+        plant = (plants / "chain.plant").string();
+        writeText(plant, chainPlant("steady", 2000.0f, "UV Disinfection", 1.0));
+    }
+    ~CachedChain() {
+        std::filesystem::remove_all(directory);
+    }
+
+    std::vector<std::string> batch(bool cached) {
+        std::filesystem::path summary = directory / "summary.csv";
+        CHECK(runBatch(plants.string(), 1, summary.string(), true, cached ? cache.string() : "") == 0);
+        return summaryRows(summary);
+    }
+};
+
+//|........||An identical run is answered from the entry the first run stored, without rewriting it
+void testResultCacheHit() {
+    CachedChain chain("wwtpsim_test_cache_hit");
+    const std::vector<std::string> fresh = chain.batch(false);
+    CHECK(chain.batch(true) == fresh);
+    ResultKey key;
+    CHECK(resultKey(chain.cache.string(), chain.plant, key));
+    {
+        ResultFile entry;
+        CHECK(entry.open(key.path));
+        CHECK(entry.header && entry.header->ticks == key.feeds.size());
+    }
+    const auto stored = std::filesystem::last_write_time(key.path);
+    CHECK(chain.batch(true) == fresh);
+    CHECK(std::filesystem::last_write_time(key.path) == stored);
+}
+
+//|........||An entry written by another engine version is not used: the run is simulated and stored again
+void testResultCacheMissesOtherEngineVersion() {
+    CachedChain chain("wwtpsim_test_cache_version");
+    const std::vector<std::string> fresh = chain.batch(false);
+    CHECK(chain.batch(true) == fresh);
+    ResultKey key;
+    CHECK(resultKey(chain.cache.string(), chain.plant, key));
+    {
+        std::fstream file(key.path, std::ios::in | std::ios::out | std::ios::binary);
+        const uint32_t other = ENGINE_VERSION + 1;
+        file.seekp(offsetof(ResultFileHeader, version));
+        file.write(reinterpret_cast<const char*>(&other), sizeof(other));
+    }
+    {
+        ResultFile stale;
+        CHECK(!stale.open(key.path));
+    }
+    CHECK(chain.batch(true) == fresh);
+    ResultFile rewritten;
+    CHECK(rewritten.open(key.path));
+}
+
+//|........||Only the influent from 12 h on changes: the run takes the agreeing ticks from the first entry, solves
+//|........||the rest and still matches an uncached run
+void testResultCacheResumesChangedTail() {
+    CachedChain chain("wwtpsim_test_cache_tail");
+    CHECK(chain.batch(true) == chain.batch(false));
+    ResultKey first;
+    CHECK(resultKey(chain.cache.string(), chain.plant, first));
+
+    std::string influent = CHAIN_INFLUENT;
+    influent.replace(influent.find("12,"), std::string("12, 9000").size(), "12, 7000");
+    writeText(chain.plants / "influent.csv", influent);
+    ResultKey changed;
+    CHECK(resultKey(chain.cache.string(), chain.plant, changed));
+    CHECK(changed.directory == first.directory);
+    CHECK(changed.path != first.path);
+    size_t agree = 0;
+    {
+        ResultFile entry;
+        CHECK(entry.open(first.path));
+        if (!entry.header) return;
+        while (agree < changed.feeds.size() && entry.ticks[agree].feed == changed.feeds[agree]) ++agree;
+    }
+    CHECK(agree > 0 && agree < changed.feeds.size());
+
+    CHECK(chain.batch(true) == chain.batch(false));
+    ResultFile resumed;
+    CHECK(resumed.open(changed.path));
+}
+
+//|........||The compiled Pipeline of the default train leaves the plant as the virtual sweep does, bit for bit:
+//|........||pipe waters, dirty flags and blower power, through random edits of the inlet and unit parameters
+void testPipelineMatchesVirtualSweep() {
+    Plant sweep(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    Plant fused(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    for (Plant* plant : {&sweep, &fused}) {
+        plant->append(new PrimaryClarifier(sf::Vector2f(0, 440)));
+        plant->append(new AerationTank(sf::Vector2f(0, 440)));
+        plant->append(new SecondaryClarifier(sf::Vector2f(0, 440)));
+        plant->append(new UVDisinfection(sf::Vector2f(0, 440)));
+        plant->setMode(STEADY_STATE);
+        Water& feed = plant->inlet->outletWater;
+        feed.flow = 10000.0f;
+        feed.parameters[BOD] = 250.0f;
+        feed.parameters[COD] = 500.0f;
+        feed.parameters[TSS] = 200.0f;
+        feed.parameters[NH4] = 40.0f;
+        feed.parameters[P] = 8.0f;
+        feed.parameters[PATHOGENS] = 1e6f;
+        feed.parameters[TEMP] = 18.0f;
+    }
+    CHECK(fused.fuse());
+    CHECK(!sweep.fused);
+    if (!fused.fused) return;
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> scale(0.8f, 1.2f);
+    int mismatches = 0;
+    for (int edit = 0; edit < 2000; ++edit) {
+        //|........||Every third step edits nothing, so clean units must stay skipped in both
+        const bool change = edit % 3 != 0;
+        size_t unit = random() % (sweep.components.size() - 1);
+        if (change && unit == 0) {
+            Water& feed = sweep.inlet->outletWater;
+            float& value = random() % 2 ? feed.flow : feed.parameters[random() % PARAMETER_COUNT];
+            value *= scale(random);
+            fused.inlet->outletWater = feed;
+            sweep.inlet->markDirty();
+            fused.inlet->markDirty();
+        } else if (change) {
+            std::vector<ParameterRef> refs, fusedRefs;
+            sweep.components[unit]->parameters(refs);
+            fused.components[unit]->parameters(fusedRefs);
+            size_t r = random() % refs.size();
+            float value = std::min(std::max(*refs[r].value * scale(random), refs[r].min), refs[r].max);
+            *refs[r].value = *fusedRefs[r].value = value;
+            sweep.components[unit]->markDirty();
+            fused.components[unit]->markDirty();
+        }
+        sweep.step(0.0f);
+        fused.step(0.0f);
+        bool same = sweep.outlet->inletWater == fused.outlet->inletWater;
+        for (size_t c = 0; c < sweep.connections.size(); ++c) {
+            same = same && sweep.connections[c]->water == fused.connections[c]->water;
+        }
+        for (size_t u = 0; u < sweep.components.size(); ++u) {
+            same = same && sweep.components[u]->dirty.load() == fused.components[u]->dirty.load();
+            EnergyMeter* meter = sweep.components[u]->energyMeter();
+            same = same && (!meter || meter->power == fused.components[u]->energyMeter()->power);
+        }
+        mismatches += same ? 0 : 1;
+    }
+    CHECK(mismatches == 0);
+}
+
+//|........||Passes its inlet on with BOD scaled by `factor`, counting its simulate() calls
+class CountingUnit : public Component {
+public:
+    int calls = 0;
+    float factor = 0.9f;
+
+    CountingUnit() : Component("Counting Unit", "Counts its simulate() calls.", sf::Vector2f(0, 440)) {}
+
+    void simulate(float) override {
+        ++calls;
+        outletWater = inletWater;
+        outletWater.parameters[BOD] *= factor;
+    }
+};
+
+//|........||In steady state an idle plant simulates nothing, and an edit re-simulates the edited unit and only
+//|........||the units downstream whose inlet water actually changed
+void testSteadyStateSimulatesOnlyChanges() {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    std::vector<CountingUnit*> units;
+    for (int u = 0; u < 5; ++u) {
+        units.push_back(new CountingUnit());
+        plant.append(units.back());
+    }
+    plant.inlet->outletWater.flow = 1000.0f;
+    plant.inlet->outletWater.parameters[BOD] = 200.0f;
+    plant.setMode(STEADY_STATE);
+    auto calls = [&]() {
+        std::vector<int> counts;
+        for (CountingUnit* unit : units) {
+            counts.push_back(unit->calls);
+            unit->calls = 0;
+        }
+        return counts;
+    };
+
+    plant.step(0.0f);
+    CHECK(calls() == std::vector<int>({1, 1, 1, 1, 1}));
+    const float effluent = plant.outlet->inletWater.parameters[BOD];
+    for (int idle = 0; idle < 10; ++idle) plant.step(0.0f);
+    CHECK(calls() == std::vector<int>({0, 0, 0, 0, 0}));
+
+    units[2]->factor = 0.5f;
+    units[2]->markDirty();
+    plant.step(0.0f);
+    CHECK(calls() == std::vector<int>({0, 0, 1, 1, 1}));
+    CHECK(plant.outlet->inletWater.parameters[BOD] < effluent);
+
+    //|........||Marked dirty with nothing changed: its outlet is the same, so nothing downstream runs
+    units[3]->markDirty();
+    plant.step(0.0f);
+    CHECK(calls() == std::vector<int>({0, 0, 0, 1, 0}));
+}
+
+//|........||Anderson acceleration solves the return-sludge loop to tolerance in fewer sweeps than plain
+//|........||substitution, reports its iterations and residual history, and lands on the same effluent
+void testAndersonSolvesRecycleLoop() {
+    auto solve = [](int depth, Water& effluent) {
+        Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+        buildRecycleLoop(plant, 4.0f);
+        Water& feed = plant.inlet->outletWater;
+        feed.flow = 10000.0f;
+        feed.parameters[BOD] = 250.0f;
+        feed.parameters[TSS] = 200.0f;
+        feed.parameters[NH4] = 40.0f;
+        plant.andersonDepth = depth;
+        plant.setMode(STEADY_STATE);
+        plant.step(0.0f);
+        effluent = plant.outlet->inletWater;
+        return plant.lastSolve;
+    };
+    Water accelerated, substituted;
+    const SteadyStateReport anderson = solve(5, accelerated);
+    const SteadyStateReport substitution = solve(0, substituted);
+    const double tolerance = Plant(new Inlet(sf::Vector2f()), new Outlet(sf::Vector2f())).steadyTolerance;
+
+    CHECK(anderson.converged);
+    CHECK(anderson.residual <= tolerance);
+    CHECK(anderson.iterations > 1);
+    CHECK(anderson.residuals.size() == size_t(anderson.iterations));
+    CHECK(!anderson.residuals.empty() && anderson.residuals.back() == anderson.residual);
+    CHECK(anderson.residuals.front() > tolerance);
+    CHECK(substitution.converged);
+    CHECK(anderson.evaluations < substitution.evaluations);
+    for (WaterParameter p : {BOD, TSS, NH4}) {
+        double expected = substituted.parameters[p];
+        CHECK_NEAR(accelerated.parameters[p], expected, 1e-3 * std::fabs(expected));
+    }
+    CHECK_NEAR(accelerated.flow, substituted.flow, 1e-3 * substituted.flow);
+}
+
+//|........||Mass balance across the joints: the Splitter divides flow without changing concentrations, and the
+//|........||Mixer's blend carries exactly the load (flow × concentration) of the unequal trains feeding it
+void testSplitterAndMixerConserveMass() {
+    Plant plant(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    buildParallelTrains(plant, 3);
+    Water& feed = plant.inlet->outletWater;
+    feed.flow = 12000.0f;
+    feed.parameters[BOD] = 250.0f;
+    feed.parameters[TSS] = 200.0f;
+    feed.parameters[NH4] = 40.0f;
+    plant.inlet->markDirty();
+
+    Splitter* splitter = nullptr;
+    Mixer* mixer = nullptr;
+    for (Component* comp : plant.components) {
+        if (!splitter) splitter = dynamic_cast<Splitter*>(comp);
+        if (!mixer) mixer = dynamic_cast<Mixer*>(comp);
+    }
+    CHECK(splitter && mixer);
+    if (!splitter || !mixer) return;
+    splitter->splitFractions = {1.0f, 2.0f, 5.0f};
+    splitter->markDirty();
+    //|........||Slower kinetics in the last train, so the mixer blends different concentrations
+    Component* primary = splitter->outputs.back()->to;
+    AerationTank* aeration = dynamic_cast<AerationTank*>(primary->outputs.front()->to);
+    CHECK(aeration);
+    if (!aeration) return;
+    aeration->k_bod = 0.05f;
+    aeration->markDirty();
+    plant.setMode(STEADY_STATE);
+    plant.step(0.0f);
+
+    double splitFlow = 0.0;
+    for (size_t k = 0; k < splitter->outputs.size(); ++k) {
+        const Water& branch = splitter->outputs[k]->water;
+        splitFlow += branch.flow;
+        for (int p = 0; p < PARAMETER_COUNT; ++p) {
+            CHECK(branch.parameters[p] == splitter->inletWater.parameters[p]);
+        }
+    }
+    CHECK_NEAR(splitFlow, splitter->inletWater.flow, 1e-6 * splitter->inletWater.flow);
+    CHECK_NEAR(splitter->outputs.front()->water.flow, splitter->inletWater.flow / 8.0, 1e-3);
+
+    const std::vector<Connection*>& trains = mixer->inputs;
+    CHECK(trains.size() == 3);
+    CHECK(trains.front()->water.parameters[BOD] != trains.back()->water.parameters[BOD]);
+    double mixedFlow = 0.0;
+    for (const Connection* train : trains) mixedFlow += train->water.flow;
+    CHECK_NEAR(mixer->inletWater.flow, mixedFlow, 1e-6 * mixedFlow);
+    for (int p = 0; p < PARAMETER_COUNT; ++p) {
+        double load = 0.0;
+        for (const Connection* train : trains) load += double(train->water.flow) * train->water.parameters[p];
+        double mixedLoad = double(mixer->inletWater.flow) * mixer->inletWater.parameters[p];
+        CHECK_NEAR(mixedLoad, load, 1e-6 * std::fabs(load) + 1e-9);
+    }
+}
+
+//|........||Trains stepped on the thread pool give bit-identical waters and pump operating points to the serial
+//|........||sweep. Each train starts with a pump whose discharge losses walk the pipes the trains share downstream.
+void testParallelTrainsMatchSerial() {
+    auto build = [](Plant& plant) {
+        buildParallelTrains(plant, 4, 2);
+        Splitter* splitter = nullptr;
+        for (Component* comp : plant.components) {
+            if (!splitter) splitter = dynamic_cast<Splitter*>(comp);
+        }
+        for (size_t t = 0; t < splitter->outputs.size(); ++t) {
+            plant.insertBetween(new Pump(sf::Vector2f(0, 440)), splitter->outputs[t]);
+        }
+        splitter->splitFractions = {1.0f, 2.0f, 3.0f, 4.0f};
+        Water& feed = plant.inlet->outletWater;
+        feed.flow = 12000.0f;
+        feed.parameters[BOD] = 250.0f;
+        feed.parameters[TSS] = 200.0f;
+        feed.parameters[NH4] = 40.0f;
+        plant.markAllDirty();
+    };
+    auto identical = [](const Plant& serial, const Plant& parallel) {
+        bool same = serial.connections.size() == parallel.connections.size();
+        for (size_t i = 0; same && i < serial.connections.size(); ++i) {
+            const Water& a = serial.connections[i]->water;
+            const Water& b = parallel.connections[i]->water;
+            same = a.flow == b.flow;
+            for (int p = 0; same && p < PARAMETER_COUNT; ++p) same = a.parameters[p] == b.parameters[p];
+        }
+        for (size_t i = 0; same && i < serial.components.size(); ++i) {
+            const Pump* a = dynamic_cast<const Pump*>(serial.components[i]);
+            const Pump* b = dynamic_cast<const Pump*>(parallel.components[i]);
+            if (a && b) same = a->requiredHead == b->requiredHead && a->speed == b->speed && a->meter.power == b->meter.power;
+        }
+        return same;
+    };
+
+    ThreadPool pool(3);
+    Plant serial(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    Plant parallel(new Inlet(sf::Vector2f(50, 440)), new Outlet(sf::Vector2f(1650, 440)));
+    build(serial);
+    build(parallel);
+    parallel.pool = &pool;
+    parallel.parallelMinUnits = 1;
+
+    for (Plant* plant : {&serial, &parallel}) {
+        plant->setMode(STEADY_STATE);
+        plant->step(0.0f);
+    }
+    CHECK(serial.outlet->inletWater.flow > 0.0f);
+    CHECK(identical(serial, parallel));
+
+    for (Plant* plant : {&serial, &parallel}) {
+        plant->setMode(DYNAMIC);
+        plant->fixedStep = 0.0f;
+        plant->timeScale = 1.0f;
+    }
+    for (int step = 0; step < 200; ++step) {
+        for (Plant* plant : {&serial, &parallel}) plant->step(SIMULATION_TIME_STEP);
+    }
+    CHECK(identical(serial, parallel));
+}
+
+std::vector<Test> registerTests() {
+    return {
+        {"DelayLine/recovers-after-low-flow", testDelayRecoversAfterLowFlow},
+        {"SludgeDigester/steady-state-ignores-history", testDigesterSteadyStateIgnoresHistory},
+        {"ADM1/reports-non-convergence", testAdm1ReportsNonConvergence},
+        {"ADM1/structural-sparsity", testAdm1StructuralSparsity},
+        {"PlantFile/saves-plant-without-inlet-output", testSavePlantWithoutInletOutput},
+        {"P2Quantile/few-samples", testP2QuantileFewSamples},
+        {"Gradient/through-digester", testGradientThroughDigester},
+        {"SurrogateTable/tabulates-digester", testSurrogateTabulatesDigester},
+        {"ProcessThetas/inherit-and-clamp", testProcessThetas},
+        {"Precision/chlorine-closed-form", testChlorinePreciseClosedForm},
+        {"Batch/shared-prefixes-match-separate-runs", testSharedPrefixesMatchSeparateRuns},
+        {"ResultCache/hit", testResultCacheHit},
+        {"ResultCache/misses-other-engine-version", testResultCacheMissesOtherEngineVersion},
+        {"ResultCache/resumes-changed-tail", testResultCacheResumesChangedTail},
+        {"Pipeline/matches-virtual-sweep", testPipelineMatchesVirtualSweep},
+        {"Plant/steady-state-simulates-only-changes", testSteadyStateSimulatesOnlyChanges},
+        {"Plant/anderson-solves-recycle-loop", testAndersonSolvesRecycleLoop},
+        {"Plant/splitter-and-mixer-conserve-mass", testSplitterAndMixerConserveMass},
+        {"Plant/parallel-trains-match-serial", testParallelTrainsMatchSerial},
+    };
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else {
+            std::cerr << "usage: wwtpsim_test [--filter <text>]\n";
+            return 2;
+        }
+    }
+
+    int failed = 0, ran = 0;
+    for (const Test& test : registerTests()) {
+        if (!filter.empty() && test.name.find(filter) == std::string::npos) continue;
+        failures.clear();
+        test.run();
+        ++ran;
+        std::printf("%-48s %s\n", test.name.c_str(), failures.empty() ? "ok" : "FAILED");
+        for (const std::string& failure : failures) std::printf("    line %s\n", failure.c_str());
+        if (!failures.empty()) ++failed;
+    }
+    std::printf("%d of %d tests passed\n", ran - failed, ran);
+    return failed > 0 ? 1 : 0;
+}